@@ -0,0 +1,87 @@
+#include "circuit.h"
+#include "celllibrary.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+void usage()
+{
+    cout << "./simulation_benchmark [<liberty>] <verilog>..." << endl;
+}
+
+// Only the evaluation is timed, for at least half a second
+double patternsPerSecond(CompiledSimulator &sim)
+{
+    srand(1);
+    for (size_t i = 0; i < sim.inputSize(); i++)
+        for (size_t j = 0; j < sim.lanes() / CompiledSimulator::WordBits; j++)
+            sim.setInputWord(i, ((CompiledSimulator::Word) rand() << 32) ^ rand(), j);
+
+    size_t passes = 0;
+    double seconds = 0.0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    while (seconds < 0.5)
+    {
+        sim.runWords();
+        passes++;
+        seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    return passes * sim.lanes() / seconds;
+}
+
+// Patterns per second of every bit-parallel kernel this CPU runs, with
+// two and with four values
+void benchmark(const Circuit &circuit)
+{
+    CompiledSimulator sim(circuit);
+    cout << circuit.name() << ": " << sim.instructionSize() << " instructions, "
+         << sim.inputSize() << " inputs" << endl;
+
+    for (int k = CompiledSimulator::Scalar; k <= CompiledSimulator::AVX512; k++)
+    {
+        CompiledSimulator::Kernel kernel = (CompiledSimulator::Kernel) k;
+        cout << "  " << CompiledSimulator::kernelName(kernel) << ": ";
+        if (!sim.setKernel(kernel))
+        {
+            cout << "not supported" << endl;
+            continue;
+        }
+        sim.setFourValued(false);
+        cout << patternsPerSecond(sim) << " patterns/s, ";
+        sim.setFourValued(true);
+        cout << patternsPerSecond(sim) << " with four values" << endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        usage();
+        return 1;
+    }
+
+    int first = 1;
+    CellLibrary library;
+    string path(argv[1]);
+    if (path.size() > 4 && path.compare(path.size() - 4, 4, ".lib") == 0)
+    {
+        library = CellLibrary(path);
+        first = 2;
+    }
+
+    for (int i = first; i < argc; i++)
+    {
+        Circuit circuit = (first == 2 ? Circuit(argv[i], library) : Circuit(argv[i]));
+        if (circuit.isNull())
+        {
+            cout << argv[i] << ": circuit is empty" << endl;
+            continue;
+        }
+        benchmark(circuit);
+    }
+    return 0;
+}
@@ -22,7 +22,7 @@ public:
         double slew;
         double maxDelay;
         double wireDelay;
-        Node node;
+        NodeRef node;
         std::string trace;
         Signal::Transition transIn;
         Signal::Transition transOut;
@@ -32,16 +32,17 @@ public:
         : circuit(c), library(lib)
     {
         // Set input information
-        for (size_t i = 0; i < circuit.inputSize(); i++)
+        NodeRange inputs = circuit.inputPorts();
+        for (NodeRange::const_iterator it = inputs.begin(); it != inputs.end(); ++it)
         {
-            Port inputPort = circuit.inputPort(i);
+            NodeRef inputPort = *it;
             STAData fall = { .loading = 0.0, .slew = 0.0, .maxDelay = 0.0, .wireDelay = 0.0, .node = inputPort };
             STAData rise = { .loading = 0.0, .slew = 0.0, .maxDelay = 0.0, .wireDelay = 0.0, .node = inputPort };
             STAMap[inputPort.name()] = std::make_pair(fall, rise);
         }
     }
 
-    void whenInputRise(STAData *fall, STAData *rise, const std::pair<STAData,STAData> &inputData, Cell &cell, const std::string &fromPin, const std::string &toPin)
+    void whenInputRise(STAData *fall, STAData *rise, const std::pair<STAData,STAData> &inputData, CellRef cell, const std::string &fromPin, const std::string &toPin)
     {
         double inputSlew = inputData.second.slew;
         double wireDelay = library.inputWireDelayRiseMax(cell, fromPin);
@@ -77,7 +78,7 @@ public:
         }
     }
 
-    void whenInputFall(STAData *fall, STAData *rise, const std::pair<STAData,STAData> &inputData, Cell &cell, const std::string &fromPin, const std::string &toPin)
+    void whenInputFall(STAData *fall, STAData *rise, const std::pair<STAData,STAData> &inputData, CellRef cell, const std::string &fromPin, const std::string &toPin)
     {
         double inputSlew = inputData.first.slew;
         double wireDelay = library.inputWireDelayFallMax(cell, fromPin);
@@ -115,7 +116,7 @@ public:
 
     bool run()
     {
-        vector<Cell> levelized;
+        vector<CellRef> levelized;
         EDAUtils::orderByLevel(circuit, levelized);
         if (levelized.empty())
         {
@@ -125,14 +126,14 @@ public:
 
         for (size_t i = 0; i < levelized.size(); i++)
         {
-            Cell cell = levelized[i];
+            CellRef cell = levelized[i];
             
             STAData fall = { .loading = 0.0, .slew = 0.0, .maxDelay = 0.0, .wireDelay = 0.0, .node = cell };
             STAData rise = { .loading = 0.0, .slew = 0.0, .maxDelay = 0.0, .wireDelay = 0.0, .node = cell };
 
             for (size_t j = 0; j < cell.inputSize(); j++)
             {
-                Node input = cell.input(j);
+                NodeRef input = cell.input(j);
 
                 // bypass wire
                 if (input.isWire())
@@ -187,12 +188,13 @@ int main(int argc, char *argv[])
     double globalMaxDelay = 0.0;
     std::string globalMaxDelayPort;
     STA::STAData globalMaxDelayCell;
-    for (size_t i = 0; i < circuit.POSize(); i++)
+    NodeRange POs = circuit.POs();
+    for (NodeRange::const_iterator it = POs.begin(); it != POs.end(); ++it)
     {
-        Port port = circuit.PO(i);
+        NodeRef port = *it;
         for (size_t j = 0; j < port.inputSize(); j++)
         {
-            Node node = port.input(j);
+            NodeRef node = port.input(j);
 
             if (node.isWire())
                 node = node.input(0);
@@ -15,10 +15,10 @@ int main()
         return 1;
     }
 
-    const Module &module = circuit.topModule();
-    for (size_t i = 0; i < module.cellSize(); i++)
+    NodeRange cells = circuit.cells();
+    for (NodeRange::const_iterator it = cells.begin(); it != cells.end(); ++it)
     {
-        Cell cell = module.cell(i);
+        CellRef cell = (*it).toCell();
         cout << cell.type() << endl;
         for (size_t j = 0; j < cell.inputSize(); j++)
         {
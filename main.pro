@@ -6,6 +6,10 @@ CONFIG += console debug
 CONFIG -= debug_and_release debug_and_release_target
 
 LIBS += -L./lib -lCircuit
+zlib: LIBS += -lz
+zstd: LIBS += -lzstd
+zlib: SUBCONFIG += zlib
+zstd: SUBCONFIG += zstd
 INCLUDEPATH += include
 
 PRE_TARGETDEPS += ./lib/libCircuit.a
@@ -19,4 +23,4 @@ extradistclean.commands = cd src && make distclean
 
 circuit.target = ./lib/libCircuit.a
 circuit.depends = FORCE
-circuit.commands = cd src && qmake && make
\ No newline at end of file
+circuit.commands = cd src && qmake "CONFIG+=$$SUBCONFIG" && make
\ No newline at end of file
@@ -124,15 +124,16 @@ void EDAUtils::levelize(const Circuit &circuit)
     }
 
     // Set all input port (PI PPI) ready
-    for(size_t in_idx = 0; in_idx < circuit.inputSize(); in_idx++)
+    NodeRange inputs = circuit.inputPorts();
+    for(NodeRange::const_iterator in = inputs.begin(); in != inputs.end(); ++in)
     {  
-        Port p = circuit.inputPort(in_idx);
+        NodeRef p = *in;
         for(size_t pin_idx = 0; pin_idx < p.outputSize(); pin_idx++)
         {
-            Node node = p.output(pin_idx);
+            NodeRef node = p.output(pin_idx);
             if(node.isCell())
             {
-                Cell cell = node.toCell();
+                Cell cell = node.toNode().toCell();
                 if(count_map.count(cell.name()) == 0)
                     count_map[cell.name()] = 1;
                 else
@@ -146,7 +147,7 @@ void EDAUtils::levelize(const Circuit &circuit)
             }
             else if(node.isGate())
             {
-                Gate gate = node.toGate();
+                Gate gate = node.toNode().toGate();
                 if(count_map.count(gate.name()) == 0)
                     count_map[gate.name()] = 1;
                 else
@@ -161,13 +162,13 @@ void EDAUtils::levelize(const Circuit &circuit)
                 cout << "Input port directly connect to output port" << endl;
             else if(node.isWire())
             {
-                Wire wire = node.toWire();
+                NodeRef wire = node;
                 for(size_t wo = 0; wo < wire.outputSize(); wo++)
                 {
-                    Node node = wire.output(wo);
+                    NodeRef node = wire.output(wo);
                     if(node.isCell())
                     {
-                        Cell cell = node.toCell();
+                        Cell cell = node.toNode().toCell();
                         if(count_map.count(cell.name()) == 0)
                             count_map[cell.name()] = 1;
                         else
@@ -181,7 +182,7 @@ void EDAUtils::levelize(const Circuit &circuit)
                     }
                     else if(node.isGate())
                     {
-                        Gate gate = node.toGate();
+                        Gate gate = node.toNode().toGate();
                         if(count_map.count(gate.name()) == 0)
                             count_map[gate.name()] = 1;
                         else
@@ -317,6 +318,21 @@ void EDAUtils::orderByLevel(const Circuit &circuit, std::vector<Cell> &cells)
     std::sort(cells.begin(), cells.end(), _compare_);
 }
 
+static 
+bool _compareRef_(const CellRef &cell1, const CellRef &cell2)
+{
+    return cell1.level() < cell2.level();
+}
+void EDAUtils::orderByLevel(const Circuit &circuit, std::vector<CellRef> &cells)
+{
+    levelize(circuit);
+    NodeRange range = circuit.cells();
+    cells.reserve(cells.size() + range.size());
+    for(NodeRange::const_iterator it = range.begin(); it != range.end(); ++it)
+        cells.push_back((*it).toCell());
+    std::sort(cells.begin(), cells.end(), _compareRef_);
+}
+
 static std::string _genFakeCellName()
 {
     static unsigned int n = 0;
@@ -330,6 +346,7 @@ void EDAUtils::removeAllDFF(Circuit &circuit, CellLibrary &library)
     for(size_t m_idx = 0; m_idx < circuit.moduleSize(); m_idx++)
     {
         Module module = circuit.module(m_idx);
+        module.beginEdit();
         for(size_t c_idx = 0; c_idx < module.cellSize(); c_idx++)
         {
             Cell cell = module.cell(c_idx);
@@ -369,6 +386,7 @@ void EDAUtils::removeAllDFF(Circuit &circuit, CellLibrary &library)
                 cout << "Warning!! EDAUtils::removeAllDFF() Not handle FF type: " << cell.type() << endl;
             }
         }
+        module.commitEdit();
     }
 }
 
@@ -441,15 +459,21 @@ bool EDAUtils::mux_connect_internal(Circuit &circuit, Cell &target, CellLibrary
 bool EDAUtils::insertCell2AllCellOutputs(Circuit &circuit, CellLibrary &library, bool (*CALLBACK)(Circuit &circuit, Cell &target, CellLibrary &library, vector<Cell> &newCells))
 {
     vector<Cell> allCells;
-    for(size_t idx = 0; idx < circuit.topModule().cellSize(); idx++)
+    Module topModule = circuit.topModule();
+    topModule.beginEdit();
+    for(size_t idx = 0; idx < topModule.cellSize(); idx++)
     {
-        Cell cell = circuit.topModule().cell(idx);
+        Cell cell = topModule.cell(idx);
         if(!CALLBACK(circuit, cell, library, allCells))
+        {
+            topModule.commitEdit();
             return false;
+        }
     }
 
     for(vector<Cell>::iterator it = allCells.begin(); it != allCells.end(); it++)
-        circuit.topModule().addCell(*it);
+        topModule.addCell(*it);
+    topModule.commitEdit();
 
     return true;
 }
@@ -43,6 +43,14 @@ class EDAUtils
          *  EDAUtils::orderGateByLevel(c17, cellList);
          */
         static void orderByLevel(const Circuit &circuit, std::vector<Cell> &orderedList);
+
+        /**
+         * Same as above, but fills non-owning CellRefs so no reference
+         * counts are touched. They are valid while the cells stay in the circuit.
+         * @param Circuit & : circuit object
+         * @param std::vector<CellRef> & : an CellRef container
+         */
+        static void orderByLevel(const Circuit &circuit, std::vector<CellRef> &orderedList);
        
         /**
          * Remove All the cells which its type contains "FF" and has input "CK".
@@ -2,27 +2,43 @@
 #include "circuit.h"
 #include <iostream>
 #include <fstream>
-#include <sstream>
 #include <string>
-#include <cassert>
+#include <cstring>
+#include <mutex>
 #include <qatomic.h>
+#include "binaryimage_p.h"
+#include "compressedstream_p.h"
 #include "../parser/liberty/driver.h"
 #include "../parser/liberty/expression.h"
 
+namespace {
+class CompiledLibrary;
+}
+
 class CellLibraryPrivate
 {
 public:
     CellLibraryPrivate();
     CellLibraryPrivate(const std::string&);
+    ~CellLibraryPrivate();
 
     double wireResistance(int fanout) const;
     double wireCapacitance(int fanout) const;
 
     void createTwoInputCell(const std::string&, const std::string&, const std::string&, const std::string&);
     bool hasCell(const std::string&) const;
-    Cell cell(const std::string&) const;
+    Cell cell(const std::string&);
+    size_t cellCount() const;
+    size_t builtCellCount() const;
 
     bool load(std::fstream&, const std::string &path);
+    bool loadCompiled(MappedFile *file);
+    bool loadCompiled(std::vector<char> &buffer);
+    bool indexCompiled(const char *data, size_t size);
+    Cell buildCell(uint32_t index) const;
+    void releaseCompiled();
+    static bool compile(std::istream&, const std::string &path, uint64_t sourceHash, std::vector<char> &image);
+    static bool compile(const std::string &path, uint64_t sourceHash, std::vector<char> &image);
 
     std::string name;
     std::string time_unit;
@@ -41,19 +57,385 @@ public:
     std::string default_wire_load;
 
     bool isDefault;
+    // Loaded from the <path>.lcc cache of a Liberty file
+    bool cached;
 
     std::map<std::string,Cell> cells;
+    // Cells of the compiled image that were not asked for yet. The image
+    // is kept until the last of them is built.
+    std::map<std::string,uint32_t> pendingCells;
+    CompiledLibrary *compiled;
+    MappedFile *mapped;
+    std::vector<char> image;
+    mutable std::mutex lock;
 
     QAtomicInt ref;
 };
 
+/**************************************************************
+ *
+ * Compiled library format
+ *
+ **************************************************************/
+
+// What load() takes from a Liberty file, as one relocatable block that is
+// read in place (see binaryimage_p.h). Integers are in the byte order of
+// the writer; a machine with a different order recompiles.
+//
+//   LibraryHeader
+//   strings    uint32 offsets[stringCount + 1], then the characters
+//   fanouts    FanoutRecord[fanoutCount], the default wire load
+//   cells      CellRecord[cellCount]
+//   pins       PinRecord[pinCount], input and output pins in file order
+//   arcs       ArcRecord[arcCount], the timing tables of output pins
+//   values     double[valueCount]
+//
+// Tables are stored after the template's index order has been applied: x,
+// y, then rowCount rows of columnCount values. Nothing is parsed on load.
+
+namespace {
+
+const char LibraryMagic[8] = { 'L', 'C', 'L', 'I', 'B', '\0', '\r', '\n' };
+const uint32_t LibraryVersion = 1;
+const uint32_t ByteOrderMark = 0x01020304u;
+
+enum PinDirection
+{
+    InputPin,
+    OutputPin
+};
+
+struct LibraryHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t size;
+    uint64_t sourceHash;
+    uint32_t name;
+    uint32_t timeUnit;
+    uint32_t leakagePowerUnit;
+    uint32_t voltageUnit;
+    uint32_t currentUnit;
+    uint32_t pullingResistanceUnit;
+    uint32_t capacitiveLoadUnit;
+    uint32_t defaultWireLoad;
+    double nomProcess;
+    double nomTemperature;
+    double nomVoltage;
+    double wireLoadResistance;
+    double wireLoadCapacitance;
+    double slope;
+    uint32_t stringCount;
+    uint32_t fanoutCount;
+    uint32_t cellCount;
+    uint32_t pinCount;
+    uint32_t arcCount;
+    uint32_t reserved;
+    uint64_t valueCount;
+    uint64_t strings;
+    uint64_t fanouts;
+    uint64_t cells;
+    uint64_t pins;
+    uint64_t arcs;
+    uint64_t values;
+};
+
+struct FanoutRecord
+{
+    int32_t fanout;
+    uint32_t reserved;
+    double length;
+};
+
+struct CellRecord
+{
+    double area;
+    uint32_t name;
+    uint32_t firstPin;
+    uint32_t pinCount;
+    uint32_t reserved;
+};
+
+struct PinRecord
+{
+    double capacitance;     // inputs only
+    double riseCapacitance;
+    double fallCapacitance;
+    double riseCapacitanceMin;
+    double fallCapacitanceMin;
+    double riseCapacitanceMax;
+    double fallCapacitanceMax;
+    double maxCapacitance;  // outputs only
+    double maxTransition;
+    uint32_t name;
+    uint32_t direction;     // PinDirection
+    uint32_t function;
+    uint32_t firstArc;
+    uint32_t arcCount;
+    uint32_t reserved;
+};
+
+struct ArcRecord
+{
+    uint32_t type;          // "delay" or "trans"
+    uint32_t relatedPin;
+    uint32_t timingSense;
+    uint32_t transition;    // Signal::Transition
+    uint32_t xCount;
+    uint32_t yCount;
+    uint32_t rowCount;
+    uint32_t columnCount;
+    uint64_t values;
+};
+
+// Collects the records while the Liberty file is walked
+class LibraryImage
+{
+public:
+    LibraryImage() { memset(&header, 0, sizeof(header)); }
+
+    void setProperties(LibertyContext &liberty)
+    {
+        header.name = strings.intern(liberty.name);
+        header.timeUnit = strings.intern(liberty.time_unit);
+        header.leakagePowerUnit = strings.intern(liberty.leakage_power_unit);
+        header.voltageUnit = strings.intern(liberty.voltage_unit);
+        header.currentUnit = strings.intern(liberty.current_unit);
+        header.pullingResistanceUnit = strings.intern(liberty.pulling_resistance_unit);
+        header.capacitiveLoadUnit = strings.intern(liberty.capacitive_load_unit);
+        header.nomProcess = liberty.nom_process;
+        header.nomTemperature = liberty.nom_temperature;
+        header.nomVoltage = liberty.nom_voltage;
+        header.defaultWireLoad = strings.intern(liberty.default_wire_load);
+
+        LNWireLoad &wireLoad = liberty.wire_loads[liberty.default_wire_load];
+        header.wireLoadResistance = wireLoad.resistance;
+        header.wireLoadCapacitance = wireLoad.capacitance;
+        header.slope = wireLoad.slope;
+        std::map<int,double>::const_iterator it;
+        for (it = wireLoad.fanout_length.begin(); it != wireLoad.fanout_length.end(); ++it)
+        {
+            FanoutRecord f = { it->first, 0, it->second };
+            fanouts.push_back(f);
+        }
+    }
+
+    void addCell(const std::string &name, double area)
+    {
+        CellRecord c = { area, strings.intern(name), (uint32_t) pins.size(), 0, 0 };
+        cells.push_back(c);
+    }
+
+    void addPin(LNPin *pin, PinDirection direction)
+    {
+        PinRecord p;
+        memset(&p, 0, sizeof(p));
+        p.name = strings.intern(pin->name);
+        p.direction = direction;
+        p.firstArc = arcs.size();
+        if (direction == InputPin)
+        {
+            p.capacitance = pin->capacitance;
+            p.riseCapacitance = pin->rise_capacitance;
+            p.fallCapacitance = pin->fall_capacitance;
+            p.riseCapacitanceMin = pin->rise_capacitance_range.left();
+            p.fallCapacitanceMin = pin->fall_capacitance_range.left();
+            p.riseCapacitanceMax = pin->rise_capacitance_range.right();
+            p.fallCapacitanceMax = pin->fall_capacitance_range.right();
+        }
+        else
+        {
+            p.function = strings.intern(pin->function);
+            p.maxCapacitance = pin->max_capacitance;
+            p.maxTransition = pin->max_transition;
+        }
+        pins.push_back(p);
+        cells.back().pinCount++;
+    }
+
+    // Belongs to the last pin added. z holds y.size() rows of x.size()
+    // values.
+    void addTimingTable(const std::string &type,
+                        const std::string &relatedPin,
+                        const std::string &timingSense,
+                        Signal::Transition transition,
+                        const std::vector<double> &x,
+                        const std::vector<double> &y,
+                        const double *z)
+    {
+        ArcRecord a;
+        a.type = strings.intern(type);
+        a.relatedPin = strings.intern(relatedPin);
+        a.timingSense = strings.intern(timingSense);
+        a.transition = transition;
+        a.xCount = x.size();
+        a.yCount = y.size();
+        a.rowCount = y.size();
+        a.columnCount = x.size();
+        a.values = values.size();
+        values.insert(values.end(), x.begin(), x.end());
+        values.insert(values.end(), y.begin(), y.end());
+        values.insert(values.end(), z, z + y.size() * x.size());
+        arcs.push_back(a);
+        pins.back().arcCount++;
+    }
+
+    void write(uint64_t sourceHash, std::vector<char> &out)
+    {
+        LibraryHeader h = header;
+        memcpy(h.magic, LibraryMagic, sizeof(LibraryMagic));
+        h.version = LibraryVersion;
+        h.byteOrder = ByteOrderMark;
+        h.sourceHash = sourceHash;
+        h.stringCount = strings.size();
+        h.fanoutCount = fanouts.size();
+        h.cellCount = cells.size();
+        h.pinCount = pins.size();
+        h.arcCount = arcs.size();
+        h.valueCount = values.size();
+
+        out.clear();
+        imagePut(out, h);
+        h.strings = out.size();
+        imagePutStrings(out, strings);
+        h.fanouts = out.size();
+        putArray(out, fanouts);
+        h.cells = out.size();
+        putArray(out, cells);
+        h.pins = out.size();
+        putArray(out, pins);
+        h.arcs = out.size();
+        putArray(out, arcs);
+        h.values = out.size();
+        putArray(out, values);
+        h.size = out.size();
+        memcpy(out.data(), &h, sizeof(h));
+    }
+
+private:
+    template <class T>
+    static void putArray(std::vector<char> &out, const std::vector<T> &v)
+    {
+        const char *p = (const char*) v.data();
+        out.insert(out.end(), p, p + v.size() * sizeof(T));
+        imageAlign(out);
+    }
+
+    LibraryHeader header;
+    SymbolTable strings;
+    std::vector<FanoutRecord> fanouts;
+    std::vector<CellRecord> cells;
+    std::vector<PinRecord> pins;
+    std::vector<ArcRecord> arcs;
+    std::vector<double> values;
+};
+
+bool isCompiledLibrary(const char *data, size_t size)
+{
+    if (size < sizeof(LibraryHeader))
+        return false;
+    const LibraryHeader *h = (const LibraryHeader*) data;
+    return memcmp(h->magic, LibraryMagic, sizeof(LibraryMagic)) == 0
+        && h->version == LibraryVersion
+        && h->byteOrder == ByteOrderMark
+        && h->size == size;
+}
+
+// A checked view of a compiled library
+class CompiledLibrary
+{
+public:
+    CompiledLibrary() : header(0), fanouts(0), cells(0), pins(0), arcs(0), values(0) {}
+
+    bool open(const char *data, size_t size)
+    {
+        if (!isCompiledLibrary(data, size))
+            return false;
+        const LibraryHeader *h = (const LibraryHeader*) data;
+        if (!strings.open(data, size, h->strings, h->stringCount))
+            return false;
+        fanouts = imageArray<FanoutRecord>(data, size, h->fanouts, h->fanoutCount);
+        cells = imageArray<CellRecord>(data, size, h->cells, h->cellCount);
+        pins = imageArray<PinRecord>(data, size, h->pins, h->pinCount);
+        arcs = imageArray<ArcRecord>(data, size, h->arcs, h->arcCount);
+        values = imageArray<double>(data, size, h->values, h->valueCount);
+        if (!fanouts || !cells || !pins || !arcs || !values)
+            return false;
+
+        const uint32_t names[] = { h->name, h->timeUnit, h->leakagePowerUnit, h->voltageUnit,
+                                   h->currentUnit, h->pullingResistanceUnit,
+                                   h->capacitiveLoadUnit, h->defaultWireLoad };
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+            if (!strings.contains(names[i]))
+                return false;
+        for (size_t i = 0; i < h->cellCount; i++)
+            if (!strings.contains(cells[i].name)
+                    || cells[i].firstPin > h->pinCount
+                    || cells[i].pinCount > h->pinCount - cells[i].firstPin)
+                return false;
+        for (size_t i = 0; i < h->pinCount; i++)
+        {
+            const PinRecord &p = pins[i];
+            if (!strings.contains(p.name) || !strings.contains(p.function)
+                    || p.direction > OutputPin
+                    || p.firstArc > h->arcCount || p.arcCount > h->arcCount - p.firstArc)
+                return false;
+        }
+        for (size_t i = 0; i < h->arcCount; i++)
+        {
+            const ArcRecord &a = arcs[i];
+            if (!strings.contains(a.type) || !strings.contains(a.relatedPin)
+                    || !strings.contains(a.timingSense)
+                    || (a.transition != Signal::Rise && a.transition != Signal::Fall))
+                return false;
+            uint64_t count = (uint64_t) a.xCount + a.yCount + (uint64_t) a.rowCount * a.columnCount;
+            if (a.values > h->valueCount || count > h->valueCount - a.values)
+                return false;
+        }
+        header = h;
+        return true;
+    }
+
+    const LibraryHeader *header;
+    ImageStrings strings;
+    const FanoutRecord *fanouts;
+    const CellRecord *cells;
+    const PinRecord *pins;
+    const ArcRecord *arcs;
+    const double *values;
+};
+
+} // namespace
+
+// FNV-1a, enough to tell a changed source from the one a cache was built from
+static uint64_t contentHash(const char *data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= (unsigned char) data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// 0 unless data is a valid compiled library
+static uint64_t compiledSourceHash(const char *data, size_t size)
+{
+    if (!isCompiledLibrary(data, size))
+        return 0;
+    return ((const LibraryHeader*) data)->sourceHash;
+}
+
 /**************************************************************
  *
  * CellLibraryPrivate
  *
  **************************************************************/
 
-CellLibraryPrivate::CellLibraryPrivate() : isDefault(true)
+CellLibraryPrivate::CellLibraryPrivate()
+    : isDefault(true), cached(false), compiled(0), mapped(0), ref(1)
 {
     Cell INV_X1("INV_X1");
     INV_X1.addInputPinName("A");
@@ -68,16 +450,55 @@ CellLibraryPrivate::CellLibraryPrivate() : isDefault(true)
     createTwoInputCell( "XOR2_X1", "A",  "B",  "Z");
 }
 
-CellLibraryPrivate::CellLibraryPrivate(const std::string &path) : isDefault(false)
+// A compiled library is used as is. A Liberty file is loaded from the
+// cache next to it if that was compiled from the same content, otherwise
+// it is parsed and the cache is written for the next time.
+CellLibraryPrivate::CellLibraryPrivate(const std::string &path)
+    : isDefault(false), cached(false), compiled(0), mapped(0), ref(1)
 {
-    // Open a Liberty file
-    std::fstream infile(path.c_str());
-    if (!infile.good())
+    MappedFile *source = new MappedFile(path);
+    if (!source->isOpen())
     {
         std::cerr << "Could not open file: " << path << std::endl;
+        delete source;
+        return;
+    }
+    if (isCompiledLibrary(source->data, source->size))
+    {
+        if (!loadCompiled(source))
+        {
+            std::cerr << "Invalid compiled library: " << path << std::endl;
+            delete source;
+        }
+        return;
+    }
+
+    uint64_t hash = contentHash(source->data, source->size);
+    delete source;
+    std::string cachePath = path + ".lcc";
+    MappedFile *cache = new MappedFile(cachePath);
+    if (cache->isOpen() && compiledSourceHash(cache->data, cache->size) == hash
+            && loadCompiled(cache))
+    {
+        cached = true;
         return;
     }
-    load(infile, path);
+    delete cache;
+
+    std::vector<char> buffer;
+    if (!compile(path, hash, buffer))
+        return;
+    // The library is still loaded if the directory is read-only, but every
+    // load parses it again
+    if (!imageWrite(cachePath, buffer))
+        std::cerr << "WARNING: Could not write library cache: " << cachePath << std::endl;
+    loadCompiled(buffer);
+}
+
+CellLibraryPrivate::~CellLibraryPrivate()
+{
+    delete compiled;
+    delete mapped;
 }
 
 double CellLibraryPrivate::wireCapacitance(int fanout) const
@@ -124,76 +545,53 @@ double CellLibraryPrivate::wireResistance(int fanout) const
     return wire_load_resistance * fanout_length;
 }
 
-static void tableRowStringToDouble(std::vector<double> *out, const std::string &data)
-{
-    std::istringstream iss(data);
-    double item;
-    while (iss >> item)
-    {
-        out->push_back(item);
-        if (iss.peek() == ',')
-            iss.ignore();
-    }
-    while (iss);
-}
-
-static void handleTimingTable(LibertyContext &liberty, Cell &cell, LNPin *pin, const std::string &type, Signal::Transition trans, LNTiming *timing, LNTimingTable* timingTable)
+static void handleTimingTable(LibertyContext &liberty, LibraryImage &compiled, const std::string &type, Signal::Transition trans, LNTiming *timing, LNTimingTable* timingTable)
 {
-    std::vector<std::string> &t_table = timingTable->table;
-    std::vector<double> x;
-    std::vector<double> y;
     LNLuTableTemplate &tableTemplate = liberty.lu_table_templates[timingTable->lu_table_template];
     if (tableTemplate.variable_1 == "input_net_transition" &&
         tableTemplate.variable_2 == "total_output_net_capacitance")
     {
         // NanGate
-        tableRowStringToDouble(&x, tableTemplate.index_2);
-        tableRowStringToDouble(&y, tableTemplate.index_1);
-
-        std::vector<std::vector<double> > table;
-        for (size_t i = 0; i < y.size(); i++)
+        const std::vector<double> &x = tableTemplate.index_2;
+        const std::vector<double> &y = tableTemplate.index_1;
+        if (timingTable->rows != y.size() || timingTable->columns != x.size())
         {
-            std::vector<double> temp;
-            tableRowStringToDouble(&temp, t_table[i]);
-            assert(x.size() == temp.size());
-            table.push_back(temp);
+            std::cerr << "WARNING: Invalid data in value(...)" << std::endl;
+            return;
         }
 
-        cell.addTimingTable(type,
-            pin->name,
+        compiled.addTimingTable(type,
             timing->related_pin,
             timing->timing_sense,
             trans,
-            x, y, table);
+            x, y, timingTable->values.data());
     }
     else if (tableTemplate.variable_1 == "total_output_net_capacitance" &&
              tableTemplate.variable_2 == "input_net_transition")
     {
         // ISPD
-        tableRowStringToDouble(&x, tableTemplate.index_1);
-        tableRowStringToDouble(&y, tableTemplate.index_2);
-
-        std::vector<std::vector<double> > table;
-        for (size_t i = 0; i < y.size(); i++)
+        const std::vector<double> &x = tableTemplate.index_1;
+        const std::vector<double> &y = tableTemplate.index_2;
+        if (timingTable->rows != x.size() || timingTable->columns != y.size())
         {
-            std::vector<double> temp;
-            table.push_back(temp);
+            std::cerr << "WARNING: Invalid data in value(...)" << std::endl;
+            return;
         }
 
-        for (size_t i = 0; i < y.size(); i++)
+        // Rows follow index_1 here, so transpose
+        std::vector<double> table(x.size() * y.size());
+        for (size_t i = 0; i < x.size(); i++)
         {
-            std::vector<double> temp;
-            tableRowStringToDouble(&temp, t_table[i]);
+            const double *row = timingTable->row(i);
             for (size_t j = 0; j < y.size(); j++)
-                table[j].push_back(temp[j]);
+                table[j * x.size() + i] = row[j];
         }
 
-        cell.addTimingTable(type,
-            pin->name,
+        compiled.addTimingTable(type,
             timing->related_pin,
             timing->timing_sense,
             trans,
-            x, y, table);
+            x, y, table.data());
     }
     else
     {
@@ -201,82 +599,57 @@ static void handleTimingTable(LibertyContext &liberty, Cell &cell, LNPin *pin, c
     }
 }
 
-static void handleTimings(LibertyContext &liberty, Cell &cell, LNPin *pin)
+static void handleTimings(LibertyContext &liberty, LibraryImage &compiled, LNPin *pin)
 {
     for (size_t j = 0; j < pin->timings.size(); j++)
     {
         LNTiming *timing = pin->timings[j];
         if (timing->cell_fall)
-            handleTimingTable(liberty, cell, pin, "delay", Signal::Fall, timing, timing->cell_fall);
+            handleTimingTable(liberty, compiled, "delay", Signal::Fall, timing, timing->cell_fall);
         if (timing->cell_rise)
-            handleTimingTable(liberty, cell, pin, "delay", Signal::Rise, timing, timing->cell_rise);
+            handleTimingTable(liberty, compiled, "delay", Signal::Rise, timing, timing->cell_rise);
         if (timing->fall_transition)
-            handleTimingTable(liberty, cell, pin, "trans", Signal::Fall, timing, timing->fall_transition);
+            handleTimingTable(liberty, compiled, "trans", Signal::Fall, timing, timing->fall_transition);
         if (timing->rise_transition)
-            handleTimingTable(liberty, cell, pin, "trans", Signal::Rise, timing, timing->rise_transition);
+            handleTimingTable(liberty, compiled, "trans", Signal::Rise, timing, timing->rise_transition);
         // otherwise, temporarily ignore
     }
 }
 
-bool CellLibraryPrivate::load(std::fstream &infile, const std::string &path)
+// Parses a Liberty file into the compiled form
+bool CellLibraryPrivate::compile(std::istream &infile, const std::string &path, uint64_t sourceHash, std::vector<char> &image)
 {
     LibertyContext liberty;
     Liberty::Driver driver(liberty);
     // driver.trace_scanning = true;
     // driver.trace_parsing = true;
 
-    // Start parsing the Verilog file
+    // Start parsing the Liberty file
     liberty.clearExpressions();
     bool result = driver.parse_stream(infile, path);
     if (!result || liberty.expressions.size() == 0)
         return false;
 
-    // Copy properties
-    name = liberty.name;
-    time_unit = liberty.time_unit;
-    leakage_power_unit = liberty.leakage_power_unit;
-    voltage_unit = liberty.voltage_unit;
-    current_unit = liberty.current_unit;
-    pulling_resistance_unit = liberty.pulling_resistance_unit;
-    capacitive_load_unit = liberty.capacitive_load_unit;
-    nom_process = liberty.nom_process;
-    nom_temperature = liberty.nom_temperature;
-    nom_voltage = liberty.nom_voltage;
-    default_wire_load = liberty.default_wire_load;
-    wire_load_resistance = liberty.wire_loads[default_wire_load].resistance;
-    wire_load_capacitance = liberty.wire_loads[default_wire_load].capacitance;
-    fanout_lengthes = liberty.wire_loads[default_wire_load].fanout_length;
-    slope = liberty.wire_loads[default_wire_load].slope;
+    LibraryImage compiled;
+    compiled.setProperties(liberty);
 
     std::map<std::string,LNCell>::iterator it;
     for (it = liberty.cells.begin(); it != liberty.cells.end(); ++it)
     {
-        LNCell tmp_cell = it->second;
-
-        Cell cell(tmp_cell.name);
-        cell.setArea(tmp_cell.area);
+        LNCell &tmp_cell = it->second;
+        compiled.addCell(tmp_cell.name, tmp_cell.area);
 
         for (size_t i = 0; i < tmp_cell.pins.size(); i++)
         {
             LNPin *pin = tmp_cell.pins[i];
             if (pin->direction == "input")
             {
-                cell.setInputCapacitance(pin->name, pin->capacitance);
-                cell.setInputCapacitanceRise(pin->name, pin->rise_capacitance);
-                cell.setInputCapacitanceFall(pin->name, pin->fall_capacitance);
-                cell.setInputCapacitanceRiseMin(pin->name, pin->rise_capacitance_range.left());
-                cell.setInputCapacitanceFallMin(pin->name, pin->fall_capacitance_range.left());
-                cell.setInputCapacitanceRiseMax(pin->name, pin->rise_capacitance_range.right());
-                cell.setInputCapacitanceFallMax(pin->name, pin->fall_capacitance_range.right());
-                cell.addInputPinName(pin->name);
+                compiled.addPin(pin, InputPin);
             }
             else if (pin->direction == "output")
             {
-                cell.setFunction(pin->function);
-                cell.setOutputMaxCapacitance(pin->name, pin->max_capacitance);
-                cell.setOutputMaxTransition(pin->name, pin->max_transition);
-                cell.addOutputPinName(pin->name);
-                handleTimings(liberty, cell, pin);
+                compiled.addPin(pin, OutputPin);
+                handleTimings(liberty, compiled, pin);
             }
             else if (pin->direction == "internal")
             { /* do nothing */ }
@@ -287,59 +660,152 @@ bool CellLibraryPrivate::load(std::fstream &infile, const std::string &path)
                           << "pin direction is " << pin->direction << std::endl;
             }
         }
-        cells[tmp_cell.name] = cell;
     }
 
+    compiled.write(sourceHash, image);
     return true;
+}
 
-    // for (std::map<std::string,LNLuTableTemplate>::iterator it = liberty.lu_table_templates.begin();
-    //         it != liberty.lu_table_templates.end(); ++it)
-    // {
-    //     std::cout << it->first << std::endl;
-    //     std::cout << it->second.variable_1 << " ";
-    //     std::cout << it->second.variable_2 << std::endl;
-    //     std::cout << it->second.index_1 << std::endl;
-    //     std::cout << it->second.index_2 << std::endl;
-    // }
-    for (std::map<std::string,LNCell>::iterator it = liberty.cells.begin();
-            it != liberty.cells.end(); ++it)
+// Compressed files are parsed while a second thread decompresses them
+bool CellLibraryPrivate::compile(const std::string &path, uint64_t sourceHash, std::vector<char> &image)
+{
+    Compression compression = fileCompression(path);
+    if (compression != NoCompression)
     {
-        LNCell tmp_cell = it->second;
-        std::cout << tmp_cell.name << std::endl;
-        for (size_t i = 0; i < tmp_cell.pins.size(); i++)
+        DecompressingStream infile(path, compression);
+        return compile(infile, path, sourceHash, image);
+    }
+    std::fstream infile(path.c_str());
+    return compile(infile, path, sourceHash, image);
+}
+
+bool CellLibraryPrivate::load(std::fstream &infile, const std::string &path)
+{
+    std::vector<char> buffer;
+    return compile(infile, path, 0, buffer) && loadCompiled(buffer);
+}
+
+// Takes the mapping if it is a valid library, cells are built from it on
+// first use
+bool CellLibraryPrivate::loadCompiled(MappedFile *file)
+{
+    if (!indexCompiled(file->data, file->size))
+        return false;
+    delete mapped;
+    mapped = file;
+    std::vector<char>().swap(image);
+    return true;
+}
+
+// Takes the contents of buffer
+bool CellLibraryPrivate::loadCompiled(std::vector<char> &buffer)
+{
+    if (!indexCompiled(buffer.data(), buffer.size()))
+        return false;
+    image.swap(buffer);
+    delete mapped;
+    mapped = 0;
+    return true;
+}
+
+// Reads the properties and the cell names. The cells themselves are only
+// built by cell(), so data must stay valid while any is pending.
+bool CellLibraryPrivate::indexCompiled(const char *data, size_t size)
+{
+    CompiledLibrary *lib = new CompiledLibrary;
+    if (!lib->open(data, size))
+    {
+        delete lib;
+        return false;
+    }
+    const LibraryHeader *h = lib->header;
+    const ImageStrings &strings = lib->strings;
+
+    // Copy properties
+    name = strings.str(h->name);
+    time_unit = strings.str(h->timeUnit);
+    leakage_power_unit = strings.str(h->leakagePowerUnit);
+    voltage_unit = strings.str(h->voltageUnit);
+    current_unit = strings.str(h->currentUnit);
+    pulling_resistance_unit = strings.str(h->pullingResistanceUnit);
+    capacitive_load_unit = strings.str(h->capacitiveLoadUnit);
+    nom_process = h->nomProcess;
+    nom_temperature = h->nomTemperature;
+    nom_voltage = h->nomVoltage;
+    default_wire_load = strings.str(h->defaultWireLoad);
+    wire_load_resistance = h->wireLoadResistance;
+    wire_load_capacitance = h->wireLoadCapacitance;
+    slope = h->slope;
+    fanout_lengthes.clear();
+    for (size_t i = 0; i < h->fanoutCount; i++)
+        fanout_lengthes[lib->fanouts[i].fanout] = lib->fanouts[i].length;
+
+    std::lock_guard<std::mutex> guard(lock);
+    cells.clear();
+    pendingCells.clear();
+    for (uint32_t i = 0; i < h->cellCount; i++)
+        pendingCells[strings.str(lib->cells[i].name)] = i;
+    delete compiled;
+    compiled = lib;
+    return true;
+}
+
+// The same Cell the whole library used to be built into
+Cell CellLibraryPrivate::buildCell(uint32_t index) const
+{
+    const CompiledLibrary &lib = *compiled;
+    const ImageStrings &strings = lib.strings;
+    const CellRecord &c = lib.cells[index];
+    Cell cell(strings.str(c.name));
+    cell.setArea(c.area);
+
+    for (size_t j = c.firstPin; j < c.firstPin + c.pinCount; j++)
+    {
+        const PinRecord &pin = lib.pins[j];
+        std::string pinName = strings.str(pin.name);
+        if (pin.direction == InputPin)
         {
-            LNPin *pin = tmp_cell.pins[i];
-            std::cout << "  " << pin->name << std::endl;
-            for (size_t j = 0; j < pin->timings.size(); j++)
-            {
-                if (pin->timings[j]->cell_fall)
-                {
-                    std::vector<std::string> &table = pin->timings[j]->cell_fall->table;
-                    std::cout << "    " << pin->timings[j]->cell_fall->name << std::endl;
-                    // for (size_t i = 0; i < table.size(); i++)
-                    // {
-                    //     std::cout << "      ";
-                    //     std::cout << table[i];
-                    //     std::cout << std::endl;
-                    // }
-                }
-                else if (pin->timings[j]->fall_constraint) {
-                    std::vector<std::string> &table = pin->timings[j]->fall_constraint->table;
-                    for (size_t i = 0; i < table.size(); i++)
-                    {
-                        std::cout << "      ";
-                        std::cout << table[i];
-                        std::cout << std::endl;
-                    }
-                } else {
-                    std::cout << "    " << "0" << std::endl;
-                }
-                std::cout << "    " << pin->timings[j]->related_pin << std::endl;
-            }
+            cell.setInputCapacitance(pinName, pin.capacitance);
+            cell.setInputCapacitanceRise(pinName, pin.riseCapacitance);
+            cell.setInputCapacitanceFall(pinName, pin.fallCapacitance);
+            cell.setInputCapacitanceRiseMin(pinName, pin.riseCapacitanceMin);
+            cell.setInputCapacitanceFallMin(pinName, pin.fallCapacitanceMin);
+            cell.setInputCapacitanceRiseMax(pinName, pin.riseCapacitanceMax);
+            cell.setInputCapacitanceFallMax(pinName, pin.fallCapacitanceMax);
+            cell.addInputPinName(pinName);
+            continue;
+        }
+        cell.setFunction(strings.str(pin.function));
+        cell.setOutputMaxCapacitance(pinName, pin.maxCapacitance);
+        cell.setOutputMaxTransition(pinName, pin.maxTransition);
+        cell.addOutputPinName(pinName);
+        for (size_t k = pin.firstArc; k < pin.firstArc + pin.arcCount; k++)
+        {
+            const ArcRecord &arc = lib.arcs[k];
+            const double *v = lib.values + arc.values;
+            std::vector<double> x(v, v + arc.xCount);
+            v += arc.xCount;
+            std::vector<double> y(v, v + arc.yCount);
+            v += arc.yCount;
+            std::vector<std::vector<double> > table(arc.rowCount);
+            for (size_t r = 0; r < arc.rowCount; r++, v += arc.columnCount)
+                table[r].assign(v, v + arc.columnCount);
+            cell.addTimingTable(strings.str(arc.type), pinName,
+                strings.str(arc.relatedPin), strings.str(arc.timingSense),
+                (Signal::Transition) arc.transition, x, y, table);
         }
     }
+    return cell;
+}
 
-    return true;
+// Every cell is built, nothing reads the image any more
+void CellLibraryPrivate::releaseCompiled()
+{
+    delete compiled;
+    compiled = 0;
+    delete mapped;
+    mapped = 0;
+    std::vector<char>().swap(image);
 }
 
 void CellLibraryPrivate::createTwoInputCell(const std::string &name, const std::string &a, const std::string &b, const std::string &out)
@@ -353,14 +819,38 @@ void CellLibraryPrivate::createTwoInputCell(const std::string &name, const std::
 
 bool CellLibraryPrivate::hasCell(const std::string &type) const
 {
-    return (cells.find(type) != cells.end());
+    std::lock_guard<std::mutex> guard(lock);
+    return (cells.find(type) != cells.end()
+            || pendingCells.find(type) != pendingCells.end());
 }
 
-Cell CellLibraryPrivate::cell(const std::string &type) const
+Cell CellLibraryPrivate::cell(const std::string &type)
 {
-    if (hasCell(type))
-        return cells.at(type).cloneNode().toCell();
-    return Cell();
+    std::lock_guard<std::mutex> guard(lock);
+    std::map<std::string,Cell>::const_iterator it = cells.find(type);
+    if (it == cells.end())
+    {
+        std::map<std::string,uint32_t>::iterator pending = pendingCells.find(type);
+        if (pending == pendingCells.end())
+            return Cell();
+        it = cells.insert(std::make_pair(type, buildCell(pending->second))).first;
+        pendingCells.erase(pending);
+        if (pendingCells.empty())
+            releaseCompiled();
+    }
+    return it->second.cloneNode().toCell();
+}
+
+size_t CellLibraryPrivate::cellCount() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return cells.size() + pendingCells.size();
+}
+
+size_t CellLibraryPrivate::builtCellCount() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return cells.size();
 }
 
 
@@ -385,6 +875,34 @@ CellLibrary::CellLibrary(CellLibraryPrivate *p)
     impl = p;
 }
 
+std::shared_future<CellLibrary> CellLibrary::loadAsync(const std::string &path)
+{
+    return std::async(std::launch::async, [path]() { return CellLibrary(path); }).share();
+}
+
+bool CellLibrary::compile(const std::string &src, const std::string &dst)
+{
+    uint64_t hash;
+    {
+        MappedFile source(src);
+        if (!source.isOpen())
+        {
+            std::cerr << "Could not open file: " << src << std::endl;
+            return false;
+        }
+        hash = contentHash(source.data, source.size);
+    }
+    std::vector<char> image;
+    if (!CellLibraryPrivate::compile(src, hash, image))
+        return false;
+    if (!imageWrite(dst, image))
+    {
+        std::cerr << "Could not write file: " << dst << std::endl;
+        return false;
+    }
+    return true;
+}
+
 CellLibrary::CellLibrary(const CellLibrary &n)
 {
     impl = n.impl;
@@ -500,6 +1018,11 @@ bool CellLibrary::isDefault() const
     return impl->isDefault;
 }
 
+bool CellLibrary::isCached() const
+{
+    return impl->cached;
+}
+
 bool CellLibrary::isNull() const
 {
     return (impl == 0);
@@ -530,7 +1053,14 @@ size_t CellLibrary::cellCount() const
 {
     if (!impl)
         return 0;
-    return impl->cells.size();
+    return impl->cellCount();
+}
+
+size_t CellLibrary::builtCellCount() const
+{
+    if (!impl)
+        return 0;
+    return impl->builtCellCount();
 }
 
 bool CellLibrary::hasCell(const std::string &type) const
@@ -547,7 +1077,7 @@ Cell CellLibrary::cell(const std::string &type) const
     return impl->cell(type);
 }
 
-double CellLibrary::inputWireDelayRiseMin(const Cell &cell, size_t index) const
+double CellLibrary::inputWireDelayRiseMin(CellRef cell, size_t index) const
 {
     if (!impl)
         return 0.0;
@@ -559,7 +1089,7 @@ double CellLibrary::inputWireDelayRiseMin(const Cell &cell, size_t index) const
     return (r_wire / fanout) * (cell.inputCapacitanceRiseMin(index) + (c_wire / fanout));
 }
 
-double CellLibrary::inputWireDelayRiseMin(const Cell &cell, const std::string &pinIn) const
+double CellLibrary::inputWireDelayRiseMin(CellRef cell, const std::string &pinIn) const
 {
     if (!impl)
         return 0.0;
@@ -571,7 +1101,7 @@ double CellLibrary::inputWireDelayRiseMin(const Cell &cell, const std::string &p
     return (r_wire / fanout) * (cell.inputCapacitanceRiseMin(pinIn) + (c_wire / fanout));
 }
 
-double CellLibrary::inputWireDelayRiseMax(const Cell &cell, size_t index) const
+double CellLibrary::inputWireDelayRiseMax(CellRef cell, size_t index) const
 {
     if (!impl)
         return 0.0;
@@ -583,7 +1113,7 @@ double CellLibrary::inputWireDelayRiseMax(const Cell &cell, size_t index) const
     return (r_wire / fanout) * (cell.inputCapacitanceRiseMax(index) + (c_wire / fanout));
 }
 
-double CellLibrary::inputWireDelayRiseMax(const Cell &cell, const std::string &pinIn) const
+double CellLibrary::inputWireDelayRiseMax(CellRef cell, const std::string &pinIn) const
 {
     if (!impl)
         return 0.0;
@@ -595,7 +1125,7 @@ double CellLibrary::inputWireDelayRiseMax(const Cell &cell, const std::string &p
     return (r_wire / fanout) * (cell.inputCapacitanceRiseMax(pinIn) + (c_wire / fanout));
 }
 
-double CellLibrary::inputWireDelayFallMin(const Cell &cell, size_t index) const
+double CellLibrary::inputWireDelayFallMin(CellRef cell, size_t index) const
 {
     if (!impl)
         return 0.0;
@@ -607,7 +1137,7 @@ double CellLibrary::inputWireDelayFallMin(const Cell &cell, size_t index) const
     return (r_wire / fanout) * (cell.inputCapacitanceFallMin(index) + (c_wire / fanout));
 }
 
-double CellLibrary::inputWireDelayFallMin(const Cell &cell, const std::string &pinIn) const
+double CellLibrary::inputWireDelayFallMin(CellRef cell, const std::string &pinIn) const
 {
     if (!impl)
         return 0.0;
@@ -619,7 +1149,7 @@ double CellLibrary::inputWireDelayFallMin(const Cell &cell, const std::string &p
     return (r_wire / fanout) * (cell.inputCapacitanceFallMin(pinIn) + (c_wire / fanout));
 }
 
-double CellLibrary::inputWireDelayFallMax(const Cell &cell, size_t index) const
+double CellLibrary::inputWireDelayFallMax(CellRef cell, size_t index) const
 {
     if (!impl)
         return 0.0;
@@ -631,7 +1161,7 @@ double CellLibrary::inputWireDelayFallMax(const Cell &cell, size_t index) const
     return (r_wire / fanout) * (cell.inputCapacitanceFallMax(index) + (c_wire / fanout));
 }
 
-double CellLibrary::inputWireDelayFallMax(const Cell &cell, const std::string &pinIn) const
+double CellLibrary::inputWireDelayFallMax(CellRef cell, const std::string &pinIn) const
 {
     if (!impl)
         return 0.0;
@@ -2,6 +2,7 @@
 #define CELLLIBRARY_H
 
 #include "circuit.h"
+#include <future>
 #include <string>
 
 // Forward declaration
@@ -11,6 +12,9 @@ class CellLibrary
 {
 public:
     CellLibrary();
+    // A Liberty file, plain or gzip/zstd compressed, or one written by
+    // compile(). A Liberty file is cached next to itself as <path>.lcc and
+    // the cache used while it is current.
     CellLibrary(const std::string &path);
     CellLibrary(const CellLibrary&);
     CellLibrary& operator= (const CellLibrary&);
@@ -18,6 +22,9 @@ public:
     bool operator!= (const CellLibrary&) const;
     ~CellLibrary();
 
+    // Loads on a worker thread, see Circuit::loadAsync()
+    static std::shared_future<CellLibrary> loadAsync(const std::string &path);
+
     // Properties
     std::string name() const;
     std::string time_unit() const;
@@ -35,22 +42,29 @@ public:
 
     size_t cellCount() const;
     inline size_t size() const { return cellCount(); }
+    // Cells of a loaded library are built when first asked for
+    size_t builtCellCount() const;
     bool hasCell(const std::string &type) const;
     Cell cell(const std::string &type) const;
 
     bool isDefault() const;
+    // Whether the cache of the Liberty file was current and used
+    bool isCached() const;
     bool isNull() const;
 
     bool load(std::fstream &infile, const std::string &path);
 
-    double inputWireDelayRiseMin(const Cell&, size_t index) const;
-    double inputWireDelayRiseMin(const Cell&, const std::string &pinIn) const;
-    double inputWireDelayRiseMax(const Cell&, size_t index) const;
-    double inputWireDelayRiseMax(const Cell&, const std::string &pinIn) const;
-    double inputWireDelayFallMin(const Cell&, size_t index) const;
-    double inputWireDelayFallMin(const Cell&, const std::string &pinIn) const;
-    double inputWireDelayFallMax(const Cell&, size_t index) const;
-    double inputWireDelayFallMax(const Cell&, const std::string &pinIn) const;
+    // Writes the Liberty file src in the binary form CellLibrary(path) reads
+    static bool compile(const std::string &src, const std::string &dst);
+
+    double inputWireDelayRiseMin(CellRef, size_t index) const;
+    double inputWireDelayRiseMin(CellRef, const std::string &pinIn) const;
+    double inputWireDelayRiseMax(CellRef, size_t index) const;
+    double inputWireDelayRiseMax(CellRef, const std::string &pinIn) const;
+    double inputWireDelayFallMin(CellRef, size_t index) const;
+    double inputWireDelayFallMin(CellRef, const std::string &pinIn) const;
+    double inputWireDelayFallMax(CellRef, size_t index) const;
+    double inputWireDelayFallMax(CellRef, const std::string &pinIn) const;
 
 private:
     CellLibraryPrivate *impl;
@@ -0,0 +1,192 @@
+#ifndef BINARYIMAGE_P_H
+#define BINARYIMAGE_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the public libCircuit API. It exists for the
+// convenience of the circuit implementation files and may change without
+// notice.
+//
+
+#include "symboltable_p.h"
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Helpers for the relocatable images written by Circuit::save() and
+// CellLibrary::compile(). An image is one block in which every reference
+// is an index or a byte offset from its start, so it is read in place.
+
+// The whole file, read-only. Mapped where possible, otherwise copied.
+class MappedFile
+{
+public:
+    MappedFile(const std::string &path)
+        : data(0), size(0), mapped(false), opened(false)
+    {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void *p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED)
+            {
+                data = (const char*) p;
+                size = st.st_size;
+                mapped = opened = true;
+            }
+        }
+        close(fd);
+        if (mapped)
+            return;
+#endif
+        std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+        if (!in.good())
+            return;
+        copy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        data = copy.data();
+        size = copy.size();
+        opened = true;
+    }
+
+    ~MappedFile()
+    {
+#ifndef _WIN32
+        if (mapped)
+            munmap((void*) data, size);
+#endif
+    }
+
+    bool isOpen() const { return opened; }
+
+    const char *data;
+    size_t size;
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    bool mapped;
+    bool opened;
+    std::vector<char> copy;
+};
+
+// Written under a temporary name and renamed, so that a concurrent reader
+// never sees a partial image. The process id and a counter keep the
+// temporary files of writers in other processes and threads apart.
+inline bool imageWrite(const std::string &path, const std::vector<char> &image)
+{
+    static std::atomic<unsigned> counter(0);
+    std::string tmp = path + ".tmp";
+#ifndef _WIN32
+    tmp += std::to_string((long long) getpid()) + ".";
+#endif
+    tmp += std::to_string((unsigned long long) counter++);
+    {
+        std::ofstream out(tmp.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out.good())
+            return false;
+        out.write(image.data(), image.size());
+        if (!out.good())
+        {
+            out.close();
+            std::remove(tmp.c_str());
+            return false;
+        }
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        // Windows does not replace an existing file
+        std::remove(path.c_str());
+        if (std::rename(tmp.c_str(), path.c_str()) != 0)
+        {
+            std::remove(tmp.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+template <class T>
+inline void imagePut(std::vector<char> &out, const T &value)
+{
+    const char *p = (const char*) &value;
+    out.insert(out.end(), p, p + sizeof(T));
+}
+
+// Sections start on 8-byte boundaries
+inline void imageAlign(std::vector<char> &out)
+{
+    out.resize((out.size() + 7) & ~(size_t) 7);
+}
+
+// Array of count T at a byte offset of the image, 0 if it does not fit or
+// is not aligned for T
+template <class T>
+inline const T *imageArray(const char *data, size_t size, uint64_t offset, uint64_t count)
+{
+    if (offset > size || count > (size - offset) / sizeof(T) || (uintptr_t) (data + offset) % alignof(T))
+        return 0;
+    return (const T*) (data + offset);
+}
+
+// String section: uint32 offsets[count + 1], then the characters
+inline void imagePutStrings(std::vector<char> &out, const SymbolTable &strings)
+{
+    uint32_t offset = 0;
+    imagePut(out, offset);
+    for (size_t i = 0; i < strings.size(); i++)
+        imagePut(out, offset += (uint32_t) strings.length(i));
+    for (size_t i = 0; i < strings.size(); i++)
+        out.insert(out.end(), strings.data((Symbol) i), strings.data((Symbol) i) + strings.length((Symbol) i));
+    imageAlign(out);
+}
+
+class ImageStrings
+{
+public:
+    ImageStrings() : offsets(0), chars(0), count(0) {}
+
+    bool open(const char *data, size_t size, uint64_t offset, uint32_t n)
+    {
+        offsets = imageArray<uint32_t>(data, size, offset, (uint64_t) n + 1);
+        if (!offsets)
+            return false;
+        uint64_t base = offset + ((uint64_t) n + 1) * sizeof(uint32_t);
+        for (size_t i = 0; i < n; i++)
+            if (offsets[i] > offsets[i + 1])
+                return false;
+        if (offsets[n] > size - base)
+            return false;
+        chars = data + base;
+        count = n;
+        return true;
+    }
+
+    bool contains(uint32_t i) const { return i < count; }
+    size_t size() const { return count; }
+    const char *data(uint32_t i) const { return chars + offsets[i]; }
+    size_t length(uint32_t i) const { return offsets[i + 1] - offsets[i]; }
+    std::string str(uint32_t i) const { return std::string(data(i), length(i)); }
+
+private:
+    const uint32_t *offsets;
+    const char *chars;
+    uint32_t count;
+};
+
+#endif // BINARYIMAGE_P_H
@@ -1,4 +1,6 @@
 #include "circuit.h"
+#include "circuit_p.h"
+#include "compressedstream_p.h"
 #include "celllibrary.h"
 #include "interpolate.h"
 #include <iostream>
@@ -7,6 +9,8 @@
 #include <set>
 #include <algorithm>
 #include <cassert>
+#include <new>
+#include <utility>
 #include <qatomic.h>
 #include "../parser/verilog/driver.h"
 #include "../parser/verilog/expression.h"
@@ -20,260 +24,88 @@ static std::string _dir2str(Node::Direct dir)
     return dir == Node::left ? "left" : "right"; 
 }
 
-const static std::string SCOPE_KEY = ":";
-
-typedef std::map<std::string,std::map<std::string,std::map<Signal::Transition,interpolate::interp2d*> > > TimingTable;
-
 /**************************************************************
  *
- * Private class declerations
+ * NodeArena
  *
  **************************************************************/
-class NodePrivate
-{
-public:
-    NodePrivate(CircuitPrivate*, NodePrivate* parent = 0);
-    NodePrivate(NodePrivate* n, bool deep);
-    virtual ~NodePrivate();
-
-    std::string nodeName() const { return name; }
-    void setName(const std::string &name);
-    void replaceName(ModulePrivate *module, const std::string &name);
-
-    Signal nodeValue() const { return value; }
-    void setNodeValue(Signal &v) { value = v; }
-
-    CircuitPrivate* ownerCircuit();
-    void setOwnerCircuit(CircuitPrivate* c);
-
-    size_t inputSize() const;
-    size_t outputSize() const;
-    bool hasInput(const std::string &name) const;
-    bool hasOutput(const std::string &name) const;
-    NodePrivate* input(const std::string &name) const;
-    NodePrivate* output(const std::string &name) const;
-    NodePrivate* input(size_t i) const;
-    NodePrivate* output(size_t i) const;
-    void addInput(NodePrivate *node);
-    void addOutput(NodePrivate *node);
-    void addInputPinName(const std::string &pinName);
-    void addOutputPinName(const std::string &pinName);
-    void connect(const std::string &pin, NodePrivate *targ, const std::string targ_pin = "");
-
-    void connectInput(size_t pin, NodePrivate *targ);
-    void connectOutput(size_t pin, NodePrivate *targ);
-
-    virtual NodePrivate* cloneNode(bool deep = true);
-    void clear();
-
-    inline NodePrivate* parent() const { return hasParent ? ownerNode : 0; }
-    inline void setParent(NodePrivate *p) { ownerNode = p; hasParent = true; }
-
-    bool isPort() const     { return nodeType() == Node::PortNode; }
-    bool isWire() const     { return nodeType() == Node::WireNode; }
-    bool isGate() const     { return nodeType() == Node::GateNode; }
-    bool isCell() const     { return nodeType() == Node::CellNode; }
-    bool isModule() const   { return nodeType() == Node::ModuleNode; }
-    bool isCircuit() const  { return nodeType() == Node::CircuitNode; }
-
-    virtual Node::NodeType nodeType() const { return Node::BaseNode; }
-
-    QAtomicInt ref;
-    NodePrivate* ownerNode;
-    std::map<std::string,NodePrivate*> inputs;
-    std::map<std::string,NodePrivate*> outputs;
-    std::vector<std::string> inputNames;
-    std::vector<std::string> outputNames;
-    bool hasParent : 1;
-    bool isInternal;
 
-    std::string name;
-    Signal value;
-};
+static const size_t NodesPerBlock = 1024;
 
-class PortPrivate : public NodePrivate
+NodeArena::NodeArena(size_t size_)
+    : size((size_ + 15) & ~size_t(15)), used(NodesPerBlock),
+      freeList(0), live(0), attached(true)
 {
-public:
-    PortPrivate(CircuitPrivate*, NodePrivate* parent, const std::string &name, Port::PortType type);
-    PortPrivate(PortPrivate* n, bool deep);
-    ~PortPrivate();
-
-    Port::PortType type;
-    // Reimplemented from NodePrivate
-    NodePrivate* cloneNode(bool deep = true);
-    Node::NodeType nodeType() const { return Node::PortNode; }
-};
+}
 
-class WirePrivate : public NodePrivate
+NodeArena::~NodeArena()
 {
-public:
-    WirePrivate(CircuitPrivate*, NodePrivate* parent, const std::string &name);
-    WirePrivate(WirePrivate* n, bool deep);
-    ~WirePrivate();
-
-    // Reimplemented from NodePrivate
-    NodePrivate* cloneNode(bool deep = true);
-    Node::NodeType nodeType() const { return Node::WireNode; }
-};
+    for (size_t i = 0; i < blocks.size(); i++)
+        delete [] blocks[i];
+}
 
-class GatePrivate : public NodePrivate
+void *NodeArena::allocate()
 {
-public:
-    GatePrivate(GatePrivate* n, bool deep);
-    GatePrivate(CircuitPrivate*, NodePrivate* parent, const std::string &name, Gate::GateType type);
-    ~GatePrivate();
-
-    Gate::GateType gateType() const { return type; }
-
-    // Reimplemented from NodePrivate
-    NodePrivate* cloneNode(bool deep = true);
-    Node::NodeType nodeType() const { return Node::GateNode; }
-
-    //void breakOutputConnection();
-    Signal (*func)(const Node&);
-    unsigned level;
-    Gate::GateType type;
-};
+    std::lock_guard<std::mutex> guard(lock);
+    live++;
+    if (freeList)
+    {
+        void *p = freeList;
+        freeList = *(void**) p;
+        return p;
+    }
+    if (used == NodesPerBlock)
+    {
+        blocks.push_back(new char[size * NodesPerBlock]);
+        used = 0;
+    }
+    return blocks.back() + size * used++;
+}
 
-class CellPrivate : public GatePrivate
+void NodeArena::release(void *p)
 {
-public:
-    CellPrivate(CellPrivate* n, bool deep);
-    CellPrivate(CircuitPrivate*, NodePrivate* parent, const std::string &name, const std::string &type);
-    ~CellPrivate();
-
-    std::string cellType() const { return type; }
-
-    void addInputPinName(const std::string &pinName);
-    void addOutputPinName(const std::string &pinName);
-    Port::PortType pinType(size_t i) const;
-    void outputCapacitanceMax();
-    double outputCapacitanceRiseMax();
-    double outputCapacitanceFallMax();
-
-    void breakOutputConnection(const std::string &pinName);
-
-    // Reimplemented from NodePrivate
-    NodePrivate* cloneNode(bool deep = true);
-    Node::NodeType nodeType() const { return Node::CellNode; }
-
-    double area;
-    std::string type;
-    std::string function;
-    std::map<std::string,double> inputCapacitances;
-    std::map<std::string,double> inputCapacitancesRise;
-    std::map<std::string,double> inputCapacitancesFall;
-    std::map<std::string,double> inputCapacitancesRiseMin;
-    std::map<std::string,double> inputCapacitancesFallMin;
-    std::map<std::string,double> inputCapacitancesRiseMax;
-    std::map<std::string,double> inputCapacitancesFallMax;
-    std::map<std::string,double> outputMaxCapacitance;
-    std::map<std::string,double> outputMaxTransition;
-    std::vector<Port::PortType> pinTypes;
-
-    std::map<std::string,std::map<std::string,TimingSense> > timingSense;
-    TimingTable delayTables;
-    TimingTable transTables;
-
-    double cacheOutputCapacitanceRiseMax;
-    double cacheOutputCapacitanceFallMax;
-    bool dirty : 1;
-};
+    bool last;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        *(void**) p = freeList;
+        freeList = p;
+        last = (--live == 0 && !attached);
+    }
+    if (last)
+        delete this;
+}
 
-class ModulePrivate : public NodePrivate
+void NodeArena::release(const std::vector<void*> &nodes)
 {
-public:
-    ModulePrivate(CircuitPrivate*, NodePrivate* parent, const std::string &name);
-    ModulePrivate(ModulePrivate* n, bool deep);
-    ~ModulePrivate();
-
-    size_t gateCount() const;
-
-    void addCell(CellPrivate *);
-
-    PortPrivate *PI(size_t);
-    PortPrivate *PO(size_t);
-    PortPrivate *PPI(size_t);
-    PortPrivate *PPO(size_t);
-
-    bool hasPort(const std::string &portName) const;
-    bool hasWire(const std::string &wireName) const;
-    bool hasGate(const std::string &gateName) const;
-    bool hasCell(const std::string &cellName) const;
-
-    PortPrivate* port(size_t i);
-    WirePrivate* wire(size_t i);
-    GatePrivate* gate(size_t i);
-    CellPrivate* cell(size_t i);
-    PortPrivate* port(const std::string &portName);
-    WirePrivate* wire(const std::string &wireName);
-    GatePrivate* gate(const std::string &gateName);
-    CellPrivate* cell(const std::string &cellName);
-
-    PortPrivate* createPort(const std::string &portName, Port::PortType);
-    WirePrivate* createWire(const std::string &wireName);
-    GatePrivate* createGate(const std::string &gateName, Gate::GateType);
-    CellPrivate* createCell(const std::string &cellName, const std::string&);
-
-    void setCellName(CellPrivate *, const std::string name);
-    void setGateName(GatePrivate *, const std::string name);
-    void setWireName(WirePrivate *, const std::string name);
-    void setPortName(PortPrivate *, const std::string name);
-
-    bool pushCell(CellPrivate* cell);
-    bool pushGate(GatePrivate* gate);
-    bool pushWire(WirePrivate* wire);
-    bool pushPort(PortPrivate* port);
-
-    bool removeCell(const std::string &cellName);
-    bool removeGate(const std::string &gateName);
-    bool removeWire(const std::string &wireName);
-    bool removePort(const std::string &portName);
-
-    Node::NodeType nodeType() const { return Node::ModuleNode; }
-
-    std::map<std::string,PortPrivate*> ports;
-    std::map<std::string,WirePrivate*> wires;
-    std::map<std::string,CellPrivate*> cells;
-    std::map<std::string,GatePrivate*> gates;
-    std::vector<std::string> portNames;
-    std::vector<std::string> wireNames;
-    std::vector<std::string> cellNames;
-    std::vector<std::string> gateNames;
-
-    std::map<std::string,PortPrivate*> PIs;
-    std::map<std::string,PortPrivate*> POs;
-    std::map<std::string,PortPrivate*> PPIs;
-    std::map<std::string,PortPrivate*> PPOs;
-    std::vector<std::string> PINames;
-    std::vector<std::string> PONames;
-    std::vector<std::string> PPINames;
-    std::vector<std::string> PPONames;
-private:
-};
+    if (nodes.empty())
+        return;
+    bool last;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            *(void**) nodes[i] = freeList;
+            freeList = nodes[i];
+        }
+        live -= nodes.size();
+        last = (live == 0 && !attached);
+    }
+    if (last)
+        delete this;
+}
 
-class CircuitPrivate : public NodePrivate
+// The circuit is gone; nodes still referenced keep the blocks alive
+void NodeArena::detach()
 {
-public:
-    CircuitPrivate();
-    CircuitPrivate(const std::string &name);
-    CircuitPrivate(CircuitPrivate* n, bool deep);
-    ~CircuitPrivate();
-
-    size_t gateCount() const;
-
-    bool hasModule(const std::string &moduleName);
-    ModulePrivate* module(const std::string &moduleName);
-    ModulePrivate* createModule(const std::string &moduleName);
-
-    void setTopModule(ModulePrivate *module);
-
-    std::string path;
-    ModulePrivate *topModule;
-    std::map<std::string,ModulePrivate*> modules;
-    std::vector<std::string> moduleNames;
-    CellLibrary *library;
-};
+    bool last;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        attached = false;
+        last = (live == 0);
+    }
+    if (last)
+        delete this;
+}
 
 /**************************************************************
  *
@@ -281,13 +113,48 @@ public:
  *
  **************************************************************/
 
-inline void NodePrivate::setOwnerCircuit(CircuitPrivate *c)
+// The name is carried over when the node moves to another symbol table
+void NodePrivate::setOwnerCircuit(CircuitPrivate *c)
 {
+    SymbolTable &from = symbols();
     ownerNode = c;
     hasParent = false;
+    if (symbol && &symbols() != &from)
+        symbol = symbols().intern(from.str(symbol));
+}
+
+void NodePrivate::setParent(NodePrivate *p)
+{
+    SymbolTable &from = symbols();
+    ownerNode = p;
+    hasParent = true;
+    if (symbol && &symbols() != &from)
+        symbol = symbols().intern(from.str(symbol));
+}
+
+SymbolTable &NodePrivate::symbols() const
+{
+    const NodePrivate *p = this;
+    while (p)
+    {
+        Node::NodeType type = p->nodeType();
+        if (type == Node::ModuleNode)
+            return *((const ModulePrivate*)p)->symbolTable;
+        if (type == Node::CircuitNode)
+            return *((const CircuitPrivate*)p)->symbolTable;
+        p = p->ownerNode;
+    }
+    return SymbolTable::shared();
+}
+
+// Called when the owner goes away while the node is still referenced
+void NodePrivate::orphan()
+{
+    setOwnerCircuit(0);
 }
 
-NodePrivate::NodePrivate(CircuitPrivate *c, NodePrivate *parent) : ref(1), isInternal(false)
+NodePrivate::NodePrivate(CircuitPrivate *c, NodePrivate *parent)
+    : ref(1), arena(0), ownerNode(0), hasParent(false), hasTombstones(false), touched(false), marked(false), isInternal(false), index(0), symbol(0)
 {
     if (parent)
         setParent(parent);
@@ -295,33 +162,36 @@ NodePrivate::NodePrivate(CircuitPrivate *c, NodePrivate *parent) : ref(1), isInt
         setOwnerCircuit(c);
 }
 
-NodePrivate::NodePrivate(NodePrivate* n, bool deep) : ref(1), isInternal(false)
+NodePrivate::NodePrivate(NodePrivate* n, bool deep)
+    : ref(1), arena(0), ownerNode(0), hasParent(false), hasTombstones(false), touched(false), marked(false), isInternal(false), index(0), symbol(0)
 {
     setOwnerCircuit(n->ownerCircuit());
-    name = n->name;
-    inputNames = n->inputNames;
-    outputNames = n->outputNames;
-    inputs = n->inputs;
-    outputs = n->outputs;
-    std::map<std::string,NodePrivate*>::iterator it;
-    for (it = inputs.begin(); it != inputs.end(); ++it)
-        it->second = 0;
-    for (it = outputs.begin(); it != outputs.end(); ++it)
-        it->second = 0;
+    setName(n->nodeName());
+    // Same pins, nothing connected
+    inputs.resize(n->inputs.size());
+    outputs.resize(n->outputs.size());
 
     if (!deep)
         return;
 }
 
+// Connections do not own their peers, they only have to forget us
 NodePrivate::~NodePrivate()
 {
-    // std::map<std::string,NodePrivate*>::iterator it;
-    // for (it = outputs.begin(); it != outputs.end(); ++it)
-    //     if (it->second && !it->second->ref.deref())
-    //         delete it->second;
-    // for (it = inputs.begin(); it != inputs.end(); ++it)
-    //     if (it->second && !it->second->ref.deref())
-    //         delete it->second;
+    unlink();
+}
+
+void NodePrivate::destroy(NodePrivate *node)
+{
+    NodeArena *arena = node->arena;
+    if (!arena)
+    {
+        delete node;
+        return;
+    }
+    void *p = dynamic_cast<void*>(node);
+    node->~NodePrivate();
+    arena->release(p);
 }
 
 CircuitPrivate* NodePrivate::ownerCircuit()
@@ -355,85 +225,193 @@ size_t NodePrivate::outputSize() const
     return outputs.size();
 }
 
+// Nodes without named pins look up a neighbour by its name, e.g. the
+// module finds its ports this way.
+int NodePrivate::inputPin(const std::string &name) const
+{
+    Symbol s = symbols().find(name);
+    if (s == SymbolTable::NoSymbol)
+        return -1;
+    for (size_t i = 0; i < inputs.size(); i++)
+        if (inputs[i].node && inputs[i].node->symbol == s)
+            return (int) i;
+    return -1;
+}
+
+int NodePrivate::outputPin(const std::string &name) const
+{
+    Symbol s = symbols().find(name);
+    if (s == SymbolTable::NoSymbol)
+        return -1;
+    for (size_t i = 0; i < outputs.size(); i++)
+        if (outputs[i].node && outputs[i].node->symbol == s)
+            return (int) i;
+    return -1;
+}
+
 bool NodePrivate::hasInput(const std::string &name) const
 {
-    return (inputs.find(name) != inputs.end());
-    /* return std::find(inputNames.begin(), inputNames.end(), name) != inputNames.end(); */
+    return inputPin(name) >= 0;
 }
 
 bool NodePrivate::hasOutput(const std::string &name) const
 {
-    return (outputs.find(name) != outputs.end());
-    /* return std::find(outputNames.begin(), outputNames.end(), name) != outputNames.end(); */
+    return outputPin(name) >= 0;
 }
 
 NodePrivate* NodePrivate::input(const std::string &name) const
 {
-    return inputs.at(name);
+    int i = inputPin(name);
+    return i < 0 ? 0 : inputs[i].node;
 }
 
 NodePrivate* NodePrivate::output(const std::string &name) const
 {
-    return outputs.at(name);
+    int i = outputPin(name);
+    return i < 0 ? 0 : outputs[i].node;
 }
 
 NodePrivate* NodePrivate::input(size_t i) const
 {
-    std::string name = inputNames[i];
-    return inputs.at(name);
+    return i < inputs.size() ? inputs[i].node : 0;
 }
 
 NodePrivate* NodePrivate::output(size_t i) const
 {
-    std::string name = outputNames[i];
-    return outputs.at(name);
+    return i < outputs.size() ? outputs[i].node : 0;
 }
 
+// One-way link, the node does not point back
 void NodePrivate::addInput(NodePrivate *node)
 {
-    inputs[node->name] = node;
-    inputNames.push_back(node->name);
+    inputs.push_back(PinSlot(node, PinSlot::NoPin));
 }
 
 void NodePrivate::addOutput(NodePrivate *node)
 {
-    outputs[node->name] = node;
-    outputNames.push_back(node->name);
+    outputs.push_back(PinSlot(node, PinSlot::NoPin));
 }
 
 void NodePrivate::addInputPinName(const std::string &pinName)
 {
-    inputs[pinName] = 0;
-    inputNames.push_back(pinName);
+    (void) pinName;
+    appendInput();
 }
 
 void NodePrivate::addOutputPinName(const std::string &pinName)
 {
-    outputs[pinName] = 0;
-    outputNames.push_back(pinName);
+    (void) pinName;
+    appendOutput();
 }
 
-// targ wire name will be something like "module:U1:A1"
-// [ModuleName]:[CellName]:[PinName]
-static std::string _genkey(NodePrivate *cell, const std::string &pin)
+static inline void _link(NodePrivate *from, unsigned out, NodePrivate *to, unsigned in)
 {
-    std::ostringstream oss;
-    oss << cell->ownerNode->name << SCOPE_KEY << cell->name << SCOPE_KEY << pin;
-    return oss.str();
+    from->outputs[out] = PinSlot(to, in);
+    to->inputs[in] = PinSlot(from, out);
+    from->connectionChanged();
+    to->connectionChanged();
 }
 
-static std::string _genkey(NodePrivate *node, const std::string &pin, const size_t n)
+// Forget input slot i on this side only. Pins of gates and cells stay in
+// place; the connection list of a port or wire shrinks and the neighbours
+// behind it are told their new slot index.
+void NodePrivate::releaseInput(size_t i)
 {
-    std::ostringstream oss;
-    oss << _genkey(node, pin) << SCOPE_KEY << n;
-    return oss.str();
+    if (hasFixedPins())
+    {
+        inputs[i] = PinSlot();
+    }
+    else
+    {
+        inputs.erase(inputs.begin() + i);
+        for (size_t j = i; j < inputs.size(); j++)
+            if (inputs[j].node && inputs[j].pin != PinSlot::NoPin)
+                inputs[j].node->outputs[inputs[j].pin].pin = (unsigned) j;
+    }
+    connectionChanged();
+}
+
+void NodePrivate::releaseOutput(size_t i)
+{
+    if (hasFixedPins())
+    {
+        outputs[i] = PinSlot();
+    }
+    else
+    {
+        outputs.erase(outputs.begin() + i);
+        for (size_t j = i; j < outputs.size(); j++)
+            if (outputs[j].node && outputs[j].pin != PinSlot::NoPin)
+                outputs[j].node->inputs[outputs[j].pin].pin = (unsigned) j;
+    }
+    connectionChanged();
+}
+
+// Break the connection on input slot i and leave the slot empty
+void NodePrivate::disconnectInput(size_t i)
+{
+    PinSlot s = inputs[i];
+    if (s.node && s.pin != PinSlot::NoPin)
+        s.node->releaseOutput(s.pin);
+    inputs[i] = PinSlot();
+    connectionChanged();
+}
+
+void NodePrivate::disconnectOutput(size_t i)
+{
+    PinSlot s = outputs[i];
+    if (s.node && s.pin != PinSlot::NoPin)
+        s.node->releaseInput(s.pin);
+    outputs[i] = PinSlot();
+    connectionChanged();
+}
+
+// Drops data derived from this node's connections, or leaves that to the
+// commit of an open module edit
+void NodePrivate::connectionChanged()
+{
+    NodePrivate *p = parent();
+    if (p && p->isModule() && ((ModulePrivate*)p)->editDepth)
+    {
+        ((ModulePrivate*)p)->touch(this);
+        return;
+    }
+    invalidateLoads();
+}
+
+void NodePrivate::invalidateLoads()
+{
+    if (isCell())
+    {
+        ((CellPrivate*)this)->dirty = 1;
+    }
+    else if (isWire())
+    {
+        // The load seen by the driving cells changed
+        for (size_t i = 0; i < inputs.size(); i++)
+            if (inputs[i].node && inputs[i].node->isCell())
+                ((CellPrivate*)inputs[i].node)->dirty = 1;
+    }
 }
 
-// Get "A1" from "module:cell:A1"
-static std::string _getPinfromKey(const NodePrivate *node, const std::string &key)
+// Detach the neighbours from this node. Our own slots keep pointing at them
+// so a removed node can still be asked what it was connected to.
+void NodePrivate::unlink()
 {
-    std::string str = node->ownerNode->name + SCOPE_KEY + node->name + SCOPE_KEY;
-    return key.substr(str.length());
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        PinSlot &s = inputs[i];
+        if (s.node && s.pin != PinSlot::NoPin)
+            s.node->releaseOutput(s.pin);
+        s.pin = PinSlot::NoPin;
+    }
+    for (size_t i = 0; i < outputs.size(); i++)
+    {
+        PinSlot &s = outputs[i];
+        if (s.node && s.pin != PinSlot::NoPin)
+            s.node->releaseInput(s.pin);
+        s.pin = PinSlot::NoPin;
+    }
 }
 
 void NodePrivate::connect(const std::string &pin, NodePrivate *targ, const std::string targ_pin)
@@ -443,25 +421,16 @@ void NodePrivate::connect(const std::string &pin, NodePrivate *targ, const std::
 
     if (this->isCell() || this->isGate())
     {
-        if (hasOutput(pin))
+        int k;
+        if ((k = outputPin(pin)) >= 0)
         {
-            outputs[pin] = targ;
-            targ->ref.ref();
-            ownerNode = targ->ownerNode;
-            std::string key = _genkey(this, pin);
-            //oss << targ->inputNames.size();
-            targ->inputNames.push_back(key);
-            targ->inputs[key] = this;
+            disconnectOutput(k);
+            _link(this, k, targ, targ->appendInput());
         }
-        else if (hasInput(pin))
+        else if ((k = inputPin(pin)) >= 0)
         {
-            inputs[pin] = targ;
-            targ->ref.ref();
-            ownerNode = targ->ownerNode;
-            std::string key = _genkey(this, pin);
-            //oss << targ->outputNames.size();
-            targ->outputNames.push_back(key);
-            targ->outputs[key] = this;
+            disconnectInput(k);
+            _link(targ, targ->appendOutput(), this, k);
         }
         else
         {
@@ -473,30 +442,12 @@ void NodePrivate::connect(const std::string &pin, NodePrivate *targ, const std::
         // targ need to be Port or Wire
         if (targ->isPort() || targ->isWire())
         {
-            if(pin == _dir2str(Node::Direct::left))
-            {
-                std::string key = _genkey(targ, _dir2str(Node::Direct::right), targ->outputNames.size());
-                this->inputNames.push_back(key);
-                this->inputs[key] = targ;
-
-                key = _genkey(this, _dir2str(Node::Direct::left), inputNames.size());
-                targ->outputNames.push_back(key);
-                targ->outputs[key] = this;
-            }
-            else if(pin == _dir2str(Node::Direct::right))
-            {
-                std::string key = _genkey(targ, _dir2str(Node::Direct::left), targ->inputNames.size());
-                outputNames.push_back(key);
-                outputs[key] = targ;
-                
-                key = _genkey(this, _dir2str(Node::Direct::right), outputNames.size());
-                targ->inputNames.push_back(key);
-                targ->inputs[key] = this;
-            }
+            if (pin == _dir2str(Node::Direct::left))
+                _link(targ, targ->appendOutput(), this, appendInput());
+            else if (pin == _dir2str(Node::Direct::right))
+                _link(this, appendOutput(), targ, targ->appendInput());
             else
-            {
                 std::cerr << "No such pin: " << pin << std::endl;
-            }
         }
         else if (targ->isCell() || targ->isGate())
         {
@@ -514,38 +465,24 @@ void NodePrivate::connectInput(size_t pin, NodePrivate *targ)
     if (targ == this)
         return;
 
-    std::string pinName;
     if (nodeType() == Node::CellNode)
     {
         if (pin >= inputs.size())
         {
-            std::cerr << "Invalid output pin number: " << pin << std::endl;
+            std::cerr << "Invalid input pin number: " << pin << std::endl;
             return;
         }
-        pinName = inputNames[pin];
     }
-    else
+    else if (pin >= inputs.size())
     {
-        std::ostringstream oss;
-        if (pin >= inputs.size())
-        {
-            oss << inputNames.size();
-            inputNames.push_back(oss.str());
-        }
+        if (hasFixedPins())
+            inputs.resize(pin + 1);
         else
-            oss << pin;
-        pinName = oss.str();
+            pin = appendInput();
     }
 
-    // TODO handle reconnect
-
-    std::ostringstream oss;
-    oss << targ->outputNames.size();
-    targ->outputNames.push_back(oss.str());
-    targ->outputs[oss.str()] = this;
-
-    inputs[pinName] = targ;
-    targ->ref.ref();
+    disconnectInput(pin);
+    _link(targ, targ->appendOutput(), this, pin);
 }
 
 void NodePrivate::connectOutput(size_t pin, NodePrivate *targ)
@@ -553,7 +490,6 @@ void NodePrivate::connectOutput(size_t pin, NodePrivate *targ)
     if (targ == this)
         return;
 
-    std::string pinName;
     if (nodeType() == Node::CellNode)
     {
         if (pin >= outputs.size())
@@ -561,30 +497,17 @@ void NodePrivate::connectOutput(size_t pin, NodePrivate *targ)
             std::cerr << "Invalid output pin number: " << pin << std::endl;
             return;
         }
-        pinName = outputNames[pin];
     }
-    else
+    else if (pin >= outputs.size())
     {
-        std::ostringstream oss;
-        if (pin >= outputs.size())
-        {
-            oss << outputNames.size();
-            outputNames.push_back(oss.str());
-        }
+        if (hasFixedPins())
+            outputs.resize(pin + 1);
         else
-            oss << pin;
-        pinName = oss.str();
+            pin = appendOutput();
     }
 
-    // TODO handle reconnect
-
-    std::ostringstream oss;
-    oss << targ->inputNames.size();
-    targ->inputNames.push_back(oss.str());
-    targ->inputs[oss.str()] = this;
-
-    outputs[pinName] = targ;
-    targ->ref.ref();
+    disconnectOutput(pin);
+    _link(this, pin, targ, targ->appendInput());
 }
 
 void NodePrivate::replaceName(ModulePrivate *module, const std::string &name)
@@ -597,12 +520,12 @@ void NodePrivate::replaceName(ModulePrivate *module, const std::string &name)
         module->setWireName((WirePrivate*)this, name);
     else if (this->isPort())
         module->setPortName((PortPrivate*)this, name);
-    this->name = name;
+    setName(name);
 }
 
-void NodePrivate::setName(const std::string &name_)
+void NodePrivate::setName(const std::string &name)
 {
-    name = name_;
+    symbol = symbols().intern(name);
 }
 
 /**************************************************************
@@ -637,8 +560,21 @@ Node& Node::operator=(const Node &n)
     if (n.impl)
         n.impl->ref.ref();
     if (impl && !impl->ref.deref())
-        delete impl;
+        NodePrivate::destroy(impl);
+    impl = n.impl;
+    return *this;
+}
+
+// Moves steal the reference, so no atomic operation is needed
+Node::Node(Node &&n)
+{
     impl = n.impl;
+    n.impl = 0;
+}
+
+Node& Node::operator=(Node &&n)
+{
+    std::swap(impl, n.impl);
     return *this;
 }
 
@@ -655,7 +591,7 @@ bool Node::operator!=(const Node &n) const
 Node::~Node()
 {
     if (impl && !impl->ref.deref())
-        delete impl;
+        NodePrivate::destroy(impl);
 }
 
 bool Node::hasParent() const
@@ -796,7 +732,7 @@ std::string Node::nodeName() const
 {
     if (!impl)
         return std::string();
-    return IMPL->name;
+    return IMPL->nodeName();
 }
 
 /* void Node::replaceName(Module &module, const std::string &name) */
@@ -832,7 +768,7 @@ bool Node::isNull() const
 void Node::clear()
 {
     if (impl && !impl->ref.deref())
-        delete impl;
+        NodePrivate::destroy(impl);
     impl = 0;
 }
 
@@ -906,8 +842,108 @@ void Node::setValue(Signal value)
     IMPL->value = value;
 }
 
+NodeRange Node::fanin() const
+{
+    if (!impl)
+        return NodeRange();
+    return NodeRange(impl->inputs.data(), impl->inputs.size(), sizeof(PinSlot));
+}
+
+NodeRange Node::fanout() const
+{
+    if (!impl)
+        return NodeRange();
+    return NodeRange(impl->outputs.data(), impl->outputs.size(), sizeof(PinSlot));
+}
+
 #undef IMPL
 
+/**************************************************************
+ *
+ * NodeRef
+ *
+ **************************************************************/
+
+std::string NodeRef::name() const
+{
+    if (!impl)
+        return std::string();
+    return impl->nodeName();
+}
+
+Node::NodeType NodeRef::nodeType() const
+{
+    if (!impl)
+        return Node::BaseNode;
+    return impl->nodeType();
+}
+
+size_t NodeRef::inputSize() const
+{
+    if (!impl)
+        return 0;
+    return impl->inputs.size();
+}
+
+size_t NodeRef::outputSize() const
+{
+    if (!impl)
+        return 0;
+    return impl->outputs.size();
+}
+
+NodeRef NodeRef::input(const std::string &name) const
+{
+    if (!impl)
+        return NodeRef();
+    return NodeRef(impl->input(name));
+}
+
+NodeRef NodeRef::output(const std::string &name) const
+{
+    if (!impl)
+        return NodeRef();
+    return NodeRef(impl->output(name));
+}
+
+NodeRef NodeRef::input(size_t i) const
+{
+    if (!impl || i >= impl->inputs.size())
+        return NodeRef();
+    return NodeRef(impl->inputs[i].node);
+}
+
+NodeRef NodeRef::output(size_t i) const
+{
+    if (!impl || i >= impl->outputs.size())
+        return NodeRef();
+    return NodeRef(impl->outputs[i].node);
+}
+
+NodeRange NodeRef::fanin() const
+{
+    if (!impl)
+        return NodeRange();
+    return NodeRange(impl->inputs.data(), impl->inputs.size(), sizeof(PinSlot));
+}
+
+NodeRange NodeRef::fanout() const
+{
+    if (!impl)
+        return NodeRange();
+    return NodeRange(impl->outputs.data(), impl->outputs.size(), sizeof(PinSlot));
+}
+
+Node NodeRef::toNode() const
+{
+    return Node(impl);
+}
+
+CellRef NodeRef::toCell() const
+{
+    return CellRef(*this);
+}
+
 /**************************************************************
  *
  * PortPrivate
@@ -915,9 +951,9 @@ void Node::setValue(Signal value)
  **************************************************************/
 
 PortPrivate::PortPrivate(CircuitPrivate *c, NodePrivate* p, const std::string &name_, Port::PortType type_)
-    : NodePrivate(c, p)
+    : NodePrivate(c, p), typeIndex(0), slotIndex(0)
 {
-    name = name_;
+    setName(name_);
     type = type_;
 }
 
@@ -926,7 +962,7 @@ PortPrivate::~PortPrivate()
 }
 
 PortPrivate::PortPrivate(PortPrivate* n, bool deep)
-    : NodePrivate(n, deep)
+    : NodePrivate(n, deep), typeIndex(0), slotIndex(0)
 {
 }
 
@@ -966,11 +1002,21 @@ Port::Port(const std::string &name, Port::PortType type)
     impl = new PortPrivate(0, 0, name, type);
 }
 
-Port& Port::operator=(const Port& x)
+Port& Port::operator=(const Port &x)
 {
     return (Port&) Node::operator=(x);
 }
 
+Port::Port(Port &&x)
+    : Node(std::move(x))
+{
+}
+
+Port& Port::operator=(Port &&x)
+{
+    return (Port&) Node::operator=(std::move(x));
+}
+
 Port::PortType Port::type() const
 {
     if (!impl)
@@ -989,7 +1035,7 @@ Port::PortType Port::type() const
 WirePrivate::WirePrivate(CircuitPrivate *c, NodePrivate* p, const std::string &name_)
 : NodePrivate(c, p)
 {
-    name = name_;
+    setName(name_);
 }
 
 WirePrivate::WirePrivate(WirePrivate* n, bool deep)
@@ -1035,6 +1081,16 @@ Wire& Wire::operator=(const Wire &x)
     return (Wire&) Node::operator=(x);
 }
 
+Wire::Wire(Wire &&x)
+    : Node(std::move(x))
+{
+}
+
+Wire& Wire::operator=(Wire &&x)
+{
+    return (Wire&) Node::operator=(std::move(x));
+}
+
 
 /**************************************************************
  *
@@ -1045,7 +1101,6 @@ Wire& Wire::operator=(const Wire &x)
 GatePrivate::GatePrivate(GatePrivate* n, bool deep)
     : NodePrivate(n, deep)
 {
-    name = n->name;
     type = n->type;
     level = n->level;
 }
@@ -1053,7 +1108,7 @@ GatePrivate::GatePrivate(GatePrivate* n, bool deep)
 GatePrivate::GatePrivate(CircuitPrivate *c, NodePrivate* p, const std::string &name_, Gate::GateType type_)
     : NodePrivate(c, p), level(0)
 {
-    name = name_;
+    setName(name_);
     type = type_;
 }
 
@@ -1103,6 +1158,16 @@ Gate& Gate::operator=(const Gate &x)
     return (Gate&) Node::operator=(x);
 }
 
+Gate::Gate(Gate &&x)
+    : Node(std::move(x))
+{
+}
+
+Gate& Gate::operator=(Gate &&x)
+{
+    return (Gate&) Node::operator=(std::move(x));
+}
+
 // std::string Gate::name() const
 // {
 //     if (!impl)
@@ -1173,8 +1238,13 @@ void Gate::eval()
         }
         case Gate::XNOR:
         case Gate::XOR:
-            std::cerr << "WARNING: Unimplemented" << std::endl;
+        {
+            Signal out = 0;
+            for (size_t i = 0; i < inputSize(); i++)
+                out ^= input(i).value();
+            setValue(IMPL->gateType() == Gate::XOR ? out : ~out);
             break;
+        }
         case Gate::CustomGate:
         {
             if (!IMPL->func)
@@ -1206,32 +1276,10 @@ std::string Gate::outputWireName() const
 
 /**************************************************************
  *
- * CellPrivate
+ * CellMaster
  *
  **************************************************************/
 
-CellPrivate::CellPrivate(CellPrivate* n, bool deep)
-     : GatePrivate(n, deep)
- {
-     area = n->area;
-     type = n->type;
-     function = n->function;
-     inputCapacitances = n->inputCapacitances;
-     inputCapacitancesRise = n->inputCapacitancesRise;
-     inputCapacitancesFall = n->inputCapacitancesFall;
-     inputCapacitancesRiseMin = n->inputCapacitancesRiseMin;
-     inputCapacitancesFallMin = n->inputCapacitancesFallMin;
-     inputCapacitancesRiseMax = n->inputCapacitancesRiseMax;
-     inputCapacitancesFallMax = n->inputCapacitancesFallMax;
-     outputMaxCapacitance = n->outputMaxCapacitance;
-     outputMaxTransition = n->outputMaxTransition;
-     pinTypes = n->pinTypes;
-     timingSense = n->timingSense;
-     delayTables = n->delayTables;
-     transTables = n->transTables;
-     dirty = 1;
- }
-
 static Gate::GateType toGateType(const std::string &type)
 {
     std::string typeLower(type);
@@ -1256,41 +1304,165 @@ static Gate::GateType toGateType(const std::string &type)
         return Gate::CustomGate;
 }
 
-CellPrivate::CellPrivate(CircuitPrivate *c, NodePrivate* p, const std::string &name_, const std::string &type_)
-    : GatePrivate(c, p, name, toGateType(type_))
+static void copyTimingTable(TimingTable &dst, const TimingTable &src)
 {
-    name = name_;
-    type = type_;
-    area = 0;
+    TimingTable::const_iterator it;
+    for (it = src.begin(); it != src.end(); ++it)
+    {
+        std::map<std::string,std::map<Signal::Transition,LookupTable*> >::const_iterator jt;
+        for (jt = it->second.begin(); jt != it->second.end(); ++jt)
+        {
+            std::map<Signal::Transition,LookupTable*>::const_iterator kt;
+            for (kt = jt->second.begin(); kt != jt->second.end(); ++kt)
+                dst[it->first][jt->first][kt->first] = new LookupTable(*kt->second);
+        }
+    }
 }
 
-CellPrivate::~CellPrivate()
+static void deleteTimingTable(TimingTable &table)
 {
+    TimingTable::iterator it;
+    for (it = table.begin(); it != table.end(); ++it)
+    {
+        std::map<std::string,std::map<Signal::Transition,LookupTable*> >::iterator jt;
+        for (jt = it->second.begin(); jt != it->second.end(); ++jt)
+        {
+            std::map<Signal::Transition,LookupTable*>::iterator kt;
+            for (kt = jt->second.begin(); kt != jt->second.end(); ++kt)
+                delete kt->second;
+        }
+    }
+    table.clear();
 }
 
-NodePrivate* CellPrivate::cloneNode(bool deep)
+CellMaster::CellMaster(const std::string &type_)
+    : ref(1), type(type_), module(0), area(0)
 {
-    NodePrivate *p = new CellPrivate(this, deep);
-    // We are not interested in this node
-    p->ref.deref();
-    return p;
 }
 
-void CellPrivate::addOutputPinName(const std::string &pinName)
+CellMaster::CellMaster(const CellMaster &m)
+    : ref(1),
+      type(m.type),
+      module(m.module),
+      area(m.area),
+      function(m.function),
+      inputNames(m.inputNames),
+      outputNames(m.outputNames),
+      pinTypes(m.pinTypes),
+      inputCapacitances(m.inputCapacitances),
+      inputCapacitancesRise(m.inputCapacitancesRise),
+      inputCapacitancesFall(m.inputCapacitancesFall),
+      inputCapacitancesRiseMin(m.inputCapacitancesRiseMin),
+      inputCapacitancesFallMin(m.inputCapacitancesFallMin),
+      inputCapacitancesRiseMax(m.inputCapacitancesRiseMax),
+      inputCapacitancesFallMax(m.inputCapacitancesFallMax),
+      outputMaxCapacitance(m.outputMaxCapacitance),
+      outputMaxTransition(m.outputMaxTransition),
+      timingSense(m.timingSense)
 {
-    NodePrivate::addOutputPinName(pinName);
-    pinTypes.push_back(Port::Output);
+    copyTimingTable(delayTables, m.delayTables);
+    copyTimingTable(transTables, m.transTables);
+}
+
+CellMaster::~CellMaster()
+{
+    deleteTimingTable(delayTables);
+    deleteTimingTable(transTables);
+}
+
+/**************************************************************
+ *
+ * CellPrivate
+ *
+ **************************************************************/
+
+CellPrivate::CellPrivate(CellPrivate* n, bool deep)
+     : GatePrivate(n, deep)
+ {
+     master = n->master;
+     master->ref.ref();
+     dirty = 1;
+ }
+
+CellPrivate::CellPrivate(CircuitPrivate *c, NodePrivate* p, const std::string &name_, const std::string &type_)
+    : GatePrivate(c, p, name_, toGateType(type_))
+{
+    master = new CellMaster(type_);
+    dirty = 1;
+}
+
+// An instance of an existing master, with one empty slot per pin
+CellPrivate::CellPrivate(CircuitPrivate *c, NodePrivate* p, const std::string &name_, CellMaster *master_)
+    : GatePrivate(c, p, name_, toGateType(master_->type))
+{
+    master = master_;
+    master->ref.ref();
+    inputs.resize(master->inputNames.size());
+    outputs.resize(master->outputNames.size());
+    dirty = 1;
+}
+
+CellPrivate::~CellPrivate()
+{
+    if (!master->ref.deref())
+        delete master;
+}
+
+NodePrivate* CellPrivate::cloneNode(bool deep)
+{
+    NodePrivate *p = new CellPrivate(this, deep);
+    // We are not interested in this node
+    p->ref.deref();
+    return p;
+}
+
+void CellPrivate::detach()
+{
+    if (master->ref.load() == 1)
+        return;
+    CellMaster *m = new CellMaster(*master);
+    if (!master->ref.deref())
+        delete master;
+    master = m;
+}
+
+void CellPrivate::addOutputPinName(const std::string &pinName)
+{
+    detach();
+    NodePrivate::addOutputPinName(pinName);
+    master->outputNames.push_back(pinName);
+    master->pinTypes.push_back(Port::Output);
 }
 
 void CellPrivate::addInputPinName(const std::string &pinName)
 {
+    detach();
     NodePrivate::addInputPinName(pinName);
-    pinTypes.push_back(Port::Input);
+    master->inputNames.push_back(pinName);
+    master->pinTypes.push_back(Port::Input);
+}
+
+int CellPrivate::inputPin(const std::string &name) const
+{
+    const std::vector<std::string> &names = master->inputNames;
+    for (size_t i = 0; i < names.size(); i++)
+        if (names[i] == name)
+            return (int) i;
+    return -1;
+}
+
+int CellPrivate::outputPin(const std::string &name) const
+{
+    const std::vector<std::string> &names = master->outputNames;
+    for (size_t i = 0; i < names.size(); i++)
+        if (names[i] == name)
+            return (int) i;
+    return -1;
 }
 
 Port::PortType CellPrivate::pinType(size_t i) const
 {
-    return pinTypes[i];
+    return master->pinTypes[i];
 }
 
 void CellPrivate::outputCapacitanceMax()
@@ -1309,24 +1481,27 @@ void CellPrivate::outputCapacitanceMax()
     size_t fanoutSize = outputs.size();
     cacheOutputCapacitanceRiseMax = 0.0;
     cacheOutputCapacitanceFallMax = 0.0;
-    std::map<std::string,NodePrivate*>::const_iterator it;
-    for (it = outputs.begin(); it != outputs.end(); ++it)
+    for (size_t i = 0; i < outputs.size(); i++)
     {
-        NodePrivate *node = it->second;
+        NodePrivate *node = outputs[i].node;
+        if (!node)
+            continue;
         if (node->isWire())
         {
             fanoutSize = node->outputs.size();
-            std::map<std::string,NodePrivate*>::const_iterator jt;
-            for (jt = node->outputs.begin(); jt != node->outputs.end(); ++jt)
+            for (size_t j = 0; j < node->outputs.size(); j++)
             {
-                NodePrivate *wireOutput = jt->second;
+                const PinSlot &s = node->outputs[j];
+                NodePrivate *wireOutput = s.node;
+                if (!wireOutput)
+                    continue;
                 if (wireOutput->isCell())
                 {
                     CellPrivate *outputCell = (CellPrivate*) wireOutput;
-                    std::map<std::string,NodePrivate*>::const_iterator kt;
-                    std::string pin = _getPinfromKey(outputCell, jt->first);
-                    cacheOutputCapacitanceRiseMax += outputCell->inputCapacitancesRiseMax.at(pin);
-                    cacheOutputCapacitanceFallMax += outputCell->inputCapacitancesFallMax.at(pin);
+                    // Input slots of a cell follow its master's pin list
+                    const std::string &pin = outputCell->master->inputNames.at(s.pin);
+                    cacheOutputCapacitanceRiseMax += outputCell->master->inputCapacitancesRiseMax.at(pin);
+                    cacheOutputCapacitanceFallMax += outputCell->master->inputCapacitancesFallMax.at(pin);
                 }
                 else if (wireOutput->isPort())
                 {
@@ -1384,17 +1559,12 @@ double CellPrivate::outputCapacitanceFallMax()
 
 void CellPrivate::breakOutputConnection(const std::string &pinName)
 {
-    if (this->hasOutput(pinName))
-    {
-        NodePrivate* nextNode = this->output(pinName);
-        if (nextNode->isWire() || nextNode->isPort())
-        {
-            this->outputs.erase(pinName);
-            this->outputs[pinName] = 0;
-            nextNode->inputs.erase(_genkey(this, pinName));
-            nextNode->inputNames.erase(std::remove(nextNode->inputNames.begin(), nextNode->inputNames.end(), _genkey(this, pinName)), nextNode->inputNames.end());
-        }
-    }
+    int pin = outputPin(pinName);
+    if (pin < 0)
+        return;
+    NodePrivate* nextNode = outputs[pin].node;
+    if (nextNode && (nextNode->isWire() || nextNode->isPort()))
+        disconnectOutput(pin);
 }
 
 /**************************************************************
@@ -1405,6 +1575,14 @@ void CellPrivate::breakOutputConnection(const std::string &pinName)
 
 #define IMPL ((CellPrivate*)impl)
 
+static double pinValue(const std::map<std::string,double> &values, const std::string &pinName)
+{
+    std::map<std::string,double>::const_iterator it = values.find(pinName);
+    if (it == values.end())
+        return 0;
+    return it->second;
+}
+
 /*!
     Contructs an empty cell.
 */
@@ -1438,6 +1616,16 @@ Cell& Cell::operator=(const Cell &x)
     return (Cell&) Gate::operator=(x);
 }
 
+Cell::Cell(Cell &&x)
+    : Gate(std::move(x))
+{
+}
+
+Cell& Cell::operator=(Cell &&x)
+{
+    return (Cell&) Gate::operator=(std::move(x));
+}
+
 void Cell::setName(const std::string &name)
 {
     if (!impl)
@@ -1447,9 +1635,7 @@ void Cell::setName(const std::string &name)
 
 std::string Cell::type() const
 {
-    if (!impl)
-        return std::string();
-    return IMPL->cellType();
+    return CellRef(*this).type();
 }
 
 void Cell::addInputPinName(const std::string &pinName)
@@ -1468,244 +1654,202 @@ void Cell::addOutputPinName(const std::string &pinName)
 
 std::string Cell::inputPinName(size_t i)
 {
-    if (!impl)
-        return std::string();
-    return impl->inputNames[i];
+    return CellRef(*this).inputPinName(i);
 }
 
 std::string Cell::outputPinName(size_t i)
 {
-    if (!impl)
-        return std::string();
-    return impl->outputNames[i];
+    return CellRef(*this).outputPinName(i);
 }
 
 Port::PortType Cell::pinType(size_t i) const
+{
+    return CellRef(*this).pinType(i);
+}
+
+Module Cell::definition() const
 {
     if (!impl)
-        return Port::BasePort;
-    return IMPL->pinType(i);
+        return Module();
+    return Module(IMPL->master->module);
 }
 
 void Cell::setArea(double area)
 {
     if (!impl)
         return;
-    IMPL->area = area;
+    IMPL->detach();
+    IMPL->master->area = area;
 }
 
 void Cell::setFunction(const std::string &func)
 {
     if (!impl)
         return;
-    IMPL->function = func;
+    IMPL->detach();
+    IMPL->master->function = func;
 }
 
 std::string Cell::function() const
 {
-    if (!impl)
-        return std::string();
-    return IMPL->function;
+    return CellRef(*this).function();
 }
 
 double Cell::area() const
 {
-    if (!impl)
-        return 0;
-    return IMPL->area;
+    return CellRef(*this).area();
 }
 
 double Cell::inputCapacitance(size_t i) const
 {
-    if (!impl)
-        return 0;
-    return IMPL->inputCapacitances[impl->inputNames[i]];
+    return CellRef(*this).inputCapacitance(i);
 }
 
 double Cell::inputCapacitance(const std::string &pinName) const
 {
-    if (!impl)
-        return 0;
-    if (IMPL->inputCapacitances.find(pinName) == IMPL->inputCapacitances.end())
-        return 0;
-    return IMPL->inputCapacitances[pinName];
+    return CellRef(*this).inputCapacitance(pinName);
 }
 
 double Cell::inputCapacitanceRise(size_t i) const
 {
-    if (!impl)
-        return 0;
-    return IMPL->inputCapacitancesRise[impl->inputNames[i]];
+    return CellRef(*this).inputCapacitanceRise(i);
 }
 
 double Cell::inputCapacitanceRise(const std::string &pinName) const
 {
-    if (!impl)
-        return 0;
-    if (IMPL->inputCapacitancesRise.find(pinName) == IMPL->inputCapacitancesRise.end())
-        return 0;
-    return IMPL->inputCapacitancesRise[pinName];
+    return CellRef(*this).inputCapacitanceRise(pinName);
 }
 
 double Cell::inputCapacitanceFall(size_t i) const
 {
-    if (!impl)
-        return 0;
-    return IMPL->inputCapacitancesFall[impl->inputNames[i]];
+    return CellRef(*this).inputCapacitanceFall(i);
 }
 
 double Cell::inputCapacitanceFall(const std::string &pinName) const
 {
-    if (!impl)
-        return 0;
-    if (IMPL->inputCapacitancesFall.find(pinName) == IMPL->inputCapacitancesFall.end())
-        return 0;
-    return IMPL->inputCapacitancesFall[pinName];
+    return CellRef(*this).inputCapacitanceFall(pinName);
 }
 
 double Cell::inputCapacitanceRiseMin(size_t i) const
 {
-    if (!impl)
-        return 0;
-    return IMPL->inputCapacitancesRiseMin[impl->inputNames[i]];
+    return CellRef(*this).inputCapacitanceRiseMin(i);
 }
 
 double Cell::inputCapacitanceRiseMin(const std::string &pinName) const
 {
-    if (!impl)
-        return 0;
-    if (IMPL->inputCapacitancesRiseMin.find(pinName) == IMPL->inputCapacitancesRiseMin.end())
-        return 0;
-    return IMPL->inputCapacitancesRiseMin[pinName];
+    return CellRef(*this).inputCapacitanceRiseMin(pinName);
 }
 
 double Cell::inputCapacitanceFallMin(size_t i) const
 {
-    if (!impl)
-        return 0;
-    return IMPL->inputCapacitancesFallMin[impl->inputNames[i]];
+    return CellRef(*this).inputCapacitanceFallMin(i);
 }
 
 double Cell::inputCapacitanceFallMin(const std::string &pinName) const
 {
-    if (!impl)
-        return 0;
-    if (IMPL->inputCapacitancesFallMin.find(pinName) == IMPL->inputCapacitancesFallMin.end())
-        return 0;
-    return IMPL->inputCapacitancesFallMin[pinName];
+    return CellRef(*this).inputCapacitanceFallMin(pinName);
 }
 
 double Cell::inputCapacitanceRiseMax(size_t i) const
 {
-    if (!impl)
-        return 0;
-    return IMPL->inputCapacitancesRiseMax[impl->inputNames[i]];
+    return CellRef(*this).inputCapacitanceRiseMax(i);
 }
 
 double Cell::inputCapacitanceRiseMax(const std::string &pinName) const
 {
-    if (!impl)
-        return 0;
-    if (IMPL->inputCapacitancesRiseMax.find(pinName) == IMPL->inputCapacitancesRiseMax.end())
-        return 0;
-    return IMPL->inputCapacitancesRiseMax[pinName];
+    return CellRef(*this).inputCapacitanceRiseMax(pinName);
 }
 
 double Cell::inputCapacitanceFallMax(size_t i) const
 {
-    if (!impl)
-        return 0;
-    return IMPL->inputCapacitancesFallMax[impl->inputNames[i]];
+    return CellRef(*this).inputCapacitanceFallMax(i);
 }
 
 double Cell::inputCapacitanceFallMax(const std::string &pinName) const
 {
-    if (!impl)
-        return 0;
-    if (IMPL->inputCapacitancesFallMax.find(pinName) == IMPL->inputCapacitancesFallMax.end())
-        return 0;
-    return IMPL->inputCapacitancesFallMax[pinName];
+    return CellRef(*this).inputCapacitanceFallMax(pinName);
 }
 
 double Cell::outputMaxCapacitance(const std::string &pinName) const
 {
-    if (!impl)
-        return 0;
-    if (IMPL->outputMaxCapacitance.find(pinName) == IMPL->outputMaxCapacitance.end())
-        return 0;
-    return IMPL->outputMaxCapacitance[pinName];
+    return CellRef(*this).outputMaxCapacitance(pinName);
 }
 
 double Cell::outputMaxTransition(const std::string &pinName) const
 {
-    if (!impl)
-        return 0;
-    if (IMPL->outputMaxTransition.find(pinName) == IMPL->outputMaxTransition.end())
-        return 0;
-    return IMPL->outputMaxTransition[pinName];
+    return CellRef(*this).outputMaxTransition(pinName);
 }
 
 void Cell::setInputCapacitance(const std::string &pinName, double cap)
 {
     if (!impl)
         return;
-    IMPL->inputCapacitances[pinName] = cap;
+    IMPL->detach();
+    IMPL->master->inputCapacitances[pinName] = cap;
 }
 
 void Cell::setInputCapacitanceRise(const std::string &pinName, double cap)
 {
     if (!impl)
         return;
-    IMPL->inputCapacitancesRise[pinName] = cap;
+    IMPL->detach();
+    IMPL->master->inputCapacitancesRise[pinName] = cap;
 }
 
 void Cell::setInputCapacitanceFall(const std::string &pinName, double cap)
 {
     if (!impl)
         return;
-    IMPL->inputCapacitancesFall[pinName] = cap;
+    IMPL->detach();
+    IMPL->master->inputCapacitancesFall[pinName] = cap;
 }
 
 void Cell::setInputCapacitanceRiseMin(const std::string &pinName, double cap)
 {
     if (!impl)
         return;
-    IMPL->inputCapacitancesRiseMin[pinName] = cap;
+    IMPL->detach();
+    IMPL->master->inputCapacitancesRiseMin[pinName] = cap;
 }
 
 void Cell::setInputCapacitanceFallMin(const std::string &pinName, double cap)
 {
     if (!impl)
         return;
-    IMPL->inputCapacitancesFallMin[pinName] = cap;
+    IMPL->detach();
+    IMPL->master->inputCapacitancesFallMin[pinName] = cap;
 }
 
 void Cell::setInputCapacitanceRiseMax(const std::string &pinName, double cap)
 {
     if (!impl)
         return;
-    IMPL->inputCapacitancesRiseMax[pinName] = cap;
+    IMPL->detach();
+    IMPL->master->inputCapacitancesRiseMax[pinName] = cap;
 }
 
 void Cell::setInputCapacitanceFallMax(const std::string &pinName, double cap)
 {
     if (!impl)
         return;
-    IMPL->inputCapacitancesFallMax[pinName] = cap;
+    IMPL->detach();
+    IMPL->master->inputCapacitancesFallMax[pinName] = cap;
 }
 
 void Cell::setOutputMaxCapacitance(const std::string &pinName, double cap)
 {
     if (!impl)
         return;
-    IMPL->outputMaxCapacitance[pinName] = cap;
+    IMPL->detach();
+    IMPL->master->outputMaxCapacitance[pinName] = cap;
 }
 
 void Cell::setOutputMaxTransition(const std::string &pinName, double tran)
 {
     if (!impl)
         return;
-    IMPL->outputMaxTransition[pinName] = tran;
+    IMPL->detach();
+    IMPL->master->outputMaxTransition[pinName] = tran;
 }
 
 void Cell::breakOutputConnection(const std::string &pinName)
@@ -1752,750 +1896,1321 @@ void Cell::addTimingTable(const std::string &type_,
     if (!impl)
         return;
 
+    IMPL->detach();
+    CellMaster *master = IMPL->master;
     if (timingSense == "negative_unate")
-        IMPL->timingSense[pin][relatedPin] = NegativeUnate;
+        master->timingSense[pin][relatedPin] = NegativeUnate;
     else if (timingSense == "positive_unate")
-        IMPL->timingSense[pin][relatedPin] = PositiveUnate;
+        master->timingSense[pin][relatedPin] = PositiveUnate;
     else if (timingSense == "non_unate")
-        IMPL->timingSense[pin][relatedPin] = NonUnate;
+        master->timingSense[pin][relatedPin] = NonUnate;
 
+    TimingTable *tables = 0;
     if (type_ == "delay")
-        IMPL->delayTables[pin][relatedPin][transition] = new interpolate::interp2d(x, y, table);
+        tables = &master->delayTables;
     else if (type_ == "trans")
-        IMPL->transTables[pin][relatedPin][transition] = new interpolate::interp2d(x, y, table);
+        tables = &master->transTables;
     else
+    {
         std::cerr << "Weird things happened on Cell::addTimingTable()" << std::endl;
+        return;
+    }
+    LookupTable *&t = (*tables)[pin][relatedPin][transition];
+    delete t;
+    t = new LookupTable(x, y, table);
+}
+
+static const LookupTable* findLookupTable(const TimingTable &tables, const std::string &pinIn, const std::string &pinOut, Signal::Transition trans)
+{
+    TimingTable::const_iterator it = tables.find(pinOut);
+    if (it == tables.end())
+        return 0;
+    std::map<std::string,std::map<Signal::Transition,LookupTable*> >::const_iterator jt = it->second.find(pinIn);
+    if (jt == it->second.end())
+        return 0;
+    std::map<Signal::Transition,LookupTable*>::const_iterator kt = jt->second.find(trans);
+    if (kt == jt->second.end())
+        return 0;
+    return kt->second;
+}
+
+static TimingSense findTimingSense(const CellMaster *master, const std::string &pinIn, const std::string &pinOut)
+{
+    std::map<std::string,std::map<std::string,TimingSense> >::const_iterator it = master->timingSense.find(pinOut);
+    if (it == master->timingSense.end())
+        return TimingSense::NonUnate;
+    std::map<std::string,TimingSense>::const_iterator jt = it->second.find(pinIn);
+    if (jt == it->second.end())
+        return TimingSense::NonUnate;
+    return jt->second;
 }
 
 double Cell::delay(const std::string &pinIn, const std::string &pinOut, Signal::Transition trans, double inputSlew, double outputLoad) const
 {
-    if (!impl)
-        return 0.0;
-    if ((IMPL->delayTables.find(pinOut) == IMPL->delayTables.end()) ||
-        (IMPL->delayTables[pinOut].find(pinIn) == IMPL->delayTables[pinOut].end()) ||
-        (IMPL->delayTables[pinOut][pinIn].find(trans) == IMPL->delayTables[pinOut][pinIn].end()))
-        return 0.0;
-    if (IMPL->timingSense[pinOut][pinIn] == NegativeUnate)
-        trans = (trans == Signal::Rise ? Signal::Fall : Signal::Rise);
-    return (*(IMPL->delayTables[pinOut][pinIn][trans]))(outputLoad, inputSlew);
+    return CellRef(*this).delay(pinIn, pinOut, trans, inputSlew, outputLoad);
 }
 
 double Cell::slew(const std::string &pinIn, const std::string &pinOut, Signal::Transition trans, double inputSlew, double outputLoad) const
 {
-    if (!impl)
-        return 0.0;
-    if ((IMPL->transTables.find(pinOut) == IMPL->transTables.end()) ||
-        (IMPL->transTables[pinOut].find(pinIn) == IMPL->transTables[pinOut].end()) ||
-        (IMPL->transTables[pinOut][pinIn].find(trans) == IMPL->transTables[pinOut][pinIn].end()))
-        return 0.0;
-    if (IMPL->timingSense[pinOut][pinIn] == NegativeUnate)
-        trans = (trans == Signal::Rise ? Signal::Fall : Signal::Rise);
-    return (*(IMPL->transTables[pinOut][pinIn][trans]))(outputLoad, inputSlew);
+    return CellRef(*this).slew(pinIn, pinOut, trans, inputSlew, outputLoad);
 }
 
 double Cell::loadingMax(const std::string &pinIn, const std::string &pinOut, Signal::Transition trans)
 {
-    if (!impl)
-        return 0.0;
-
-    if (timingSense(pinIn, pinOut) == NegativeUnate)
-        trans = (trans == Signal::Rise ? Signal::Fall : Signal::Rise);
-
-    if (trans == Signal::Rise)
-        return IMPL->outputCapacitanceRiseMax();
-    else if (trans == Signal::Fall)
-        return IMPL->outputCapacitanceFallMax();
-    else
-        return 0.0;
+    return CellRef(*this).loadingMax(pinIn, pinOut, trans);
 }
 
 TimingSense Cell::timingSense(const std::string &pinIn, const std::string &pinOut)
 {
-    if (!impl)
-        return TimingSense::NonUnate;
-    if (IMPL->timingSense.find(pinOut) == IMPL->timingSense.end() ||
-        IMPL->timingSense[pinOut].find(pinIn) == IMPL->timingSense[pinOut].end())
-        return TimingSense::NonUnate;
-    return IMPL->timingSense[pinOut][pinIn];
+    return CellRef(*this).timingSense(pinIn, pinOut);
 }
 
-#undef IMPL
-
 /**************************************************************
  *
- * ModulePrivate
+ * CellRef
  *
  **************************************************************/
 
-ModulePrivate::ModulePrivate(CircuitPrivate* c, NodePrivate* p, const std::string &name_)
-    : NodePrivate(c, p)
+CellRef::CellRef(const NodeRef &node)
+    : NodeRef(node.nodeType() == Node::CellNode ? node : NodeRef())
 {
-    name = name_;
 }
 
-ModulePrivate::ModulePrivate(ModulePrivate* n, bool deep)
-    : NodePrivate(n, deep)
+int CellRef::level() const
 {
-    // Bad implementation
-    // move to NodePrivate is quite correct on performance.
-    wires = n->wires;
+    if (!impl)
+        return 0;
+    return IMPL->level;
 }
 
-template <class T>
-static void deleteNameMap(std::map<std::string,T*> &nm)
+Gate::GateType CellRef::gateType() const
 {
-    typename std::map<std::string,T*>::iterator it;
-    for (it = nm.begin(); it != nm.end(); ++it)
-    {
-        if (it->second && !it->second->ref.deref())
-            delete it->second;
-    }
+    if (!impl)
+        return Gate::BaseGate;
+    return IMPL->gateType();
 }
 
-ModulePrivate::~ModulePrivate()
+std::string CellRef::type() const
 {
-    // Don't delete PIs, POs, PPIs and PPOs
-    deleteNameMap(ports);
-    deleteNameMap(wires);
-    deleteNameMap(cells);
-    deleteNameMap(gates);
+    if (!impl)
+        return std::string();
+    return IMPL->cellType();
 }
 
-size_t ModulePrivate::gateCount() const
+std::string CellRef::inputPinName(size_t i) const
 {
-    if (!gates.empty() && !cells.empty())
-    {
-        std::cerr << "Bad circuit" << std::endl;
-        return 0;
-    }
-    else if (!gates.empty())
-        return gates.size();
-    else if (!cells.empty())
-        return cells.size();
-    else
-        return 0;
+    if (!impl)
+        return std::string();
+    return IMPL->master->inputNames[i];
 }
 
-bool ModulePrivate::hasPort(const std::string &name) const
+std::string CellRef::outputPinName(size_t i) const
 {
-    return (ports.find(name) != ports.end());
+    if (!impl)
+        return std::string();
+    return IMPL->master->outputNames[i];
 }
 
-bool ModulePrivate::hasWire(const std::string &name) const
+Port::PortType CellRef::pinType(size_t i) const
 {
-    return (wires.find(name) != wires.end());
+    if (!impl)
+        return Port::BasePort;
+    return IMPL->pinType(i);
 }
 
-bool ModulePrivate::hasGate(const std::string &name) const
+std::string CellRef::function() const
 {
-    return (gates.find(name) != gates.end());
+    if (!impl)
+        return std::string();
+    return IMPL->master->function;
 }
 
-bool ModulePrivate::hasCell(const std::string &name) const
+double CellRef::area() const
 {
-    return (cells.find(name) != cells.end());
+    if (!impl)
+        return 0;
+    return IMPL->master->area;
 }
 
-PortPrivate* ModulePrivate::PI(size_t i)
+double CellRef::inputCapacitance(size_t i) const
 {
-    return PIs[PINames[i]];
+    if (!impl)
+        return 0;
+    return pinValue(IMPL->master->inputCapacitances, IMPL->master->inputNames[i]);
 }
 
-PortPrivate* ModulePrivate::PO(size_t i)
+double CellRef::inputCapacitance(const std::string &pinName) const
 {
-    return POs[PONames[i]];
+    if (!impl)
+        return 0;
+    return pinValue(IMPL->master->inputCapacitances, pinName);
 }
 
-PortPrivate* ModulePrivate::PPI(size_t i)
+double CellRef::inputCapacitanceRise(size_t i) const
 {
-    return PPIs[PPINames[i]];
+    if (!impl)
+        return 0;
+    return pinValue(IMPL->master->inputCapacitancesRise, IMPL->master->inputNames[i]);
 }
 
-PortPrivate* ModulePrivate::PPO(size_t i)
+double CellRef::inputCapacitanceRise(const std::string &pinName) const
 {
-    return PPOs[PPONames[i]];
+    if (!impl)
+        return 0;
+    return pinValue(IMPL->master->inputCapacitancesRise, pinName);
 }
 
-PortPrivate* ModulePrivate::port(size_t i)
+double CellRef::inputCapacitanceFall(size_t i) const
 {
-    return ports[portNames[i]];
+    if (!impl)
+        return 0;
+    return pinValue(IMPL->master->inputCapacitancesFall, IMPL->master->inputNames[i]);
 }
 
-WirePrivate* ModulePrivate::wire(size_t i)
+double CellRef::inputCapacitanceFall(const std::string &pinName) const
 {
-    return wires[wireNames[i]];
+    if (!impl)
+        return 0;
+    return pinValue(IMPL->master->inputCapacitancesFall, pinName);
 }
 
-GatePrivate* ModulePrivate::gate(size_t i)
+double CellRef::inputCapacitanceRiseMin(size_t i) const
 {
-    return gates[gateNames[i]];
+    if (!impl)
+        return 0;
+    return pinValue(IMPL->master->inputCapacitancesRiseMin, IMPL->master->inputNames[i]);
 }
 
-CellPrivate* ModulePrivate::cell(size_t i)
+double CellRef::inputCapacitanceRiseMin(const std::string &pinName) const
 {
-    return cells[cellNames[i]];
+    if (!impl)
+        return 0;
+    return pinValue(IMPL->master->inputCapacitancesRiseMin, pinName);
 }
 
-PortPrivate* ModulePrivate::port(const std::string &portName)
+double CellRef::inputCapacitanceFallMin(size_t i) const
 {
-    if (ports.find(portName) == ports.end())
+    if (!impl)
         return 0;
-    return ports[portName];
+    return pinValue(IMPL->master->inputCapacitancesFallMin, IMPL->master->inputNames[i]);
 }
 
-WirePrivate* ModulePrivate::wire(const std::string &wireName)
+double CellRef::inputCapacitanceFallMin(const std::string &pinName) const
 {
-    if (wires.find(wireName) == wires.end())
+    if (!impl)
         return 0;
-    return wires[wireName];
+    return pinValue(IMPL->master->inputCapacitancesFallMin, pinName);
 }
 
-GatePrivate* ModulePrivate::gate(const std::string &gateName)
+double CellRef::inputCapacitanceRiseMax(size_t i) const
 {
-    if (gates.find(gateName) == gates.end())
+    if (!impl)
         return 0;
-    return gates[gateName];
+    return pinValue(IMPL->master->inputCapacitancesRiseMax, IMPL->master->inputNames[i]);
 }
 
-CellPrivate* ModulePrivate::cell(const std::string &cellName)
+double CellRef::inputCapacitanceRiseMax(const std::string &pinName) const
 {
-    if (cells.find(cellName) == cells.end())
+    if (!impl)
         return 0;
-    return cells[cellName];
+    return pinValue(IMPL->master->inputCapacitancesRiseMax, pinName);
 }
 
-void ModulePrivate::addCell(CellPrivate *cell)
+double CellRef::inputCapacitanceFallMax(size_t i) const
 {
-    if (cells.find(cell->name) != cells.end())
-        std::cerr << "WARNING: Duplicate add the same cell instance" << std::endl;
-    cell->setParent(this);
-    cell->ref.ref();
-    cellNames.push_back(cell->name);
-    cells[cell->name] = cell;
+    if (!impl)
+        return 0;
+    return pinValue(IMPL->master->inputCapacitancesFallMax, IMPL->master->inputNames[i]);
 }
 
-WirePrivate* ModulePrivate::createWire(const std::string &wireName)
+double CellRef::inputCapacitanceFallMax(const std::string &pinName) const
 {
-    // Duplicate creating wire
-    if (wires.find(wireName) != wires.end())
-        std::cerr << "WARNING: Duplicate create wire: " << wireName << std::endl;
-    WirePrivate *w = new WirePrivate((CircuitPrivate*)this->ownerNode, this, wireName);
-    // w->ref.deref();
-    wireNames.push_back(wireName);
-    wires[wireName] = w;
-    return w;
+    if (!impl)
+        return 0;
+    return pinValue(IMPL->master->inputCapacitancesFallMax, pinName);
 }
 
-PortPrivate* ModulePrivate::createPort(const std::string &portName, Port::PortType type)
+double CellRef::outputMaxCapacitance(const std::string &pinName) const
 {
-    if (ports.find(portName) != ports.end())
-        std::cerr << "WARNING: Duplicate create port: " << portName << std::endl;
-    PortPrivate *p = new PortPrivate((CircuitPrivate*)this->ownerNode, this, portName, type);
-    switch (type)
-    {
-        case Port::Input:  addInput(p);  PIs[portName] = p;  PINames.push_back(portName);  break;
-        case Port::Output: addOutput(p); POs[portName] = p;  PONames.push_back(portName);  break;
-        case Port::PPI:    addInput(p);  PPIs[portName] = p; PPINames.push_back(portName); break;
-        case Port::PPO:    addOutput(p); PPOs[portName] = p; PPONames.push_back(portName); break;
-        default:
-            return 0;
-    }
-    portNames.push_back(portName);
-    ports[portName] = p;
-    return p;
+    if (!impl)
+        return 0;
+    return pinValue(IMPL->master->outputMaxCapacitance, pinName);
+}
+
+double CellRef::outputMaxTransition(const std::string &pinName) const
+{
+    if (!impl)
+        return 0;
+    return pinValue(IMPL->master->outputMaxTransition, pinName);
+}
+
+double CellRef::delay(const std::string &pinIn, const std::string &pinOut, Signal::Transition trans, double inputSlew, double outputLoad) const
+{
+    if (!impl)
+        return 0.0;
+    if (findTimingSense(IMPL->master, pinIn, pinOut) == NegativeUnate)
+        trans = (trans == Signal::Rise ? Signal::Fall : Signal::Rise);
+    const LookupTable *table = findLookupTable(IMPL->master->delayTables, pinIn, pinOut, trans);
+    if (!table)
+        return 0.0;
+    return (*table)(outputLoad, inputSlew);
+}
+
+double CellRef::slew(const std::string &pinIn, const std::string &pinOut, Signal::Transition trans, double inputSlew, double outputLoad) const
+{
+    if (!impl)
+        return 0.0;
+    if (findTimingSense(IMPL->master, pinIn, pinOut) == NegativeUnate)
+        trans = (trans == Signal::Rise ? Signal::Fall : Signal::Rise);
+    const LookupTable *table = findLookupTable(IMPL->master->transTables, pinIn, pinOut, trans);
+    if (!table)
+        return 0.0;
+    return (*table)(outputLoad, inputSlew);
+}
+
+double CellRef::loadingMax(const std::string &pinIn, const std::string &pinOut, Signal::Transition trans) const
+{
+    if (!impl)
+        return 0.0;
+
+    if (timingSense(pinIn, pinOut) == NegativeUnate)
+        trans = (trans == Signal::Rise ? Signal::Fall : Signal::Rise);
+
+    if (trans == Signal::Rise)
+        return IMPL->outputCapacitanceRiseMax();
+    else if (trans == Signal::Fall)
+        return IMPL->outputCapacitanceFallMax();
+    else
+        return 0.0;
+}
+
+TimingSense CellRef::timingSense(const std::string &pinIn, const std::string &pinOut) const
+{
+    if (!impl)
+        return TimingSense::NonUnate;
+    return findTimingSense(IMPL->master, pinIn, pinOut);
+}
+
+#undef IMPL
+
+/**************************************************************
+ *
+ * ModulePrivate
+ *
+ **************************************************************/
+
+// Modules share the symbol table of their circuit
+ModulePrivate::ModulePrivate(CircuitPrivate* c, NodePrivate* p, const std::string &name_)
+    : NodePrivate(c, p), symbolTable(c ? c->symbolTable : new SymbolTable),
+      master(0), editDepth(0), leveled(false)
+{
+    if (c)
+        symbolTable->ref.ref();
+    setName(name_);
+}
+
+ModulePrivate::ModulePrivate(ModulePrivate* n, bool deep)
+    : NodePrivate(n, deep), symbolTable(n->symbolTable),
+      master(0), editDepth(0), leveled(n->leveled)
+{
+    symbolTable->ref.ref();
+    // Bad implementation
+    // move to NodePrivate is quite correct on performance.
+    wires = n->wires;
+}
+
+// Wire, gate and cell lists are unordered: removal moves the last node
+// into the hole. Ports keep their declaration order, a removed port leaves
+// a null entry until ModulePrivate::compact().
+static void appendNode(std::vector<NodePrivate*> &list, NodePrivate *node)
+{
+    node->index = (unsigned) list.size();
+    list.push_back(node);
+}
+
+static void eraseNode(std::vector<NodePrivate*> &list, NodePrivate *node)
+{
+    NodePrivate *last = list.back();
+    list[node->index] = last;
+    last->index = node->index;
+    list.pop_back();
+}
+
+// Nodes still referenced from outside move to the shared symbol table
+template <class T>
+static void deleteNode(T *node, NodePrivate *owner)
+{
+    if (!node)
+        return;
+    if (!node->ref.deref())
+        NodePrivate::destroy(node);
+    else if (node->ownerNode == owner)
+        node->orphan();
+}
+
+template <class K, class T>
+static void deleteNameMap(std::map<K,T*> &nm, NodePrivate *owner)
+{
+    typename std::map<K,T*>::iterator it;
+    for (it = nm.begin(); it != nm.end(); ++it)
+        deleteNode(it->second, owner);
+}
+
+// A node that outlives its neighbours forgets the connections to them.
+// Ports and wires close the gaps in their connection lists.
+static bool dropDeadSlots(std::vector<PinSlot> &slots, bool fixedPins, bool input)
+{
+    bool dropped = false;
+    size_t n = 0;
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        PinSlot s = slots[i];
+        if (s.node && !s.node->ref.load())
+        {
+            dropped = true;
+            if (fixedPins)
+                slots[n++] = PinSlot();
+            continue;
+        }
+        if (s.node && s.pin != PinSlot::NoPin)
+            (input ? s.node->outputs : s.node->inputs)[s.pin].pin = (unsigned) n;
+        slots[n++] = s;
+    }
+    slots.resize(n);
+    return dropped;
+}
+
+// Tears down all nodes at once. Dead nodes are not unlinked one by one,
+// which would renumber the slots of every neighbour, and their arena
+// slots go back with one call per arena.
+void ModulePrivate::releaseNodes()
+{
+    std::vector<NodePrivate*> *lists[] = { &portList, &wireList, &cellList, &gateList, &instanceList };
+    std::vector<NodePrivate*> dead, kept;
+    for (size_t k = 0; k < sizeof(lists) / sizeof(lists[0]); k++)
+    {
+        std::vector<NodePrivate*> &list = *lists[k];
+        for (size_t i = 0; i < list.size(); i++)
+        {
+            NodePrivate *node = list[i];
+            if (!node)
+                continue;
+            if (!node->ref.deref())
+                dead.push_back(node);
+            else
+                kept.push_back(node);
+        }
+        list.clear();
+    }
+
+    // Nodes still referenced from outside move to the shared symbol table
+    for (size_t i = 0; i < kept.size(); i++)
+        if (kept[i]->ownerNode == this)
+            kept[i]->orphan();
+
+    std::vector<NodePrivate*> peers;
+    for (size_t i = 0; i < dead.size(); i++)
+    {
+        const NodePrivate *node = dead[i];
+        for (size_t j = 0; j < node->inputs.size(); j++)
+            if (node->inputs[j].node && node->inputs[j].pin != PinSlot::NoPin && node->inputs[j].node->ref.load())
+                peers.push_back(node->inputs[j].node);
+        for (size_t j = 0; j < node->outputs.size(); j++)
+            if (node->outputs[j].node && node->outputs[j].pin != PinSlot::NoPin && node->outputs[j].node->ref.load())
+                peers.push_back(node->outputs[j].node);
+    }
+    std::sort(peers.begin(), peers.end());
+    peers.erase(std::unique(peers.begin(), peers.end()), peers.end());
+    for (size_t i = 0; i < peers.size(); i++)
+    {
+        NodePrivate *node = peers[i];
+        bool dropped = dropDeadSlots(node->inputs, node->hasFixedPins(), true);
+        if (dropDeadSlots(node->outputs, node->hasFixedPins(), false) || dropped)
+            node->connectionChanged();
+    }
+
+    std::vector<std::pair<NodeArena*,std::vector<void*> > > freed;
+    for (size_t i = 0; i < dead.size(); i++)
+    {
+        NodePrivate *node = dead[i];
+        node->inputs.clear();
+        node->outputs.clear();
+        NodeArena *arena = node->arena;
+        if (!arena)
+        {
+            delete node;
+            continue;
+        }
+        size_t k = 0;
+        while (k < freed.size() && freed[k].first != arena)
+            k++;
+        if (k == freed.size())
+            freed.push_back(std::make_pair(arena, std::vector<void*>()));
+        void *p = dynamic_cast<void*>(node);
+        node->~NodePrivate();
+        freed[k].second.push_back(p);
+    }
+    for (size_t k = 0; k < freed.size(); k++)
+        freed[k].first->release(freed[k].second);
+}
+
+ModulePrivate::~ModulePrivate()
+{
+    // An edit left open still holds the nodes it touched
+    for (size_t i = 0; i < touchedNodes.size(); i++)
+    {
+        touchedNodes[i]->touched = false;
+        if (!touchedNodes[i]->ref.deref())
+            NodePrivate::destroy(touchedNodes[i]);
+    }
+    // Don't delete PIs, POs, PPIs and PPOs
+    releaseNodes();
+    if (master && !master->ref.deref())
+        delete master;
+    if (!symbolTable->ref.deref())
+        delete symbolTable;
+}
+
+size_t ModulePrivate::gateCount() const
+{
+    if (!gateList.empty() && !cellList.empty())
+    {
+        std::cerr << "Bad circuit" << std::endl;
+        return 0;
+    }
+    else if (!gateList.empty())
+        return gateList.size();
+    else if (!cellList.empty())
+        return cellList.size();
+    else
+        return 0;
+}
+
+void ModulePrivate::reserve(size_t portCount, size_t wireCount, size_t gateCount, size_t cellCount)
+{
+    symbolTable->reserve(symbolTable->size() + portCount + wireCount + gateCount + cellCount);
+    ports.reserve(portCount);
+    portList.reserve(portCount);
+    wires.reserve(wireCount);
+    wireList.reserve(wireCount);
+    gates.reserve(gateCount);
+    gateList.reserve(gateCount);
+    cells.reserve(cellCount);
+    cellList.reserve(cellCount);
+}
+
+bool ModulePrivate::hasPort(const std::string &name)
+{
+    return port(name) != 0;
+}
+
+bool ModulePrivate::hasWire(const std::string &name)
+{
+    return wire(name) != 0;
+}
+
+bool ModulePrivate::hasGate(const std::string &name)
+{
+    return gate(name) != 0;
+}
+
+bool ModulePrivate::hasCell(const std::string &name)
+{
+    return cell(name) != 0;
+}
+
+PortPrivate* ModulePrivate::PI(size_t i)
+{
+    return PIs[i];
+}
+
+PortPrivate* ModulePrivate::PO(size_t i)
+{
+    return POs[i];
+}
+
+PortPrivate* ModulePrivate::PPI(size_t i)
+{
+    return PPIs[i];
+}
+
+PortPrivate* ModulePrivate::PPO(size_t i)
+{
+    return PPOs[i];
+}
+
+PortPrivate* ModulePrivate::port(size_t i)
+{
+    return (PortPrivate*) portList[i];
+}
+
+WirePrivate* ModulePrivate::wire(size_t i)
+{
+    return (WirePrivate*) wireList[i];
+}
+
+GatePrivate* ModulePrivate::gate(size_t i)
+{
+    return (GatePrivate*) gateList[i];
+}
+
+CellPrivate* ModulePrivate::cell(size_t i)
+{
+    return (CellPrivate*) cellList[i];
+}
+
+// A name never interned names no node, pending or not, so a lookup for a
+// fresh name does not index the nodes of an open edit
+PortPrivate* ModulePrivate::port(const std::string &portName)
+{
+    Symbol s = symbolTable->find(portName);
+    if (s == SymbolTable::NoSymbol)
+        return 0;
+    flushIndex();
+    return ports.value(s);
+}
+
+WirePrivate* ModulePrivate::wire(const std::string &wireName)
+{
+    Symbol s = symbolTable->find(wireName);
+    if (s == SymbolTable::NoSymbol)
+        return 0;
+    flushIndex();
+    return wires.value(s);
+}
+
+GatePrivate* ModulePrivate::gate(const std::string &gateName)
+{
+    Symbol s = symbolTable->find(gateName);
+    if (s == SymbolTable::NoSymbol)
+        return 0;
+    flushIndex();
+    return gates.value(s);
+}
+
+CellPrivate* ModulePrivate::cell(const std::string &cellName)
+{
+    Symbol s = symbolTable->find(cellName);
+    if (s == SymbolTable::NoSymbol)
+        return 0;
+    flushIndex();
+    return cells.value(s);
+}
+
+void ModulePrivate::addCell(CellPrivate *cell)
+{
+    cell->setParent(this);
+    cell->ref.ref();
+    appendNode(cellList, cell);
+    if (!indexNode(cell))
+        std::cerr << "WARNING: Duplicate add the same cell instance" << std::endl;
+}
+
+// Names the cell in this module's symbol table directly
+void ModulePrivate::addCell(CellPrivate *cell, const std::string &name)
+{
+    cell->symbol = 0;
+    cell->setParent(this);
+    cell->setName(name);
+    addCell(cell);
+}
+
+// A new instance sharing the prototype's master, kept in the cell arena
+CellPrivate* ModulePrivate::createCell(const std::string &cellName, CellPrivate *prototype)
+{
+    CircuitPrivate *c = ownerCircuit();
+    CellPrivate *cell = _newNode<CellPrivate>(c ? c->cellArena : 0, prototype, true);
+    addCell(cell, cellName);
+    cell->ref.deref();
+    return cell;
+}
+
+// An instance of definition, with one pin per port of it
+CellPrivate* ModulePrivate::createInstance(const std::string &instanceName, ModulePrivate *definition)
+{
+    CircuitPrivate *c = ownerCircuit();
+    CellPrivate *inst = _newNode<CellPrivate>(c ? c->cellArena : 0, c, this, instanceName, definition->instanceMaster());
+    appendNode(instanceList, inst);
+    if (!indexNode(inst))
+        std::cerr << "WARNING: Duplicate create instance: " << instanceName << std::endl;
+    return inst;
+}
+
+CellPrivate* ModulePrivate::instance(const std::string &instanceName)
+{
+    Symbol s = symbolTable->find(instanceName);
+    if (s == SymbolTable::NoSymbol)
+        return 0;
+    flushIndex();
+    return instances.value(s);
+}
+
+// Whether master has one pin per port, in order, with its name and direction
+static bool pinsMatchPorts(const CellMaster *master, const std::vector<NodePrivate*> &portList,
+                           const SymbolTable &names)
+{
+    size_t pinCount = 0, inputCount = 0, outputCount = 0;
+    for (size_t i = 0; i < portList.size(); i++)
+    {
+        const PortPrivate *p = (const PortPrivate*) portList[i];
+        if (!p)
+            continue;
+        bool output = (p->type == Port::Output || p->type == Port::PPO);
+        if (pinCount == master->pinTypes.size()
+                || master->pinTypes[pinCount++] != (output ? Port::Output : Port::Input))
+            return false;
+        const std::string &pin = output ? master->outputNames[outputCount++] : master->inputNames[inputCount++];
+        if (pin.compare(0, std::string::npos, names.data(p->symbol), names.length(p->symbol)) != 0)
+            return false;
+    }
+    return pinCount == master->pinTypes.size();
+}
+
+bool ModulePrivate::pinsMatch(const CellMaster *master) const
+{
+    return pinsMatchPorts(master, portList, *symbolTable);
+}
+
+// Inputs and outputs in port order, shared by all instances. A module whose
+// ports change gets a new master; instances made before keep the old one.
+CellMaster* ModulePrivate::instanceMaster()
+{
+    if (master && pinsMatchPorts(master, portList, *symbolTable))
+        return master;
+    if (master && !master->ref.deref())
+        delete master;
+    master = new CellMaster(nodeName());
+    master->module = this;
+    for (size_t i = 0; i < portList.size(); i++)
+    {
+        const PortPrivate *p = (const PortPrivate*) portList[i];
+        if (!p)
+            continue;
+        bool output = (p->type == Port::Output || p->type == Port::PPO);
+        (output ? master->outputNames : master->inputNames).push_back(p->nodeName());
+        master->pinTypes.push_back(output ? Port::Output : Port::Input);
+    }
+    return master;
+}
+
+WirePrivate* ModulePrivate::createWire(const std::string &wireName)
+{
+    CircuitPrivate *c = ownerCircuit();
+    WirePrivate *w = _newNode<WirePrivate>(c ? c->wireArena : 0, c, this, wireName);
+    // w->ref.deref();
+    appendNode(wireList, w);
+    // Duplicate creating wire
+    if (!indexNode(w))
+        std::cerr << "WARNING: Duplicate create wire: " << wireName << std::endl;
+    return w;
+}
+
+PortPrivate* ModulePrivate::createPort(const std::string &portName, Port::PortType type)
+{
+    CircuitPrivate *c = ownerCircuit();
+    PortPrivate *p = _newNode<PortPrivate>(c ? c->portArena : 0, c, this, portName, type);
+    if (!attachPort(p))
+    {
+        NodePrivate::destroy(p);
+        return 0;
+    }
+    appendNode(portList, p);
+    if (!indexNode(p))
+        std::cerr << "WARNING: Duplicate create port: " << portName << std::endl;
+    return p;
 }
 
 GatePrivate* ModulePrivate::createGate(const std::string &gateName, Gate::GateType type)
 {
+    CircuitPrivate *c = ownerCircuit();
+    GatePrivate *w = _newNode<GatePrivate>(c ? c->gateArena : 0, c, this, gateName, type);
+    // w->ref.deref();
+    appendNode(gateList, w);
     // Duplicate creating wire
-    if (gates.find(gateName) != gates.end())
+    if (!indexNode(w))
         std::cerr << "WARNING: Duplicate create wire: " << gateName << std::endl;
-    GatePrivate *w = new GatePrivate((CircuitPrivate*)this->ownerNode, this, gateName, type);
-    // w->ref.deref();
-    gateNames.push_back(gateName);
-    gates[gateName] = w;
     return w;
 }
 
 void ModulePrivate::setCellName(CellPrivate *cell, const std::string name)
 {
-    std::string origin = cell->name;
-    
-    CellPrivate *origin_cell = cells[origin];
-    if (origin_cell)
+    flushIndex();
+    Symbol origin = cell->symbol;
+
+    if (cells.remove(origin))
     {
-        cells[name] = origin_cell;
-        cells.erase(origin);
-        std::replace(cellNames.begin(), cellNames.end(), origin, name);
+        Symbol s = symbolTable->intern(name);
+        cells.insert(s, cell);
     }
     else
-        std::cerr << "setCellName fail:" << this->name  << ":" << origin << std::endl;
-
+        std::cerr << "setCellName fail:" << nodeName() << ":" << symbolTable->str(origin) << std::endl;
 }
 
 void ModulePrivate::setGateName(GatePrivate *gate, const std::string name)
 {
-    std::string origin = gate->name;
+    flushIndex();
+    Symbol origin = gate->symbol;
 
-    GatePrivate *origin_gate = gates[origin];
-    if(origin_gate)
+    if (gates.remove(origin))
     {
-        gates[name] = origin_gate;
-        gates.erase(origin);
-        std::replace(gateNames.begin(), gateNames.end(), origin, name);
+        Symbol s = symbolTable->intern(name);
+        gates.insert(s, gate);
     }
     else
-        std::cerr << "setGateName fail:" << this->name << ":" << origin << std::endl;
-
+        std::cerr << "setGateName fail:" << nodeName() << ":" << symbolTable->str(origin) << std::endl;
 }
 
 void ModulePrivate::setWireName(WirePrivate *wire, const std::string name)
 {
-    std::string origin = wire->name;
+    flushIndex();
+    Symbol origin = wire->symbol;
 
-    WirePrivate *origin_wire = wires[origin];
-    if(origin_wire)
+    if (wires.remove(origin))
     {
-        wires[name] = origin_wire;
-        wires.erase(origin);
-        std::replace(wireNames.begin(), wireNames.end(), origin, name);
+        Symbol s = symbolTable->intern(name);
+        wires.insert(s, wire);
     }
     else
-        std::cerr << "setWireName fail:" << this->name << ":" << origin << std::endl;
+        std::cerr << "setWireName fail:" << nodeName() << ":" << symbolTable->str(origin) << std::endl;
 }
 
-void ModulePrivate::setPortName(PortPrivate *port, const std::string name)
+void ModulePrivate::setPortName(PortPrivate *port, const std::string port_name)
 {
-    std::string origin = port->name;
+    flushIndex();
+    Symbol origin = port->symbol;
 
-    PortPrivate *origin_port = ports[origin];
-    if(origin_port)
+    if (ports.remove(origin))
     {
-        ports[name] = origin_port;
-        ports.erase(origin);
-        std::replace(portNames.begin(), portNames.end(), origin, name);
-
-        NodePrivate *node = NULL;
-        PortPrivate *temp = NULL;
-        switch(port->type)
-        {
-            case Port::Input:
-                node = inputs[origin];
-                inputs.erase(origin);
-                inputs[name] = node;
-                std::replace(inputNames.begin(), inputNames.end(), origin, name);
-               
-                temp = PIs[origin];
-                PIs.erase(origin);
-                PIs[name] = temp;
-
-                std::replace(PINames.begin(), PINames.end(), origin, name);
-                break;
-            case Port::Output:
-                node = outputs[origin];
-                outputs.erase(origin);
-                outputs[name] = node;
-                std::replace(outputNames.begin(), outputNames.end(), origin, name);
-
-                temp = POs[origin];
-                POs.erase(origin);
-                POs[name] = temp;
-
-                std::replace(PONames.begin(), PONames.end(), origin, name);
-                break;
-            case Port::PPI:
-                node = inputs[origin];
-                inputs.erase(origin);
-                inputs[name] = node;
-                std::replace(inputNames.begin(), inputNames.end(), origin, name);
-
-                temp = PPIs[origin];
-                PPIs.erase(origin);
-                PPIs[name] = temp;
-
-                std::replace(PPINames.begin(), PPINames.end(), origin, name);
-                break;
-            case Port::PPO:
-                node = outputs[origin];
-                outputs.erase(origin);
-                outputs[name] = node;
-                std::replace(outputNames.begin(), outputNames.end(), origin, name);
-
-                temp = PPOs[origin];
-                PPOs.erase(origin);
-                PPOs[name] = temp;
-
-                std::replace(PPONames.begin(), PPONames.end(), origin, name);
-                break;
-            default: break;
-        }
+        Symbol name = symbolTable->intern(port_name);
+        ports.insert(name, port);
     }
     else
-        std::cerr << "setPortName fail:" << this->name << ":" << origin << std::endl;
+        std::cerr << "setPortName fail:" << nodeName() << ":" << symbolTable->str(origin) << std::endl;
 }
 
 bool ModulePrivate::pushCell(CellPrivate* cell)
 {
-    if (cells.find(cell->name) != cells.end())
-        std::cerr << "WARNING: Duplicate add the same cell instance" << std::endl;
-    cell->setOwnerCircuit(this->ownerCircuit());
     cell->setParent(this);
     cell->ref.ref();
-    cellNames.push_back(cell->name);
-    cells[cell->name] = cell;
+    appendNode(cellList, cell);
+    if (!indexNode(cell))
+        std::cerr << "WARNING: Duplicate add the same cell instance" << std::endl;
     return false;
 }
 
 bool ModulePrivate::pushGate(GatePrivate* gate)
 {
-    if (gates.find(gate->name) != gates.end())
-        std::cerr << "WARNING: Duplicate add the same gate instance" << std::endl;
-    gate->setOwnerCircuit(this->ownerCircuit());
     gate->setParent(this);
     gate->ref.ref();
-    gateNames.push_back(gate->name);
-    gates[gate->name] = gate;
+    appendNode(gateList, gate);
+    if (!indexNode(gate))
+        std::cerr << "WARNING: Duplicate add the same gate instance" << std::endl;
    return false;
 }
 
 bool ModulePrivate::pushWire(WirePrivate* wire)
 {
-    if (wires.find(wire->name) != wires.end())
-        std::cerr << "WARNING: Duplicate add the same wire instance" << std::endl;
-    wire->setOwnerCircuit(this->ownerCircuit());
     wire->setParent(this);
     wire->ref.ref();
-    wireNames.push_back(wire->name);
-    wires[wire->name] = wire;
+    appendNode(wireList, wire);
+    if (!indexNode(wire))
+        std::cerr << "WARNING: Duplicate add the same wire instance" << std::endl;
     return false;
 }
 
-bool ModulePrivate::pushPort(PortPrivate* port)
+bool ModulePrivate::pushPort(PortPrivate* port)
+{
+    port->setParent(this);
+    port->ref.ref();
+    if (!attachPort(port))
+        return 0;
+    appendNode(portList, port);
+    if (!indexNode(port))
+        std::cerr << "WARNING: Duplicate add the same port instance" << std::endl;
+    return false;
+}
+
+// Flip-flops start a new level like the primary inputs, as in
+// EDAUtils::levelize()
+static bool isSequential(const NodePrivate *node)
+{
+    if (!node->isCell())
+        return false;
+    const CellPrivate *cell = (const CellPrivate*) node;
+    return cell->master->type.find("FF") != std::string::npos && cell->inputPin("CK") >= 0;
+}
+
+// Gates and cells reading the net of a port or wire, also through the
+// wires connected to it
+static void netReaders(const NodePrivate *net, std::vector<NodePrivate*> &readers)
+{
+    std::vector<NodePrivate*> nets(1, (NodePrivate*) net);
+    nets[0]->marked = true;
+    for (size_t k = 0; k < nets.size(); k++)
+    {
+        const NodePrivate *n = nets[k];
+        for (size_t i = 0; i < n->outputs.size(); i++)
+        {
+            NodePrivate *reader = n->outputs[i].node;
+            if (!reader)
+                continue;
+            if (reader->isGate() || reader->isCell())
+                readers.push_back(reader);
+            else if ((reader->isWire() || reader->isPort()) && !reader->marked)
+            {
+                reader->marked = true;
+                nets.push_back(reader);
+            }
+        }
+    }
+    for (size_t k = 0; k < nets.size(); k++)
+        nets[k]->marked = false;
+}
+
+// Gates and cells reading an output of a gate, directly or through nets
+static void gateReaders(const NodePrivate *gate, std::vector<NodePrivate*> &readers)
+{
+    for (size_t i = 0; i < gate->outputs.size(); i++)
+    {
+        NodePrivate *out = gate->outputs[i].node;
+        if (out && (out->isGate() || out->isCell()))
+            readers.push_back(out);
+        else if (out)
+            netReaders(out, readers);
+    }
+}
+
+// 1 + the highest level of the gates driving an input; inputs driven by
+// ports or flip-flops count as level 0
+static unsigned inputLevel(const NodePrivate *gate)
+{
+    unsigned level = 0;
+    for (size_t i = 0; i < gate->inputs.size(); i++)
+    {
+        const NodePrivate *driver = gate->inputs[i].node;
+        for (size_t hops = 0; driver && (driver->isWire() || driver->isPort()) && hops < 64; hops++)
+            driver = driver->inputs.empty() ? 0 : driver->inputs[0].node;
+        if (driver && (driver->isGate() || driver->isCell()) && !isSequential(driver))
+            level = std::max(level, ((const GatePrivate*) driver)->level);
+    }
+    return level + 1;
+}
+
+// Updates the levels of the seeds and of the gates after them whose level
+// changes as a result. Gates outside that cone keep their level.
+void ModulePrivate::relevel(const std::vector<NodePrivate*> &seeds)
+{
+    size_t limit = gateList.size() + cellList.size() + instanceList.size() + 1;
+    std::vector<NodePrivate*> queue(seeds);
+    for (size_t k = 0; k < queue.size(); k++)
+    {
+        GatePrivate *gate = (GatePrivate*) queue[k];
+        unsigned level = inputLevel(gate);
+        if (level == gate->level)
+            continue;
+        if (level > limit)
+        {
+            std::cerr << "WARNING: Combinational loop at " << gate->nodeName() << std::endl;
+            return;
+        }
+        gate->level = level;
+        if (!isSequential(gate))
+            gateReaders(gate, queue);
+    }
+}
+
+// Levels all gates, cells and instances in one topological pass, in time
+// linear in the connections. Used for a module built from scratch, where
+// relevel() would revisit a gate once for every gate before it.
+void ModulePrivate::levelize()
+{
+    const std::vector<NodePrivate*> *lists[] = { &gateList, &cellList, &instanceList };
+    std::vector<NodePrivate*> queue, readers;
+
+    // Until a gate is queued its level counts the drivers it waits for
+    for (size_t l = 0; l < 3; l++)
+        for (size_t i = 0; i < lists[l]->size(); i++)
+            ((GatePrivate*) (*lists[l])[i])->level = 0;
+    for (size_t l = 0; l < 3; l++)
+        for (size_t i = 0; i < lists[l]->size(); i++)
+        {
+            NodePrivate *gate = (*lists[l])[i];
+            if (isSequential(gate))
+                continue;
+            readers.clear();
+            gateReaders(gate, readers);
+            for (size_t j = 0; j < readers.size(); j++)
+                ((GatePrivate*) readers[j])->level++;
+        }
+    for (size_t l = 0; l < 3; l++)
+        for (size_t i = 0; i < lists[l]->size(); i++)
+            if (!((GatePrivate*) (*lists[l])[i])->level)
+                queue.push_back((*lists[l])[i]);
+
+    for (size_t k = 0; k < queue.size(); k++)
+    {
+        GatePrivate *gate = (GatePrivate*) queue[k];
+        gate->marked = true;
+        gate->level = inputLevel(gate);
+        if (isSequential(gate))
+            continue;
+        readers.clear();
+        gateReaders(gate, readers);
+        for (size_t j = 0; j < readers.size(); j++)
+            if (!--((GatePrivate*) readers[j])->level)
+                queue.push_back(readers[j]);
+    }
+
+    // Gates on a combinational loop never became ready
+    std::vector<GatePrivate*> looped;
+    for (size_t l = 0; l < 3; l++)
+        for (size_t i = 0; i < lists[l]->size(); i++)
+        {
+            GatePrivate *gate = (GatePrivate*) (*lists[l])[i];
+            if (!gate->marked)
+                looped.push_back(gate);
+            gate->marked = false;
+        }
+    if (looped.empty())
+        return;
+    std::cerr << "WARNING: Combinational loop at " << looped[0]->nodeName() << std::endl;
+    for (size_t i = 0; i < looped.size(); i++)
+        looped[i]->level = 0;
+    for (size_t i = 0; i < looped.size(); i++)
+        looped[i]->level = inputLevel(looped[i]);
+}
+
+void ModulePrivate::beginEdit()
+{
+    editDepth++;
+}
+
+void ModulePrivate::commitEdit()
+{
+    if (!editDepth)
+    {
+        std::cerr << "WARNING: commitEdit() without beginEdit()" << std::endl;
+        return;
+    }
+    if (--editDepth)
+        return;
+    indexPending();
+    compact();
+    if (touchedNodes.empty())
+        return;
+
+    // Connections changed: cached loads and the levels behind them are stale
+    std::vector<NodePrivate*> nodes, seeds;
+    nodes.swap(touchedNodes);
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        NodePrivate *node = nodes[i];
+        node->touched = false;
+        if (!owns(node))
+            continue;
+        node->invalidateLoads();
+        if (!leveled)
+            continue;
+        if (node->isGate() || node->isCell())
+            seeds.push_back(node);
+        else
+            netReaders(node, seeds);
+    }
+    if (leveled)
+        relevel(seeds);
+    else
+        levelize();
+    leveled = true;
+    for (size_t i = 0; i < nodes.size(); i++)
+        if (!nodes[i]->ref.deref())
+            NodePrivate::destroy(nodes[i]);
+}
+
+// Keeps the node alive until the commit, it may be removed meanwhile
+void ModulePrivate::touch(NodePrivate *node)
+{
+    if (node->touched)
+        return;
+    node->touched = true;
+    node->ref.ref();
+    touchedNodes.push_back(node);
+}
+
+bool ModulePrivate::owns(const NodePrivate *node) const
+{
+    const std::vector<NodePrivate*> *list;
+    switch (node->nodeType())
+    {
+        case Node::PortNode: list = &portList; break;
+        case Node::WireNode: list = &wireList; break;
+        case Node::GateNode: list = &gateList; break;
+        case Node::CellNode:
+            list = (((const CellPrivate*) node)->master->module ? &instanceList : &cellList);
+            break;
+        default: return false;
+    }
+    return node->index < list->size() && (*list)[node->index] == node;
+}
+
+template <class T>
+static bool insertSymbol(SymbolMap<T> &map, T *node)
+{
+    bool fresh = !map.contains(node->symbol);
+    map.insert(node->symbol, node);
+    return fresh;
+}
+
+// Returns false if the name was taken
+bool ModulePrivate::insertName(NodePrivate *node)
+{
+    switch (node->nodeType())
+    {
+        case Node::PortNode: return insertSymbol(ports, (PortPrivate*) node);
+        case Node::WireNode: return insertSymbol(wires, (WirePrivate*) node);
+        case Node::GateNode: return insertSymbol(gates, (GatePrivate*) node);
+        case Node::CellNode:
+            if (((CellPrivate*) node)->master->module)
+                return insertSymbol(instances, (CellPrivate*) node);
+            return insertSymbol(cells, (CellPrivate*) node);
+        default: return true;
+    }
+}
+
+// Makes the node findable by name, right away unless an edit is open
+bool ModulePrivate::indexNode(NodePrivate *node)
+{
+    if (editDepth)
+    {
+        unindexed.push_back(node);
+        return true;
+    }
+    return insertName(node);
+}
+
+void ModulePrivate::indexPending()
+{
+    size_t portCount = 0, wireCount = 0, gateCount = 0, cellCount = 0;
+    for (size_t i = 0; i < unindexed.size(); i++)
+    {
+        switch (unindexed[i]->nodeType())
+        {
+            case Node::PortNode: portCount++; break;
+            case Node::WireNode: wireCount++; break;
+            case Node::GateNode: gateCount++; break;
+            case Node::CellNode: cellCount++; break;
+            default: break;
+        }
+    }
+    ports.reserve(ports.size() + portCount);
+    wires.reserve(wires.size() + wireCount);
+    gates.reserve(gates.size() + gateCount);
+    cells.reserve(cells.size() + cellCount);
+    for (size_t i = 0; i < unindexed.size(); i++)
+        if (!insertName(unindexed[i]))
+            std::cerr << "WARNING: Duplicate name: " << unindexed[i]->nodeName() << std::endl;
+    unindexed.clear();
+}
+
+// The slot of a port is kept in slotIndex, so no scan is needed. Ports
+// created in an open edit are not in the map yet and are searched for.
+int ModulePrivate::inputPin(const std::string &name) const
+{
+    if (!unindexed.empty())
+        return NodePrivate::inputPin(name);
+    const PortPrivate *port = ports.value(symbolTable->find(name));
+    if (!port || port->slotIndex >= inputs.size() || inputs[port->slotIndex].node != port)
+        return -1;
+    return (int) port->slotIndex;
+}
+
+int ModulePrivate::outputPin(const std::string &name) const
+{
+    if (!unindexed.empty())
+        return NodePrivate::outputPin(name);
+    const PortPrivate *port = ports.value(symbolTable->find(name));
+    if (!port || port->slotIndex >= outputs.size() || outputs[port->slotIndex].node != port)
+        return -1;
+    return (int) port->slotIndex;
+}
+
+std::vector<PortPrivate*>* ModulePrivate::portTypeList(Port::PortType type)
+{
+    switch (type)
+    {
+        case Port::Input:   return &PIs;
+        case Port::Output:  return &POs;
+        case Port::PPI:     return &PPIs;
+        case Port::PPO:     return &PPOs;
+        default:            return 0;
+    }
+}
+
+// Adds the port to its type list and to this module's inputs or outputs
+bool ModulePrivate::attachPort(PortPrivate *port)
+{
+    std::vector<PortPrivate*> *list = portTypeList(port->type);
+    if (!list)
+        return false;
+    port->typeIndex = (unsigned) list->size();
+    list->push_back(port);
+    if (port->type == Port::Input || port->type == Port::PPI)
+    {
+        port->slotIndex = (unsigned) inputs.size();
+        addInput(port);
+    }
+    else
+    {
+        port->slotIndex = (unsigned) outputs.size();
+        addOutput(port);
+    }
+    return true;
+}
+
+// Port order is significant, so removed ports leave a null entry behind
+// until compact(), which runs when the edit is committed
+void ModulePrivate::detachPort(PortPrivate *port)
+{
+    std::vector<PortPrivate*> *list = portTypeList(port->type);
+    if (!list)
+        return;
+    (*list)[port->typeIndex] = 0;
+    if (port->type == Port::Input || port->type == Port::PPI)
+        inputs[port->slotIndex] = PinSlot();
+    else
+        outputs[port->slotIndex] = PinSlot();
+    hasTombstones = true;
+}
+
+static void compactNodeList(std::vector<NodePrivate*> &list)
 {
-    if (ports.find(port->name) != ports.end())
-        std::cerr << "WARNING: Duplicate add the same port instance" << std::endl;
-    port->setOwnerCircuit(this->ownerCircuit());
-    port->setParent(this);
-    port->ref.ref();
-    switch (port->type)
+    size_t n = 0;
+    for (size_t i = 0; i < list.size(); i++)
     {
-        case Port::Input:   addInput(port);  PIs[port->name] = port;  PINames.push_back(port->name);  break;
-        case Port::Output:  addOutput(port); POs[port->name] = port;  PONames.push_back(port->name);  break;
-        case Port::PPI:     addInput(port);  PPIs[port->name] = port; PPINames.push_back(port->name); break;
-        case Port::PPO:     addOutput(port); PPOs[port->name] = port; PPONames.push_back(port->name); break;
-        default: return 0;
+        if (!list[i])
+            continue;
+        list[i]->index = (unsigned) n;
+        list[n++] = list[i];
     }
-    portNames.push_back(port->name);
-    ports[port->name] = port;
-    return false;
+    list.resize(n);
 }
 
-bool ModulePrivate::removeWire(const std::string &wireName)
+static void compactPortList(std::vector<PortPrivate*> &list)
 {
-    WirePrivate *wire = wires[wireName];
-    for(size_t in = 0; in < wire->inputSize(); in++)
+    size_t n = 0;
+    for (size_t i = 0; i < list.size(); i++)
     {
-        NodePrivate* nodei = wire->input(in);
-        if(nodei != NULL)
-        {
-            if(nodei->isWire() || nodei->isPort())
-            {
-                std::string key;
-                for(std::map<std::string, NodePrivate*>::iterator it = nodei->outputs.begin(); it != nodei->outputs.end(); it++)
-                {
-                    NodePrivate* cnode = it->second;
-                    if(cnode->name == wireName)
-                    {
-                        key = it->first;
-                        break;
-                    }
-                }
-                //std::string key = _genkey(wire, _dir2str(Node::Direct::left), in);
-                nodei->outputs.erase(key);
-                nodei->outputNames.erase(std::remove(nodei->outputNames.begin(), nodei->outputNames.end(), key), nodei->outputNames.end());
-            }
-            else if(nodei->isGate() || nodei->isCell())
-            {
-                std::string key;
-                for(std::map<std::string, NodePrivate*>::iterator it = nodei->outputs.begin(); it != nodei->outputs.end(); it++)
-                {
-                    NodePrivate* cnode = it->second;
-                    if(cnode->name == wireName)
-                    {
-                        key = it->first;
-                        break;
-                    }
-                }
-                //std::string key = _getPinfromKey(nodei, wire->inputNames[in]);
-                nodei->outputs.erase(key);
-                nodei->outputs[key] = 0;
-            }
-        }
+        if (!list[i])
+            continue;
+        list[i]->typeIndex = (unsigned) n;
+        list[n++] = list[i];
     }
-    for(size_t out = 0; out < wire->outputSize(); out++)
-    {
-        NodePrivate* nodeo = wire->output(out);
-        if(nodeo != NULL)
-        {
-            if(nodeo->isWire() || nodeo->isPort())
-            {
-                std::string key;
-                for(std::map<std::string, NodePrivate*>::iterator it = nodeo->inputs.begin(); it != nodeo->inputs.end(); it++)
-                {
-                    NodePrivate* cnode = it->second;
-                    if(cnode->name == wireName)
-                    {
-                        key = it->first;
-                        break;
-                    }
-                }
-                //std::string key = _genkey(wire, _dir2str(Node::Direct::right), out);
-                nodeo->inputs.erase(key);
-                nodeo->inputNames.erase(std::remove(nodeo->inputNames.begin(), nodeo->inputNames.end(), key), nodeo->inputNames.end());
-            }
-            else if(nodeo->isGate() || nodeo->isCell())
-            {
-                std::string key;
-                for(std::map<std::string, NodePrivate*>::iterator it = nodeo->inputs.begin(); it != nodeo->inputs.end(); it++)
-                {
-                    NodePrivate* cnode = it->second;
-                    if(cnode->name == wireName)
-                    {
-                        key = it->first;
-                        break;
-                    }
-                }
-                //std::string key = _getPinfromKey(nodeo, wire->outputNames[out]);
-                nodeo->inputs.erase(key);
-                nodeo->inputs[key] = 0;
+    list.resize(n);
+}
 
-            }
-        }
+static void compactPortSlots(std::vector<PinSlot> &slots)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        if (!slots[i].node)
+            continue;
+        ((PortPrivate*) slots[i].node)->slotIndex = (unsigned) n;
+        slots[n++] = slots[i];
     }
-    wires.erase(wireName);
-    wireNames.erase(std::remove(wireNames.begin(), wireNames.end(), wireName), wireNames.end());
+    slots.resize(n);
+}
+
+void ModulePrivate::compact()
+{
+    if (!hasTombstones)
+        return;
+    compactNodeList(portList);
+    compactPortList(PIs);
+    compactPortList(POs);
+    compactPortList(PPIs);
+    compactPortList(PPOs);
+    compactPortSlots(inputs);
+    compactPortSlots(outputs);
+    hasTombstones = false;
+}
+
+bool ModulePrivate::removeWire(const std::string &wireName)
+{
+    flushIndex();
+    Symbol s = symbolTable->find(wireName);
+    WirePrivate *wire = wires.value(s);
+    if (!wire)
+        return false;
+    wire->unlink();
+    wires.remove(s);
+    eraseNode(wireList, wire);
+    if (!wire->ref.deref())
+        NodePrivate::destroy(wire);
     
     return true;
 }
 
 bool ModulePrivate::removePort(const std::string &portName)
 {
-    PortPrivate *port = ports[portName];
-    for(size_t in = 0; in < port->inputSize(); in++)
-    {
-        NodePrivate* nodei = port->input(in);
-        if(nodei != NULL)
-        {
-            if(nodei->isWire() || nodei->isPort())
-            {
-                std::string key;
-                for(std::map<std::string, NodePrivate*>::iterator it = nodei->outputs.begin(); it != nodei->outputs.end(); it++)
-                {
-                    NodePrivate* cnode = it->second;
-                    if(cnode->name == portName)
-                    {
-                        key = it->first;
-                        break;
-                    }
-                }
-                //std::string key = _genkey(port, _dir2str(Node::Direct::left), in);
-                nodei->outputs.erase(key);
-                nodei->outputNames.erase(std::remove(nodei->outputNames.begin(), nodei->outputNames.end(), key), nodei->outputNames.end());
-            }
-            else if(nodei->isGate() || nodei->isCell())
-            {
-                std::string key;
-                for(std::map<std::string, NodePrivate*>::iterator it = nodei->outputs.begin(); it != nodei->outputs.end(); it++)
-                {
-                    NodePrivate* cnode = it->second;
-                    if(cnode->name == portName)
-                    {
-                        key = it->first;
-                        break;
-                    }
-                }
-                //std::string key = _getPinfromKey(nodei, port->inputNames[in]);
-                nodei->outputs.erase(key);
-                nodei->outputs[key] = 0;
-            }
-        }
-    }
-    for(size_t out = 0; out < port->outputSize(); out++)
-    {
-        NodePrivate* nodeo = port->output(out);
-        if(nodeo != NULL)
-        {
-            if(nodeo->isWire() || nodeo->isPort())
-            {
-                std::string key;
-                for(std::map<std::string, NodePrivate*>::iterator it = nodeo->inputs.begin(); it != nodeo->inputs.end(); it++)
-                {
-                    NodePrivate* cnode = it->second;
-                    if(cnode->name == portName)
-                    {
-                        key = it->first;
-                        break;
-                    }
-                }
-                //std::string key = _genkey(port, _dir2str(Node::Direct::right), out);
-                nodeo->inputs.erase(key);
-                nodeo->inputNames.erase(std::remove(nodeo->inputNames.begin(), nodeo->inputNames.end(), key), nodeo->inputNames.end());
-            }
-            else if(nodeo->isGate() || nodeo->isCell())
-            {
-                std::string key;
-                for(std::map<std::string, NodePrivate*>::iterator it = nodeo->inputs.begin(); it != nodeo->inputs.end(); it++)
-                {
-                    NodePrivate* cnode = it->second;
-                    if(cnode->name == portName)
-                    {
-                        key = it->first;
-                        break;
-                    }
-                }
-                //std::string key = _getPinfromKey(nodeo, port->outputNames[out]);
-                nodeo->inputs.erase(key);
-                nodeo->inputs[key] = 0;
-            }
-        }
-    }
-    ports.erase(portName);
-    portNames.erase(std::remove(portNames.begin(), portNames.end(), portName), portNames.end());
-   
-    switch (port->type)
-    {
-        case Port::Input: 
-            inputs.erase(portName);
-            inputNames.erase(std::remove(inputNames.end(), inputNames.end(), portName), inputNames.end());
-            PIs.erase(portName);
-            PINames.erase(std::remove(PINames.begin(), PINames.end(), portName), PINames.end());
-            break;
-        case Port::Output:
-            outputs.erase(portName);
-            outputNames.erase(std::remove(outputNames.begin(), outputNames.end(), portName), outputNames.end());
-            POs.erase(portName);
-            PONames.erase(std::remove(PONames.begin(), PONames.end(), portName), PONames.end());
-            break;
-        case Port::PPI:
-            inputs.erase(portName);
-            inputNames.erase(std::remove(inputNames.begin(), inputNames.end(), portName), inputNames.end());
-            PPIs.erase(portName);
-            PPINames.erase(std::remove(PPINames.begin(), PPINames.end(), portName), PPINames.end());
-            break;
-        case Port::PPO:
-            outputs.erase(portName);
-            outputNames.erase(std::remove(outputNames.begin(), outputNames.end(), portName), outputNames.end()); 
-            PPOs.erase(portName);
-            PPONames.erase(std::remove(PPONames.begin(), PPONames.end(), portName), PPONames.end());
-            break;
-        default:
-            break;
-    }
+    flushIndex();
+    Symbol s = symbolTable->find(portName);
+    PortPrivate *port = ports.value(s);
+    if (!port)
+        return false;
+    port->unlink();
+    ports.remove(s);
+    portList[port->index] = 0;
+    detachPort(port);
+    if (!port->ref.deref())
+        NodePrivate::destroy(port);
+    if (!editDepth)
+        compact();
     return true;
 }
 
 bool ModulePrivate::removeGate(const std::string &gateName)
 {
-    GatePrivate *gate = gates[gateName];
-    for(size_t in = 0; in < gate->inputSize(); in++)
-    {
-        NodePrivate* nodei = gate->input(in);
-        if(nodei != NULL)
-        {
-            if(nodei->isWire() || nodei->isPort())
-            {
-                std::string key;
-                for(std::map<std::string, NodePrivate*>::iterator it = nodei->outputs.begin(); it != nodei->outputs.end(); it++)
-                {
-                    NodePrivate* cnode = it->second;
-                    if(cnode->name == gateName)
-                    {
-                        key = it->first;
-                        break;
-                    }
-                }
-                nodei->outputs.erase(key);
-                nodei->outputNames.erase(std::remove(nodei->outputNames.begin(), nodei->outputNames.end(), key), nodei->outputNames.end());
-            }
-        }
-    }
-    for(size_t out = 0; out < gate->outputSize(); out++)
-    {
-        NodePrivate* nodeo = gate->output(out);
-        if(nodeo != NULL)
-        {
-            if(nodeo->isWire() || nodeo->isPort())
-            {
-                std::string key;
-                for(std::map<std::string, NodePrivate*>::iterator it = nodeo->inputs.begin(); it != nodeo->inputs.end(); it++)
-                {
-                    NodePrivate* cnode = it->second;
-                    if(cnode->name == gateName)
-                    {
-                        key = it->first;
-                        break;
-                    }
-                }
-                nodeo->inputs.erase(key);
-                nodeo->inputNames.erase(std::remove(nodeo->inputNames.begin(), nodeo->inputNames.end(), key), nodeo->inputNames.end());
-            }
-        }
-    }
-    gates.erase(gateName);
-    gateNames.erase(std::remove(gateNames.begin(), gateNames.end(), gateName), gateNames.end());
+    flushIndex();
+    Symbol s = symbolTable->find(gateName);
+    GatePrivate *gate = gates.value(s);
+    if (!gate)
+        return false;
+    gate->unlink();
+    gates.remove(s);
+    eraseNode(gateList, gate);
+    if (!gate->ref.deref())
+        NodePrivate::destroy(gate);
     
     return true;
 }
 
+bool ModulePrivate::removeInstance(const std::string &instanceName)
+{
+    flushIndex();
+    Symbol s = symbolTable->find(instanceName);
+    CellPrivate *inst = instances.value(s);
+    if (!inst)
+        return false;
+    inst->unlink();
+    instances.remove(s);
+    eraseNode(instanceList, inst);
+    if (!inst->ref.deref())
+        NodePrivate::destroy(inst);
+    return true;
+}
+
 bool ModulePrivate::removeCell(const std::string &cellName)
 {
-    CellPrivate *cell = cells[cellName];
-    for(size_t in = 0; in < cell->inputSize(); in++)
-    {
-        NodePrivate* nodei = cell->input(in);
-        if(nodei != NULL) 
-        {
-            if(nodei->isWire() || nodei->isPort())
-            {
-                std::string key;
-                for(std::map<std::string, NodePrivate*>::iterator it = nodei->outputs.begin(); it != nodei->outputs.end(); it++)
-                {
-                    NodePrivate* cnode = it->second;
-                    if(cnode->name == cellName)
-                    {
-                        key = it->first;
-                        break;
-                    }
-                }
-                nodei->outputs.erase(key);
-                nodei->outputNames.erase(std::remove(nodei->outputNames.begin(), nodei->outputNames.end(), key), nodei->outputNames.end());
-            }
-        }
-    }
-    for(size_t out = 0; out < cell->outputSize(); out++)
-    {
-        NodePrivate* nodeo = cell->output(out);
-        if(nodeo != NULL) 
-        {
-            if(nodeo->isWire() || nodeo->isPort())
-            {
-                std::string key;
-                for(std::map<std::string, NodePrivate*>::iterator it = nodeo->inputs.begin(); it != nodeo->inputs.end(); it++)
-                {
-                    NodePrivate* cnode = it->second;
-                    if(cnode->name == cellName)
-                    {
-                        key = it->first;
-                        break;
-                    }
-                }
-                nodeo->inputs.erase(key);
-                nodeo->inputNames.erase(std::remove(nodeo->inputNames.begin(), nodeo->inputNames.end(), key), nodeo->inputNames.end());
-            }
-        }
-    }
-    cells.erase(cellName);
-    cellNames.erase(std::remove(cellNames.begin(), cellNames.end(), cellName), cellNames.end());
+    flushIndex();
+    Symbol s = symbolTable->find(cellName);
+    CellPrivate *cell = cells.value(s);
+    if (!cell)
+        return false;
+    cell->unlink();
+    cells.remove(s);
+    eraseNode(cellList, cell);
+    if (!cell->ref.deref())
+        NodePrivate::destroy(cell);
     
     return true;
 }
@@ -2522,6 +3237,21 @@ Module::Module(ModulePrivate *x)
 {
 }
 
+Module& Module::operator=(const Module &x)
+{
+    return (Module&) Node::operator=(x);
+}
+
+Module::Module(Module &&x)
+    : Node(std::move(x))
+{
+}
+
+Module& Module::operator=(Module &&x)
+{
+    return (Module&) Node::operator=(std::move(x));
+}
+
 Port Module::PI(size_t i) const
 {
     if (!impl)
@@ -2564,6 +3294,76 @@ Port Module::outputPort(size_t i) const
     return Port((PortPrivate*)impl->output(i));
 }
 
+NodeRange Module::ports() const
+{
+    if (!impl)
+        return NodeRange();
+    return NodeRange(IMPL->portList.data(), IMPL->portList.size(), sizeof(NodePrivate*));
+}
+
+NodeRange Module::wires() const
+{
+    if (!impl)
+        return NodeRange();
+    return NodeRange(IMPL->wireList.data(), IMPL->wireList.size(), sizeof(NodePrivate*));
+}
+
+NodeRange Module::gates() const
+{
+    if (!impl)
+        return NodeRange();
+    return NodeRange(IMPL->gateList.data(), IMPL->gateList.size(), sizeof(NodePrivate*));
+}
+
+NodeRange Module::cells() const
+{
+    if (!impl)
+        return NodeRange();
+    return NodeRange(IMPL->cellList.data(), IMPL->cellList.size(), sizeof(NodePrivate*));
+}
+
+NodeRange Module::PIs() const
+{
+    if (!impl)
+        return NodeRange();
+    return NodeRange(IMPL->PIs.data(), IMPL->PIs.size(), sizeof(PortPrivate*));
+}
+
+NodeRange Module::POs() const
+{
+    if (!impl)
+        return NodeRange();
+    return NodeRange(IMPL->POs.data(), IMPL->POs.size(), sizeof(PortPrivate*));
+}
+
+NodeRange Module::PPIs() const
+{
+    if (!impl)
+        return NodeRange();
+    return NodeRange(IMPL->PPIs.data(), IMPL->PPIs.size(), sizeof(PortPrivate*));
+}
+
+NodeRange Module::PPOs() const
+{
+    if (!impl)
+        return NodeRange();
+    return NodeRange(IMPL->PPOs.data(), IMPL->PPOs.size(), sizeof(PortPrivate*));
+}
+
+NodeRange Module::inputPorts() const
+{
+    if (!impl)
+        return NodeRange();
+    return NodeRange(impl->inputs.data(), impl->inputs.size(), sizeof(PinSlot));
+}
+
+NodeRange Module::outputPorts() const
+{
+    if (!impl)
+        return NodeRange();
+    return NodeRange(impl->outputs.data(), impl->outputs.size(), sizeof(PinSlot));
+}
+
 size_t Module::gateCount() const
 {
     if (!impl)
@@ -2603,28 +3403,28 @@ size_t Module::wireSize() const
 {
     if (!impl)
         return 0;
-    return IMPL->wires.size();
+    return IMPL->wireList.size();
 }
 
 size_t Module::gateSize() const
 {
     if (!impl)
         return 0;
-    return IMPL->gates.size();
+    return IMPL->gateList.size();
 }
 
 size_t Module::cellSize() const
 {
     if (!impl)
         return 0;
-    return IMPL->cells.size();
+    return IMPL->cellList.size();
 }
 
 size_t Module::portSize() const
 {
     if (!impl)
         return 0;
-    return IMPL->ports.size();
+    return IMPL->portList.size();
 }
 
 bool Module::hasPort(const std::string &name) const
@@ -2704,18 +3504,137 @@ Gate Module::gate(const std::string &gateName) const
     return Gate(IMPL->gate(gateName));
 }
 
-Cell Module::cell(const std::string &cellName) const
+Cell Module::cell(const std::string &cellName) const
+{
+    if (!impl)
+        return Cell();
+    return Cell(IMPL->cell(cellName));
+}
+
+size_t Module::instanceSize() const
+{
+    if (!impl)
+        return 0;
+    return IMPL->instanceList.size();
+}
+
+bool Module::hasInstance(const std::string &name) const
+{
+    if (!impl)
+        return false;
+    return IMPL->instance(name) != 0;
+}
+
+Cell Module::instance(size_t i) const
+{
+    if (!impl)
+        return Cell();
+    return Cell((CellPrivate*) IMPL->instanceList[i]);
+}
+
+Cell Module::instance(const std::string &name) const
+{
+    if (!impl)
+        return Cell();
+    return Cell(IMPL->instance(name));
+}
+
+NodeRange Module::instances() const
+{
+    if (!impl)
+        return NodeRange();
+    return NodeRange(IMPL->instanceList.data(), IMPL->instanceList.size(), sizeof(NodePrivate*));
+}
+
+/*!
+    Creates an instance of definition with one pin per port of it, inputs
+    and outputs in port order. Pins are connected by port name.
+*/
+Cell Module::createInstance(const std::string &name, const Module &definition)
+{
+    if (!impl || definition.isNull())
+        return Cell();
+    return Cell(IMPL->createInstance(name, (ModulePrivate*) definition.impl));
+}
+
+void Module::addCell(Cell &cell)
+{
+    if (!impl)
+        return;
+    IMPL->addCell((CellPrivate*)cell.impl);
+}
+
+/*!
+    Adds \a cell to the module as instance \a name. Same as setting the
+    name first, but the name is only stored in this circuit.
+*/
+void Module::addCell(Cell &cell, const std::string &name)
+{
+    if (!impl || cell.isNull())
+        return;
+    IMPL->addCell((CellPrivate*)cell.impl, name);
+}
+
+/*!
+    Creates instance \a name of library cell \a cell. The instance shares
+    the library data of \a cell, which is left untouched.
+*/
+Cell Module::createCell(const std::string &name, const Cell &cell)
+{
+    if (!impl || cell.isNull())
+        return Cell();
+    return Cell(IMPL->createCell(name, (CellPrivate*)cell.impl));
+}
+
+/*!
+    Reserves room for the given number of ports, wires, gates and cells so
+    that adding them does not grow the name indexes.
+*/
+void Module::reserve(size_t ports, size_t wires, size_t gates, size_t cells)
+{
+    if (!impl)
+        return;
+    IMPL->reserve(ports, wires, gates, cells);
+}
+
+/*!
+    Starts a batch of structural edits. Until the matching commitEdit(),
+    new nodes are only made findable by name when a lookup needs them, and
+    cached cell loads and levels are not touched. Calls may nest.
+*/
+void Module::beginEdit()
+{
+    if (!impl)
+        return;
+    IMPL->beginEdit();
+}
+
+/*!
+    Ends the batch started by beginEdit(). The outermost commit indexes the
+    new nodes in one pass. For the nodes whose connections changed it marks
+    the cell loads for recomputation and updates the levels of the gates
+    and cells behind them from the levels of their drivers, the way
+    EDAUtils::levelize() assigns them; the other levels are kept.
+*/
+void Module::commitEdit()
 {
     if (!impl)
-        return Cell();
-    return Cell(IMPL->cell(cellName));
+        return;
+    IMPL->commitEdit();
 }
 
-void Module::addCell(Cell &cell)
+/*!
+    Removing a port inside an edit leaves a hole in the ordered port lists
+    so that bulk removal stays linear. The outermost commitEdit() squeezes
+    the holes out, as does this; a removal outside an edit does it at once.
+    Until then ports(), port(i), fanin(), fanout() and the PI/PO accessors
+    may show null entries, and the sizes count them.
+*/
+void Module::compact()
 {
     if (!impl)
         return;
-    IMPL->addCell((CellPrivate*)cell.impl);
+    IMPL->compact();
 }
 
 Port Module::createPort(const std::string &portName, Port::PortType type)
@@ -2778,6 +3697,8 @@ bool Module::removeNode(Node &node)
     if (!impl)
         return false;
 
+    else if (node.isCell() && !node.toCell().definition().isNull())
+        return IMPL->removeInstance(node.name());
     else if (node.isCell())
         return IMPL->removeCell(node.name());
     else if (node.isGate())
@@ -2800,29 +3721,52 @@ bool Module::removeNode(Node &node)
  **************************************************************/
 
 CircuitPrivate::CircuitPrivate()
-    : NodePrivate(0)
+    : NodePrivate(0), symbolTable(new SymbolTable),
+      portArena(new NodeArena(sizeof(PortPrivate))),
+      wireArena(new NodeArena(sizeof(WirePrivate))),
+      gateArena(new NodeArena(sizeof(GatePrivate))),
+      cellArena(new NodeArena(sizeof(CellPrivate))),
+      topModule(0), library(0), ownedLibrary(0)
 {
-    name = "#circuit";
+    setName("#circuit");
 }
 
 CircuitPrivate::CircuitPrivate(const std::string &name_)
-    : NodePrivate(0)
+    : NodePrivate(0), symbolTable(new SymbolTable),
+      portArena(new NodeArena(sizeof(PortPrivate))),
+      wireArena(new NodeArena(sizeof(WirePrivate))),
+      gateArena(new NodeArena(sizeof(GatePrivate))),
+      cellArena(new NodeArena(sizeof(CellPrivate))),
+      topModule(0), library(0), ownedLibrary(0)
 {
-    name = name_;
+    setName(name_);
 }
 
 CircuitPrivate::CircuitPrivate(CircuitPrivate* n, bool deep)
-    : NodePrivate(n, deep)
+    : NodePrivate(n, deep), symbolTable(n->symbolTable),
+      portArena(new NodeArena(sizeof(PortPrivate))),
+      wireArena(new NodeArena(sizeof(WirePrivate))),
+      gateArena(new NodeArena(sizeof(GatePrivate))),
+      cellArena(new NodeArena(sizeof(CellPrivate)))
 {
+    symbolTable->ref.ref();
     topModule = n->topModule;
     modules = n->modules;
     moduleNames = n->moduleNames;
-    library = n->library;
+    ownedLibrary = (n->ownedLibrary ? new CellLibrary(*n->ownedLibrary) : 0);
+    library = (ownedLibrary ? ownedLibrary : n->library);
 }
 
 CircuitPrivate::~CircuitPrivate()
 {
-    deleteNameMap(modules);
+    deleteNameMap(modules, this);
+    portArena->detach();
+    wireArena->detach();
+    gateArena->detach();
+    cellArena->detach();
+    if (!symbolTable->ref.deref())
+        delete symbolTable;
+    delete ownedLibrary;
 }
 
 size_t CircuitPrivate::gateCount() const
@@ -2837,6 +3781,17 @@ size_t CircuitPrivate::gateCount() const
     return total;
 }
 
+bool CircuitPrivate::hasModule(const std::string &name)
+{
+    return module(name) != 0;
+}
+
+ModulePrivate* CircuitPrivate::module(const std::string &name)
+{
+    std::map<std::string,ModulePrivate*>::iterator it = modules.find(name);
+    return it == modules.end() ? 0 : it->second;
+}
+
 ModulePrivate* CircuitPrivate::createModule(const std::string &name) {
     ModulePrivate *m = new ModulePrivate(this, this, name);
     if (modules.find(name) != modules.end())
@@ -2868,44 +3823,27 @@ Circuit::Circuit()
 Circuit::Circuit(const std::string &path)
 {
     CellLibrary lib;
-    // Open a Verilog file
-    std::fstream infile(path.c_str());
-    if (!infile.good())
-    {
-        std::cerr << "Could not open file: " << path << std::endl;
-        impl = 0;
-        return;
-    }
-    load(infile, path, lib);
+    load(path, lib);
 }
 
 Circuit::Circuit(const std::string &path, CellLibrary &lib)
 {
-    // Open a Verilog file
-    std::fstream infile(path.c_str());
-    if (!infile.good())
-    {
-        std::cerr << "Could not open file: " << path << std::endl;
-        impl = 0;
-        return;
-    }
-    load(infile, path, lib);
+    load(path, lib);
 }
 
 typedef struct
 {
     int id;
     Port::PortType type;
-    std::vector<std::vector<Port> > *list;
+    std::vector<std::vector<std::pair<std::string,Port::PortType> > > *list;
 }
 PortHandlerData;
 
 static void handlePortRangeCallback(const std::string &name, void *d)
 {
     PortHandlerData *data = (PortHandlerData *)d;
-    Port port(name, data->type);
     int id = data->id;
-    (*(data->list))[id].push_back(port);
+    (*(data->list))[id].push_back(std::make_pair(name, data->type));
 }
 
 static void handleWireRangeCallback(const std::string &name, void *d)
@@ -2940,16 +3878,27 @@ static void handlePortWireRange(const std::string &name, VNRange *range, void (*
     }
 }
 
+static size_t rangeWidth(VNRange *range)
+{
+    if (!range)
+        return 1;
+    int width = range->left() - range->right();
+    return (width < 0 ? -width : width) + 1;
+}
+
+// Unique within the module, so that netlists loaded on different threads
+// share no counter
 static std::string generateWireName(const Module &module)
 {
-    // not reentrant
-    static int counter = 0;
     std::string prefix = "__internal_wire_";
-    (void) module;
-    std::stringstream ss;
-    ss << prefix << counter;
-    std::string name = ss.str();
-    counter++;
+    size_t counter = module.wireSize();
+    std::string name;
+    do
+    {
+        std::stringstream ss;
+        ss << prefix << counter++;
+        name = ss.str();
+    } while (!module.wire(name).isNull());
     // std::cout << "Generate wire: " << name << std::endl;
     return name;
 }
@@ -3080,14 +4029,7 @@ static void handleOutputCallByOrder(Module &module, Gate &gate, const std::strin
 
 void Circuit::load(const std::string &path, CellLibrary &lib)
 {
-    std::fstream infile(path.c_str());
-    if (!infile.good())
-    {
-        std::cerr << "Could not open file: " << path << std::endl;
-        impl = 0;
-        return;
-    }
-    load(infile, path, lib);
+    load((std::istream*) 0, path, lib);
 }
 
 void Circuit::load(std::fstream &infile, const std::string &path)
@@ -3098,307 +4040,573 @@ void Circuit::load(std::fstream &infile, const std::string &path)
 
 void Circuit::load(std::fstream &infile, const std::string &path, CellLibrary &lib)
 {
-    if (impl && impl->ref.deref())
-        delete impl;
+    load(&infile, path, lib);
+}
 
-    VerilogContext verilog;
-    Verilog::Driver driver(verilog);
-    //driver.trace_scanning = true;
-    //driver.trace_parsing = true;
+// Elaborates the netlist statement by statement while the parser runs, so
+// no parse tree is kept. Declared ports are created in port list order just
+// before the first instance of a module needs them; a port declared after
+// that is created right away.
+//
+// With a library that is still loading, the first instance that needs it
+// and every item after it are queued until the library is ready, so they
+// are still elaborated in file order.
+//
+// An instance of a module that is defined further down the file is kept
+// until finish(), which also picks the top module.
+class CircuitBuilder : public VerilogBuilder
+{
+public:
+    CircuitBuilder(Circuit &circuit, CellLibrary &lib)
+        : failed(false), modules(0), circuit(circuit), lib(&lib), portsCreated(false) {}
+    CircuitBuilder(Circuit &circuit, const std::shared_future<CellLibrary> &pending)
+        : failed(false), modules(0), circuit(circuit), lib(0), pending(pending), portsCreated(false) {}
+    ~CircuitBuilder();
+
+    bool beginModule(const VNModule &vmodule);
+    bool addItem(VerilogNode *item);
+    bool endModule();
+    void finish();
 
-    // Start parsing the Verilog file
-    verilog.clearExpressions();
-    bool result = driver.parse_stream(infile, path);
-    if (!result || verilog.expressions.size() == 0)
+    bool failed;
+    size_t modules;
+
+private:
+    bool fail()
     {
-        std::cerr << "Failed to parse" << std::endl;
-        impl = 0;
-        return;
+        failed = true;
+        return false;
+    }
+    bool libraryReady();
+    bool flush();
+    bool take(VerilogNode *item);
+    bool elaborate(const VerilogNode &item);
+    bool addPorts(const std::string &name, VNRange *range, Port::PortType type);
+    void createPorts();
+    bool addNet(const VNNet &net);
+    bool addAssign(const VNAssign &assign);
+    void addGateInst(const VNGateInst &gInst);
+    Cell prototype(const std::string &type);
+    void addModuleInst(const VNModuleInst &mInst);
+
+    Circuit &circuit;
+    const CellLibrary *lib;
+    std::shared_future<CellLibrary> pending;
+    std::vector<VerilogNode*> deferred;
+    Module module;
+    std::map<std::string,int> portListDef;
+    std::vector<std::vector<std::pair<std::string,Port::PortType> > > portList;
+    bool portsCreated;
+    std::map<std::string,Cell> prototypes;
+    std::set<std::string> defined;
+    std::vector<std::pair<Module,VerilogNode*> > forward;
+};
+
+bool CircuitBuilder::beginModule(const VNModule &vmodule)
+{
+    // Use top module name as the circuit name, finish() may pick another
+    if (++modules == 1)
+        circuit.setName(vmodule.name());
+    module = circuit.createModule(vmodule.name());
+    if (module.isNull())
+    {
+        std::cerr << "Duplicate module: " << vmodule.name() << std::endl;
+        return fail();
+    }
+    if (modules == 1)
+        circuit.setTopModule(module);
+    module.beginEdit();
+
+    // Create port list of current module
+    portListDef.clear();
+    portList.clear();
+    portList.resize(vmodule.portSize());
+    portsCreated = false;
+    prototypes.clear();
+    for (size_t i = 0; i < vmodule.portSize(); i++)
+        portListDef[vmodule.port(i)->name()] = i;
+    // Duplicate listing port names error
+    if (vmodule.portSize() != portListDef.size())
+    {
+        std::cerr << "Duplicate listing port names." << std::endl;
+        return fail();
     }
+    return true;
+}
+
+CircuitBuilder::~CircuitBuilder()
+{
+    // Left over when the parse fails
+    for (size_t i = 0; i < deferred.size(); i++)
+        delete deferred[i];
+    for (size_t i = 0; i < forward.size(); i++)
+        delete forward[i].second;
+}
 
-    // Use top module name as the circuit name
-    VNModule *topModule = ((VNModule*)(verilog.expressions[0]));
-    impl = new CircuitPrivate(topModule->name());
+bool CircuitBuilder::libraryReady()
+{
+    if (lib)
+        return true;
+    if (pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return false;
+    lib = &pending.get();
+    return true;
+}
 
-    if (topModule->gateInstSize() > 0 && !lib.isDefault())
+// Elaborates the queued items, waiting for the library if needed
+bool CircuitBuilder::flush()
+{
+    if (!lib)
+        lib = &pending.get();
+    bool result = true;
+    for (size_t i = 0; i < deferred.size(); i++)
     {
-        std::cerr << "Warning: Cell Library is given but not used" << std::endl;
+        if (result)
+            result = take(deferred[i]);
+        else
+            delete deferred[i];
     }
+    deferred.clear();
+    return result;
+}
 
-    // TODO implement it
-    if (verilog.expressions.size() > 1)
+bool CircuitBuilder::addItem(VerilogNode *item)
+{
+    VerilogNode::NodeType type = item->nodeType();
+    bool instance = (type == VerilogNode::GateInstNode || type == VerilogNode::ModuleInstNode);
+    if (!deferred.empty() || (instance && !libraryReady()))
     {
-        std::cerr << "Error: Multiple module feature is not supported yet" << std::endl;
+        item->detach();
+        deferred.push_back(item);
+        return !libraryReady() || flush();
     }
+    return take(item);
+}
 
-    // Start building circuit
-    for (unsigned int ei = 0; ei < verilog.expressions.size(); ++ei)
+// Elaborates the item, or keeps an instance of a module not defined yet
+bool CircuitBuilder::take(VerilogNode *item)
+{
+    if (item->nodeType() == VerilogNode::ModuleInstNode)
     {
-        VNModule *vmodule = ((VNModule*)verilog.expressions[ei]);
-        Module module = createModule(vmodule->name());
-        if (ei == 0)
-            setTopModule(module);
+        std::string type = ((const VNModuleInst*) item)->name().str();
+        if (!defined.count(type) && prototype(type).isNull())
+        {
+            createPorts();
+            item->detach();
+            forward.push_back(std::make_pair(module, item));
+            return true;
+        }
+    }
+    bool result = elaborate(*item);
+    delete item;
+    return result;
+}
 
-        // Create port list of current module
-        std::map<std::string,int> portListDef;
-        std::vector<std::vector<Port> > portList;
-        if (vmodule->portSize() > 0)
+bool CircuitBuilder::elaborate(const VerilogNode &item)
+{
+    switch (item.nodeType())
+    {
+        case VerilogNode::InputNode:
         {
-            for (size_t i = 0; i < vmodule->portSize(); i++) {
-                portListDef[vmodule->port(i)->name()] = i;
-                std::vector<Port> tmp;
-                portList.push_back(tmp);
-            }
+            const VNInput &input = (const VNInput&) item;
+            for (size_t j = 0; j < input.varSize(); j++)
+                if (!addPorts(input.var(j)->name().str(), input.range(), Port::Input))
+                    return false;
+            break;
         }
-        // Duplicate listing port names error
-        if (vmodule->portSize() != portListDef.size())
+        case VerilogNode::OutputNode:
         {
-            std::cerr << "Duplicate listing port names." << std::endl;
-            delete impl;
-            impl = 0;
-            return;
+            const VNOutput &output = (const VNOutput&) item;
+            for (size_t j = 0; j < output.varSize(); j++)
+                if (!addPorts(output.var(j)->name().str(), output.range(), Port::Output))
+                    return false;
+            break;
         }
+        case VerilogNode::NetNode:
+            return addNet((const VNNet&) item);
+        case VerilogNode::AssignNode:
+            createPorts();
+            return addAssign((const VNAssign&) item);
+        case VerilogNode::GateInstNode:
+            createPorts();
+            addGateInst((const VNGateInst&) item);
+            break;
+        case VerilogNode::ModuleInstNode:
+            createPorts();
+            addModuleInst((const VNModuleInst&) item);
+            break;
+        default:
+            ; // Do nothing
+    }
+    return true;
+}
 
-        // Inputs
-        for (size_t i = 0; i < vmodule->inputSize(); i++)
+bool CircuitBuilder::endModule()
+{
+    if (!flush())
+        return false;
+    createPorts();
+    if (!portListDef.empty())
+    {
+        std::cerr << "Port is not defined: ";
+        std::string comma = "";
+        for (std::map<std::string,int>::iterator it = portListDef.begin();
+                it != portListDef.end(); ++it)
         {
-            VNInput *input = vmodule->input(i);
-            VNRange *range = input->range();
+            std::cerr << comma << (it->first);
+            comma = ", ";
+        }
+        std::cout << std::endl;
+        return fail();
+    }
 
-            for (size_t j = 0; j < input->varSize(); j++)
-            {
-                std::string inputName = input->var(j)->name();
+    module.commitEdit();
+    defined.insert(module.name());
+    return true;
+}
 
-                std::map<std::string,int>::iterator found = portListDef.find(inputName);
-                if (found == portListDef.end())
-                {
-                    std::cerr << "Port is not in the list: " << inputName << std::endl;
-                    delete impl;
-                    impl = 0;
-                    return;
-                }
-                int id = found->second;
-                portListDef.erase(found);
-
-                PortHandlerData data;
-                data.id = id;
-                data.type = Port::Input;
-                data.list = &portList;
-                handlePortWireRange(inputName, range, handlePortRangeCallback, &data);
-            }
-        }
+// The top module is the first one no other module instantiates
+void CircuitBuilder::finish()
+{
+    for (size_t i = 0; i < forward.size(); i++)
+    {
+        module = forward[i].first;
+        module.beginEdit();
+        addModuleInst((const VNModuleInst&) *forward[i].second);
+        module.commitEdit();
+        delete forward[i].second;
+    }
+    forward.clear();
 
-        // Outputs
-        for (size_t i = 0; i < vmodule->outputSize(); i++)
+    std::set<std::string> instantiated;
+    for (size_t i = 0; i < circuit.moduleSize(); i++)
+    {
+        Module m = circuit.module(i);
+        for (size_t j = 0; j < m.instanceSize(); j++)
+            instantiated.insert(m.instance(j).type());
+    }
+    for (size_t i = 0; i < circuit.moduleSize(); i++)
+    {
+        Module m = circuit.module(i);
+        if (!instantiated.count(m.name()))
         {
-            VNOutput *output = vmodule->output(i);
-            VNRange *range = output->range();
+            circuit.setTopModule(m);
+            circuit.setName(m.name());
+            break;
+        }
+    }
+}
 
-            for (size_t j = 0; j < output->varSize(); j++)
-            {
-                std::string outputName = output->var(j)->name();
+bool CircuitBuilder::addPorts(const std::string &name, VNRange *range, Port::PortType type)
+{
+    std::map<std::string,int>::iterator found = portListDef.find(name);
+    if (found == portListDef.end())
+    {
+        std::cerr << "Port is not in the list: " << name << std::endl;
+        return fail();
+    }
+    int id = found->second;
+    portListDef.erase(found);
 
-                std::map<std::string,int>::iterator found = portListDef.find(outputName);
-                if (found == portListDef.end())
-                {
-                    std::cerr << "Port is not in the list: " << outputName << std::endl;
-                    delete impl;
-                    impl = 0;
-                    return;
-                }
-                int id = found->second;
-                portListDef.erase(found);
-
-                PortHandlerData data;
-                data.id = id;
-                data.type = Port::Output;
-                data.list = &portList;
-                handlePortWireRange(outputName, range, handlePortRangeCallback, &data);
-            }
-        }
+    PortHandlerData data;
+    data.id = id;
+    data.type = type;
+    data.list = &portList;
+    handlePortWireRange(name, range, handlePortRangeCallback, &data);
+
+    // Late declaration, the other ports already exist
+    if (portsCreated)
+    {
+        for (size_t j = 0; j < portList[id].size(); j++)
+            module.createPort(portList[id][j].first, portList[id][j].second);
+    }
+    return true;
+}
 
-        // Nets
-        for (size_t i = 0; i < vmodule->netSize(); i++)
+// Setup ports for instances to connect to
+void CircuitBuilder::createPorts()
+{
+    if (portsCreated)
+        return;
+    portsCreated = true;
+    for (size_t i = 0; i < portList.size(); i++)
+    {
+        for (size_t j = 0; j < portList[i].size(); j++)
         {
-            VNNet *net = vmodule->net(i);
-            VNRange *range = net->range();
-            if (net->type() != "wire")
-            {
-                std::cerr << "Unsupported net type: " << net->type() << std::endl;
-                delete impl;
-                impl = 0;
-                return;
-            }
-            for (size_t j = 0; j < net->varSize(); j++)
-            {
-                std::string netName = net->var(j)->name();
-                handlePortWireRange(netName, range, handleWireRangeCallback, &module);
-            }
+            const std::pair<std::string,Port::PortType> &port = portList[i][j];
+            module.createPort(port.first, port.second);
         }
+    }
+}
+
+bool CircuitBuilder::addNet(const VNNet &net)
+{
+    VNRange *range = net.range();
+    if (net.type() != "wire")
+    {
+        std::cerr << "Unsupported net type: " << net.type() << std::endl;
+        return fail();
+    }
+    // Netlists declare their wires in a few long statements
+    module.reserve(module.portSize(), module.wireSize() + net.varSize() * rangeWidth(range),
+                   module.gateSize(), module.cellSize());
+    for (size_t j = 0; j < net.varSize(); j++)
+    {
+        std::string netName = net.var(j)->name().str();
+        handlePortWireRange(netName, range, handleWireRangeCallback, &module);
+    }
+    return true;
+}
+
+// Only an output port can be assigned. It is tied to the net of the right
+// hand side, as if that net were connected to it by name.
+bool CircuitBuilder::addAssign(const VNAssign &assign)
+{
+    Port lhs = module.port(assign.lhs().str());
+    if (lhs.isNull() || lhs.type() != Port::Output)
+    {
+        std::cerr << "Unsupported assignment to: " << assign.lhs() << std::endl;
+        return fail();
+    }
 
-        // Setup ports for instances to connect to
-        for (size_t i = 0; i < portList.size(); i++)
+    std::string from = assign.rhs().str();
+    Wire w = module.wire(from);
+    if (w.isNull())
+    {
+        Port p = module.port(from);
+        if (!p.isNull())
         {
-            for (size_t j = 0; j < portList[i].size(); j++)
-            {
-                Port &port = portList[i][j];
-                module.createPort(port.name(), port.type());
-            }
+            w = module.createWire(from);
+            if (p.type() == Port::Output)
+                p.connect(Node::dir2str(Node::Direct::left), w);
+            else
+                p.connect(Node::dir2str(Node::Direct::right), w);
         }
-
-        // Gate instance in the module
-        for (size_t i = 0; i < vmodule->gateInstSize(); i++)
+        else if (from == "1'b0" || from == "1'b1")
         {
-            VNGateInst *gInst = vmodule->gateInst(i);
-            Gate::GateType type;
-            if (gInst->type() == "and")         { type = Gate::AND; }
-            else if (gInst->type() == "nand")   { type = Gate::NAND; }
-            else if (gInst->type() == "or")     { type = Gate::OR; }
-            else if (gInst->type() == "nor")    { type = Gate::NOR; }
-            else if (gInst->type() == "xor")    { type = Gate::XOR; }
-            else if (gInst->type() == "xnor")   { type = Gate::XNOR; }
-            else if (gInst->type() == "buf")    { type = Gate::BUF; }
-            else if (gInst->type() == "not")    { type = Gate::AND; }
-            else                                { type = Gate::BaseGate; }
-
-            for (size_t j = 0; j < gInst->instSize(); j++)
-            {
-                VNInstance *inst = gInst->inst(j);
-                Gate gate = module.createGate(inst->name(), type);
+            w = module.createWire(generateWireName(module));
+            w.setValue(from == "1'b0" ? 0 : 1);
+        }
+        else
+        {
+            std::cerr << "No port/wire can be assigned: " << from << std::endl;
+            return fail();
+        }
+    }
+    lhs.connect(Node::dir2str(Node::Direct::left), w);
+    return true;
+}
+
+// Gate instance in the module
+void CircuitBuilder::addGateInst(const VNGateInst &gInst)
+{
+    if (modules == 1 && module.gateSize() == 0 && !lib->isDefault())
+    {
+        std::cerr << "Warning: Cell Library is given but not used" << std::endl;
+    }
+
+    Gate::GateType type;
+    if (gInst.type() == "and")         { type = Gate::AND; }
+    else if (gInst.type() == "nand")   { type = Gate::NAND; }
+    else if (gInst.type() == "or")     { type = Gate::OR; }
+    else if (gInst.type() == "nor")    { type = Gate::NOR; }
+    else if (gInst.type() == "xor")    { type = Gate::XOR; }
+    else if (gInst.type() == "xnor")   { type = Gate::XNOR; }
+    else if (gInst.type() == "buf")    { type = Gate::BUF; }
+    else if (gInst.type() == "not")    { type = Gate::INV; }
+    else                               { type = Gate::BaseGate; }
+
+    for (size_t j = 0; j < gInst.instSize(); j++)
+    {
+        VNInstance *inst = gInst.inst(j);
+        Gate gate = module.createGate(inst->name().str(), type);
 #ifdef DEBUG
-                std::cout << inst->connSize() << std::endl;
-                std::cout << inst->name() << "(" << gInst->type() << ")" << std::endl;
+        std::cout << inst->connSize() << std::endl;
+        std::cout << inst->name() << "(" << gInst.type() << ")" << std::endl;
 #endif
-                size_t inputCounter = 0;
-                size_t outputCounter = 0;
-                for (size_t k = 0; k < inst->connSize(); k++)
-                {
-                    //std::string to = inst->conn(k)->to();
-                    std::string from = inst->conn(k)->from();
+        size_t inputCounter = 0;
+        size_t outputCounter = 0;
+        for (size_t k = 0; k < inst->connSize(); k++)
+        {
+            //std::string to = inst->conn(k)->to();
+            std::string from = inst->conn(k)->from().str();
 #ifdef DEBUG
-                    std::string spaces(2, ' ');
-                    if (k == 0)
-                        std::cout << spaces << "Output is connected to '" << from << "'" << std::endl;
-                    else
-                        std::cout << spaces << "Input " << k - 1 << " is connected to '" << from << "'" << std::endl;
+            std::string spaces(2, ' ');
+            if (k == 0)
+                std::cout << spaces << "Output is connected to '" << from << "'" << std::endl;
+            else
+                std::cout << spaces << "Input " << k - 1 << " is connected to '" << from << "'" << std::endl;
 #endif
-                    if (k == 0) // output
-                        handleOutputCallByOrder(module, gate, from, &outputCounter);
-                    else
-                        handleInputCallByOrder(module, gate, from, &inputCounter);
-                }
-            }
+            if (k == 0) // output
+                handleOutputCallByOrder(module, gate, from, &outputCounter);
+            else
+                handleInputCallByOrder(module, gate, from, &inputCounter);
         }
+    }
+}
+
+// The library cell of the type, null if there is none
+Cell CircuitBuilder::prototype(const std::string &type)
+{
+    std::map<std::string,Cell>::iterator proto = prototypes.find(type);
+    if (proto == prototypes.end())
+        proto = prototypes.insert(std::make_pair(type, lib->cell(type))).first;
+    return proto->second;
+}
 
-        // Module instances in the module
-        // TODO
-        for (size_t i = 0; i < vmodule->moduleInstSize(); i++)
+// Library cells, or instances of modules of the netlist
+void CircuitBuilder::addModuleInst(const VNModuleInst &mInst)
+{
+    std::string type = mInst.name().str();
+    Cell proto = prototype(type);
+    Module definition;
+    if (proto.isNull())
+        definition = circuit.module(type);
+    for (size_t j = 0; j < mInst.instSize(); j++)
+    {
+        VNInstance *inst = mInst.inst(j);
+        if (proto.isNull() && definition.isNull())
         {
-            VNModuleInst *mInst = vmodule->moduleInst(i);
-            for (size_t j = 0; j < mInst->instSize(); j++)
-            {
-                VNInstance *inst = mInst->inst(j);
-                Cell cell = lib.cell(mInst->name());
+            std::cerr << "WARNING: Unknown module: " << type << std::endl;
+            continue;
+        }
 
-                if (cell.isNull())
-                {
-                    std::cerr << "WARNING: Unknown module: " << mInst->name() << std::endl;
-                    // Connect modules after modules are all created.
-                    // TODO somewhere to store module connectivity
-                    continue;
-                }
+        std::string name = inst->name().str();
+        Cell cell = proto.isNull() ? module.createInstance(name, definition)
+                                   : module.createCell(name, proto);
 
-                cell.setName(mInst->inst(0)->name());
+        size_t inputCounter = 0;
+        size_t outputCounter = 0;
+        for (size_t k = 0; k < inst->connSize(); k++)
+        {
+            std::string to = inst->conn(k)->to().str();
+            std::string from = inst->conn(k)->from().str();
+            // Call by order
+            if (to == "")
+            {
+#ifdef DEBUG
+                std::cout << cell.name() << "(" << cell.type() << ")" << std::endl;
+                std::string spaces(2, ' ');
+                std::cout << spaces;
+                if (cell.pinType(k) == Port::Input)
+                    std::cout << "Input '" << k << "' is connected to '" << from << "'" << std::endl;
+                else if (cell.pinType(k) == Port::Output)
+                    std::cout << "Output '" << k << "' is connected to '" << from << "'" << std::endl;
+                else
+                    std::cout << "Don't known how to connect '" << k << "' and '" << from << "'" << std::endl;
+#endif
+                //TODO
+                //
 
-                size_t inputCounter = 0;
-                size_t outputCounter = 0;
-                for (size_t k = 0; k < inst->connSize(); k++)
+                if (cell.pinType(k) == Port::Input)
+                    handleInputCallByOrder(module, cell, from, &inputCounter);
+                else if (cell.pinType(k) == Port::Output)
+                    handleOutputCallByOrder(module, cell, from, &outputCounter);
+                else
+                    std::cout << "Don't known how to connect '" << k << "' and '" << from << "'" << std::endl;
+            }
+            else // Call by name
+            {
+                Port p = module.port(from);
+                if (p.isNull())
                 {
-                    std::string to = inst->conn(k)->to();
-                    std::string from = inst->conn(k)->from();
-                    // Call by order
-                    if (to == "")
+                    Wire w = module.wire(from);
+                    if (!w.isNull())
+                        cell.connect(to, w);
+                    else
                     {
-#ifdef DEBUG
-                        std::cout << cell.name() << "(" << cell.type() << ")" << std::endl;
-                        std::string spaces(2, ' ');
-                        std::cout << spaces;
-                        if (cell.pinType(k) == Port::Input)
-                            std::cout << "Input '" << k << "' is connected to '" << from << "'" << std::endl;
-                        else if (cell.pinType(k) == Port::Output)
-                            std::cout << "Output '" << k << "' is connected to '" << from << "'" << std::endl;
-                        else
-                            std::cout << "Don't known how to connect '" << k << "' and '" << from << "'" << std::endl;
-#endif
-                        //TODO
-                        //
-
-                        if (cell.pinType(k) == Port::Input)
-                            handleInputCallByOrder(module, cell, from, &inputCounter);
-                        else if (cell.pinType(k) == Port::Output)
-                            handleOutputCallByOrder(module, cell, from, &outputCounter);
-                        else
-                            std::cout << "Don't known how to connect '" << k << "' and '" << from << "'" << std::endl;
+                        handleOtherExpr(module, cell, to, from);
                     }
-                    else // Call by name
+                }
+                else
+                {
+                    Wire w = module.wire(from);
+                    if (w.isNull())
                     {
-                        Port p = module.port(from);
-                        if (p.isNull())
-                        {
-                            Wire w = module.wire(from);
-                            if (!w.isNull())
-                                cell.connect(to, w);
-                            else
-                            {
-                                handleOtherExpr(module, cell, to, from);
-                            }
-                        }
-                        else
+                        w = module.createWire(from);
+                        switch (p.type())
                         {
-                            Wire w = module.wire(from);
-                            if (w.isNull())
-                            {
-                                w = module.createWire(from);
-                                switch (p.type())
-                                {
-                                    case Port::Input:
-                                        p.connect(Node::dir2str(Node::Direct::right), w);
-                                        break;
-                                    case Port::Output:
-                                        p.connect(Node::dir2str(Node::Direct::left), w);
-                                        break;
-                                    default: ;/* do nothing */
-                                }
-                            }
-                            cell.connect(to, w);
-                            //cell.connect(to, p);
+                            case Port::Input:
+                                p.connect(Node::dir2str(Node::Direct::right), w);
+                                break;
+                            case Port::Output:
+                                p.connect(Node::dir2str(Node::Direct::left), w);
+                                break;
+                            default: ;/* do nothing */
                         }
                     }
+                    cell.connect(to, w);
+                    //cell.connect(to, p);
                 }
-                module.addCell(cell);
-                /* module.setNodeName(cell, mInst->inst(0)->name()); */
             }
         }
+    }
+}
 
-        if (!portListDef.empty())
-        {
-            std::cerr << "Port is not defined: ";
-            std::string comma = "";
-            for (std::map<std::string,int>::iterator it = portListDef.begin();
-                    it != portListDef.end(); ++it)
-            {
-                std::cerr << comma << (it->first);
-                comma = ", ";
-            }
-            std::cout << std::endl;
-            delete impl;
-            impl = 0;
-            return;
-        }
+void Circuit::load(std::istream *infile, const std::string &path, CellLibrary &lib)
+{
+    CircuitBuilder builder(*this, lib);
+    if (load(infile, path, builder))
+        IMPL->library = (lib.isDefault() ? 0 : &lib);
+}
+
+// Without a stream the file is memory-mapped and lexed in place, see
+// Verilog::Driver::parse_file(). Compressed files are lexed while a second
+// thread decompresses them.
+bool Circuit::load(std::istream *infile, const std::string &path, CircuitBuilder &builder)
+{
+    Compression compression = (infile ? NoCompression : fileCompression(path));
+    if (compression != NoCompression)
+    {
+        DecompressingStream stream(path, compression);
+        return load(&stream, path, builder);
+    }
+
+    if (impl && !impl->ref.deref())
+        delete impl;
+    impl = new CircuitPrivate(std::string());
+
+    VerilogContext verilog;
+    Verilog::Driver driver(verilog);
+    //driver.trace_scanning = true;
+    //driver.trace_parsing = true;
+    driver.builder = &builder;
 
-        IMPL->path = path;
+    // Start parsing the Verilog file, building the circuit as it goes
+    bool result = infile ? driver.parse_stream(*infile, path) : driver.parse_file(path);
+    if (result && !builder.failed && builder.modules)
+        builder.finish();
+    if (!builder.failed && (!result || builder.modules == 0))
+        std::cerr << "Failed to parse" << std::endl;
+    if (builder.failed || !result || builder.modules == 0)
+    {
+        delete impl;
+        impl = 0;
+        return false;
     }
-    IMPL->library = (lib.isDefault() ? 0 : &lib);
+
+    IMPL->path = path;
+    return true;
+}
+
+std::future<Circuit> Circuit::loadAsync(const std::string &path)
+{
+    return std::async(std::launch::async, [path]() { return Circuit(path); });
+}
+
+std::future<Circuit> Circuit::loadAsync(const std::string &path, const std::shared_future<CellLibrary> &lib)
+{
+    return std::async(std::launch::async, [path, lib]() {
+        Circuit circuit;
+        CircuitBuilder builder(circuit, lib);
+        if (circuit.load((std::istream*) 0, path, builder) && !lib.get().isDefault())
+        {
+            CircuitPrivate *p = (CircuitPrivate*) circuit.impl;
+            p->ownedLibrary = new CellLibrary(lib.get());
+            p->library = p->ownedLibrary;
+        }
+        return circuit;
+    });
 }
 
 Circuit::Circuit(const Circuit &x)
@@ -3416,6 +4624,16 @@ Circuit& Circuit::operator= (const Circuit &x)
     return (Circuit&) Node::operator=(x);
 }
 
+Circuit::Circuit(Circuit &&x)
+    : Node(std::move(x))
+{
+}
+
+Circuit& Circuit::operator=(Circuit &&x)
+{
+    return (Circuit&) Node::operator=(std::move(x));
+}
+
 size_t Circuit::gateCount() const
 {
     if (!impl)
@@ -3449,7 +4667,19 @@ Module Circuit::module(const std::string &name) const
 {
     if (!impl)
         return Module();
-    return Module(IMPL->modules[name]);
+    return Module(IMPL->module(name));
+}
+
+Circuit::iterator Circuit::begin() const
+{
+    Module top = topModule();
+    return top.gateSize() ? top.gates().begin() : top.cells().begin();
+}
+
+Circuit::iterator Circuit::end() const
+{
+    Module top = topModule();
+    return top.gateSize() ? top.gates().end() : top.cells().end();
 }
 
 Module Circuit::topModule() const
@@ -7,8 +7,12 @@
 #include <vector>
 #include <list>
 #include <iterator>
+#include <cstddef>
+#include <cstdint>
+#include <future>
 
 class CellLibrary;
+class CircuitBuilder;
 
 class NodePrivate;
 class PortPrivate;
@@ -25,11 +29,17 @@ class Gate;
 class Cell;
 class Module;
 class Circuit;
+class NodeRef;
+class CellRef;
+class NodeRange;
 
 enum DelayType { None, MinDelay, MaxDelay };
 enum TimingSense { NegativeUnate, PositiveUnate, NonUnate };
 
 typedef std::string Pattern;
+// Two bits, the same as one pattern of the four-valued packed simulation:
+// bit 0 is the value plane and bit 1 the unknown plane. Operators read Z
+// as X, and a controlling 0 (for &) or 1 (for |) wins over an unknown.
 class Signal
 {
 public:
@@ -47,16 +57,22 @@ public:
     };
     Signal();
     Signal(unsigned s);
-    Signal operator& (const Signal&);
+    static inline Signal fromPlanes(bool value, bool unknown) { return Signal(unknown << 1 | value); }
+    inline bool valuePlane() const   { return value & 1; }
+    inline bool unknownPlane() const { return value >> 1; }
+
+    Signal operator& (const Signal&) const;
     Signal operator&= (const Signal&);
-    Signal operator| (const Signal&);
+    Signal operator| (const Signal&) const;
     Signal operator|= (const Signal&);
-    bool operator== (const Signal&);
-
-    bool operator== (const SignalType&);
-    bool operator!= (const SignalType&);
-    Signal operator~ ();
-    Signal operator! ();
+    Signal operator^ (const Signal&) const;
+    Signal operator^= (const Signal&);
+    bool operator== (const Signal&) const;
+
+    bool operator== (const SignalType&) const;
+    bool operator!= (const SignalType&) const;
+    Signal operator~ () const;
+    Signal operator! () const;
     friend std::ostream& operator<< (std::ostream&, const Signal&);
 
 private:
@@ -85,6 +101,8 @@ public:
     Node();
     Node(const Node&);
     Node& operator= (const Node&);
+    Node(Node&&);
+    Node& operator= (Node&&);
     bool operator== (const Node&) const;
     bool operator!= (const Node&) const;
     ~Node();
@@ -141,9 +159,114 @@ public:
     Signal value() const;
     void setValue(Signal value);
 
+    // Neighbours as non-owning references, in pin order
+    NodeRange fanin() const;
+    NodeRange fanout() const;
+
 protected:
     NodePrivate* impl;
     Node(NodePrivate*);
+
+    friend class NetlistView;
+    friend class NodeRef;
+};
+
+// Non-owning reference to a node. Unlike the Node handles it does no
+// reference counting, so it is only valid while the node is in its module.
+class NodeRef
+{
+public:
+    NodeRef() : impl(0) {}
+    NodeRef(const Node &node) : impl(node.impl) {}
+
+    inline bool isNull() const { return impl == 0; }
+    inline bool operator== (const NodeRef &o) const { return impl == o.impl; }
+    inline bool operator!= (const NodeRef &o) const { return impl != o.impl; }
+
+    std::string name() const;
+    Node::NodeType nodeType() const;
+    inline bool isPort() const { return nodeType() == Node::PortNode; }
+    inline bool isWire() const { return nodeType() == Node::WireNode; }
+    inline bool isGate() const { return nodeType() == Node::GateNode; }
+    inline bool isCell() const { return nodeType() == Node::CellNode; }
+
+    size_t inputSize() const;
+    size_t outputSize() const;
+    NodeRef input(size_t i) const;
+    NodeRef output(size_t i) const;
+    NodeRef input(const std::string &name) const;
+    NodeRef output(const std::string &name) const;
+    NodeRange fanin() const;
+    NodeRange fanout() const;
+
+    // Full, reference-counted handle
+    Node toNode() const;
+    // Null unless the node is a cell
+    CellRef toCell() const;
+
+protected:
+    explicit NodeRef(NodePrivate *p) : impl(p) {}
+
+    NodePrivate *impl;
+
+    friend class NodeRange;
+    friend class NetlistView;
+};
+
+// Nodes stored contiguously inside a circuit, such as the cells of a
+// module or the fanin of a node, seen as NodeRefs. Like a vector
+// iterator, a range is invalidated by edits of what it covers.
+class NodeRange
+{
+public:
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::ptrdiff_t difference_type;
+        typedef NodeRef value_type;
+        typedef const NodeRef *pointer;
+        typedef NodeRef reference;
+
+        const_iterator() : p(0), stride(0) {}
+        inline NodeRef operator*() const { return NodeRange::at(p); }
+        inline bool operator==(const const_iterator &o) const { return p == o.p; }
+        inline bool operator!=(const const_iterator &o) const { return p != o.p; }
+        inline const_iterator &operator++() { p += stride; return *this; }
+        inline const_iterator operator++(int) { const_iterator i = *this; p += stride; return i; }
+
+    private:
+        const_iterator(const char *p, size_t stride) : p(p), stride(stride) {}
+
+        const char *p;
+        size_t stride;
+
+        friend class NodeRange;
+    };
+    typedef const_iterator iterator;
+
+    NodeRange() : first(0), count(0), stride(0) {}
+
+    inline const_iterator begin() const { return const_iterator(first, stride); }
+    inline const_iterator end() const { return const_iterator(first + count * stride, stride); }
+    inline size_t size() const { return count; }
+    inline bool empty() const { return count == 0; }
+    inline NodeRef operator[](size_t i) const { return at(first + i * stride); }
+
+private:
+    // Each element starts with the NodePrivate pointer
+    NodeRange(const void *first, size_t count, size_t stride)
+        : first((const char*) first), count(count), stride(stride) {}
+    static inline NodeRef at(const char *p) { return NodeRef(*(NodePrivate* const*) p); }
+
+    const char *first;
+    size_t count;
+    size_t stride;
+
+    friend class Node;
+    friend class NodeRef;
+    friend class Module;
+    friend class Circuit;
 };
 
 class Port : public Node
@@ -160,6 +283,8 @@ public:
     Port(const std::string&, PortType);
     Port(const Port&);
     Port& operator= (const Port&);
+    Port(Port&&);
+    Port& operator= (Port&&);
 
     PortType type() const;
 
@@ -179,6 +304,8 @@ public:
     Wire();
     Wire(const Wire&);
     Wire& operator= (const Wire&);
+    Wire(Wire&&);
+    Wire& operator= (Wire&&);
 
     // Overridden from Node
     inline Node::NodeType nodeType() const { return WireNode; }
@@ -210,6 +337,8 @@ public:
     Gate(const std::string &name, GateType type);
     Gate(const Gate&);
     Gate& operator= (const Gate&);
+    Gate(Gate&&);
+    Gate& operator= (Gate&&);
 
     int level() const;
     void setLevel(int level);
@@ -237,6 +366,8 @@ public:
     Cell(const std::string &name, const std::string &type);
     Cell(const Cell&);
     Cell& operator= (const Cell&);
+    Cell(Cell&&);
+    Cell& operator= (Cell&&);
 
     //Gate::GateType gateType() const;
 
@@ -272,6 +403,8 @@ public:
     std::string inputPinName(size_t i);
     std::string outputPinName(size_t i);
     Port::PortType pinType(size_t) const;
+    // The module an instance refers to, null for a library cell
+    Module definition() const;
 
     void setArea(double);
     void setFunction(const std::string&);
@@ -299,6 +432,47 @@ private:
 
     friend class Node;
     friend class Module;
+    friend class Circuit;
+};
+
+// Non-owning view of a cell with the read-only Cell API. Like NodeRef it
+// is only valid while the cell is in its module.
+class CellRef : public NodeRef
+{
+public:
+    CellRef() {}
+    CellRef(const Cell &cell) : NodeRef(cell) {}
+    explicit CellRef(const NodeRef &node);
+
+    int level() const;
+    Gate::GateType gateType() const;
+    std::string type() const;
+    std::string function() const;
+    double area() const;
+    std::string inputPinName(size_t i) const;
+    std::string outputPinName(size_t i) const;
+    Port::PortType pinType(size_t) const;
+
+    double inputCapacitance(size_t index) const;
+    double inputCapacitance(const std::string &pinIn) const;
+    double inputCapacitanceRise(size_t index) const;
+    double inputCapacitanceRise(const std::string &pinIn) const;
+    double inputCapacitanceRiseMin(size_t index) const;
+    double inputCapacitanceRiseMin(const std::string &pinIn) const;
+    double inputCapacitanceRiseMax(size_t index) const;
+    double inputCapacitanceRiseMax(const std::string &pinIn) const;
+    double inputCapacitanceFall(size_t index) const;
+    double inputCapacitanceFall(const std::string &pinIn) const;
+    double inputCapacitanceFallMin(size_t index) const;
+    double inputCapacitanceFallMin(const std::string &pinIn) const;
+    double inputCapacitanceFallMax(size_t index) const;
+    double inputCapacitanceFallMax(const std::string &pinIn) const;
+    double outputMaxCapacitance(const std::string &pinOut) const;
+    double outputMaxTransition(const std::string &pinOut) const;
+    double delay(const std::string &pinIn, const std::string &pinOut, Signal::Transition transIn, double inputSlew, double outputLoad) const;
+    double slew(const std::string &pinIn, const std::string &pinOut, Signal::Transition transIn, double inputSlew, double outputLoad) const;
+    double loadingMax(const std::string &pinIn, const std::string &pinOut, Signal::Transition transIn) const;
+    TimingSense timingSense(const std::string &pinIn, const std::string &pinOut) const;
 };
 
 class Module : public Node
@@ -307,6 +481,8 @@ public:
     Module();
     Module(const Module&);
     Module& operator= (const Module&);
+    Module(Module&&);
+    Module& operator= (Module&&);
 
     // Read
     Pattern input() const;
@@ -347,20 +523,58 @@ public:
     Gate gate(const std::string&) const;
     Cell cell(const std::string&) const;
 
+    NodeRange ports() const;
+    NodeRange wires() const;
+    NodeRange gates() const;
+    NodeRange cells() const;
+    // PI(i) ... outputPort(i) without a handle for each port
+    NodeRange PIs() const;
+    NodeRange POs() const;
+    NodeRange PPIs() const;
+    NodeRange PPOs() const;
+    NodeRange inputPorts() const;
+    NodeRange outputPorts() const;
+
+    // Instances of other modules are cells whose definition() is that
+    // module. They are kept apart from the cells, and a module is stored
+    // once however often it is instantiated. See Circuit::flatten().
+    size_t instanceSize() const;
+    bool hasInstance(const std::string&) const;
+    Cell instance(size_t i) const;
+    Cell instance(const std::string&) const;
+    NodeRange instances() const;
+    Cell createInstance(const std::string &name, const Module &definition);
+    std::vector<Module> submodules() const; // instantiated here, each once
+    size_t flatGateCount() const;           // gateCount() with instances expanded
+    // A circuit with this module as its only, flattened module, named and
+    // bound to a library as the circuit of this module
+    Circuit flatten() const;
+
     size_t gateCount() const; // return gateSize() or cellSize() if present
     inline size_t size() const { return gateCount(); }
 
     void addCell(Cell &cell);
+    void addCell(Cell &cell, const std::string &name);
+    void reserve(size_t ports, size_t wires, size_t gates, size_t cells);
 
     Port createPort(const std::string&, Port::PortType);
     Wire createWire(const std::string&);
     Gate createGate(const std::string&, Gate::GateType);
     Cell createCell(const std::string&, const std::string&);
+    Cell createCell(const std::string &name, const Cell &cell);
 
     void setNodeName(Node &, const std::string &name);
 
     bool pushNode(Node &);
+    // Removing a wire, gate or cell moves the last one of its kind into
+    // its place, so wire(i), gate(i) and cell(i) are not stable across a
+    // removal. Ports keep their declaration order; inside an edit a removed
+    // port leaves a null entry until the commit, see compact().
     bool removeNode(Node &node);
+    void compact();
+
+    void beginEdit();
+    void commitEdit();
 
 private:
     Node input(const std::string &name) const;
@@ -368,6 +582,7 @@ private:
     Module(ModulePrivate*);
 
     friend class Node;
+    friend class Cell;
     friend class Circuit;
 };
 
@@ -379,6 +594,8 @@ public:
     Circuit(const std::string &path, CellLibrary &lib);
     Circuit(const Circuit&);
     Circuit& operator= (const Circuit&);
+    Circuit(Circuit&&);
+    Circuit& operator= (Circuit&&);
 
     // Reimplemented from Node
     size_t inputSize() const        { return topModule().inputSize(); }
@@ -415,6 +632,10 @@ public:
 
     Module createModule(const std::string &name);
 
+    // A circuit with the top module only, every instance replaced by the
+    // logic of its module. Names get the instance path, as in "u1/U3".
+    Circuit flatten() const;
+
     std::string filePath() const;
     CellLibrary cellLibrary() const;
 
@@ -422,43 +643,235 @@ public:
     void load(std::fstream&, const std::string&);
     void load(std::fstream&, const std::string&, CellLibrary &lib);
 
-    inline Node::NodeType nodeType() const { return CircuitNode; }
+    // Loads on a worker thread. The netlist is parsed while lib is still
+    // loading and only binding the cells waits for it.
+    static std::future<Circuit> loadAsync(const std::string &path);
+    static std::future<Circuit> loadAsync(const std::string &path, const std::shared_future<CellLibrary> &lib);
 
-    class iterator
-    {
-    public:
-        std::list<Node*>::iterator it;
-        typedef std::forward_iterator_tag iterator_category;
-        typedef int difference_type;
-        typedef Node value_type;
-        typedef Node *pointer;
-        typedef Node &reference;
-
-        inline iterator(const std::list<Node*>::iterator i) : it(i) {}
-        inline Node &operator*() const { return *(*it); }
-        inline Node *operator->() const { return (*it); }
-        inline bool operator==(const iterator &o) const { return it == o.it; }
-        inline bool operator!=(const iterator &o) const { return it != o.it; }
-        inline iterator &operator++() { ++it; return *this; }
-        inline iterator operator++(int) { std::list<Node*>::iterator i = it; ++it; return i; }
-    };
+    // Binary image of the circuit for fast restore, see snapshot.cpp.
+    // Cells are bound to the library cells of the same type on load.
+    bool save(const std::string &path) const;
+    void loadSnapshot(const std::string &path);
+    void loadSnapshot(const std::string &path, CellLibrary &lib);
 
-    class const_iterator
-    {
-    public:
-    };
+    // Structural Verilog, read back by load(). See verilogwriter.cpp.
+    bool write(const std::string &path) const;
 
-    // iterator begin() const { return iterator(nodes.begin()); }
-    // iterator end() const { return iterator(nodes.end()); }
-    // const_iterator begin() const {}
-    // const_iterator end() const {}
-    // const_iterator cbegin() const {}
-    // const_iterator cend() const {}
+    inline Node::NodeType nodeType() const { return CircuitNode; }
+
+    inline NodeRange ports() const  { return topModule().ports(); }
+    inline NodeRange wires() const  { return topModule().wires(); }
+    inline NodeRange gates() const  { return topModule().gates(); }
+    inline NodeRange cells() const  { return topModule().cells(); }
+    inline NodeRange PIs() const    { return topModule().PIs(); }
+    inline NodeRange POs() const    { return topModule().POs(); }
+    inline NodeRange inputPorts() const  { return topModule().inputPorts(); }
+    inline NodeRange outputPorts() const { return topModule().outputPorts(); }
+
+    // Iterates the gates of the top module, or its cells if it has no gates
+    typedef NodeRange::const_iterator iterator;
+    typedef NodeRange::const_iterator const_iterator;
+    iterator begin() const;
+    iterator end() const;
+    inline const_iterator cbegin() const { return begin(); }
+    inline const_iterator cend() const { return end(); }
 
 private:
     Circuit(CircuitPrivate*);
+    void load(std::istream *infile, const std::string &path, CellLibrary &lib);
+    bool load(std::istream *infile, const std::string &path, CircuitBuilder &builder);
 
     friend class Node;
+    friend class Module;
+};
+
+// Flat snapshot of a module for fast traversal: every port, wire, gate and
+// cell gets a dense id, fanin/fanout are stored in compressed-sparse-row
+// arrays. The view does not track later edits of the module; rebuild it
+// after changing the netlist. Node pointers stay valid as long as the
+// circuit lives.
+class NetlistView
+{
+public:
+    typedef unsigned int Id;
+    static const Id NullId = 0xffffffffu;
+
+    NetlistView();
+    explicit NetlistView(const Module &module);
+    explicit NetlistView(const Circuit &circuit);
+
+    void build(const Module &module);
+    void clear();
+    void levelize();
+
+    inline size_t size() const { return types.size(); }
+    inline bool isEmpty() const { return types.empty(); }
+
+    // Same order as Module::inputPort()/outputPort()
+    inline size_t inputSize() const  { return inputIds.size(); }
+    inline size_t outputSize() const { return outputIds.size(); }
+    inline Id input(size_t i) const  { return inputIds[i]; }
+    inline Id output(size_t i) const { return outputIds[i]; }
+
+    inline Node::NodeType nodeType(Id id) const { return (Node::NodeType) types[id]; }
+    inline Gate::GateType gateType(Id id) const { return (Gate::GateType) gateTypes[id]; }
+    inline int level(Id id) const { return levels[id]; }
+    inline int maxLevel() const { return depth; }
+    Port::PortType portType(Id id) const;
+
+    // Unconnected pins are kept as NullId so that positions match pin order
+    inline size_t faninSize(Id id) const  { return faninIndex[id + 1] - faninIndex[id]; }
+    inline size_t fanoutSize(Id id) const { return fanoutIndex[id + 1] - fanoutIndex[id]; }
+    inline Id fanin(Id id, size_t i) const  { return faninData[faninIndex[id] + i]; }
+    inline Id fanout(Id id, size_t i) const { return fanoutData[fanoutIndex[id] + i]; }
+    inline const Id *faninBegin(Id id) const  { return faninData.data() + faninIndex[id]; }
+    inline const Id *faninEnd(Id id) const    { return faninData.data() + faninIndex[id + 1]; }
+    inline const Id *fanoutBegin(Id id) const { return fanoutData.data() + fanoutIndex[id]; }
+    inline const Id *fanoutEnd(Id id) const   { return fanoutData.data() + fanoutIndex[id + 1]; }
+
+    Id id(NodeRef node) const;
+    Node node(Id id) const;
+    std::string name(Id id) const;
+
+private:
+    Id indexOf(const NodePrivate *node) const;
+
+    std::vector<NodePrivate*> nodes;
+    std::vector<unsigned char> types;
+    std::vector<unsigned char> gateTypes;
+    std::vector<int> levels;
+    std::vector<Id> faninIndex;
+    std::vector<Id> faninData;
+    std::vector<Id> fanoutIndex;
+    std::vector<Id> fanoutData;
+    std::vector<Id> inputIds;
+    std::vector<Id> outputIds;
+    std::vector<std::pair<const NodePrivate*,Id> > ids; // sorted by pointer
+    int depth;
+
+    friend class CompiledSimulator;
+};
+
+// Logic simulation compiled from a module once: each gate or cell becomes
+// an instruction over a dense array of net values, ordered by level, so
+// evaluating a pattern is a single pass with no lookups or allocation.
+// Nets joined by port/wire connections share one value. X and Z inputs
+// follow the Verilog primitives: a controlling value decides the output,
+// otherwise it is X. Cells other than simple gates and MUX2 are compiled
+// from their Liberty function; without one their outputs stay at X. Nets
+// without a driver are X too, except the 1'b0 and 1'b1 of the netlist. A
+// module with instances is compiled from Module::flatten().
+class CompiledSimulator
+{
+public:
+    CompiledSimulator();
+    explicit CompiledSimulator(const Module &module);
+    explicit CompiledSimulator(const Circuit &circuit);
+
+    void compile(const Module &module);
+    void clear();
+
+    inline size_t inputSize() const  { return inputSlots.size(); }
+    inline size_t outputSize() const { return outputSlots.size(); }
+    inline size_t instructionSize() const { return code.size(); }
+    inline size_t valueSize() const { return values.size(); }
+
+    // Same characters as Circuit::input(): 0, 1, z/Z, anything else is X
+    bool input(const Pattern &pattern);
+    void setInput(size_t i, Signal value);
+    void run();
+    Pattern output() const;
+    Signal output(size_t i) const;
+    // After run(); a gate or cell reads as its first output
+    Signal value(NodeRef node) const;
+
+    // Selective trace: evaluates, level by level, only the instructions
+    // reading a value that changed since the last run, starting from the
+    // inputs set with input() or setInput(). Same results as run().
+    void runEvents();
+    // An event is one instruction evaluated; run() counts all of them
+    inline size_t eventCount() const { return lastEvents; }
+    inline size_t runCount() const { return runs; }
+    double eventsPerPattern() const;
+    // eventsPerPattern() over instructionSize(); runEvents() wins well below 1
+    double activity() const;
+    void resetCounters();
+
+    // Bit-parallel mode: each net has lanes() bits, one per pattern, so one
+    // pass evaluates 64, 256 or 512 patterns depending on the kernel. Only
+    // 0 and 1 are kept, X and Z read as 0, unless four values are on: then
+    // every net has a second, unknown plane, encoded like Signal, and X and
+    // Z go through the gates as they do in run().
+    typedef uint64_t Word;
+    enum { WordBits = 64 };
+    enum Kernel { Scalar, AVX2, AVX512 };
+    // Widest kernel this CPU runs, checked with CPUID; the default
+    static Kernel bestKernel();
+    static bool hasKernel(Kernel kernel);
+    static const char *kernelName(Kernel kernel);
+    bool setKernel(Kernel kernel);
+    inline Kernel kernel() const { return currentKernel; }
+    inline size_t lanes() const { return blockWords * WordBits; }
+    void setFourValued(bool on);
+    inline bool isFourValued() const { return planes == 2; }
+
+    // Packs patterns [first, first + lanes()) of a batch; false on a size mismatch
+    bool input(const std::vector<Pattern> &patterns, size_t first = 0);
+    // Word j of a net holds patterns [64 j, 64 j + 64) of the pass
+    void setInputWord(size_t i, Word word, size_t j = 0);
+    void setInputPlanes(size_t i, Word value, Word unknown, size_t j = 0);
+    void runWords();
+    Word outputWord(size_t i, size_t j = 0) const;
+    Word outputUnknownWord(size_t i, size_t j = 0) const;
+    // One pattern per packed input pattern, written like output()
+    std::vector<Pattern> outputPatterns() const;
+    // Runs a batch of any size, lanes() patterns at a time
+    std::vector<Pattern> simulate(const std::vector<Pattern> &patterns);
+
+private:
+    enum Opcode { Buf, Inv, And, Nand, Or, Nor, Xor, Xnor, Mux2 };
+    struct Instruction
+    {
+        unsigned char op;
+        unsigned short count;
+        unsigned out;
+        unsigned in;    // first operand in operands
+    };
+
+    bool compileFunction(NetlistView::Id id, unsigned out);
+    void compileEvents();
+    void resetWords();
+    NodeRef flatNode(NodeRef node) const;
+
+    // The module compiled, and its flattened copy if it has instances; the
+    // view then refers to the copy
+    Module source;
+    Circuit flat;
+    NetlistView view;
+    std::vector<Instruction> code;
+    std::vector<unsigned> operands;
+    std::vector<unsigned char> values;
+    std::vector<Word> words;            // planes * blockWords per value
+    Kernel currentKernel;
+    size_t blockWords;
+    size_t planes;
+    size_t wordPatterns;                // patterns packed in words
+    std::vector<unsigned> nodeSlots;    // value of each node of view
+    std::vector<unsigned> inputSlots;
+    std::vector<unsigned> outputSlots;
+
+    std::vector<unsigned> readerIndex;  // instructions reading each value
+    std::vector<unsigned> readers;
+    std::vector<unsigned> levels;       // of each instruction
+    std::vector<std::vector<unsigned> > queues;
+    std::vector<unsigned char> queued;
+    std::vector<unsigned> changed;      // values set since the last run
+    bool settled;
+    size_t lastEvents;
+    size_t eventTotal;
+    size_t runs;
+
+    friend struct SimulatorKernels;
 };
 
 inline const char * type_str(Node::NodeType type)
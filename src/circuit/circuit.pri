@@ -1,2 +1,2 @@
-HEADERS += $$PWD/circuit.h
-SOURCES += $$PWD/circuit.cpp $$PWD/signal.cpp
\ No newline at end of file
+HEADERS += $$PWD/circuit.h $$PWD/circuit_p.h $$PWD/symboltable_p.h $$PWD/binaryimage_p.h $$PWD/compressedstream_p.h
+SOURCES += $$PWD/circuit.cpp $$PWD/signal.cpp $$PWD/netlistview.cpp $$PWD/symboltable.cpp $$PWD/snapshot.cpp $$PWD/compressedstream.cpp $$PWD/verilogwriter.cpp $$PWD/hierarchy.cpp $$PWD/simulator.cpp
\ No newline at end of file
@@ -0,0 +1,448 @@
+#ifndef CIRCUIT_P_H
+#define CIRCUIT_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the public libCircuit API. It exists for the
+// convenience of the circuit implementation files and may change without
+// notice.
+//
+
+#include "circuit.h"
+#include "interpolate.h"
+#include "symboltable_p.h"
+#include <map>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <qatomic.h>
+
+// Keeps the raw table next to the interpolator so it can be copied
+struct LookupTable
+{
+    LookupTable(std::vector<double> &x, std::vector<double> &y, std::vector<std::vector<double> > &z)
+        : x(x), y(y), z(z), interp(new interpolate::interp2d(x, y, z)) {}
+    LookupTable(const LookupTable &t)
+        : x(t.x), y(t.y), z(t.z), interp(new interpolate::interp2d(x, y, z)) {}
+    ~LookupTable() { delete interp; }
+
+    double operator()(double x, double y) const { return (*interp)(x, y); }
+
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<std::vector<double> > z;
+    interpolate::interp2d *interp;
+};
+
+typedef std::map<std::string,std::map<std::string,std::map<Signal::Transition,LookupTable*> > > TimingTable;
+
+// One end of a connection. Cells and gates keep one slot per pin (cells in
+// the order of their master's pin list); ports, wires and modules get one
+// slot per connection. 'pin' is the index of the slot on 'node' that points
+// back here, or NoPin for one-way links such as module -> port.
+struct PinSlot
+{
+    static const unsigned NoPin = 0xffffffffu;
+
+    PinSlot() : node(0), pin(NoPin) {}
+    PinSlot(NodePrivate *n, unsigned p) : node(n), pin(p) {}
+
+    NodePrivate *node;
+    unsigned pin;
+};
+
+// Fixed-size storage for one private node class of a circuit. Nodes are
+// carved out of large blocks and released slots are reused. The blocks go
+// away together once the circuit has detached and the last node is gone.
+class NodeArena
+{
+public:
+    NodeArena(size_t size);
+
+    void *allocate();
+    void release(void *p);
+    // Slots of a whole module, taken back under one lock
+    void release(const std::vector<void*> &nodes);
+    void detach();
+
+private:
+    ~NodeArena();
+
+    size_t size;
+    size_t used;
+    std::vector<char*> blocks;
+    void *freeList;
+    size_t live;
+    bool attached;
+    std::mutex lock;
+};
+
+/**************************************************************
+ *
+ * Private class declerations
+ *
+ **************************************************************/
+class NodePrivate
+{
+public:
+    NodePrivate(CircuitPrivate*, NodePrivate* parent = 0);
+    NodePrivate(NodePrivate* n, bool deep);
+    virtual ~NodePrivate();
+
+    std::string nodeName() const { return symbols().str(symbol); }
+    void setName(const std::string &name);
+    // Names resolve through the owning circuit, or the shared table
+    SymbolTable &symbols() const;
+    void orphan();
+    void replaceName(ModulePrivate *module, const std::string &name);
+
+    Signal nodeValue() const { return value; }
+    void setNodeValue(Signal &v) { value = v; }
+
+    CircuitPrivate* ownerCircuit();
+    void setOwnerCircuit(CircuitPrivate* c);
+
+    size_t inputSize() const;
+    size_t outputSize() const;
+    bool hasInput(const std::string &name) const;
+    bool hasOutput(const std::string &name) const;
+    NodePrivate* input(const std::string &name) const;
+    NodePrivate* output(const std::string &name) const;
+    NodePrivate* input(size_t i) const;
+    NodePrivate* output(size_t i) const;
+    void addInput(NodePrivate *node);
+    void addOutput(NodePrivate *node);
+    void addInputPinName(const std::string &pinName);
+    void addOutputPinName(const std::string &pinName);
+    void connect(const std::string &pin, NodePrivate *targ, const std::string targ_pin = "");
+
+    void connectInput(size_t pin, NodePrivate *targ);
+    void connectOutput(size_t pin, NodePrivate *targ);
+
+    // Slot index of a named pin, -1 if there is none
+    virtual int inputPin(const std::string &name) const;
+    virtual int outputPin(const std::string &name) const;
+    bool hasFixedPins() const { return isGate() || isCell(); }
+    unsigned appendInput() { inputs.push_back(PinSlot()); return (unsigned) inputs.size() - 1; }
+    unsigned appendOutput() { outputs.push_back(PinSlot()); return (unsigned) outputs.size() - 1; }
+    void releaseInput(size_t i);
+    void releaseOutput(size_t i);
+    void disconnectInput(size_t i);
+    void disconnectOutput(size_t i);
+    void unlink();
+    void connectionChanged();
+    void invalidateLoads();
+
+    virtual NodePrivate* cloneNode(bool deep = true);
+    void clear();
+    // Deletes a node whose last reference is gone
+    static void destroy(NodePrivate *node);
+
+    inline NodePrivate* parent() const { return hasParent ? ownerNode : 0; }
+    void setParent(NodePrivate *p);
+
+    bool isPort() const     { return nodeType() == Node::PortNode; }
+    bool isWire() const     { return nodeType() == Node::WireNode; }
+    bool isGate() const     { return nodeType() == Node::GateNode; }
+    bool isCell() const     { return nodeType() == Node::CellNode; }
+    bool isModule() const   { return nodeType() == Node::ModuleNode; }
+    bool isCircuit() const  { return nodeType() == Node::CircuitNode; }
+
+    virtual Node::NodeType nodeType() const { return Node::BaseNode; }
+
+    QAtomicInt ref;
+    NodeArena* arena;
+    NodePrivate* ownerNode;
+    std::vector<PinSlot> inputs;
+    std::vector<PinSlot> outputs;
+    bool hasParent : 1;
+    // Module only: removed ports left null entries, see compact()
+    bool hasTombstones : 1;
+    // Connections changed in an open module edit, see ModulePrivate::touch()
+    bool touched : 1;
+    // Scratch mark of a single graph walk, cleared again when it ends
+    bool marked : 1;
+    bool isInternal;
+    // Position in the owning module's node list
+    unsigned index;
+
+    Symbol symbol;
+    Signal value;
+};
+
+class PortPrivate : public NodePrivate
+{
+public:
+    PortPrivate(CircuitPrivate*, NodePrivate* parent, const std::string &name, Port::PortType type);
+    PortPrivate(PortPrivate* n, bool deep);
+    ~PortPrivate();
+
+    Port::PortType type;
+    // Positions in the module's PI/PO/PPI/PPO list and inputs/outputs
+    unsigned typeIndex;
+    unsigned slotIndex;
+    // Reimplemented from NodePrivate
+    NodePrivate* cloneNode(bool deep = true);
+    Node::NodeType nodeType() const { return Node::PortNode; }
+};
+
+class WirePrivate : public NodePrivate
+{
+public:
+    WirePrivate(CircuitPrivate*, NodePrivate* parent, const std::string &name);
+    WirePrivate(WirePrivate* n, bool deep);
+    ~WirePrivate();
+
+    // Reimplemented from NodePrivate
+    NodePrivate* cloneNode(bool deep = true);
+    Node::NodeType nodeType() const { return Node::WireNode; }
+};
+
+class GatePrivate : public NodePrivate
+{
+public:
+    GatePrivate(GatePrivate* n, bool deep);
+    GatePrivate(CircuitPrivate*, NodePrivate* parent, const std::string &name, Gate::GateType type);
+    ~GatePrivate();
+
+    Gate::GateType gateType() const { return type; }
+
+    // Reimplemented from NodePrivate
+    NodePrivate* cloneNode(bool deep = true);
+    Node::NodeType nodeType() const { return Node::GateNode; }
+
+    //void breakOutputConnection();
+    Signal (*func)(const Node&);
+    unsigned level;
+    Gate::GateType type;
+};
+
+// Library data shared by every instance of the same cell type
+class CellMaster
+{
+public:
+    CellMaster(const std::string &type);
+    CellMaster(const CellMaster &m);
+    ~CellMaster();
+
+    QAtomicInt ref;
+    std::string type;
+    // Definition behind an instance of a netlist module, 0 for library cells
+    ModulePrivate *module;
+    double area;
+    std::string function;
+    std::vector<std::string> inputNames;
+    std::vector<std::string> outputNames;
+    std::vector<Port::PortType> pinTypes;
+    std::map<std::string,double> inputCapacitances;
+    std::map<std::string,double> inputCapacitancesRise;
+    std::map<std::string,double> inputCapacitancesFall;
+    std::map<std::string,double> inputCapacitancesRiseMin;
+    std::map<std::string,double> inputCapacitancesFallMin;
+    std::map<std::string,double> inputCapacitancesRiseMax;
+    std::map<std::string,double> inputCapacitancesFallMax;
+    std::map<std::string,double> outputMaxCapacitance;
+    std::map<std::string,double> outputMaxTransition;
+
+    std::map<std::string,std::map<std::string,TimingSense> > timingSense;
+    TimingTable delayTables;
+    TimingTable transTables;
+};
+
+class CellPrivate : public GatePrivate
+{
+public:
+    CellPrivate(CellPrivate* n, bool deep);
+    CellPrivate(CircuitPrivate*, NodePrivate* parent, const std::string &name, const std::string &type);
+    CellPrivate(CircuitPrivate*, NodePrivate* parent, const std::string &name, CellMaster *master);
+    ~CellPrivate();
+
+    std::string cellType() const { return master->type; }
+
+    void addInputPinName(const std::string &pinName);
+    void addOutputPinName(const std::string &pinName);
+    int inputPin(const std::string &name) const;
+    int outputPin(const std::string &name) const;
+    Port::PortType pinType(size_t i) const;
+    void outputCapacitanceMax();
+    double outputCapacitanceRiseMax();
+    double outputCapacitanceFallMax();
+
+    void breakOutputConnection(const std::string &pinName);
+
+    // Copy-on-write: called before the master is modified
+    void detach();
+
+    // Reimplemented from NodePrivate
+    NodePrivate* cloneNode(bool deep = true);
+    Node::NodeType nodeType() const { return Node::CellNode; }
+
+    CellMaster *master;
+
+    double cacheOutputCapacitanceRiseMax;
+    double cacheOutputCapacitanceFallMax;
+    bool dirty : 1;
+};
+
+class ModulePrivate : public NodePrivate
+{
+public:
+    ModulePrivate(CircuitPrivate*, NodePrivate* parent, const std::string &name);
+    ModulePrivate(ModulePrivate* n, bool deep);
+    ~ModulePrivate();
+
+    size_t gateCount() const;
+    void reserve(size_t portCount, size_t wireCount, size_t gateCount, size_t cellCount);
+
+    void addCell(CellPrivate *);
+    void addCell(CellPrivate *, const std::string &name);
+
+    PortPrivate *PI(size_t);
+    PortPrivate *PO(size_t);
+    PortPrivate *PPI(size_t);
+    PortPrivate *PPO(size_t);
+
+    bool hasPort(const std::string &portName);
+    bool hasWire(const std::string &wireName);
+    bool hasGate(const std::string &gateName);
+    bool hasCell(const std::string &cellName);
+
+    PortPrivate* port(size_t i);
+    WirePrivate* wire(size_t i);
+    GatePrivate* gate(size_t i);
+    CellPrivate* cell(size_t i);
+    PortPrivate* port(const std::string &portName);
+    WirePrivate* wire(const std::string &wireName);
+    GatePrivate* gate(const std::string &gateName);
+    CellPrivate* cell(const std::string &cellName);
+
+    PortPrivate* createPort(const std::string &portName, Port::PortType);
+    WirePrivate* createWire(const std::string &wireName);
+    GatePrivate* createGate(const std::string &gateName, Gate::GateType);
+    CellPrivate* createCell(const std::string &cellName, const std::string&);
+    CellPrivate* createCell(const std::string &cellName, CellPrivate *prototype);
+    CellPrivate* createInstance(const std::string &instanceName, ModulePrivate *definition);
+    CellPrivate* instance(const std::string &instanceName);
+    CellMaster* instanceMaster();
+    // Whether an instance with this master still fits the ports
+    bool pinsMatch(const CellMaster *master) const;
+
+    void setCellName(CellPrivate *, const std::string name);
+    void setGateName(GatePrivate *, const std::string name);
+    void setWireName(WirePrivate *, const std::string name);
+    void setPortName(PortPrivate *, const std::string name);
+
+    bool pushCell(CellPrivate* cell);
+    bool pushGate(GatePrivate* gate);
+    bool pushWire(WirePrivate* wire);
+    bool pushPort(PortPrivate* port);
+
+    bool removeCell(const std::string &cellName);
+    bool removeGate(const std::string &gateName);
+    bool removeWire(const std::string &wireName);
+    bool removePort(const std::string &portName);
+    bool removeInstance(const std::string &instanceName);
+    void compact();
+
+    void beginEdit();
+    void commitEdit();
+    void touch(NodePrivate *node);
+    bool owns(const NodePrivate *node) const;
+    void relevel(const std::vector<NodePrivate*> &seeds);
+    void levelize();
+    bool indexNode(NodePrivate *node);
+    bool insertName(NodePrivate *node);
+    void flushIndex() { if (!unindexed.empty()) indexPending(); }
+    void indexPending();
+    void releaseNodes();
+
+    // Reimplemented from NodePrivate, ports are found through the port map
+    int inputPin(const std::string &name) const;
+    int outputPin(const std::string &name) const;
+
+    std::vector<PortPrivate*>* portTypeList(Port::PortType type);
+    bool attachPort(PortPrivate *port);
+    void detachPort(PortPrivate *port);
+
+    Node::NodeType nodeType() const { return Node::ModuleNode; }
+
+    SymbolTable *symbolTable;
+    SymbolMap<PortPrivate> ports;
+    SymbolMap<WirePrivate> wires;
+    SymbolMap<CellPrivate> cells;
+    SymbolMap<GatePrivate> gates;
+    SymbolMap<CellPrivate> instances;
+    // Kept as NodePrivate* so they can be handed out as NodeRange
+    std::vector<NodePrivate*> portList;
+    std::vector<NodePrivate*> wireList;
+    std::vector<NodePrivate*> cellList;
+    std::vector<NodePrivate*> gateList;
+    // Instances of other modules, cells whose master has a module
+    std::vector<NodePrivate*> instanceList;
+    // Pins of this module as seen by its instances, see instanceMaster()
+    CellMaster *master;
+
+    std::vector<PortPrivate*> PIs;
+    std::vector<PortPrivate*> POs;
+    std::vector<PortPrivate*> PPIs;
+    std::vector<PortPrivate*> PPOs;
+
+    // Open beginEdit() calls. Nodes created meanwhile wait in unindexed,
+    // nodes whose connections changed wait in touched with a reference
+    // held, and the outermost commitEdit() updates what depends on them.
+    unsigned editDepth;
+    // Whether the gates carry levels yet; the first commit levels them all
+    bool leveled;
+    std::vector<NodePrivate*> touchedNodes;
+    std::vector<NodePrivate*> unindexed;
+private:
+};
+
+class CircuitPrivate : public NodePrivate
+{
+public:
+    CircuitPrivate();
+    CircuitPrivate(const std::string &name);
+    CircuitPrivate(CircuitPrivate* n, bool deep);
+    ~CircuitPrivate();
+
+    size_t gateCount() const;
+
+    bool hasModule(const std::string &moduleName);
+    ModulePrivate* module(const std::string &moduleName);
+    ModulePrivate* createModule(const std::string &moduleName);
+
+    void setTopModule(ModulePrivate *module);
+
+    Node::NodeType nodeType() const { return Node::CircuitNode; }
+
+    SymbolTable *symbolTable;
+    NodeArena *portArena;
+    NodeArena *wireArena;
+    NodeArena *gateArena;
+    NodeArena *cellArena;
+    std::string path;
+    ModulePrivate *topModule;
+    std::map<std::string,ModulePrivate*> modules;
+    std::vector<std::string> moduleNames;
+    CellLibrary *library;
+    // Copy of the library held by a circuit from loadAsync()
+    CellLibrary *ownedLibrary;
+};
+
+// Constructs a node in the arena, or on the heap if there is none
+template <class T, class... Args>
+static T *_newNode(NodeArena *arena, Args&&... args)
+{
+    if (!arena)
+        return new T(std::forward<Args>(args)...);
+    T *node = new (arena->allocate()) T(std::forward<Args>(args)...);
+    node->arena = arena;
+    return node;
+}
+
+#endif // CIRCUIT_P_H
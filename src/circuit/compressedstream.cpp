@@ -0,0 +1,241 @@
+#include "compressedstream_p.h"
+#include <cstring>
+#include <iostream>
+#ifdef LIBCIRCUIT_ZLIB
+#include <zlib.h>
+#endif
+#ifdef LIBCIRCUIT_ZSTD
+#include <zstd.h>
+#endif
+
+Compression fileCompression(const std::string &path)
+{
+    unsigned char magic[4] = { 0, 0, 0, 0 };
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+        return NoCompression;
+    size_t n = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+    if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+        return GzipCompression;
+    if (n == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+        return ZstdCompression;
+    return NoCompression;
+}
+
+/**************************************************************
+ *
+ * DecompressingBuffer
+ *
+ **************************************************************/
+
+DecompressingBuffer::DecompressingBuffer(const std::string &path_, Compression compression)
+    : path(path_), file(0), head(0), count(0),
+      reading(false), finished(false), stopping(false)
+{
+    file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        std::cerr << "Could not open file: " << path << std::endl;
+        return;
+    }
+    for (size_t i = 0; i < SlotCount; i++)
+    {
+        slots[i].resize(SlotSize);
+        filled[i] = 0;
+    }
+    worker = std::thread(&DecompressingBuffer::run, this, compression);
+}
+
+DecompressingBuffer::~DecompressingBuffer()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    changed.notify_all();
+    if (worker.joinable())
+        worker.join();
+    if (file)
+        fclose(file);
+}
+
+DecompressingBuffer::int_type DecompressingBuffer::underflow()
+{
+    if (!file)
+        return traits_type::eof();
+    std::unique_lock<std::mutex> guard(lock);
+    if (reading)
+    {
+        // Hand the slot back to the worker
+        head = (head + 1) % SlotCount;
+        count--;
+        reading = false;
+        changed.notify_all();
+    }
+    while (count == 0 && !finished)
+        changed.wait(guard);
+    if (count == 0)
+        return traits_type::eof();
+    reading = true;
+    char *data = slots[head].data();
+    setg(data, data, data + filled[head]);
+    return traits_type::to_int_type(*data);
+}
+
+// The next free slot, 0 once the reader is gone
+char *DecompressingBuffer::acquire()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (count == SlotCount && !stopping)
+        changed.wait(guard);
+    if (stopping)
+        return 0;
+    return slots[(head + count) % SlotCount].data();
+}
+
+void DecompressingBuffer::publish(size_t size)
+{
+    if (size == 0)
+        return;
+    std::lock_guard<std::mutex> guard(lock);
+    filled[(head + count) % SlotCount] = size;
+    count++;
+    changed.notify_all();
+}
+
+// The reader sees the end of the file, also after an error
+void DecompressingBuffer::finish()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    finished = true;
+    changed.notify_all();
+}
+
+void DecompressingBuffer::run(Compression compression)
+{
+    if (compression == GzipCompression)
+        inflateGzip();
+    else
+        inflateZstd();
+    finish();
+}
+
+bool DecompressingBuffer::inflateGzip()
+{
+#ifdef LIBCIRCUIT_ZLIB
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    // 32 lets zlib accept both gzip and zlib headers
+    if (inflateInit2(&z, 15 + 32) != Z_OK)
+        return false;
+    std::vector<unsigned char> input(InputSize);
+    char *out = acquire();
+    size_t used = 0;
+    bool eof = false;
+    bool complete = false;
+    bool ok = true;
+    while (out)
+    {
+        if (z.avail_in == 0 && !eof)
+        {
+            z.next_in = input.data();
+            z.avail_in = fread(input.data(), 1, input.size(), file);
+            eof = (z.avail_in == 0);
+        }
+        if (eof && complete)
+            break;
+        z.next_out = (Bytef*) out + used;
+        z.avail_out = SlotSize - used;
+        int ret = inflate(&z, Z_NO_FLUSH);
+        used = SlotSize - z.avail_out;
+        if (ret == Z_STREAM_END)
+        {
+            // A gzip file may hold several members
+            complete = true;
+            inflateReset(&z);
+        }
+        else if (ret == Z_OK)
+            complete = false;
+        else
+        {
+            // Z_BUF_ERROR here means the file ends inside a member
+            ok = false;
+            break;
+        }
+        if (used == SlotSize)
+        {
+            publish(used);
+            out = acquire();
+            used = 0;
+        }
+    }
+    if (out)
+        publish(used);
+    inflateEnd(&z);
+    if (!ok || ferror(file))
+    {
+        std::cerr << "Invalid compressed data: " << path << std::endl;
+        return false;
+    }
+    return true;
+#else
+    std::cerr << "libCircuit was built without gzip support (CONFIG+=zlib)" << std::endl;
+    return false;
+#endif
+}
+
+bool DecompressingBuffer::inflateZstd()
+{
+#ifdef LIBCIRCUIT_ZSTD
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    if (!dctx)
+        return false;
+    std::vector<char> data(InputSize);
+    ZSTD_inBuffer input = { data.data(), 0, 0 };
+    char *out = acquire();
+    size_t used = 0;
+    size_t ret = 1;     // 0 once a frame is decoded and flushed
+    bool eof = false;
+    bool ok = true;
+    while (out)
+    {
+        if (input.pos == input.size && !eof)
+        {
+            input.size = fread(data.data(), 1, data.size(), file);
+            input.pos = 0;
+            eof = (input.size == 0);
+        }
+        if (eof && input.pos == input.size && ret == 0)
+            break;
+        size_t consumed = input.pos;
+        ZSTD_outBuffer output = { out, SlotSize, used };
+        ret = ZSTD_decompressStream(dctx, &output, &input);
+        if (ZSTD_isError(ret) || (eof && input.pos == consumed && output.pos == used))
+        {
+            // Corrupt, or the file ends inside a frame
+            ok = false;
+            break;
+        }
+        used = output.pos;
+        if (used == SlotSize)
+        {
+            publish(used);
+            out = acquire();
+            used = 0;
+        }
+    }
+    if (out)
+        publish(used);
+    ZSTD_freeDCtx(dctx);
+    if (!ok || ferror(file))
+    {
+        std::cerr << "Invalid compressed data: " << path << std::endl;
+        return false;
+    }
+    return true;
+#else
+    std::cerr << "libCircuit was built without zstd support (CONFIG+=zstd)" << std::endl;
+    return false;
+#endif
+}
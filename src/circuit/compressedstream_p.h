@@ -0,0 +1,89 @@
+#ifndef COMPRESSEDSTREAM_P_H
+#define COMPRESSEDSTREAM_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the public libCircuit API. It exists for the
+// convenience of the circuit implementation files and may change without
+// notice.
+//
+
+#include <condition_variable>
+#include <cstdio>
+#include <istream>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Input files may be compressed with gzip (built with CONFIG+=zlib) or
+// zstd (CONFIG+=zstd). The format is told by the first bytes of the file,
+// not by its name.
+enum Compression
+{
+    NoCompression,
+    GzipCompression,
+    ZstdCompression
+};
+
+Compression fileCompression(const std::string &path);
+
+// Decompresses a file on a worker thread into a small ring of buffers that
+// the reader drains, so decompression overlaps with lexing.
+class DecompressingBuffer : public std::streambuf
+{
+public:
+    DecompressingBuffer(const std::string &path, Compression compression);
+    ~DecompressingBuffer();
+
+    bool isOpen() const { return file != 0; }
+
+protected:
+    int_type underflow();
+
+private:
+    DecompressingBuffer(const DecompressingBuffer&);
+    DecompressingBuffer& operator=(const DecompressingBuffer&);
+
+    enum { SlotCount = 4, SlotSize = 1 << 18, InputSize = 1 << 16 };
+
+    void run(Compression compression);
+    bool inflateGzip();
+    bool inflateZstd();
+    char *acquire();
+    void publish(size_t size);
+    void finish();
+
+    std::string path;
+    FILE *file;
+    std::vector<char> slots[SlotCount];
+    size_t filled[SlotCount];
+    size_t head;        // slot the reader is on or waits for
+    size_t count;       // published slots, including the one being read
+    bool reading;
+    bool finished;
+    bool stopping;
+    std::mutex lock;
+    std::condition_variable changed;
+    std::thread worker;
+};
+
+class DecompressingStream : public std::istream
+{
+public:
+    DecompressingStream(const std::string &path, Compression compression)
+        : std::istream(0), buffer(path, compression)
+    {
+        rdbuf(&buffer);
+        if (!buffer.isOpen())
+            setstate(std::ios::failbit);
+    }
+
+private:
+    DecompressingBuffer buffer;
+};
+
+#endif // COMPRESSEDSTREAM_P_H
@@ -0,0 +1,298 @@
+#include "circuit.h"
+#include "circuit_p.h"
+#include "celllibrary.h"
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <set>
+
+// A module instance is a cell whose master has the module as definition,
+// so the module itself is stored once. Flattening copies the logic of each
+// instance into a new top module, with the nets of its ports replaced by
+// the nets connected to the instance pins.
+
+namespace {
+
+const char Separator = '/';
+
+// Node counts of a module with all its instances expanded
+struct FlatSize
+{
+    FlatSize() : wires(0), gates(0), cells(0) {}
+
+    size_t wires;
+    size_t gates;
+    size_t cells;
+};
+
+class FlatSizes
+{
+public:
+    const FlatSize &size(ModulePrivate *m);
+
+private:
+    std::map<ModulePrivate*,FlatSize> sizes;
+    std::set<ModulePrivate*> path;
+};
+
+// Recursive instances count as empty
+const FlatSize &FlatSizes::size(ModulePrivate *m)
+{
+    std::map<ModulePrivate*,FlatSize>::iterator it = sizes.find(m);
+    if (it != sizes.end())
+        return it->second;
+    FlatSize total;
+    if (path.insert(m).second)
+    {
+        total.wires = m->wireList.size();
+        total.gates = m->gateList.size();
+        total.cells = m->cellList.size();
+        for (size_t i = 0; i < m->instanceList.size(); i++)
+        {
+            ModulePrivate *definition = ((CellPrivate*) m->instanceList[i])->master->module;
+            const FlatSize &s = size(definition);
+            total.wires += s.wires;
+            total.gates += s.gates;
+            total.cells += s.cells;
+        }
+        path.erase(m);
+    }
+    return sizes[m] = total;
+}
+
+class Flattener
+{
+public:
+    explicit Flattener(ModulePrivate *flat) : flat(flat) {}
+
+    // portNets holds the flat net of each port of m, 0 for the top module
+    void copy(ModulePrivate *m, const std::string &prefix, const std::vector<NodePrivate*> *portNets);
+
+private:
+    ModulePrivate *flat;
+    std::vector<ModulePrivate*> path;
+};
+
+bool owns(const ModulePrivate *m, const NodePrivate *node, const std::vector<NodePrivate*> &list)
+{
+    return node && node->parent() == m && node->index < list.size() && list[node->index] == node;
+}
+
+void Flattener::copy(ModulePrivate *m, const std::string &prefix, const std::vector<NodePrivate*> *portNets)
+{
+    const std::vector<NodePrivate*> &ports = m->portList;
+    const std::vector<NodePrivate*> &wires = m->wireList;
+    std::vector<NodePrivate*> portMap(ports.size(), (NodePrivate*) 0);
+    std::vector<NodePrivate*> wireMap(wires.size(), (NodePrivate*) 0);
+
+    if (!portNets)
+    {
+        for (size_t i = 0; i < ports.size(); i++)
+            if (ports[i])
+                portMap[i] = flat->createPort(ports[i]->nodeName(), ((PortPrivate*) ports[i])->type);
+    }
+    else
+        portMap = *portNets;
+
+    for (size_t i = 0; i < wires.size(); i++)
+    {
+        NodePrivate *w = wires[i];
+        if (portNets)
+        {
+            // Inside an instance the wire of a port is the net at the pin
+            for (int k = 0; k < 2; k++)
+            {
+                const std::vector<PinSlot> &slots = k ? w->outputs : w->inputs;
+                for (size_t j = 0; j < slots.size(); j++)
+                {
+                    const NodePrivate *p = slots[j].node;
+                    if (!owns(m, p, ports) || !portMap[p->index])
+                        continue;
+                    if (!wireMap[i])
+                        wireMap[i] = portMap[p->index];
+                    else if (wireMap[i] != portMap[p->index])
+                        std::cerr << "WARNING: Ports of one net are not merged: " << prefix << w->nodeName() << std::endl;
+                }
+            }
+            if (wireMap[i])
+                continue;
+        }
+        WirePrivate *fw = flat->createWire(prefix + w->nodeName());
+        fw->value = w->value;
+        wireMap[i] = fw;
+        for (size_t j = 0; j < w->inputs.size(); j++)
+        {
+            const NodePrivate *p = w->inputs[j].node;
+            if (owns(m, p, ports))
+            {
+                if (portNets)
+                    portMap[p->index] = fw;     // unconnected pin
+                else
+                    portMap[p->index]->connect(Node::dir2str(Node::Direct::right), fw);
+            }
+        }
+        for (size_t j = 0; j < w->outputs.size(); j++)
+        {
+            const NodePrivate *p = w->outputs[j].node;
+            if (owns(m, p, ports))
+            {
+                if (portNets)
+                    portMap[p->index] = fw;
+                else
+                    portMap[p->index]->connect(Node::dir2str(Node::Direct::left), fw);
+            }
+        }
+    }
+
+    struct Nets
+    {
+        const ModulePrivate *m;
+        const std::vector<NodePrivate*> &portMap;
+        const std::vector<NodePrivate*> &wireMap;
+
+        NodePrivate *operator()(const NodePrivate *node) const
+        {
+            if (owns(m, node, m->wireList))
+                return wireMap[node->index];
+            if (owns(m, node, m->portList))
+                return portMap[node->index];
+            return 0;
+        }
+    } net = { m, portMap, wireMap };
+
+    for (size_t i = 0; i < m->gateList.size(); i++)
+    {
+        const GatePrivate *g = (const GatePrivate*) m->gateList[i];
+        GatePrivate *fg = flat->createGate(prefix + g->nodeName(), g->type);
+        for (size_t j = 0; j < g->inputs.size(); j++)
+            if (NodePrivate *n = net(g->inputs[j].node))
+                fg->connectInput(j, n);
+        for (size_t j = 0; j < g->outputs.size(); j++)
+            if (NodePrivate *n = net(g->outputs[j].node))
+                fg->connectOutput(j, n);
+    }
+    for (size_t i = 0; i < m->cellList.size(); i++)
+    {
+        CellPrivate *c = (CellPrivate*) m->cellList[i];
+        CellPrivate *fc = flat->createCell(prefix + c->nodeName(), c);
+        for (size_t j = 0; j < c->inputs.size(); j++)
+            if (NodePrivate *n = net(c->inputs[j].node))
+                fc->connectInput(j, n);
+        for (size_t j = 0; j < c->outputs.size(); j++)
+            if (NodePrivate *n = net(c->outputs[j].node))
+                fc->connectOutput(j, n);
+    }
+
+    path.push_back(m);
+    for (size_t i = 0; i < m->instanceList.size(); i++)
+    {
+        const CellPrivate *inst = (const CellPrivate*) m->instanceList[i];
+        const CellMaster *master = inst->master;
+        ModulePrivate *definition = master->module;
+        std::string name = prefix + inst->nodeName();
+        if (std::find(path.begin(), path.end(), definition) != path.end())
+        {
+            std::cerr << "WARNING: Recursive module instance: " << name << std::endl;
+            continue;
+        }
+        // Pins follow the ports the module had when the instance was made
+        std::vector<NodePrivate*> nets(definition->portList.size(), (NodePrivate*) 0);
+        for (size_t j = 0; j < inst->inputs.size() + inst->outputs.size(); j++)
+        {
+            bool input = j < inst->inputs.size();
+            size_t pin = input ? j : j - inst->inputs.size();
+            const std::string &pinName = input ? master->inputNames[pin] : master->outputNames[pin];
+            PortPrivate *p = definition->port(pinName);
+            if (p)
+                nets[p->index] = net(input ? inst->inputs[pin].node : inst->outputs[pin].node);
+        }
+        copy(definition, name + Separator, &nets);
+    }
+    path.pop_back();
+}
+
+} // anonymous namespace
+
+/**************************************************************
+ *
+ * Module
+ *
+ **************************************************************/
+
+#define IMPL ((ModulePrivate*)impl)
+
+std::vector<Module> Module::submodules() const
+{
+    std::vector<Module> result;
+    if (!impl)
+        return result;
+    std::set<ModulePrivate*> seen;
+    for (size_t i = 0; i < IMPL->instanceList.size(); i++)
+    {
+        ModulePrivate *definition = ((CellPrivate*) IMPL->instanceList[i])->master->module;
+        if (seen.insert(definition).second)
+            result.push_back(Module(definition));
+    }
+    return result;
+}
+
+size_t Module::flatGateCount() const
+{
+    if (!impl)
+        return 0;
+    FlatSizes sizes;
+    const FlatSize &size = sizes.size(IMPL);
+    if (size.gates && size.cells)
+    {
+        std::cerr << "Bad circuit" << std::endl;
+        return 0;
+    }
+    return size.gates ? size.gates : size.cells;
+}
+
+Circuit Module::flatten() const
+{
+    Circuit result;
+    if (!impl)
+        return result;
+    ModulePrivate *source = IMPL;
+    CircuitPrivate *owner = source->ownerCircuit();
+
+    CircuitPrivate *c = new CircuitPrivate(owner ? owner->nodeName() : source->nodeName());
+    if (owner)
+    {
+        c->path = owner->path;
+        c->ownedLibrary = (owner->ownedLibrary ? new CellLibrary(*owner->ownedLibrary) : 0);
+        c->library = (c->ownedLibrary ? c->ownedLibrary : owner->library);
+    }
+    result.impl = c;
+
+    ModulePrivate *top = c->createModule(source->nodeName());
+    c->setTopModule(top);
+    FlatSizes sizes;
+    const FlatSize &size = sizes.size(source);
+    top->reserve(source->portList.size(), size.wires, size.gates, size.cells);
+    top->beginEdit();
+    Flattener(top).copy(source, std::string(), 0);
+    top->commitEdit();
+    return result;
+}
+
+#undef IMPL
+
+/**************************************************************
+ *
+ * Circuit
+ *
+ **************************************************************/
+
+#define IMPL ((CircuitPrivate*)impl)
+
+Circuit Circuit::flatten() const
+{
+    if (!impl || !IMPL->topModule)
+        return Circuit();
+    return topModule().flatten();
+}
+
+#undef IMPL
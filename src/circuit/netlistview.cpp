@@ -0,0 +1,203 @@
+#include "circuit.h"
+#include "circuit_p.h"
+#include <algorithm>
+#include <iostream>
+
+/**************************************************************
+ *
+ * NetlistView
+ *
+ **************************************************************/
+
+NetlistView::NetlistView() : depth(0)
+{
+}
+
+NetlistView::NetlistView(const Module &module) : depth(0)
+{
+    build(module);
+}
+
+NetlistView::NetlistView(const Circuit &circuit) : depth(0)
+{
+    build(circuit.topModule());
+}
+
+void NetlistView::clear()
+{
+    nodes.clear();
+    types.clear();
+    gateTypes.clear();
+    levels.clear();
+    faninIndex.clear();
+    faninData.clear();
+    fanoutIndex.clear();
+    fanoutData.clear();
+    inputIds.clear();
+    outputIds.clear();
+    ids.clear();
+    depth = 0;
+}
+
+// Ports removed in an open edit are null until the commit
+static void appendNodes(std::vector<NodePrivate*> &nodes, const std::vector<NodePrivate*> &list)
+{
+    for (size_t i = 0; i < list.size(); i++)
+        if (list[i])
+            nodes.push_back(list[i]);
+}
+
+void NetlistView::build(const Module &module)
+{
+    clear();
+    ModulePrivate *m = (ModulePrivate*) ((const Node&) module).impl;
+    if (!m)
+        return;
+
+    // Dense ids: ports, wires, gates then cells
+    nodes.reserve(m->portList.size() + m->wireList.size() + m->gateList.size() + m->cellList.size());
+    appendNodes(nodes, m->portList);
+    appendNodes(nodes, m->wireList);
+    appendNodes(nodes, m->gateList);
+    appendNodes(nodes, m->cellList);
+
+    const size_t n = nodes.size();
+    ids.reserve(n);
+    for (size_t i = 0; i < n; i++)
+        ids.push_back(std::make_pair((const NodePrivate*) nodes[i], (Id) i));
+    std::sort(ids.begin(), ids.end());
+
+    types.resize(n);
+    gateTypes.resize(n);
+    levels.resize(n);
+    faninIndex.resize(n + 1);
+    fanoutIndex.resize(n + 1);
+    faninIndex[0] = 0;
+    fanoutIndex[0] = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        NodePrivate *node = nodes[i];
+        types[i] = (unsigned char) node->nodeType();
+        if (node->isGate() || node->isCell())
+        {
+            GatePrivate *gate = (GatePrivate*) node;
+            gateTypes[i] = (unsigned char) gate->gateType();
+            levels[i] = (int) gate->level;
+        }
+        else
+        {
+            gateTypes[i] = (unsigned char) Gate::BaseGate;
+            levels[i] = 0;
+        }
+        if (levels[i] > depth)
+            depth = levels[i];
+        faninIndex[i + 1] = faninIndex[i] + (Id) node->inputs.size();
+        fanoutIndex[i + 1] = fanoutIndex[i] + (Id) node->outputs.size();
+    }
+
+    faninData.resize(faninIndex[n]);
+    fanoutData.resize(fanoutIndex[n]);
+    for (size_t i = 0; i < n; i++)
+    {
+        NodePrivate *node = nodes[i];
+        Id *in = faninData.data() + faninIndex[i];
+        for (size_t j = 0; j < node->inputs.size(); j++)
+            in[j] = indexOf(node->inputs[j].node);
+        Id *out = fanoutData.data() + fanoutIndex[i];
+        for (size_t j = 0; j < node->outputs.size(); j++)
+            out[j] = indexOf(node->outputs[j].node);
+    }
+
+    // Module::inputPort()/outputPort() order
+    inputIds.reserve(m->inputs.size());
+    for (size_t i = 0; i < m->inputs.size(); i++)
+        if (m->inputs[i].node)
+            inputIds.push_back(indexOf(m->inputs[i].node));
+    outputIds.reserve(m->outputs.size());
+    for (size_t i = 0; i < m->outputs.size(); i++)
+        if (m->outputs[i].node)
+            outputIds.push_back(indexOf(m->outputs[i].node));
+}
+
+// Longest-path levels on the flat graph: primary inputs are level 0 and
+// every gate/cell is one more than its deepest fanin. Wires and ports take
+// the level of their driver.
+void NetlistView::levelize()
+{
+    const size_t n = size();
+    std::vector<Id> pending(n);
+    std::vector<Id> queue;
+    queue.reserve(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        Id count = 0;
+        for (const Id *it = faninBegin(i); it != faninEnd(i); ++it)
+            if (*it != NullId)
+                count++;
+        pending[i] = count;
+        levels[i] = 0;
+        if (count == 0)
+            queue.push_back((Id) i);
+    }
+
+    depth = 0;
+    for (size_t head = 0; head < queue.size(); head++)
+    {
+        Id id = queue[head];
+        Node::NodeType type = nodeType(id);
+        if (type == Node::GateNode || type == Node::CellNode)
+            levels[id] += 1;
+        if (levels[id] > depth)
+            depth = levels[id];
+        for (const Id *it = fanoutBegin(id); it != fanoutEnd(id); ++it)
+        {
+            if (*it == NullId)
+                continue;
+            if (levels[*it] < levels[id])
+                levels[*it] = levels[id];
+            if (--pending[*it] == 0)
+                queue.push_back(*it);
+        }
+    }
+
+    if (queue.size() != n)
+        std::cerr << "WARNING: NetlistView::levelize(): "
+                  << n - queue.size() << " nodes are in loops" << std::endl;
+}
+
+Port::PortType NetlistView::portType(Id id) const
+{
+    if (nodeType(id) != Node::PortNode)
+        return Port::BasePort;
+    return ((PortPrivate*) nodes[id])->type;
+}
+
+NetlistView::Id NetlistView::indexOf(const NodePrivate *node) const
+{
+    if (!node)
+        return NullId;
+    std::vector<std::pair<const NodePrivate*,Id> >::const_iterator it =
+        std::lower_bound(ids.begin(), ids.end(), std::make_pair(node, (Id) 0));
+    if (it == ids.end() || it->first != node)
+        return NullId;
+    return it->second;
+}
+
+NetlistView::Id NetlistView::id(NodeRef node) const
+{
+    return indexOf(node.impl);
+}
+
+Node NetlistView::node(Id id) const
+{
+    if (id >= nodes.size())
+        return Node();
+    return Node(nodes[id]);
+}
+
+std::string NetlistView::name(Id id) const
+{
+    if (id >= nodes.size())
+        return std::string();
+    return nodes[id]->nodeName();
+}
@@ -1,5 +1,27 @@
 #include "circuit.h"
 
+namespace {
+
+// The bits that are surely 1 and surely 0, and a value from them. These
+// are the formulas of the four-valued kernels in simulator.cpp on 1 bit.
+inline unsigned one(unsigned s)
+{
+    return s & ~(s >> 1) & 1;
+}
+
+inline unsigned zero(unsigned s)
+{
+    return ~(s | (s >> 1)) & 1;
+}
+
+inline unsigned fromKnown(unsigned one, unsigned zero)
+{
+    unsigned unknown = ~(one | zero) & 1;
+    return (unknown << 1) | one | unknown;
+}
+
+} // anonymous namespace
+
 Signal::Signal() : value(0)
 {
 }
@@ -10,64 +32,63 @@ Signal::Signal(unsigned s) : value(s)
         value = X;
 }
 
-Signal Signal::operator& (const Signal &other)
+Signal Signal::operator& (const Signal &other) const
 {
-    if (this->value == Z || other.value == Z)
-        return Z;
-    if (this->value == X || other.value == X)
-        return X;
-    return this->value & other.value;
+    return fromKnown(one(value) & one(other.value), zero(value) | zero(other.value));
 }
 
 Signal Signal::operator&= (const Signal &other)
 {
-    this->value = this->value & other.value;
-    return this->value;
+    value = (*this & other).value;
+    return *this;
 }
 
-Signal Signal::operator| (const Signal &other)
+Signal Signal::operator| (const Signal &other) const
 {
-    if (this->value == Z || other.value == Z)
-        return Z;
-    if (this->value == X || other.value == X)
-        return X;
-    return this->value | other.value;
+    return fromKnown(one(value) | one(other.value), zero(value) & zero(other.value));
 }
 
 Signal Signal::operator|= (const Signal &other)
 {
-    this->value = this->value | other.value;
-    return this->value;
+    value = (*this | other).value;
+    return *this;
 }
 
-bool Signal::operator== (const Signal &other)
+Signal Signal::operator^ (const Signal &other) const
+{
+    unsigned unknown = (value | other.value) >> 1;
+    unsigned x = (value ^ other.value) & 1;
+    return fromKnown(x & ~unknown & 1, ~(x | unknown) & 1);
+}
+
+Signal Signal::operator^= (const Signal &other)
+{
+    value = (*this ^ other).value;
+    return *this;
+}
+
+bool Signal::operator== (const Signal &other) const
 {
     return this->value == other.value;
 }
 
-bool Signal::operator== (const Signal::SignalType &type)
+bool Signal::operator== (const Signal::SignalType &type) const
 {
-    return this->value == type;
+    return this->value == (unsigned) type;
 }
 
-bool Signal::operator!= (const Signal::SignalType &type)
+bool Signal::operator!= (const Signal::SignalType &type) const
 {
-    return this->value != type;
+    return this->value != (unsigned) type;
 }
 
-Signal Signal::operator~ () {
-    if (this->value == Z)
-        return Z;
-    if (this->value == X)
-        return X;
-    return ~this->value & 1;
+Signal Signal::operator~ () const
+{
+    return fromKnown(zero(value), one(value));
 }
 
-Signal Signal::operator! () {
-    if (this->value == Z)
-        return Z;
-    if (this->value == X)
-        return X;
+Signal Signal::operator! () const
+{
     return operator~();
 }
 
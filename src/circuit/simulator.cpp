@@ -0,0 +1,1183 @@
+#include "circuit.h"
+#include "circuit_p.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iostream>
+#include <set>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMULATOR_X86_KERNELS
+#endif
+#ifdef __GNUC__
+#define KERNEL_INLINE inline __attribute__((always_inline))
+#else
+#define KERNEL_INLINE inline
+#endif
+
+namespace {
+
+const unsigned char ValueX = Signal::X;
+const char ConstantPrefix[] = "__internal_wire_";
+
+// Union-find over view ids, for nets made of several ports and wires
+unsigned findNet(std::vector<unsigned> &parent, unsigned id)
+{
+    while (parent[id] != id)
+    {
+        parent[id] = parent[parent[id]];
+        id = parent[id];
+    }
+    return id;
+}
+
+bool isNet(Node::NodeType type)
+{
+    return type == Node::PortNode || type == Node::WireNode;
+}
+
+// A 1'b0 or 1'b1 of the netlist, as load() and flattening name it
+bool isConstant(const NodePrivate *node)
+{
+    if (node->value != Signal::F && node->value != Signal::T)
+        return false;
+    std::string name = node->nodeName();
+    size_t base = name.rfind('/');
+    base = (base == std::string::npos ? 0 : base + 1);
+    return name.compare(base, sizeof(ConstantPrefix) - 1, ConstantPrefix) == 0;
+}
+
+unsigned char encode(Signal s)
+{
+    return (unsigned char) (s == Signal::F ? Signal::F : s == Signal::T ? Signal::T
+                            : s == Signal::Z ? Signal::Z : Signal::X);
+}
+
+size_t kernelWords(CompiledSimulator::Kernel kernel)
+{
+    return kernel == CompiledSimulator::AVX512 ? 8 : kernel == CompiledSimulator::AVX2 ? 4 : 1;
+}
+
+bool isMux2(const std::string &type)
+{
+    return type.size() >= 4 && tolower(type[0]) == 'm' && tolower(type[1]) == 'u'
+        && tolower(type[2]) == 'x' && type[3] == '2';
+}
+
+// Liberty pin function in postfix order, "!(A1 & A2)" is A1 A2 &~
+struct Term
+{
+    char op;            // 'p' pin, '0' or '1', '!', '&', '|' or '^'
+    bool invert;
+    unsigned count;     // operands of '&', '|' and '^'
+    std::string pin;
+};
+
+// Precedence from low to high: | +, & * or a space, ^, then ! and '
+class FunctionParser
+{
+public:
+    explicit FunctionParser(const std::string &text) : text(text), pos(0) {}
+
+    bool parse(std::vector<Term> &result);
+
+private:
+    bool parseOr();
+    bool parseAnd();
+    bool parseXor();
+    bool parseUnary();
+    char next();
+    bool startsOperand();
+    void push(char op, unsigned count, const std::string &pin = std::string());
+    void invert();
+
+    const std::string &text;
+    size_t pos;
+    std::vector<Term> terms;
+};
+
+bool FunctionParser::parse(std::vector<Term> &result)
+{
+    terms.clear();
+    if (!parseOr() || next() != 0)
+        return false;
+    result.swap(terms);
+    return true;
+}
+
+char FunctionParser::next()
+{
+    while (pos < text.size() && isspace((unsigned char) text[pos]))
+        pos++;
+    return pos < text.size() ? text[pos] : 0;
+}
+
+bool FunctionParser::startsOperand()
+{
+    char c = next();
+    return c == '(' || c == '!' || c == '_' || isalnum((unsigned char) c);
+}
+
+void FunctionParser::push(char op, unsigned count, const std::string &pin)
+{
+    Term term;
+    term.op = op;
+    term.invert = false;
+    term.count = count;
+    term.pin = pin;
+    terms.push_back(term);
+}
+
+void FunctionParser::invert()
+{
+    Term &last = terms.back();
+    if (last.op == '&' || last.op == '|' || last.op == '^')
+        last.invert = !last.invert;
+    else if (last.op == '!')
+        terms.pop_back();
+    else
+        push('!', 1);
+}
+
+bool FunctionParser::parseOr()
+{
+    unsigned count = 1;
+    if (!parseAnd())
+        return false;
+    while (next() == '|' || next() == '+')
+    {
+        pos++;
+        if (!parseAnd())
+            return false;
+        count++;
+    }
+    if (count > 1)
+        push('|', count);
+    return true;
+}
+
+bool FunctionParser::parseAnd()
+{
+    unsigned count = 1;
+    if (!parseXor())
+        return false;
+    while (next() == '&' || next() == '*' || startsOperand())
+    {
+        if (next() == '&' || next() == '*')
+            pos++;
+        if (!parseXor())
+            return false;
+        count++;
+    }
+    if (count > 1)
+        push('&', count);
+    return true;
+}
+
+bool FunctionParser::parseXor()
+{
+    unsigned count = 1;
+    if (!parseUnary())
+        return false;
+    while (next() == '^')
+    {
+        pos++;
+        if (!parseUnary())
+            return false;
+        count++;
+    }
+    if (count > 1)
+        push('^', count);
+    return true;
+}
+
+bool FunctionParser::parseUnary()
+{
+    char c = next();
+    if (c == '!')
+    {
+        pos++;
+        if (!parseUnary())
+            return false;
+        invert();
+        return true;
+    }
+    if (c == '(')
+    {
+        pos++;
+        if (!parseOr() || next() != ')')
+            return false;
+        pos++;
+    }
+    else if (c == '_' || isalpha((unsigned char) c))
+    {
+        size_t first = pos;
+        while (pos < text.size() && (text[pos] == '_' || isalnum((unsigned char) text[pos])))
+            pos++;
+        push('p', 0, text.substr(first, pos - first));
+    }
+    else if (c == '0' || c == '1')
+    {
+        pos++;
+        push(c, 0);
+    }
+    else
+        return false;
+    while (next() == '\'')
+    {
+        pos++;
+        invert();
+    }
+    return true;
+}
+
+} // anonymous namespace
+
+/**************************************************************
+ *
+ * SimulatorKernels
+ *
+ **************************************************************/
+
+// One kernel for every width: V is a Word, or a GCC vector of Words that
+// the target attributes below turn into AVX2 or AVX-512 instructions.
+// Values are copied with memcpy as words are only 8-byte aligned.
+struct SimulatorKernels
+{
+    typedef CompiledSimulator::Word Word;
+    typedef CompiledSimulator::Instruction Instruction;
+
+    template <class V>
+    static KERNEL_INLINE void load(V &v, const Word *w, unsigned slot)
+    {
+        memcpy(&v, w + (size_t) slot * (sizeof(V) / sizeof(Word)), sizeof(V));
+    }
+
+    // Four values: the value plane, then the unknown plane of each slot
+    template <class V>
+    static KERNEL_INLINE void loadPlanes(V &v, V &u, const Word *w, unsigned slot)
+    {
+        const Word *p = w + (size_t) slot * (2 * sizeof(V) / sizeof(Word));
+        memcpy(&v, p, sizeof(V));
+        memcpy(&u, p + sizeof(V) / sizeof(Word), sizeof(V));
+    }
+
+    static KERNEL_INLINE unsigned char evaluate(const Instruction *i, const unsigned *operand,
+                                                const unsigned char *v);
+    template <class V>
+    static KERNEL_INLINE void run(const CompiledSimulator &sim, Word *w);
+    template <class V>
+    static KERNEL_INLINE void runFourValued(const CompiledSimulator &sim, Word *w);
+
+    static void runScalar(const CompiledSimulator &sim, Word *w);
+#ifdef SIMULATOR_X86_KERNELS
+    typedef Word Word4 __attribute__((vector_size(32)));
+    typedef Word Word8 __attribute__((vector_size(64)));
+    __attribute__((target("avx2"))) static void runAVX2(const CompiledSimulator &sim, Word *w);
+    __attribute__((target("avx512f"))) static void runAVX512(const CompiledSimulator &sim, Word *w);
+#endif
+};
+
+template <class V>
+KERNEL_INLINE void SimulatorKernels::run(const CompiledSimulator &sim, Word *w)
+{
+    const unsigned *operand = sim.operands.data();
+    const Instruction *end = sim.code.data() + sim.code.size();
+    for (const Instruction *i = sim.code.data(); i != end; ++i)
+    {
+        const unsigned *in = operand + i->in;
+        V r, x, s;
+        load(r, w, in[0]);
+        switch (i->op)
+        {
+            case CompiledSimulator::Buf:
+                break;
+            case CompiledSimulator::Inv:
+                r = ~r;
+                break;
+            case CompiledSimulator::And:
+            case CompiledSimulator::Nand:
+                for (unsigned k = 1; k < i->count; k++)
+                {
+                    load(x, w, in[k]);
+                    r &= x;
+                }
+                if (i->op == CompiledSimulator::Nand)
+                    r = ~r;
+                break;
+            case CompiledSimulator::Or:
+            case CompiledSimulator::Nor:
+                for (unsigned k = 1; k < i->count; k++)
+                {
+                    load(x, w, in[k]);
+                    r |= x;
+                }
+                if (i->op == CompiledSimulator::Nor)
+                    r = ~r;
+                break;
+            case CompiledSimulator::Xor:
+            case CompiledSimulator::Xnor:
+                for (unsigned k = 1; k < i->count; k++)
+                {
+                    load(x, w, in[k]);
+                    r ^= x;
+                }
+                if (i->op == CompiledSimulator::Xnor)
+                    r = ~r;
+                break;
+            default: // Mux2: A, B, S
+                load(x, w, in[1]);
+                load(s, w, in[2]);
+                r = (r & ~s) | (x & s);
+        }
+        memcpy(w + (size_t) i->out * (sizeof(V) / sizeof(Word)), &r, sizeof(V));
+    }
+}
+
+// Each gate works on the bits that are surely 1 and surely 0, as in
+// Signal; the rest of the output is X. Inverting swaps the two.
+template <class V>
+KERNEL_INLINE void SimulatorKernels::runFourValued(const CompiledSimulator &sim, Word *w)
+{
+    const unsigned *operand = sim.operands.data();
+    const Instruction *end = sim.code.data() + sim.code.size();
+    for (const Instruction *i = sim.code.data(); i != end; ++i)
+    {
+        const unsigned *in = operand + i->in;
+        V v, u, one, zero;
+        loadPlanes(v, u, w, in[0]);
+        one = v & ~u;
+        zero = ~(v | u);
+        switch (i->op)
+        {
+            case CompiledSimulator::Buf:
+            case CompiledSimulator::Inv:
+                break;
+            case CompiledSimulator::And:
+            case CompiledSimulator::Nand:
+                for (unsigned k = 1; k < i->count; k++)
+                {
+                    loadPlanes(v, u, w, in[k]);
+                    one &= v & ~u;
+                    zero |= ~(v | u);
+                }
+                break;
+            case CompiledSimulator::Or:
+            case CompiledSimulator::Nor:
+                for (unsigned k = 1; k < i->count; k++)
+                {
+                    loadPlanes(v, u, w, in[k]);
+                    one |= v & ~u;
+                    zero &= ~(v | u);
+                }
+                break;
+            case CompiledSimulator::Xor:
+            case CompiledSimulator::Xnor:
+            {
+                V x = v, unknown = u;
+                for (unsigned k = 1; k < i->count; k++)
+                {
+                    loadPlanes(v, u, w, in[k]);
+                    x ^= v;
+                    unknown |= u;
+                }
+                one = x & ~unknown;
+                zero = ~(x | unknown);
+                break;
+            }
+            default: // Mux2: A, B, S
+            {
+                V oneB, zeroB, oneS, zeroS;
+                loadPlanes(v, u, w, in[1]);
+                oneB = v & ~u;
+                zeroB = ~(v | u);
+                loadPlanes(v, u, w, in[2]);
+                oneS = v & ~u;
+                zeroS = ~(v | u);
+                one = (zeroS & one) | (oneS & oneB) | (one & oneB);
+                zero = (zeroS & zero) | (oneS & zeroB) | (zero & zeroB);
+            }
+        }
+        if (i->op == CompiledSimulator::Inv || i->op == CompiledSimulator::Nand
+            || i->op == CompiledSimulator::Nor || i->op == CompiledSimulator::Xnor)
+        {
+            V t = one;
+            one = zero;
+            zero = t;
+        }
+        u = ~(one | zero);
+        v = one | u;
+        Word *out = w + (size_t) i->out * (2 * sizeof(V) / sizeof(Word));
+        memcpy(out, &v, sizeof(V));
+        memcpy(out + sizeof(V) / sizeof(Word), &u, sizeof(V));
+    }
+}
+
+// One instruction of run() and runEvents() on the byte per value
+KERNEL_INLINE unsigned char SimulatorKernels::evaluate(const Instruction *i, const unsigned *operand, const unsigned char *v)
+{
+    const unsigned *in = operand + i->in;
+    unsigned char r;
+    switch (i->op)
+    {
+        case CompiledSimulator::Buf:
+        case CompiledSimulator::Inv:
+            r = v[in[0]];
+            r = (r > 1 ? ValueX : (unsigned char) (r ^ (i->op == CompiledSimulator::Inv)));
+            break;
+        case CompiledSimulator::And:
+        case CompiledSimulator::Nand:
+            r = 1;
+            for (unsigned k = 0; k < i->count; k++)
+            {
+                unsigned char x = v[in[k]];
+                if (x == 0)
+                {
+                    r = 0;
+                    break;
+                }
+                if (x != 1)
+                    r = ValueX;
+            }
+            if (i->op == CompiledSimulator::Nand && r <= 1)
+                r ^= 1;
+            break;
+        case CompiledSimulator::Or:
+        case CompiledSimulator::Nor:
+            r = 0;
+            for (unsigned k = 0; k < i->count; k++)
+            {
+                unsigned char x = v[in[k]];
+                if (x == 1)
+                {
+                    r = 1;
+                    break;
+                }
+                if (x != 0)
+                    r = ValueX;
+            }
+            if (i->op == CompiledSimulator::Nor && r <= 1)
+                r ^= 1;
+            break;
+        case CompiledSimulator::Xor:
+        case CompiledSimulator::Xnor:
+            r = (i->op == CompiledSimulator::Xnor);
+            for (unsigned k = 0; k < i->count; k++)
+            {
+                unsigned char x = v[in[k]];
+                if (x > 1)
+                {
+                    r = ValueX;
+                    break;
+                }
+                r ^= x;
+            }
+            break;
+        default: // Mux2: A, B, S
+        {
+            unsigned char a = v[in[0]], b = v[in[1]], s = v[in[2]];
+            r = (s == 0 ? a : s == 1 ? b : (a == b ? a : ValueX));
+            if (r > 1)
+                r = ValueX;
+        }
+    }
+    return r;
+}
+
+void SimulatorKernels::runScalar(const CompiledSimulator &sim, Word *w)
+{
+    if (sim.planes == 2)
+        runFourValued<Word>(sim, w);
+    else
+        run<Word>(sim, w);
+}
+
+#ifdef SIMULATOR_X86_KERNELS
+void SimulatorKernels::runAVX2(const CompiledSimulator &sim, Word *w)
+{
+    if (sim.planes == 2)
+        runFourValued<Word4>(sim, w);
+    else
+        run<Word4>(sim, w);
+}
+
+void SimulatorKernels::runAVX512(const CompiledSimulator &sim, Word *w)
+{
+    if (sim.planes == 2)
+        runFourValued<Word8>(sim, w);
+    else
+        run<Word8>(sim, w);
+}
+#endif
+
+/**************************************************************
+ *
+ * CompiledSimulator
+ *
+ **************************************************************/
+
+CompiledSimulator::CompiledSimulator()
+    : currentKernel(bestKernel()), blockWords(kernelWords(currentKernel)), planes(1), wordPatterns(0),
+      settled(false), lastEvents(0), eventTotal(0), runs(0)
+{
+}
+
+CompiledSimulator::CompiledSimulator(const Module &module)
+    : currentKernel(bestKernel()), blockWords(kernelWords(currentKernel)), planes(1), wordPatterns(0),
+      settled(false), lastEvents(0), eventTotal(0), runs(0)
+{
+    compile(module);
+}
+
+CompiledSimulator::CompiledSimulator(const Circuit &circuit)
+    : currentKernel(bestKernel()), blockWords(kernelWords(currentKernel)), planes(1), wordPatterns(0),
+      settled(false), lastEvents(0), eventTotal(0), runs(0)
+{
+    compile(circuit.topModule());
+}
+
+void CompiledSimulator::clear()
+{
+    view.clear();
+    source = Module();
+    flat = Circuit();
+    code.clear();
+    operands.clear();
+    values.clear();
+    words.clear();
+    wordPatterns = 0;
+    nodeSlots.clear();
+    inputSlots.clear();
+    outputSlots.clear();
+    readerIndex.clear();
+    readers.clear();
+    levels.clear();
+    queues.clear();
+    queued.clear();
+    changed.clear();
+    settled = false;
+    resetCounters();
+}
+
+void CompiledSimulator::compile(const Module &module)
+{
+    clear();
+    source = module;
+    if (module.instanceSize())
+    {
+        flat = module.flatten();
+        view.build(flat.topModule());
+    }
+    else
+        view.build(module);
+    view.levelize();
+    const size_t n = view.size();
+    if (n == 0)
+        return;
+
+    // One value per net; slot 0 is a constant X for unconnected pins
+    std::vector<unsigned> parent(n);
+    for (size_t i = 0; i < n; i++)
+        parent[i] = (unsigned) i;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (!isNet(view.nodeType(i)))
+            continue;
+        for (const NetlistView::Id *it = view.fanoutBegin(i); it != view.fanoutEnd(i); ++it)
+            if (*it != NetlistView::NullId && isNet(view.nodeType(*it)))
+                parent[findNet(parent, *it)] = findNet(parent, i);
+    }
+    std::vector<unsigned> netSlot(n, 0);
+    values.push_back(ValueX);
+    nodeSlots.assign(n, 0);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (!isNet(view.nodeType(i)))
+            continue;
+        unsigned root = findNet(parent, i);
+        if (!netSlot[root])
+        {
+            netSlot[root] = (unsigned) values.size();
+            values.push_back(ValueX);
+        }
+        nodeSlots[i] = netSlot[root];
+    }
+
+    // Undriven nets are X, unless they are constants, see below
+    std::vector<char> driven(values.size(), 0);
+    for (size_t i = 0; i < view.inputSize(); i++)
+        driven[nodeSlots[view.input(i)]] = 1;
+
+    std::vector<NetlistView::Id> order;
+    for (size_t i = 0; i < n; i++)
+    {
+        Node::NodeType type = view.nodeType(i);
+        if (type == Node::GateNode || type == Node::CellNode)
+            order.push_back((NetlistView::Id) i);
+    }
+    std::stable_sort(order.begin(), order.end(), [this](NetlistView::Id a, NetlistView::Id b) {
+        return view.level(a) < view.level(b);
+    });
+
+    std::set<std::string> unsupported;
+    code.reserve(order.size());
+    for (size_t k = 0; k < order.size(); k++)
+    {
+        NetlistView::Id id = order[k];
+        const GatePrivate *gate = (const GatePrivate*) view.nodes[id];
+
+        // A gate without a net on its output still gets a value of its own
+        unsigned out;
+        NetlistView::Id net = view.fanoutSize(id) ? view.fanout(id, 0) : NetlistView::NullId;
+        if (net != NetlistView::NullId && isNet(view.nodeType(net)))
+            out = nodeSlots[net];
+        else
+        {
+            out = (unsigned) values.size();
+            values.push_back(ValueX);
+        }
+        nodeSlots[id] = out;
+        for (const NetlistView::Id *it = view.fanoutBegin(id); it != view.fanoutEnd(id); ++it)
+            if (*it != NetlistView::NullId && isNet(view.nodeType(*it)))
+                driven[nodeSlots[*it]] = 1;
+
+        Instruction instruction;
+        instruction.out = out;
+        instruction.in = (unsigned) operands.size();
+        switch (gate->gateType())
+        {
+            case Gate::BUF:     instruction.op = Buf; break;
+            case Gate::INV:     instruction.op = Inv; break;
+            case Gate::AND:     instruction.op = And; break;
+            case Gate::NAND:    instruction.op = Nand; break;
+            case Gate::OR:      instruction.op = Or; break;
+            case Gate::NOR:     instruction.op = Nor; break;
+            case Gate::XOR:     instruction.op = Xor; break;
+            case Gate::XNOR:    instruction.op = Xnor; break;
+            default:
+            {
+                const CellPrivate *cell = gate->isCell() ? (const CellPrivate*) gate : 0;
+                int a = cell ? cell->inputPin("A") : -1;
+                int b = cell ? cell->inputPin("B") : -1;
+                int s = cell ? cell->inputPin("S") : -1;
+                if (cell && isMux2(cell->cellType()) && a >= 0 && b >= 0 && s >= 0)
+                {
+                    instruction.op = Mux2;
+                    instruction.count = 3;
+                    const int pins[3] = { a, b, s };
+                    for (int j = 0; j < 3; j++)
+                    {
+                        NetlistView::Id in = view.fanin(id, pins[j]);
+                        operands.push_back(in == NetlistView::NullId ? 0 : nodeSlots[in]);
+                    }
+                    code.push_back(instruction);
+                }
+                else if (!(cell && compileFunction(id, out))
+                         && unsupported.insert(cell ? cell->cellType() : std::string("gate")).second)
+                    std::cerr << "WARNING: CompiledSimulator: " << (cell ? cell->cellType() : gate->nodeName())
+                              << " is not supported, its outputs stay X" << std::endl;
+                continue;
+            }
+        }
+        size_t count = view.faninSize(id);
+        if (count == 0 || count > 0xffff)
+        {
+            std::cerr << "WARNING: CompiledSimulator: bad input count: " << gate->nodeName() << std::endl;
+            continue;
+        }
+        instruction.count = (unsigned short) count;
+        for (const NetlistView::Id *it = view.faninBegin(id); it != view.faninEnd(id); ++it)
+            operands.push_back(*it == NetlistView::NullId ? 0 : nodeSlots[*it]);
+        code.push_back(instruction);
+    }
+    // Values of gates without an output net came after
+    driven.resize(values.size(), 1);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned slot = nodeSlots[i];
+        if (slot && !driven[slot] && isNet(view.nodeType(i)) && isConstant(view.nodes[i]))
+        {
+            values[slot] = encode(view.nodes[i]->value);
+            driven[slot] = 1;
+        }
+    }
+
+    for (size_t i = 0; i < view.inputSize(); i++)
+        inputSlots.push_back(nodeSlots[view.input(i)]);
+    for (size_t i = 0; i < view.outputSize(); i++)
+        outputSlots.push_back(nodeSlots[view.output(i)]);
+
+    // Floating nets that anything reads, by their first node
+    std::vector<char> read(values.size(), 0);
+    for (size_t i = 0; i < operands.size(); i++)
+        read[operands[i]] = 1;
+    for (size_t i = 0; i < outputSlots.size(); i++)
+        read[outputSlots[i]] = 1;
+    size_t floating = 0;
+    std::string example;
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned slot = nodeSlots[i];
+        if (!slot || driven[slot] || !read[slot] || !isNet(view.nodeType(i)))
+            continue;
+        if (!floating++)
+            example = view.nodes[i]->nodeName();
+        read[slot] = 0;
+    }
+    if (floating)
+        std::cerr << "WARNING: CompiledSimulator: " << floating << " undriven net(s), e.g. "
+                  << example << ", read as X" << std::endl;
+
+    compileEvents();
+    resetWords();
+}
+
+// The readers of each value, and a level for each instruction one above
+// the instructions it reads, so that a queue does not grow while it runs
+void CompiledSimulator::compileEvents()
+{
+    std::vector<unsigned> valueLevels(values.size(), 0);
+    readerIndex.assign(values.size() + 1, 0);
+    levels.resize(code.size());
+    unsigned depth = 0;
+    for (size_t k = 0; k < code.size(); k++)
+    {
+        const Instruction &i = code[k];
+        unsigned level = 0;
+        for (unsigned j = 0; j < i.count; j++)
+        {
+            unsigned in = operands[i.in + j];
+            level = std::max(level, valueLevels[in]);
+            readerIndex[in + 1]++;
+        }
+        levels[k] = level;
+        valueLevels[i.out] = level + 1;
+        depth = std::max(depth, level);
+    }
+    for (size_t i = 0; i < values.size(); i++)
+        readerIndex[i + 1] += readerIndex[i];
+    readers.resize(readerIndex.back());
+    std::vector<unsigned> fill(readerIndex.begin(), readerIndex.end() - 1);
+    for (size_t k = 0; k < code.size(); k++)
+        for (unsigned j = 0; j < code[k].count; j++)
+            readers[fill[operands[code[k].in + j]]++] = (unsigned) k;
+
+    queues.assign(code.empty() ? 0 : depth + 1, std::vector<unsigned>());
+    queued.assign(code.size(), 0);
+    changed.clear();
+}
+
+void CompiledSimulator::resetWords()
+{
+    words.assign(values.size() * planes * blockWords, 0);
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        Word *value = words.data() + i * planes * blockWords;
+        Signal s(values[i]);
+        if (planes == 1)
+            std::fill_n(value, blockWords, (Word) 0 - (s == Signal::T));
+        else
+        {
+            std::fill_n(value, blockWords, (Word) 0 - s.valuePlane());
+            std::fill_n(value + blockWords, blockWords, (Word) 0 - s.unknownPlane());
+        }
+    }
+    wordPatterns = 0;
+}
+
+// Emits the Liberty function of a one-output cell, with new values for
+// the inner terms
+bool CompiledSimulator::compileFunction(NetlistView::Id id, unsigned out)
+{
+    const CellPrivate *cell = (const CellPrivate*) view.nodes[id];
+    std::vector<Term> terms;
+    if (cell->outputs.size() != 1 || !FunctionParser(cell->master->function).parse(terms))
+        return false;
+    std::vector<unsigned> pinSlots(terms.size(), 0);
+    for (size_t t = 0; t < terms.size(); t++)
+    {
+        if (terms[t].count > 0xffff)
+            return false;
+        if (terms[t].op != 'p')
+            continue;
+        int pin = cell->inputPin(terms[t].pin);
+        if (pin < 0)
+            return false;
+        NetlistView::Id in = view.fanin(id, pin);
+        pinSlots[t] = (in == NetlistView::NullId ? 0 : nodeSlots[in]);
+    }
+
+    std::vector<unsigned> stack;
+    for (size_t t = 0; t < terms.size(); t++)
+    {
+        const Term &term = terms[t];
+        Instruction instruction;
+        instruction.out = (t + 1 == terms.size() ? out : 0);
+        instruction.in = (unsigned) operands.size();
+        instruction.count = (unsigned short) term.count;
+        switch (term.op)
+        {
+            case 'p':
+                stack.push_back(pinSlots[t]);
+                break;
+            case '0':
+            case '1':
+                stack.push_back((unsigned) values.size());
+                values.push_back((unsigned char) (term.op - '0'));
+                break;
+            case '!':   instruction.op = Inv; break;
+            case '&':   instruction.op = (term.invert ? Nand : And); break;
+            case '|':   instruction.op = (term.invert ? Nor : Or); break;
+            default:    instruction.op = (term.invert ? Xnor : Xor); break;
+        }
+        if (term.op == 'p' || term.op == '0' || term.op == '1')
+        {
+            if (!instruction.out)
+                continue;
+            // The whole function is one pin or constant
+            instruction.op = Buf;
+            instruction.count = 1;
+        }
+        operands.insert(operands.end(), stack.end() - instruction.count, stack.end());
+        stack.resize(stack.size() - instruction.count);
+        if (!instruction.out)
+        {
+            instruction.out = (unsigned) values.size();
+            values.push_back(ValueX);
+        }
+        stack.push_back(instruction.out);
+        code.push_back(instruction);
+    }
+    return true;
+}
+
+bool CompiledSimulator::input(const Pattern &pattern)
+{
+    if (pattern.size() != inputSlots.size())
+        return false;
+    for (size_t i = 0; i < pattern.size(); i++)
+    {
+        char c = pattern[i];
+        unsigned char value = (unsigned char) (c == '0' ? Signal::F : c == '1' ? Signal::T
+                                               : (c == 'z' || c == 'Z') ? Signal::Z : Signal::X);
+        unsigned slot = inputSlots[i];
+        if (values[slot] != value)
+        {
+            values[slot] = value;
+            changed.push_back(slot);
+        }
+    }
+    return true;
+}
+
+void CompiledSimulator::setInput(size_t i, Signal value)
+{
+    if (i >= inputSlots.size())
+        return;
+    unsigned slot = inputSlots[i];
+    if (values[slot] != encode(value))
+    {
+        values[slot] = encode(value);
+        changed.push_back(slot);
+    }
+}
+
+void CompiledSimulator::run()
+{
+    unsigned char *v = values.data();
+    const unsigned *operand = operands.data();
+    const Instruction *end = code.data() + code.size();
+    for (const Instruction *i = code.data(); i != end; ++i)
+        v[i->out] = SimulatorKernels::evaluate(i, operand, v);
+    changed.clear();
+    settled = true;
+    lastEvents = code.size();
+    eventTotal += lastEvents;
+    runs++;
+}
+
+void CompiledSimulator::runEvents()
+{
+    if (!settled)
+    {
+        run();
+        return;
+    }
+    unsigned char *v = values.data();
+    const unsigned *operand = operands.data();
+    auto schedule = [this](unsigned value) {
+        for (unsigned r = readerIndex[value]; r < readerIndex[value + 1]; r++)
+        {
+            unsigned k = readers[r];
+            if (!queued[k])
+            {
+                queued[k] = 1;
+                queues[levels[k]].push_back(k);
+            }
+        }
+    };
+    for (size_t i = 0; i < changed.size(); i++)
+        schedule(changed[i]);
+    changed.clear();
+
+    size_t events = 0;
+    for (size_t level = 0; level < queues.size(); level++)
+    {
+        std::vector<unsigned> &queue = queues[level];
+        for (size_t q = 0; q < queue.size(); q++)
+        {
+            unsigned k = queue[q];
+            const Instruction *i = code.data() + k;
+            unsigned char r = SimulatorKernels::evaluate(i, operand, v);
+            queued[k] = 0;
+            if (r != v[i->out])
+            {
+                v[i->out] = r;
+                schedule(i->out);
+            }
+        }
+        events += queue.size();
+        queue.clear();
+    }
+    lastEvents = events;
+    eventTotal += events;
+    runs++;
+}
+
+double CompiledSimulator::eventsPerPattern() const
+{
+    return runs ? (double) eventTotal / runs : 0.0;
+}
+
+double CompiledSimulator::activity() const
+{
+    return code.empty() ? 0.0 : eventsPerPattern() / code.size();
+}
+
+void CompiledSimulator::resetCounters()
+{
+    lastEvents = 0;
+    eventTotal = 0;
+    runs = 0;
+}
+
+Pattern CompiledSimulator::output() const
+{
+    // Written like Circuit::output()
+    Pattern pattern(outputSlots.size(), '0');
+    for (size_t i = 0; i < outputSlots.size(); i++)
+        pattern[i] = (char) ('0' + values[outputSlots[i]]);
+    return pattern;
+}
+
+Signal CompiledSimulator::output(size_t i) const
+{
+    if (i >= outputSlots.size())
+        return Signal(Signal::X);
+    return Signal(values[outputSlots[i]]);
+}
+
+// The copy of a node of a module with instances in its flattened circuit,
+// which keeps the names of the module's own nodes
+NodeRef CompiledSimulator::flatNode(NodeRef node) const
+{
+    if (flat.isNull() || node.isNull())
+        return NodeRef();
+    Module top = flat.topModule();
+    std::string name = node.name();
+    switch (node.nodeType())
+    {
+        case Node::PortNode:
+            return NodeRef(source.port(name)) == node ? NodeRef(top.port(name)) : NodeRef();
+        case Node::WireNode:
+            return NodeRef(source.wire(name)) == node ? NodeRef(top.wire(name)) : NodeRef();
+        case Node::GateNode:
+            return NodeRef(source.gate(name)) == node ? NodeRef(top.gate(name)) : NodeRef();
+        case Node::CellNode:
+            return NodeRef(source.cell(name)) == node ? NodeRef(top.cell(name)) : NodeRef();
+        default:
+            return NodeRef();
+    }
+}
+
+Signal CompiledSimulator::value(NodeRef node) const
+{
+    NetlistView::Id id = view.id(node);
+    if (id == NetlistView::NullId)
+        id = view.id(flatNode(node));
+    if (id == NetlistView::NullId || !nodeSlots[id])
+        return Signal(Signal::X);
+    return Signal(values[nodeSlots[id]]);
+}
+
+CompiledSimulator::Kernel CompiledSimulator::bestKernel()
+{
+#ifdef SIMULATOR_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return AVX2;
+#endif
+    return Scalar;
+}
+
+bool CompiledSimulator::hasKernel(Kernel kernel)
+{
+#ifdef SIMULATOR_X86_KERNELS
+    __builtin_cpu_init();
+    if (kernel == AVX512)
+        return __builtin_cpu_supports("avx512f");
+    if (kernel == AVX2)
+        return __builtin_cpu_supports("avx2");
+#endif
+    return kernel == Scalar;
+}
+
+const char *CompiledSimulator::kernelName(Kernel kernel)
+{
+    switch (kernel)
+    {
+        case AVX2:      return "AVX2";
+        case AVX512:    return "AVX-512";
+        default:        return "Scalar";
+    }
+}
+
+bool CompiledSimulator::setKernel(Kernel kernel)
+{
+    if (!hasKernel(kernel))
+        return false;
+    currentKernel = kernel;
+    blockWords = kernelWords(kernel);
+    resetWords();
+    return true;
+}
+
+void CompiledSimulator::setFourValued(bool on)
+{
+    planes = (on ? 2 : 1);
+    resetWords();
+}
+
+bool CompiledSimulator::input(const std::vector<Pattern> &patterns, size_t first)
+{
+    size_t count = (first < patterns.size() ? std::min(patterns.size() - first, lanes()) : 0);
+    for (size_t k = 0; k < count; k++)
+        if (patterns[first + k].size() != inputSlots.size())
+            return false;
+    const size_t stride = planes * blockWords;
+    for (size_t i = 0; i < inputSlots.size(); i++)
+        std::fill_n(words.begin() + inputSlots[i] * stride, stride, 0);
+    // Pattern by pattern, so that each string is read in order
+    for (size_t k = 0; k < count; k++)
+    {
+        const char *pattern = patterns[first + k].data();
+        Word *block = words.data() + k / WordBits;
+        Word bit = (Word) 1 << (k % WordBits);
+        for (size_t i = 0; i < inputSlots.size(); i++)
+        {
+            char c = pattern[i];
+            Word *value = block + inputSlots[i] * stride;
+            if (c == '1')
+                *value |= bit;
+            else if (planes == 2 && c != '0')
+            {
+                value[blockWords] |= bit;
+                if (c != 'z' && c != 'Z')
+                    *value |= bit;
+            }
+        }
+    }
+    wordPatterns = count;
+    return true;
+}
+
+void CompiledSimulator::setInputWord(size_t i, Word word, size_t j)
+{
+    setInputPlanes(i, word, 0, j);
+}
+
+void CompiledSimulator::setInputPlanes(size_t i, Word value, Word unknown, size_t j)
+{
+    if (i >= inputSlots.size() || j >= blockWords)
+        return;
+    Word *p = words.data() + inputSlots[i] * planes * blockWords + j;
+    if (planes == 1)
+        *p = value & ~unknown;
+    else
+    {
+        p[0] = value;
+        p[blockWords] = unknown;
+    }
+}
+
+void CompiledSimulator::runWords()
+{
+    switch (currentKernel)
+    {
+#ifdef SIMULATOR_X86_KERNELS
+        case AVX512:
+            SimulatorKernels::runAVX512(*this, words.data());
+            break;
+        case AVX2:
+            SimulatorKernels::runAVX2(*this, words.data());
+            break;
+#endif
+        default:
+            SimulatorKernels::runScalar(*this, words.data());
+    }
+}
+
+CompiledSimulator::Word CompiledSimulator::outputWord(size_t i, size_t j) const
+{
+    if (i >= outputSlots.size() || j >= blockWords)
+        return 0;
+    return words[outputSlots[i] * planes * blockWords + j];
+}
+
+CompiledSimulator::Word CompiledSimulator::outputUnknownWord(size_t i, size_t j) const
+{
+    if (planes == 1 || i >= outputSlots.size() || j >= blockWords)
+        return 0;
+    return words[(outputSlots[i] * 2 + 1) * blockWords + j];
+}
+
+std::vector<Pattern> CompiledSimulator::outputPatterns() const
+{
+    std::vector<Pattern> result(wordPatterns, Pattern(outputSlots.size(), '0'));
+    for (size_t k = 0; k < wordPatterns; k++)
+    {
+        Pattern &pattern = result[k];
+        const Word *block = words.data() + k / WordBits;
+        unsigned shift = k % WordBits;
+        for (size_t i = 0; i < outputSlots.size(); i++)
+        {
+            const Word *value = block + outputSlots[i] * planes * blockWords;
+            unsigned bits = (*value >> shift) & 1;
+            if (planes == 2)
+                bits |= ((value[blockWords] >> shift) & 1) << 1;
+            pattern[i] = (char) ('0' + bits);
+        }
+    }
+    return result;
+}
+
+std::vector<Pattern> CompiledSimulator::simulate(const std::vector<Pattern> &patterns)
+{
+    std::vector<Pattern> result;
+    result.reserve(patterns.size());
+    for (size_t first = 0; first < patterns.size(); first += lanes())
+    {
+        if (!input(patterns, first))
+        {
+            std::cerr << "WARNING: CompiledSimulator: pattern size is not " << inputSize() << std::endl;
+            return std::vector<Pattern>();
+        }
+        runWords();
+        std::vector<Pattern> outputs = outputPatterns();
+        result.insert(result.end(), outputs.begin(), outputs.end());
+    }
+    return result;
+}
@@ -0,0 +1,942 @@
+#include "circuit.h"
+#include "circuit_p.h"
+#include "celllibrary.h"
+#include "binaryimage_p.h"
+#include <cstring>
+#include <iostream>
+#include <map>
+
+/**************************************************************
+ *
+ * Snapshot format
+ *
+ **************************************************************/
+
+// A snapshot is a single relocatable block: every reference is an index or
+// a byte offset from the start of the file, so it is read in place from a
+// mapping. Integers are in the byte order of the writer; a machine with a
+// different order rejects the file.
+//
+//   Header
+//   strings    uint32 offsets[stringCount + 1], then the characters
+//   masters    MasterRecord[masterCount], then uint32 pins[pinCount]
+//   modules    ModuleRecord[moduleCount]
+//   per module NodeRecord[n], uint32 faninIndex[n + 1],
+//              uint32 fanoutIndex[n + 1], SlotRecord fanin[], fanout[],
+//              uint32 PIs[], POs[], PPIs[], PPOs[], inputs[], outputs[]
+//
+// Node ids are local to their module: ports, wires, gates, cells then
+// instances of other modules, each in list order. The master of an instance
+// is the index of its module, whose ports give the pins. Connections are
+// stored from both ends like PinSlot, so no name is looked up on load.
+
+namespace {
+
+const char Magic[8] = { 'L', 'C', 'S', 'N', 'A', 'P', '\r', '\n' };
+const uint32_t Version = 2;
+const uint32_t ByteOrderMark = 0x01020304u;
+const uint32_t NoIndex = 0xffffffffu;
+
+enum NodeFlags
+{
+    InternalNode = 1
+};
+
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t size;
+    uint32_t name;
+    uint32_t path;
+    uint32_t topModule;
+    uint32_t stringCount;
+    uint32_t masterCount;
+    uint32_t pinCount;
+    uint32_t moduleCount;
+    uint32_t reserved;
+    uint64_t strings;
+    uint64_t masters;
+    uint64_t modules;
+};
+
+// A cell type. Pins are input names, output names, then one PortType per
+// pin in declaration order.
+struct MasterRecord
+{
+    double area;
+    uint32_t type;
+    uint32_t function;
+    uint32_t inputCount;
+    uint32_t outputCount;
+    uint32_t pins;
+    uint32_t reserved;
+};
+
+struct ModuleRecord
+{
+    uint32_t name;
+    uint32_t portCount;
+    uint32_t wireCount;
+    uint32_t gateCount;
+    uint32_t cellCount;
+    uint32_t PICount;
+    uint32_t POCount;
+    uint32_t PPICount;
+    uint32_t PPOCount;
+    uint32_t inputCount;
+    uint32_t outputCount;
+    uint32_t faninCount;
+    uint32_t fanoutCount;
+    uint32_t instanceCount;
+    uint64_t data;
+};
+
+struct NodeRecord
+{
+    uint32_t name;
+    uint32_t master;    // cells, or the module of an instance
+    uint32_t level;     // gates and cells
+    uint8_t nodeType;
+    uint8_t subType;    // PortType or GateType
+    uint8_t value;
+    uint8_t flags;
+};
+
+struct SlotRecord
+{
+    uint32_t node;
+    uint32_t pin;
+};
+
+// Offsets of the arrays of a module relative to ModuleRecord::data
+struct ModuleLayout
+{
+    ModuleLayout(const ModuleRecord &m)
+    {
+        count = (uint64_t) m.portCount + m.wireCount + m.gateCount + m.cellCount + m.instanceCount;
+        faninIndex = count * sizeof(NodeRecord);
+        fanoutIndex = faninIndex + (count + 1) * sizeof(uint32_t);
+        fanin = fanoutIndex + (count + 1) * sizeof(uint32_t);
+        fanout = fanin + (uint64_t) m.faninCount * sizeof(SlotRecord);
+        ports = fanout + (uint64_t) m.fanoutCount * sizeof(SlotRecord);
+        size = ports + ((uint64_t) m.PICount + m.POCount + m.PPICount + m.PPOCount
+                        + m.inputCount + m.outputCount) * sizeof(uint32_t);
+    }
+
+    uint64_t count;
+    uint64_t faninIndex;
+    uint64_t fanoutIndex;
+    uint64_t fanin;
+    uint64_t fanout;
+    uint64_t ports;
+    uint64_t size;
+};
+
+// Signal keeps its value to itself
+uint8_t signalCode(Signal s)
+{
+    for (unsigned v = Signal::F; v < Signal::Last; v++)
+        if (s == (Signal::SignalType) v)
+            return (uint8_t) v;
+    return Signal::X;
+}
+
+/**************************************************************
+ *
+ * SnapshotWriter
+ *
+ **************************************************************/
+
+class SnapshotWriter
+{
+public:
+    bool write(const CircuitPrivate *c, std::vector<char> &out);
+
+private:
+    uint32_t string(const std::string &s) { return strings.intern(s); }
+    uint32_t master(const CellMaster *m);
+    bool writeModule(const ModulePrivate *m, ModuleRecord &rec, std::vector<char> &out);
+    void writeMasters(std::vector<char> &out, uint32_t *pinCount);
+
+    SymbolTable strings;
+    std::map<const CellMaster*,uint32_t> masterIndex;
+    std::vector<const CellMaster*> masters;
+    std::map<const ModulePrivate*,uint32_t> moduleIndex;
+};
+
+uint32_t SnapshotWriter::master(const CellMaster *m)
+{
+    std::map<const CellMaster*,uint32_t>::iterator it = masterIndex.find(m);
+    if (it != masterIndex.end())
+        return it->second;
+    uint32_t i = (uint32_t) masters.size();
+    masterIndex[m] = i;
+    masters.push_back(m);
+    return i;
+}
+
+// Ids of the nodes of a module. Ports removed in an open edit leave null
+// entries in the port lists until they are compacted; they are skipped
+// and get no id, so the module is written as it will be once compacted.
+class NodeIds
+{
+public:
+    NodeIds(const ModulePrivate *m)
+        : m(m), portIds(m->portList.size(), NoIndex)
+    {
+        uint32_t id = 0;
+        for (size_t i = 0; i < m->portList.size(); i++)
+            if (m->portList[i])
+                portIds[i] = id++;
+        portCount = id;
+    }
+
+    size_t ports() const { return portCount; }
+
+    // Position of a node of the module in the id space, NoIndex for a node
+    // that belongs elsewhere
+    uint32_t operator()(const NodePrivate *node) const
+    {
+        if (!node || node->parent() != m)
+            return NoIndex;
+        const std::vector<NodePrivate*> *list;
+        size_t base;
+        switch (node->nodeType())
+        {
+            case Node::PortNode:
+                if (node->index >= portIds.size() || m->portList[node->index] != node)
+                    return NoIndex;
+                return portIds[node->index];
+            case Node::WireNode:
+                list = &m->wireList;
+                base = portCount;
+                break;
+            case Node::GateNode:
+                list = &m->gateList;
+                base = portCount + m->wireList.size();
+                break;
+            case Node::CellNode:
+                base = portCount + m->wireList.size() + m->gateList.size();
+                if (((const CellPrivate*) node)->master->module)
+                {
+                    list = &m->instanceList;
+                    base += m->cellList.size();
+                }
+                else
+                    list = &m->cellList;
+                break;
+            default:
+                return NoIndex;
+        }
+        if (node->index >= list->size() || (*list)[node->index] != node)
+            return NoIndex;
+        return (uint32_t) (base + node->index);
+    }
+
+private:
+    const ModulePrivate *m;
+    std::vector<uint32_t> portIds;
+    size_t portCount;
+};
+
+void putSlots(std::vector<char> &out, const NodeIds &ids, const std::vector<PinSlot> &slots)
+{
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        SlotRecord r;
+        r.node = ids(slots[i].node);
+        r.pin = r.node == NoIndex ? PinSlot::NoPin : slots[i].pin;
+        imagePut(out, r);
+    }
+}
+
+template <class T>
+size_t liveCount(const std::vector<T*> &list)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < list.size(); i++)
+        if (list[i])
+            n++;
+    return n;
+}
+
+size_t liveCount(const std::vector<PinSlot> &slots)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < slots.size(); i++)
+        if (slots[i].node)
+            n++;
+    return n;
+}
+
+void putPorts(std::vector<char> &out, const NodeIds &ids, const std::vector<PortPrivate*> &ports)
+{
+    for (size_t i = 0; i < ports.size(); i++)
+        if (ports[i])
+            imagePut(out, ids(ports[i]));
+}
+
+void putPorts(std::vector<char> &out, const NodeIds &ids, const std::vector<PinSlot> &slots)
+{
+    for (size_t i = 0; i < slots.size(); i++)
+        if (slots[i].node)
+            imagePut(out, ids(slots[i].node));
+}
+
+bool SnapshotWriter::writeModule(const ModulePrivate *m, ModuleRecord &rec, std::vector<char> &out)
+{
+    NodeIds ids(m);
+    std::vector<const NodePrivate*> nodes;
+    nodes.reserve(ids.ports() + m->wireList.size() + m->gateList.size()
+                  + m->cellList.size() + m->instanceList.size());
+    for (size_t i = 0; i < m->portList.size(); i++)
+        if (m->portList[i])
+            nodes.push_back(m->portList[i]);
+    nodes.insert(nodes.end(), m->wireList.begin(), m->wireList.end());
+    nodes.insert(nodes.end(), m->gateList.begin(), m->gateList.end());
+    nodes.insert(nodes.end(), m->cellList.begin(), m->cellList.end());
+    nodes.insert(nodes.end(), m->instanceList.begin(), m->instanceList.end());
+
+    memset(&rec, 0, sizeof(rec));
+    rec.name = string(m->nodeName());
+    rec.portCount = (uint32_t) ids.ports();
+    rec.wireCount = (uint32_t) m->wireList.size();
+    rec.gateCount = (uint32_t) m->gateList.size();
+    rec.cellCount = (uint32_t) m->cellList.size();
+    rec.instanceCount = (uint32_t) m->instanceList.size();
+    rec.PICount = (uint32_t) liveCount(m->PIs);
+    rec.POCount = (uint32_t) liveCount(m->POs);
+    rec.PPICount = (uint32_t) liveCount(m->PPIs);
+    rec.PPOCount = (uint32_t) liveCount(m->PPOs);
+    rec.inputCount = (uint32_t) liveCount(m->inputs);
+    rec.outputCount = (uint32_t) liveCount(m->outputs);
+    rec.data = out.size();
+
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        const NodePrivate *node = nodes[i];
+        NodeRecord r;
+        memset(&r, 0, sizeof(r));
+        r.name = string(node->nodeName());
+        r.master = NoIndex;
+        r.nodeType = (uint8_t) node->nodeType();
+        if (node->isPort())
+        {
+            r.subType = (uint8_t) ((const PortPrivate*) node)->type;
+        }
+        else if (node->isGate() || node->isCell())
+        {
+            r.subType = (uint8_t) ((const GatePrivate*) node)->type;
+            r.level = ((const GatePrivate*) node)->level;
+        }
+        if (node->isCell())
+        {
+            const CellMaster *cellMaster = ((const CellPrivate*) node)->master;
+            if (!cellMaster->module)
+                r.master = master(cellMaster);
+            else
+            {
+                // Instances get their pins from the ports of their module
+                std::map<const ModulePrivate*,uint32_t>::const_iterator it = moduleIndex.find(cellMaster->module);
+                if (it == moduleIndex.end() || !cellMaster->module->pinsMatch(cellMaster))
+                {
+                    std::cerr << "Could not save instance " << node->nodeName()
+                              << ", the ports of its module changed" << std::endl;
+                    return false;
+                }
+                r.master = it->second;
+            }
+        }
+        r.value = signalCode(node->value);
+        r.flags = node->isInternal ? InternalNode : 0;
+        imagePut(out, r);
+    }
+
+    uint32_t count = 0;
+    imagePut(out, count);
+    for (size_t i = 0; i < nodes.size(); i++)
+        imagePut(out, count += (uint32_t) nodes[i]->inputs.size());
+    rec.faninCount = count;
+    count = 0;
+    imagePut(out, count);
+    for (size_t i = 0; i < nodes.size(); i++)
+        imagePut(out, count += (uint32_t) nodes[i]->outputs.size());
+    rec.fanoutCount = count;
+    for (size_t i = 0; i < nodes.size(); i++)
+        putSlots(out, ids, nodes[i]->inputs);
+    for (size_t i = 0; i < nodes.size(); i++)
+        putSlots(out, ids, nodes[i]->outputs);
+
+    putPorts(out, ids, m->PIs);
+    putPorts(out, ids, m->POs);
+    putPorts(out, ids, m->PPIs);
+    putPorts(out, ids, m->PPOs);
+    putPorts(out, ids, m->inputs);
+    putPorts(out, ids, m->outputs);
+    imageAlign(out);
+    return true;
+}
+
+void SnapshotWriter::writeMasters(std::vector<char> &out, uint32_t *pinCount)
+{
+    std::vector<uint32_t> pins;
+    for (size_t i = 0; i < masters.size(); i++)
+    {
+        const CellMaster *m = masters[i];
+        MasterRecord r;
+        memset(&r, 0, sizeof(r));
+        r.area = m->area;
+        r.type = string(m->type);
+        r.function = string(m->function);
+        r.inputCount = (uint32_t) m->inputNames.size();
+        r.outputCount = (uint32_t) m->outputNames.size();
+        r.pins = (uint32_t) pins.size();
+        for (size_t j = 0; j < m->inputNames.size(); j++)
+            pins.push_back(string(m->inputNames[j]));
+        for (size_t j = 0; j < m->outputNames.size(); j++)
+            pins.push_back(string(m->outputNames[j]));
+        for (size_t j = 0; j < r.inputCount + r.outputCount; j++)
+            pins.push_back(j < m->pinTypes.size() ? m->pinTypes[j] : Port::BasePort);
+        imagePut(out, r);
+    }
+    for (size_t i = 0; i < pins.size(); i++)
+        imagePut(out, pins[i]);
+    *pinCount = (uint32_t) pins.size();
+    imageAlign(out);
+}
+
+bool SnapshotWriter::write(const CircuitPrivate *c, std::vector<char> &out)
+{
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, Magic, sizeof(Magic));
+    h.version = Version;
+    h.byteOrder = ByteOrderMark;
+    h.name = string(c->nodeName());
+    h.path = string(c->path);
+    h.topModule = NoIndex;
+
+    // Module data first, the strings and masters it refers to are known
+    // only afterwards
+    std::vector<const ModulePrivate*> modules;
+    for (size_t i = 0; i < c->moduleNames.size(); i++)
+    {
+        std::map<std::string,ModulePrivate*>::const_iterator it = c->modules.find(c->moduleNames[i]);
+        if (it == c->modules.end() || !it->second)
+            continue;
+        moduleIndex[it->second] = (uint32_t) modules.size();
+        modules.push_back(it->second);
+    }
+    std::vector<ModuleRecord> records(modules.size());
+    std::vector<char> data;
+    for (size_t i = 0; i < modules.size(); i++)
+    {
+        if (modules[i] == c->topModule)
+            h.topModule = (uint32_t) i;
+        if (!writeModule(modules[i], records[i], data))
+            return false;
+    }
+    h.moduleCount = (uint32_t) records.size();
+
+    std::vector<char> masterData;
+    writeMasters(masterData, &h.pinCount);
+    h.masterCount = (uint32_t) masters.size();
+    h.stringCount = (uint32_t) strings.size();
+
+    out.clear();
+    out.resize(sizeof(Header));
+    h.strings = out.size();
+    imagePutStrings(out, strings);
+    h.masters = out.size();
+    out.insert(out.end(), masterData.begin(), masterData.end());
+    h.modules = out.size();
+    uint64_t base = out.size() + records.size() * sizeof(ModuleRecord);
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        records[i].data += base;
+        imagePut(out, records[i]);
+    }
+    out.insert(out.end(), data.begin(), data.end());
+    h.size = out.size();
+    memcpy(&out[0], &h, sizeof(h));
+    return true;
+}
+
+/**************************************************************
+ *
+ * SnapshotReader
+ *
+ **************************************************************/
+
+// Validates the file as it goes, a damaged snapshot is rejected rather
+// than turned into a broken netlist
+class SnapshotReader
+{
+public:
+    SnapshotReader(const char *data, size_t size)
+        : data(data), size(size), header(0), offsets(0), chars(0), masters(0), pins(0) {}
+
+    bool open();
+    size_t masterCount() const { return header->masterCount; }
+    std::string masterType(size_t i) const { return str(masters[i].type); }
+    bool matches(size_t i, const CellMaster *master) const;
+    CellMaster *createMaster(size_t i) const;
+    CircuitPrivate *read(const std::vector<CellMaster*> &cellMasters);
+
+private:
+    template <class T>
+    const T *at(uint64_t offset, uint64_t count) const
+    {
+        return imageArray<T>(data, size, offset, count);
+    }
+    bool isString(uint32_t i) const { return i < header->stringCount; }
+    std::string str(uint32_t i) const { return std::string(chars + offsets[i], offsets[i + 1] - offsets[i]); }
+    // A module is read in three passes over all modules, since an instance
+    // needs the ports of its module and the links need the instances
+    struct ModuleData
+    {
+        ModulePrivate *module;
+        std::vector<NodePrivate*> nodes;
+    };
+    bool readNodes(CircuitPrivate *c, const ModuleRecord &rec, const std::vector<Symbol> &symbols,
+                   const std::vector<CellMaster*> &cellMasters, ModuleData &d);
+    bool readInstances(CircuitPrivate *c, const ModuleRecord &rec, const std::vector<Symbol> &symbols,
+                       const std::vector<ModuleData> &modules, ModuleData &d);
+    bool readLinks(const ModuleRecord &rec, ModuleData &d);
+
+    const char *data;
+    size_t size;
+    const Header *header;
+    const uint32_t *offsets;
+    const char *chars;
+    const MasterRecord *masters;
+    const uint32_t *pins;
+};
+
+bool SnapshotReader::open()
+{
+    header = at<Header>(0, 1);
+    if (!header || memcmp(header->magic, Magic, sizeof(Magic)) != 0)
+        return false;
+    if (header->byteOrder != ByteOrderMark || header->version != Version || header->size != size)
+        return false;
+
+    offsets = at<uint32_t>(header->strings, (uint64_t) header->stringCount + 1);
+    if (!offsets)
+        return false;
+    uint64_t charBase = header->strings + ((uint64_t) header->stringCount + 1) * sizeof(uint32_t);
+    chars = data + charBase;
+    for (size_t i = 0; i < header->stringCount; i++)
+        if (offsets[i] > offsets[i + 1])
+            return false;
+    if (offsets[header->stringCount] > size - charBase)
+        return false;
+
+    masters = at<MasterRecord>(header->masters, header->masterCount);
+    if (!masters)
+        return false;
+    pins = at<uint32_t>(header->masters + (uint64_t) header->masterCount * sizeof(MasterRecord), header->pinCount);
+    if (!pins)
+        return false;
+    for (size_t i = 0; i < header->masterCount; i++)
+    {
+        const MasterRecord &m = masters[i];
+        uint64_t pinEnd = (uint64_t) m.pins + 2 * ((uint64_t) m.inputCount + m.outputCount);
+        if (!isString(m.type) || !isString(m.function) || pinEnd > header->pinCount)
+            return false;
+        for (size_t j = 0; j < m.inputCount + m.outputCount; j++)
+            if (!isString(pins[m.pins + j]))
+                return false;
+    }
+    return isString(header->name) && isString(header->path);
+}
+
+// A library cell can stand in for a recorded type if its pins are the same
+bool SnapshotReader::matches(size_t i, const CellMaster *master) const
+{
+    const MasterRecord &m = masters[i];
+    if (master->inputNames.size() != m.inputCount || master->outputNames.size() != m.outputCount)
+        return false;
+    const uint32_t *p = pins + m.pins;
+    for (size_t j = 0; j < m.inputCount; j++)
+        if (master->inputNames[j] != str(*p++))
+            return false;
+    for (size_t j = 0; j < m.outputCount; j++)
+        if (master->outputNames[j] != str(*p++))
+            return false;
+    for (size_t j = 0; j < m.inputCount + m.outputCount; j++, p++)
+        if (j >= master->pinTypes.size() || master->pinTypes[j] != (Port::PortType) *p)
+            return false;
+    return true;
+}
+
+// The recorded pins and properties, without timing data
+CellMaster *SnapshotReader::createMaster(size_t i) const
+{
+    const MasterRecord &m = masters[i];
+    CellMaster *master = new CellMaster(str(m.type));
+    master->area = m.area;
+    master->function = str(m.function);
+    const uint32_t *p = pins + m.pins;
+    for (size_t j = 0; j < m.inputCount; j++)
+        master->inputNames.push_back(str(*p++));
+    for (size_t j = 0; j < m.outputCount; j++)
+        master->outputNames.push_back(str(*p++));
+    for (size_t j = 0; j < m.inputCount + m.outputCount; j++)
+        master->pinTypes.push_back((Port::PortType) *p++);
+    return master;
+}
+
+bool readSlots(std::vector<PinSlot> &slots, const SlotRecord *begin, const SlotRecord *end,
+                      const std::vector<NodePrivate*> &nodes)
+{
+    slots.resize(end - begin);
+    for (size_t i = 0; begin + i != end; i++)
+    {
+        const SlotRecord &r = begin[i];
+        if (r.node == NoIndex)
+            slots[i] = PinSlot();
+        else if (r.node < nodes.size())
+            slots[i] = PinSlot(nodes[r.node], r.pin);
+        else
+            return false;
+    }
+    return true;
+}
+
+// Every two-way slot must be answered by the slot it names
+bool linked(const NodePrivate *node, const std::vector<PinSlot> &slots, bool input)
+{
+    for (size_t i = 0; i < slots.size(); i++)
+    {
+        const PinSlot &s = slots[i];
+        if (!s.node || s.pin == PinSlot::NoPin)
+            continue;
+        const std::vector<PinSlot> &peer = input ? s.node->outputs : s.node->inputs;
+        if (s.pin >= peer.size() || peer[s.pin].node != node || peer[s.pin].pin != i)
+            return false;
+    }
+    return true;
+}
+
+bool readPortList(std::vector<PortPrivate*> &list, const uint32_t *ids, size_t count,
+                         Port::PortType type, const std::vector<NodePrivate*> &nodes,
+                         size_t portCount, std::vector<char> &seen)
+{
+    list.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (ids[i] >= portCount || seen[ids[i]])
+            return false;
+        PortPrivate *port = (PortPrivate*) nodes[ids[i]];
+        if (port->type != type)
+            return false;
+        seen[ids[i]] = 1;
+        port->typeIndex = (unsigned) i;
+        list[i] = port;
+    }
+    return true;
+}
+
+bool readPortSlots(std::vector<PinSlot> &slots, const uint32_t *ids, size_t count, bool input,
+                          const std::vector<NodePrivate*> &nodes, size_t portCount, std::vector<char> &seen)
+{
+    slots.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (ids[i] >= portCount || seen[ids[i]])
+            return false;
+        PortPrivate *port = (PortPrivate*) nodes[ids[i]];
+        bool inputType = port->type == Port::Input || port->type == Port::PPI;
+        if (inputType != input)
+            return false;
+        seen[ids[i]] = 1;
+        port->slotIndex = (unsigned) i;
+        slots[i] = PinSlot(port, PinSlot::NoPin);
+    }
+    return true;
+}
+
+// A node record read into a node of the module list
+void addNode(ModulePrivate *m, std::vector<NodePrivate*> &list, NodePrivate *node,
+             const NodeRecord &r, const std::vector<Symbol> &symbols)
+{
+    node->index = (unsigned) list.size();
+    list.push_back(node);
+    node->symbol = symbols[r.name];
+    node->value = Signal(r.value);
+    node->isInternal = (r.flags & InternalNode) != 0;
+    if (node->isGate() || node->isCell())
+        ((GatePrivate*) node)->level = r.level;
+    if (!m->insertName(node))
+        std::cerr << "WARNING: Duplicate name: " << node->nodeName() << std::endl;
+}
+
+bool SnapshotReader::readNodes(CircuitPrivate *c, const ModuleRecord &rec, const std::vector<Symbol> &symbols,
+                               const std::vector<CellMaster*> &cellMasters, ModuleData &d)
+{
+    ModuleLayout layout(rec);
+    const char *base = at<char>(rec.data, layout.size);
+    // Every array of a module is made of 4-byte fields
+    if (!base || (uintptr_t) base % alignof(NodeRecord) || !isString(rec.name))
+        return false;
+    const NodeRecord *records = (const NodeRecord*) base;
+
+    ModulePrivate *m = c->createModule(str(rec.name));
+    if (!m)
+        return false;
+    d.module = m;
+    // The levels come with the node records, later edits only update them
+    m->leveled = true;
+    m->reserve(rec.portCount, rec.wireCount, rec.gateCount, rec.cellCount);
+
+    const size_t n = (size_t) layout.count;
+    const size_t wireBase = rec.portCount;
+    const size_t gateBase = wireBase + rec.wireCount;
+    const size_t cellBase = gateBase + rec.gateCount;
+    const size_t instanceBase = cellBase + rec.cellCount;
+    d.nodes.assign(n, (NodePrivate*) 0);
+    for (size_t i = 0; i < instanceBase; i++)
+    {
+        const NodeRecord &r = records[i];
+        if (!isString(r.name))
+            return false;
+        NodePrivate *node;
+        std::vector<NodePrivate*> *list;
+        if (i < wireBase)
+        {
+            if (r.nodeType != Node::PortNode || r.subType < Port::Input || r.subType > Port::PPO)
+                return false;
+            node = _newNode<PortPrivate>(c->portArena, c, m, std::string(), (Port::PortType) r.subType);
+            list = &m->portList;
+        }
+        else if (i < gateBase)
+        {
+            if (r.nodeType != Node::WireNode)
+                return false;
+            node = _newNode<WirePrivate>(c->wireArena, c, m, std::string());
+            list = &m->wireList;
+        }
+        else if (i < cellBase)
+        {
+            if (r.nodeType != Node::GateNode)
+                return false;
+            node = _newNode<GatePrivate>(c->gateArena, c, m, std::string(), (Gate::GateType) r.subType);
+            list = &m->gateList;
+        }
+        else
+        {
+            if (r.nodeType != Node::CellNode || r.master >= cellMasters.size())
+                return false;
+            node = _newNode<CellPrivate>(c->cellArena, c, m, std::string(), cellMasters[r.master]);
+            list = &m->cellList;
+        }
+        addNode(m, *list, node, r, symbols);
+        d.nodes[i] = node;
+    }
+
+    // Every port is in exactly one type list and one of inputs/outputs
+    const uint32_t *ports = (const uint32_t*) (base + layout.ports);
+    std::vector<char> typed(rec.portCount, 0);
+    std::vector<char> slotted(rec.portCount, 0);
+    if (!readPortList(m->PIs, ports, rec.PICount, Port::Input, d.nodes, rec.portCount, typed))
+        return false;
+    ports += rec.PICount;
+    if (!readPortList(m->POs, ports, rec.POCount, Port::Output, d.nodes, rec.portCount, typed))
+        return false;
+    ports += rec.POCount;
+    if (!readPortList(m->PPIs, ports, rec.PPICount, Port::PPI, d.nodes, rec.portCount, typed))
+        return false;
+    ports += rec.PPICount;
+    if (!readPortList(m->PPOs, ports, rec.PPOCount, Port::PPO, d.nodes, rec.portCount, typed))
+        return false;
+    ports += rec.PPOCount;
+    if (!readPortSlots(m->inputs, ports, rec.inputCount, true, d.nodes, rec.portCount, slotted))
+        return false;
+    ports += rec.inputCount;
+    if (!readPortSlots(m->outputs, ports, rec.outputCount, false, d.nodes, rec.portCount, slotted))
+        return false;
+    for (size_t i = 0; i < rec.portCount; i++)
+        if (!typed[i] || !slotted[i])
+            return false;
+    return true;
+}
+
+bool SnapshotReader::readInstances(CircuitPrivate *c, const ModuleRecord &rec, const std::vector<Symbol> &symbols,
+                                   const std::vector<ModuleData> &modules, ModuleData &d)
+{
+    const NodeRecord *records = (const NodeRecord*) (data + rec.data);
+    ModulePrivate *m = d.module;
+    const size_t first = (size_t) rec.portCount + rec.wireCount + rec.gateCount + rec.cellCount;
+    for (size_t i = first; i < d.nodes.size(); i++)
+    {
+        const NodeRecord &r = records[i];
+        if (!isString(r.name) || r.nodeType != Node::CellNode || r.master >= modules.size())
+            return false;
+        ModulePrivate *definition = modules[r.master].module;
+        if (definition == m)
+            return false;
+        NodePrivate *node = _newNode<CellPrivate>(c->cellArena, c, m, std::string(), definition->instanceMaster());
+        addNode(m, m->instanceList, node, r, symbols);
+        d.nodes[i] = node;
+    }
+    return true;
+}
+
+bool SnapshotReader::readLinks(const ModuleRecord &rec, ModuleData &d)
+{
+    ModuleLayout layout(rec);
+    const char *base = data + rec.data;
+    const uint32_t *faninIndex = (const uint32_t*) (base + layout.faninIndex);
+    const uint32_t *fanoutIndex = (const uint32_t*) (base + layout.fanoutIndex);
+    const SlotRecord *fanin = (const SlotRecord*) (base + layout.fanin);
+    const SlotRecord *fanout = (const SlotRecord*) (base + layout.fanout);
+
+    const std::vector<NodePrivate*> &nodes = d.nodes;
+    const size_t n = nodes.size();
+    for (size_t i = 0; i < n; i++)
+    {
+        if (faninIndex[i] > faninIndex[i + 1] || faninIndex[i + 1] > rec.faninCount)
+            return false;
+        if (fanoutIndex[i] > fanoutIndex[i + 1] || fanoutIndex[i + 1] > rec.fanoutCount)
+            return false;
+        NodePrivate *node = nodes[i];
+        if (!readSlots(node->inputs, fanin + faninIndex[i], fanin + faninIndex[i + 1], nodes))
+            return false;
+        if (!readSlots(node->outputs, fanout + fanoutIndex[i], fanout + fanoutIndex[i + 1], nodes))
+            return false;
+        // Cells and instances keep exactly one slot per pin of their master
+        if (node->isCell())
+        {
+            CellMaster *master = ((CellPrivate*) node)->master;
+            if (node->inputs.size() != master->inputNames.size() || node->outputs.size() != master->outputNames.size())
+                return false;
+        }
+    }
+    for (size_t i = 0; i < n; i++)
+        if (!linked(nodes[i], nodes[i]->inputs, true) || !linked(nodes[i], nodes[i]->outputs, false))
+            return false;
+    return true;
+}
+
+CircuitPrivate *SnapshotReader::read(const std::vector<CellMaster*> &cellMasters)
+{
+    CircuitPrivate *c = new CircuitPrivate(str(header->name));
+    c->path = str(header->path);
+
+    // Names keep their snapshot index, mapped to the circuit's symbols
+    std::vector<Symbol> symbols(header->stringCount);
+    c->symbolTable->reserve(c->symbolTable->size() + header->stringCount);
+    for (size_t i = 0; i < header->stringCount; i++)
+        symbols[i] = c->symbolTable->intern(chars + offsets[i], offsets[i + 1] - offsets[i]);
+
+    const ModuleRecord *records = at<ModuleRecord>(header->modules, header->moduleCount);
+    bool ok = records != 0;
+    std::vector<ModuleData> modules(ok ? header->moduleCount : 0);
+    for (size_t i = 0; ok && i < modules.size(); i++)
+        ok = readNodes(c, records[i], symbols, cellMasters, modules[i]);
+    for (size_t i = 0; ok && i < modules.size(); i++)
+        ok = readInstances(c, records[i], symbols, modules, modules[i]);
+    for (size_t i = 0; ok && i < modules.size(); i++)
+        ok = readLinks(records[i], modules[i]);
+    if (ok && header->topModule != NoIndex)
+    {
+        ok = header->topModule < header->moduleCount;
+        if (ok)
+            c->setTopModule(c->modules[c->moduleNames[header->topModule]]);
+    }
+    if (!ok)
+    {
+        delete c;
+        return 0;
+    }
+    return c;
+}
+
+} // anonymous namespace
+
+/**************************************************************
+ *
+ * Circuit
+ *
+ **************************************************************/
+
+#define IMPL ((CircuitPrivate*)impl)
+
+bool Circuit::save(const std::string &path) const
+{
+    if (!impl)
+        return false;
+
+    std::vector<char> image;
+    SnapshotWriter writer;
+    if (!writer.write(IMPL, image))
+        return false;
+
+    if (!imageWrite(path, image))
+    {
+        std::cerr << "Could not write file: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void Circuit::loadSnapshot(const std::string &path)
+{
+    CellLibrary lib;
+    loadSnapshot(path, lib);
+}
+
+void Circuit::loadSnapshot(const std::string &path, CellLibrary &lib)
+{
+    *this = Circuit();
+
+    MappedFile file(path);
+    if (!file.data)
+    {
+        std::cerr << "Could not open file: " << path << std::endl;
+        return;
+    }
+    SnapshotReader reader(file.data, file.size);
+    if (!reader.open())
+    {
+        std::cerr << "Not a valid circuit snapshot: " << path << std::endl;
+        return;
+    }
+
+    // Cell types are taken from the library when its pins agree
+    std::vector<CellMaster*> masters;
+    for (size_t i = 0; i < reader.masterCount(); i++)
+    {
+        std::string type = reader.masterType(i);
+        Cell proto = lib.cell(type);
+        CellMaster *master = proto.isNull() ? 0 : ((CellPrivate*) proto.impl)->master;
+        if (master && reader.matches(i, master))
+        {
+            master->ref.ref();
+        }
+        else
+        {
+            std::cerr << "WARNING: Cell type " << type << " is not in the library, "
+                      << "timing data is not available" << std::endl;
+            master = reader.createMaster(i);
+        }
+        masters.push_back(master);
+    }
+
+    CircuitPrivate *c = reader.read(masters);
+    for (size_t i = 0; i < masters.size(); i++)
+        if (!masters[i]->ref.deref())
+            delete masters[i];
+    if (!c)
+    {
+        std::cerr << "Not a valid circuit snapshot: " << path << std::endl;
+        return;
+    }
+    impl = c;
+    IMPL->library = (lib.isDefault() ? 0 : &lib);
+}
+
+#undef IMPL
@@ -0,0 +1,161 @@
+#include "symboltable_p.h"
+#include <cstring>
+
+static const size_t BlockSize = 64 * 1024;
+
+// FNV-1a
+static unsigned _hash(const char *s, size_t len)
+{
+    unsigned h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char) s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+class SymbolLocker
+{
+public:
+    SymbolLocker(std::mutex *m) : m(m) { if (m) m->lock(); }
+    ~SymbolLocker() { if (m) m->unlock(); }
+private:
+    std::mutex *m;
+};
+
+/**************************************************************
+ *
+ * SymbolTable
+ *
+ **************************************************************/
+
+const Symbol SymbolTable::NoSymbol;
+
+SymbolTable::SymbolTable(bool locked)
+    : ref(1), blockUsed(BlockSize), lock(locked ? new std::mutex : 0)
+{
+    buckets.assign(64, NoSymbol);
+    intern("", 0);
+}
+
+SymbolTable::~SymbolTable()
+{
+    for (size_t i = 0; i < blocks.size(); i++)
+        delete [] blocks[i];
+    delete lock;
+}
+
+SymbolTable &SymbolTable::shared()
+{
+    static SymbolTable table(true);
+    return table;
+}
+
+const char *SymbolTable::store(const char *s, size_t len)
+{
+    // Long names get a block of their own
+    if (len + 1 > BlockSize / 4)
+    {
+        char *p = new char[len + 1];
+        memcpy(p, s, len);
+        p[len] = '\0';
+        blocks.insert(blocks.end() - (blocks.empty() ? 0 : 1), p);
+        return p;
+    }
+    if (blockUsed + len + 1 > BlockSize)
+    {
+        blocks.push_back(new char[BlockSize]);
+        blockUsed = 0;
+    }
+    char *p = blocks.back() + blockUsed;
+    memcpy(p, s, len);
+    p[len] = '\0';
+    blockUsed += len + 1;
+    return p;
+}
+
+// Linear probing; *slot is where the symbol is or would go
+Symbol SymbolTable::lookup(const char *s, size_t len, unsigned hash, size_t *slot) const
+{
+    size_t mask = buckets.size() - 1;
+    size_t i = hash & mask;
+    for (;;)
+    {
+        Symbol id = buckets[i];
+        if (id == NoSymbol)
+            break;
+        if (hashes[id] == hash && lens[id] == len && memcmp(strs[id], s, len) == 0)
+        {
+            *slot = i;
+            return id;
+        }
+        i = (i + 1) & mask;
+    }
+    *slot = i;
+    return NoSymbol;
+}
+
+void SymbolTable::rehash(size_t size)
+{
+    buckets.assign(size, NoSymbol);
+    size_t mask = buckets.size() - 1;
+    for (Symbol id = 0; id < strs.size(); id++)
+    {
+        size_t i = hashes[id] & mask;
+        while (buckets[i] != NoSymbol)
+            i = (i + 1) & mask;
+        buckets[i] = id;
+    }
+}
+
+void SymbolTable::reserve(size_t n)
+{
+    SymbolLocker locker(lock);
+    size_t size = buckets.size();
+    while (n * 2 > size)
+        size *= 2;
+    if (size != buckets.size())
+        rehash(size);
+    strs.reserve(n);
+    lens.reserve(n);
+    hashes.reserve(n);
+}
+
+Symbol SymbolTable::intern(const char *s, size_t len)
+{
+    SymbolLocker locker(lock);
+    unsigned hash = _hash(s, len);
+    size_t slot;
+    Symbol id = lookup(s, len, hash, &slot);
+    if (id != NoSymbol)
+        return id;
+
+    // Keep the load factor under 1/2
+    if ((strs.size() + 1) * 2 > buckets.size())
+    {
+        rehash(buckets.size() * 2);
+        lookup(s, len, hash, &slot);
+    }
+    id = (Symbol) strs.size();
+    strs.push_back(store(s, len));
+    lens.push_back((unsigned) len);
+    hashes.push_back(hash);
+    buckets[slot] = id;
+    return id;
+}
+
+Symbol SymbolTable::find(const char *s, size_t len) const
+{
+    SymbolLocker locker(lock);
+    size_t slot;
+    return lookup(s, len, _hash(s, len), &slot);
+}
+
+std::string SymbolTable::str(Symbol id) const
+{
+    SymbolLocker locker(lock);
+    if (id >= strs.size())
+        return std::string();
+    return std::string(strs[id], lens[id]);
+}
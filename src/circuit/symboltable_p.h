@@ -0,0 +1,184 @@
+#ifndef SYMBOLTABLE_P_H
+#define SYMBOLTABLE_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the public libCircuit API. It exists for the
+// convenience of the circuit implementation files and may change without
+// notice.
+//
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <qatomic.h>
+
+typedef unsigned Symbol;
+
+// Interns identifiers so every name is stored once and compared as an
+// integer. Symbol 0 is always the empty string. The characters live in
+// large blocks that never move, so data() stays valid for the lifetime of
+// the table.
+class SymbolTable
+{
+public:
+    static const Symbol NoSymbol = 0xffffffffu;
+
+    SymbolTable(bool locked = false);
+    ~SymbolTable();
+
+    Symbol intern(const char *s, size_t len);
+    Symbol intern(const std::string &s) { return intern(s.data(), s.size()); }
+    // Returns NoSymbol if the string was never interned
+    Symbol find(const char *s, size_t len) const;
+    Symbol find(const std::string &s) const { return find(s.data(), s.size()); }
+
+    std::string str(Symbol id) const;
+    // Makes room for n symbols without rehashing
+    void reserve(size_t n);
+    // Unlocked accessors, not for the shared table
+    const char *data(Symbol id) const { return strs[id]; }
+    size_t length(Symbol id) const { return lens[id]; }
+    size_t size() const { return strs.size(); }
+
+    // Table for nodes that do not belong to a circuit. Thread-safe.
+    static SymbolTable &shared();
+
+    QAtomicInt ref;
+
+private:
+    SymbolTable(const SymbolTable&);
+    SymbolTable& operator=(const SymbolTable&);
+
+    Symbol lookup(const char *s, size_t len, unsigned hash, size_t *slot) const;
+    void rehash(size_t size);
+    const char *store(const char *s, size_t len);
+
+    std::vector<const char*> strs;
+    std::vector<unsigned> lens;
+    std::vector<unsigned> hashes;
+    std::vector<Symbol> buckets;
+    std::vector<char*> blocks;
+    size_t blockUsed;
+    std::mutex *lock;
+};
+
+// Open-addressing map from Symbol to node, with linear probing and
+// backward-shift deletion so erasing leaves no tombstones.
+template <class T>
+class SymbolMap
+{
+public:
+    SymbolMap() : count(0), shift(32) {}
+
+    T *value(Symbol key) const
+    {
+        size_t i = slot(key);
+        return i == NotFound ? 0 : values[i];
+    }
+    bool contains(Symbol key) const { return slot(key) != NotFound; }
+
+    void insert(Symbol key, T *value)
+    {
+        if ((count + 1) * 4 > keys.size() * 3)
+            rehash(keys.empty() ? 16 : keys.size() * 2);
+        size_t mask = keys.size() - 1;
+        size_t i = bucket(key);
+        while (keys[i] != SymbolTable::NoSymbol && keys[i] != key)
+            i = (i + 1) & mask;
+        if (keys[i] == SymbolTable::NoSymbol)
+            count++;
+        keys[i] = key;
+        values[i] = value;
+    }
+
+    bool remove(Symbol key)
+    {
+        size_t i = slot(key);
+        if (i == NotFound)
+            return false;
+        size_t mask = keys.size() - 1;
+        for (size_t j = (i + 1) & mask; keys[j] != SymbolTable::NoSymbol; j = (j + 1) & mask)
+        {
+            // Move back entries whose home bucket is not in (i, j]
+            size_t home = bucket(keys[j]);
+            if (i <= j ? (home <= i || home > j) : (home <= i && home > j))
+            {
+                keys[i] = keys[j];
+                values[i] = values[j];
+                i = j;
+            }
+        }
+        keys[i] = SymbolTable::NoSymbol;
+        values[i] = 0;
+        count--;
+        return true;
+    }
+
+    // Makes room for n entries without rehashing
+    void reserve(size_t n)
+    {
+        size_t size = keys.empty() ? 16 : keys.size();
+        while (n * 4 > size * 3)
+            size *= 2;
+        if (size != keys.size())
+            rehash(size);
+    }
+
+    void clear() { keys.clear(); values.clear(); count = 0; shift = 32; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    // Slot access for iteration; unused slots hold NoSymbol
+    size_t capacity() const { return keys.size(); }
+    Symbol keyAt(size_t i) const { return keys[i]; }
+    T *valueAt(size_t i) const { return values[i]; }
+
+private:
+    static const size_t NotFound = ~(size_t) 0;
+
+    // Fibonacci hashing keeps consecutive symbols apart
+    size_t bucket(Symbol key) const { return (size_t) ((key * 2654435769u) >> shift); }
+
+    size_t slot(Symbol key) const
+    {
+        if (keys.empty() || key == SymbolTable::NoSymbol)
+            return NotFound;
+        size_t mask = keys.size() - 1;
+        for (size_t i = bucket(key); keys[i] != SymbolTable::NoSymbol; i = (i + 1) & mask)
+            if (keys[i] == key)
+                return i;
+        return NotFound;
+    }
+
+    void rehash(size_t size)
+    {
+        std::vector<Symbol> oldKeys(size, SymbolTable::NoSymbol);
+        std::vector<T*> oldValues(size, (T*) 0);
+        oldKeys.swap(keys);
+        oldValues.swap(values);
+        shift = 32;
+        for (size_t n = size; n > 1; n >>= 1)
+            shift--;
+        size_t mask = size - 1;
+        for (size_t j = 0; j < oldKeys.size(); j++)
+        {
+            if (oldKeys[j] == SymbolTable::NoSymbol)
+                continue;
+            size_t i = bucket(oldKeys[j]);
+            while (keys[i] != SymbolTable::NoSymbol)
+                i = (i + 1) & mask;
+            keys[i] = oldKeys[j];
+            values[i] = oldValues[j];
+        }
+    }
+
+    std::vector<Symbol> keys;
+    std::vector<T*> values;
+    size_t count;
+    unsigned shift;
+};
+
+#endif // SYMBOLTABLE_P_H
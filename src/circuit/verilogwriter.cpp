@@ -0,0 +1,631 @@
+#include "circuit.h"
+#include "circuit_p.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "../parser/verilog/driver.h"
+
+// Structural Verilog written by Circuit::write(). Every net is spelled once
+// and the text is put together in a large buffer that goes to the file in
+// blocks, so no stream formatting is done per line.
+//
+// A name that is not a plain identifier is written in the escaped form
+// \name, unless it is a bit of a port or wire declared as a vector. A wire
+// takes the name of the port it is connected to, and further ports on the
+// same wire are assigned from it.
+
+namespace {
+
+const char ConstantPrefix[] = "__internal_wire_";
+const size_t LineWidth = 80;
+
+class VerilogOutput
+{
+public:
+    explicit VerilogOutput(FILE *file)
+        : file(file), buffer(BufferSize), used(0), failed(false) {}
+
+    void put(const char *s, size_t n)
+    {
+        if (n > BufferSize - used)
+        {
+            flush();
+            if (n > BufferSize)
+            {
+                write(s, n);
+                return;
+            }
+        }
+        memcpy(&buffer[used], s, n);
+        used += n;
+    }
+    void put(const std::string &s) { put(s.data(), s.size()); }
+    void put(const char *s) { put(s, strlen(s)); }
+    void put(char c)
+    {
+        if (used == BufferSize)
+            flush();
+        buffer[used++] = c;
+    }
+    void putNumber(long n)
+    {
+        char digits[24];
+        int len = 0;
+        unsigned long u = n < 0 ? 0ul - (unsigned long) n : (unsigned long) n;
+        do
+        {
+            digits[len++] = (char) ('0' + u % 10);
+            u /= 10;
+        } while (u);
+        if (n < 0)
+            put('-');
+        while (len)
+            put(digits[--len]);
+    }
+
+    // False if anything could not be written
+    bool flush()
+    {
+        write(buffer.data(), used);
+        used = 0;
+        return !failed;
+    }
+
+private:
+    enum { BufferSize = 1 << 20 };
+
+    void write(const char *s, size_t n)
+    {
+        if (n && !failed && fwrite(s, 1, n, file) != n)
+            failed = true;
+    }
+
+    FILE *file;
+    std::vector<char> buffer;
+    size_t used;
+    bool failed;
+};
+
+// name is base[bit] with a plain identifier as base
+bool splitBit(const char *s, size_t len, size_t *baseLen, long *bit)
+{
+    if (len < 4 || s[len - 1] != ']')
+        return false;
+    size_t open = len - 2;
+    while (open > 0 && s[open] >= '0' && s[open] <= '9')
+        open--;
+    size_t digits = len - 2 - open;
+    if (s[open] != '[' || digits == 0 || digits > 9 || (digits > 1 && s[open + 1] == '0'))
+        return false;
+    if (!Verilog::is_identifier(s, open))
+        return false;
+    *baseLen = open;
+    *bit = strtol(s + open + 1, 0, 10);
+    return true;
+}
+
+const char *gateKeyword(Gate::GateType type)
+{
+    switch (type)
+    {
+        case Gate::INV:     return "not";
+        case Gate::BUF:     return "buf";
+        case Gate::NAND:    return "nand";
+        case Gate::AND:     return "and";
+        case Gate::NOR:     return "nor";
+        case Gate::OR:      return "or";
+        case Gate::XNOR:    return "xnor";
+        case Gate::XOR:     return "xor";
+        default:            return 0;
+    }
+}
+
+// A port or a wire of the module
+struct DeclarationItem
+{
+    size_t node;        // index in the port or wire list
+    int kind;           // Port::Input or Port::Output, 0 for a wire
+    bool isBit;
+    std::string base;
+    long bit;
+};
+
+// Declares one item, or a run of bits of one bus as a vector
+struct Declaration
+{
+    size_t first;
+    size_t count;
+    bool vector;
+};
+
+/**************************************************************
+ *
+ * ModuleWriter
+ *
+ **************************************************************/
+
+class ModuleWriter
+{
+public:
+    ModuleWriter(const ModulePrivate *m, VerilogOutput &out)
+        : m(m), out(out), names(*m->symbolTable), column(0), firstItem(true) {}
+
+    void write();
+
+private:
+    const char *name(const NodePrivate *node) const { return names.data(node->symbol); }
+    size_t length(const NodePrivate *node) const { return names.length(node->symbol); }
+    bool owns(const NodePrivate *node, const std::vector<NodePrivate*> &list) const
+    {
+        return node && node->parent() == m && node->index < list.size() && list[node->index] == node;
+    }
+
+    DeclarationItem item(size_t node, int kind) const;
+    std::string spell(const char *s, size_t len) const;
+    void putInstanceName(const NodePrivate *node);
+    void group(const std::vector<DeclarationItem> &items, std::vector<Declaration> &decls) const;
+    void keepUniqueBuses(std::vector<Declaration> &decls, const std::vector<DeclarationItem> &items,
+                         std::map<std::string,int> &uses);
+    void nameNets();
+    const std::string *net(const NodePrivate *node) const;
+    const std::vector<std::string> &pins(const CellMaster *master);
+
+    void writeHeader();
+    void writeDeclarations(const std::vector<Declaration> &decls, const std::vector<DeclarationItem> &items,
+                           const std::vector<std::string> &spelled);
+    void writeAssigns();
+    void writeGates();
+    void writeCells(const std::vector<NodePrivate*> &cells);
+    void listItem(const std::string &s);
+
+    const ModulePrivate *m;
+    VerilogOutput &out;
+    const SymbolTable &names;
+
+    std::set<std::string> buses;
+    std::vector<std::string> portNames;
+    std::vector<std::string> nets;
+    std::vector<std::pair<size_t,size_t> > assigns;    // output port, wire
+    std::vector<DeclarationItem> portItems;
+    std::vector<DeclarationItem> wireItems;
+    std::vector<Declaration> portDecls;
+    std::vector<Declaration> wireDecls;
+    std::map<const CellMaster*,std::vector<std::string> > masterPins;
+    size_t column;
+    bool firstItem;
+};
+
+DeclarationItem ModuleWriter::item(size_t node, int kind) const
+{
+    const NodePrivate *p = kind ? m->portList[node] : m->wireList[node];
+    DeclarationItem item;
+    item.node = node;
+    item.kind = kind;
+    size_t baseLen;
+    item.isBit = splitBit(name(p), length(p), &baseLen, &item.bit);
+    if (item.isBit)
+        item.base.assign(name(p), baseLen);
+    return item;
+}
+
+std::string ModuleWriter::spell(const char *s, size_t len) const
+{
+    size_t baseLen;
+    long bit;
+    if (Verilog::is_identifier(s, len)
+            || (splitBit(s, len, &baseLen, &bit) && buses.count(std::string(s, baseLen))))
+        return std::string(s, len);
+    std::string escaped;
+    escaped.reserve(len + 2);
+    escaped += '\\';
+    escaped.append(s, len);
+    escaped += ' ';
+    return escaped;
+}
+
+// Instance names are never bits of a bus
+void ModuleWriter::putInstanceName(const NodePrivate *node)
+{
+    const char *s = name(node);
+    size_t len = length(node);
+    if (Verilog::is_identifier(s, len))
+    {
+        out.put(s, len);
+        return;
+    }
+    out.put('\\');
+    out.put(s, len);
+    out.put(' ');
+}
+
+// Runs of consecutive bits of one bus, counting up or down, become vectors
+void ModuleWriter::group(const std::vector<DeclarationItem> &items, std::vector<Declaration> &decls) const
+{
+    for (size_t i = 0; i < items.size(); )
+    {
+        const DeclarationItem &a = items[i];
+        size_t j = i + 1;
+        if (a.isBit)
+        {
+            long step = 0;
+            for (; j < items.size(); j++)
+            {
+                const DeclarationItem &b = items[j];
+                long diff = b.bit - items[j - 1].bit;
+                if (!b.isBit || b.kind != a.kind || b.base != a.base
+                        || (diff != 1 && diff != -1) || (step && diff != step))
+                    break;
+                step = diff;
+            }
+        }
+        Declaration d;
+        d.first = i;
+        d.count = j - i;
+        d.vector = a.isBit;
+        decls.push_back(d);
+        i = j;
+    }
+}
+
+// A bus whose name is used by anything else is declared bit by bit
+void ModuleWriter::keepUniqueBuses(std::vector<Declaration> &decls, const std::vector<DeclarationItem> &items,
+                                   std::map<std::string,int> &uses)
+{
+    std::vector<Declaration> result;
+    for (size_t i = 0; i < decls.size(); i++)
+    {
+        const Declaration &d = decls[i];
+        const std::string &base = items[d.first].base;
+        if (!d.vector || uses[base] == 1)
+        {
+            if (d.vector)
+                buses.insert(base);
+            result.push_back(d);
+            continue;
+        }
+        for (size_t j = 0; j < d.count; j++)
+        {
+            Declaration bit = { d.first + j, 1, false };
+            result.push_back(bit);
+        }
+    }
+    decls.swap(result);
+}
+
+void ModuleWriter::nameNets()
+{
+    const std::vector<NodePrivate*> &ports = m->portList;
+    const std::vector<NodePrivate*> &wires = m->wireList;
+
+    // Each wire takes the name of the port that drives it, or else of the
+    // first port it drives. Constants from 1'b0 and 1'b1 are written as such.
+    std::vector<const NodePrivate*> netPort(wires.size(), (const NodePrivate*) 0);
+    std::vector<char> constant(wires.size(), 0);
+    for (size_t i = 0; i < wires.size(); i++)
+    {
+        const NodePrivate *w = wires[i];
+        bool driven = false;
+        for (size_t j = 0; j < w->inputs.size(); j++)
+        {
+            const NodePrivate *p = w->inputs[j].node;
+            driven |= (p != 0);
+            if (!netPort[i] && owns(p, ports))
+                netPort[i] = p;
+        }
+        for (size_t j = 0; j < w->outputs.size(); j++)
+        {
+            const NodePrivate *p = w->outputs[j].node;
+            if (!owns(p, ports) || p == netPort[i])
+                continue;
+            if (!netPort[i])
+                netPort[i] = p;
+            else
+                assigns.push_back(std::make_pair((size_t) p->index, i));
+        }
+        Signal value = w->value;
+        if (!netPort[i] && !driven && (value == Signal::F || value == Signal::T)
+                && length(w) > sizeof(ConstantPrefix) - 1
+                && memcmp(name(w), ConstantPrefix, sizeof(ConstantPrefix) - 1) == 0)
+            constant[i] = (value == Signal::F ? '0' : '1');
+    }
+
+    for (size_t i = 0; i < ports.size(); i++)
+    {
+        if (!ports[i])
+            continue;
+        Port::PortType type = ((const PortPrivate*) ports[i])->type;
+        portItems.push_back(item(i, (type == Port::Output || type == Port::PPO) ? Port::Output : Port::Input));
+    }
+    for (size_t i = 0; i < wires.size(); i++)
+        if (!netPort[i] && !constant[i])
+            wireItems.push_back(item(i, 0));
+    group(portItems, portDecls);
+    group(wireItems, wireDecls);
+
+    std::map<std::string,int> uses;
+    for (int k = 0; k < 2; k++)
+    {
+        const std::vector<Declaration> &decls = k ? wireDecls : portDecls;
+        const std::vector<DeclarationItem> &items = k ? wireItems : portItems;
+        const std::vector<NodePrivate*> &list = k ? wires : ports;
+        for (size_t i = 0; i < decls.size(); i++)
+        {
+            const DeclarationItem &first = items[decls[i].first];
+            if (decls[i].vector)
+                uses[first.base]++;
+            else
+                uses[std::string(name(list[first.node]), length(list[first.node]))]++;
+        }
+    }
+    keepUniqueBuses(portDecls, portItems, uses);
+    keepUniqueBuses(wireDecls, wireItems, uses);
+
+    portNames.resize(ports.size());
+    for (size_t i = 0; i < ports.size(); i++)
+        if (ports[i])
+            portNames[i] = spell(name(ports[i]), length(ports[i]));
+    nets.resize(wires.size());
+    for (size_t i = 0; i < wires.size(); i++)
+    {
+        if (netPort[i])
+            nets[i] = portNames[netPort[i]->index];
+        else if (constant[i])
+            nets[i] = std::string("1'b") + constant[i];
+        else
+            nets[i] = spell(name(wires[i]), length(wires[i]));
+    }
+}
+
+// The name a pin connected to node refers to, 0 if node is no net
+const std::string *ModuleWriter::net(const NodePrivate *node) const
+{
+    if (owns(node, m->wireList))
+        return &nets[node->index];
+    if (owns(node, m->portList))
+        return &portNames[node->index];
+    return 0;
+}
+
+// Cell type, then the spelled input and output pin names
+const std::vector<std::string> &ModuleWriter::pins(const CellMaster *master)
+{
+    std::map<const CellMaster*,std::vector<std::string> >::iterator it = masterPins.find(master);
+    if (it != masterPins.end())
+        return it->second;
+    std::vector<std::string> &spelled = masterPins[master];
+    spelled.push_back(spell(master->type.data(), master->type.size()));
+    for (size_t i = 0; i < master->inputNames.size(); i++)
+        spelled.push_back(spell(master->inputNames[i].data(), master->inputNames[i].size()));
+    for (size_t i = 0; i < master->outputNames.size(); i++)
+        spelled.push_back(spell(master->outputNames[i].data(), master->outputNames[i].size()));
+    return spelled;
+}
+
+// Comma separated, wrapped before LineWidth
+void ModuleWriter::listItem(const std::string &s)
+{
+    if (!firstItem)
+    {
+        out.put(',');
+        column++;
+        if (column + s.size() + 1 > LineWidth)
+        {
+            out.put("\n       ", 8);
+            column = 7;
+        }
+    }
+    out.put(' ');
+    out.put(s);
+    column += s.size() + 1;
+    firstItem = false;
+}
+
+void ModuleWriter::writeHeader()
+{
+    std::string moduleName = spell(name(m), length(m));
+    out.put("module ");
+    out.put(moduleName);
+    out.put(" (", 2);
+    column = moduleName.size() + 9;
+    firstItem = true;
+    for (size_t i = 0; i < portDecls.size(); i++)
+    {
+        const DeclarationItem &first = portItems[portDecls[i].first];
+        listItem(portDecls[i].vector ? first.base : portNames[first.node]);
+    }
+    out.put(" );\n", 4);
+}
+
+void ModuleWriter::writeDeclarations(const std::vector<Declaration> &decls, const std::vector<DeclarationItem> &items,
+                                     const std::vector<std::string> &spelled)
+{
+    size_t i = 0;
+    while (i < decls.size())
+    {
+        const Declaration &d = decls[i];
+        const DeclarationItem &first = items[d.first];
+        const char *keyword = first.kind == Port::Input ? "  input"
+                            : first.kind == Port::Output ? "  output" : "  wire  ";
+        out.put(keyword);
+        if (d.vector)
+        {
+            out.put(" [", 2);
+            out.putNumber(first.bit);
+            out.put(':');
+            out.putNumber(items[d.first + d.count - 1].bit);
+            out.put("] ", 2);
+            out.put(first.base);
+            out.put(";\n", 2);
+            i++;
+            continue;
+        }
+        // Scalars of the same kind share one statement
+        column = strlen(keyword);
+        firstItem = true;
+        for (; i < decls.size() && !decls[i].vector && items[decls[i].first].kind == first.kind; i++)
+            listItem(spelled[items[decls[i].first].node]);
+        out.put(";\n", 2);
+    }
+}
+
+void ModuleWriter::writeAssigns()
+{
+    for (size_t i = 0; i < assigns.size(); i++)
+    {
+        const PortPrivate *p = (const PortPrivate*) m->portList[assigns[i].first];
+        if (p->type != Port::Output && p->type != Port::PPO)
+        {
+            std::cerr << "WARNING: Input port " << p->nodeName() << " shares a net with another input" << std::endl;
+            continue;
+        }
+        out.put("  assign ");
+        out.put(portNames[assigns[i].first]);
+        out.put(" = ", 3);
+        out.put(nets[assigns[i].second]);
+        out.put(";\n", 2);
+    }
+}
+
+// Primitives take the output first, then the inputs in order
+void ModuleWriter::writeGates()
+{
+    std::vector<const std::string*> terminals;
+    for (size_t i = 0; i < m->gateList.size(); i++)
+    {
+        const GatePrivate *g = (const GatePrivate*) m->gateList[i];
+        const char *keyword = gateKeyword(g->type);
+        terminals.clear();
+        terminals.push_back(g->outputs.empty() ? 0 : net(g->outputs[0].node));
+        for (size_t j = 0; j < g->inputs.size(); j++)
+            terminals.push_back(net(g->inputs[j].node));
+        bool connected = true;
+        for (size_t j = 0; j < terminals.size(); j++)
+            connected &= (terminals[j] != 0);
+        if (!keyword || !connected)
+        {
+            std::cerr << "WARNING: Gate " << g->nodeName() << " cannot be written" << std::endl;
+            continue;
+        }
+        out.put("  ");
+        out.put(keyword);
+        out.put(' ');
+        if (length(g))
+        {
+            putInstanceName(g);
+            out.put(' ');
+        }
+        out.put('(');
+        for (size_t j = 0; j < terminals.size(); j++)
+        {
+            out.put(j ? ", " : " ", j ? 2 : 1);
+            out.put(*terminals[j]);
+        }
+        out.put(" );\n", 4);
+    }
+}
+
+// Cells and module instances. Pins are connected by name; unconnected pins
+// are left out
+void ModuleWriter::writeCells(const std::vector<NodePrivate*> &cells)
+{
+    for (size_t i = 0; i < cells.size(); i++)
+    {
+        const CellPrivate *c = (const CellPrivate*) cells[i];
+        const std::vector<std::string> &spelled = pins(c->master);
+        size_t inputCount = c->master->inputNames.size();
+        size_t outputCount = c->master->outputNames.size();
+        out.put("  ", 2);
+        out.put(spelled[0]);
+        out.put(' ');
+        putInstanceName(c);
+        out.put(" (", 2);
+        bool first = true;
+        for (size_t j = 0; j < c->inputs.size() + c->outputs.size(); j++)
+        {
+            bool input = j < c->inputs.size();
+            size_t pin = input ? j : j - c->inputs.size();
+            if (pin >= (input ? inputCount : outputCount))
+                continue;
+            const std::string *s = net(input ? c->inputs[pin].node : c->outputs[pin].node);
+            if (!s)
+                continue;
+            out.put(first ? " ." : ", .", first ? 2 : 3);
+            out.put(spelled[1 + (input ? 0 : inputCount) + pin]);
+            out.put('(');
+            out.put(*s);
+            out.put(')');
+            first = false;
+        }
+        out.put(" );\n", 4);
+    }
+}
+
+// Only the node lists are read, skipping the ports removed in an open edit,
+// so writing changes nothing in the module.
+void ModuleWriter::write()
+{
+    nameNets();
+    writeHeader();
+    writeDeclarations(portDecls, portItems, portNames);
+    writeDeclarations(wireDecls, wireItems, nets);
+    out.put('\n');
+    writeAssigns();
+    writeGates();
+    writeCells(m->cellList);
+    writeCells(m->instanceList);
+    out.put("endmodule\n");
+}
+
+} // anonymous namespace
+
+/**************************************************************
+ *
+ * Circuit
+ *
+ **************************************************************/
+
+#define IMPL ((CircuitPrivate*)impl)
+
+bool Circuit::write(const std::string &path) const
+{
+    if (!impl)
+        return false;
+
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        std::cerr << "Could not write file: " << path << std::endl;
+        return false;
+    }
+
+    // The top module goes first, load() takes it for the circuit
+    std::vector<const ModulePrivate*> modules;
+    if (IMPL->topModule)
+        modules.push_back(IMPL->topModule);
+    for (size_t i = 0; i < IMPL->moduleNames.size(); i++)
+    {
+        const ModulePrivate *m = IMPL->modules[IMPL->moduleNames[i]];
+        if (m && m != IMPL->topModule)
+            modules.push_back(m);
+    }
+
+    VerilogOutput out(file);
+    for (size_t i = 0; i < modules.size(); i++)
+    {
+        if (i)
+            out.put('\n');
+        ModuleWriter(modules[i], out).write();
+    }
+    bool ok = out.flush();
+    ok = (fclose(file) == 0) && ok;
+    if (!ok)
+        std::cerr << "Could not write file: " << path << std::endl;
+    return ok;
+}
+
+#undef IMPL
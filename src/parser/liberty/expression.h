@@ -18,6 +18,7 @@ class LNValue;
 class LNString;
 class LNInteger;
 class LNDouble;
+class LNTable;
 class LibertyContext;
 
 class LibertyNode
@@ -34,6 +35,7 @@ public:
         TimingTableNode = 8,
         TimingNode      = 9,
         PinNode         = 10,
+        TableNode       = 11,
         BaseNode        = 21
     };
     virtual ~LibertyNode() {};
@@ -68,8 +70,8 @@ class LNLuTableTemplate : public LibertyNode
 public:
     std::string variable_1;
     std::string variable_2;
-    std::string index_1;
-    std::string index_2;
+    std::vector<double> index_1;
+    std::vector<double> index_2;
 };
 
 class LNRange : public LibertyNode
@@ -171,6 +173,27 @@ private:
     double data;
 };
 
+// The numbers of values(...) or index_n(...), converted by the scanner and
+// kept row by row in one buffer
+class LNTable : public LibertyNode
+{
+public:
+    LNTable() : columns(0) {}
+    // Fails if the row is not as long as the previous ones
+    bool appendRow(const std::vector<double> &row)
+    {
+        if (!values.empty() && row.size() != columns)
+            return false;
+        columns = row.size();
+        values.insert(values.end(), row.begin(), row.end());
+        return true;
+    }
+    size_t rows() const { return columns ? values.size() / columns : 0; }
+    LibertyNode::NodeType nodeType() const { return LibertyNode::TableNode; }
+    std::vector<double> values;
+    size_t columns;
+};
+
 class LNValue : public LNStatement
 {
 public:
@@ -197,28 +220,18 @@ private:
 class LNTimingTable : public LibertyNode
 {
 public:
-    LNTimingTable(const std::string &name_, const std::string &template_, LibertyNodeList *values)
-        : name(name_), lu_table_template(template_)
+    LNTimingTable(const std::string &name_, const std::string &template_, LNTable *table)
+        : name(name_), lu_table_template(template_), rows(table->rows()), columns(table->columns)
     {
-        const std::vector<LibertyNode*> &nodes = values->nodes;
-        for (size_t i = 0; i < nodes.size(); i++)
-        {
-            if (nodes[i]->nodeType() == LibertyNode::StringNode)
-            {
-                LNString *str = (LNString*) nodes[i];
-                table.push_back(str->value());
-            }
-            else
-            {
-                // TODO
-                std::cerr << "WARNING: Invalid data in value(...)" << std::endl;
-            }
-        }
+        values.swap(table->values);
     }
     LibertyNode::NodeType nodeType() const { return LibertyNode::TimingTableNode; }
+    const double *row(size_t i) const { return &values[i * columns]; }
     std::string name;   // cell_fall, cell_rise, ...
     std::string lu_table_template;
-    std::vector<std::string> table;
+    std::vector<double> values;     // row by row
+    size_t rows;
+    size_t columns;
 };
 
 class LNTiming : public LibertyNode
@@ -69,6 +69,8 @@ inline std::string trim_quote(const std::string&);
     int                         ival;
     double                      fval;
     std::string*                sval;
+    std::vector<double>*        nlist;
+    class LNTable*              table;
     class LibertyNode*          node;
     class LibertyNodeList*      list;
 }
@@ -128,6 +130,7 @@ inline std::string trim_quote(const std::string&);
 %token<sval> STRING
 %token<sval> INTEGER
 %token<sval> FLOAT
+%token<nlist> NUMBER_LIST
 
 %type<sval> string
 %type<list> top_statement_list
@@ -149,6 +152,7 @@ inline std::string trim_quote(const std::string&);
 %type<node> keyword
 %type<node> value
 %type<node> identifier
+%type<table> number_table
 
 
 // %destructor { delete $$; } STRING IDENTIFIER
@@ -314,11 +318,11 @@ top_statement
                     LNString *str = (LNString*)(val->value());
                     lu_table_template.variable_2 = str->value();
                 } else if (val->name() == "index_1") {
-                    LNString *str = (LNString*)(val->value());
-                    lu_table_template.index_1 = str->value();
+                    LNTable *table = (LNTable*)(val->value());
+                    lu_table_template.index_1.swap(table->values);
                 } else if (val->name() == "index_2") {
-                    LNString *str = (LNString*)(val->value());
-                    lu_table_template.index_2 = str->value();
+                    LNTable *table = (LNTable*)(val->value());
+                    lu_table_template.index_2.swap(table->values);
                 } else {
                     error(yyloc, std::string("Bad Statement"));
                     delete $3;
@@ -409,8 +413,8 @@ lu_table_template_statement_list
 lu_table_template_statement
         : VARIABLE_1 ':' identifier ';'         { $$ = new LNValue("variable_1", $3); }
         | VARIABLE_2 ':' identifier ';'         { $$ = new LNValue("variable_2", $3); }
-        | INDEX_1 '(' string ')'                { $$ = new LNValue("index_1", new LNString(*$3)); delete $3; }
-        | INDEX_2 '(' string ')'                { $$ = new LNValue("index_2", new LNString(*$3)); delete $3; }
+        | INDEX_1 '(' number_table ')' optional_semicolon { $$ = new LNValue("index_1", $3); }
+        | INDEX_2 '(' number_table ')' optional_semicolon { $$ = new LNValue("index_2", $3); }
         ;
 
 cell_statement_list
@@ -625,12 +629,12 @@ timing_statement
         : RELATED_PIN ':' string ';'            { $$ = new LNValue("related_pin", *$3); delete $3; }
         | TIMING_SENSE ':' identifier ';'       { $$ = new LNValue("timing_sense", $3); }
         | TIMING_TYPE ':' identifier ';'        { $$ = new LNValue("timing_type", $3); }
-        | CELL_FALL '(' identifier ')' '{' VALUES '(' parameter_list ')' ';' '}' { $$ = new LNTimingTable("cell_fall", ((LNString*)$3)->value(), $8); }
-        | CELL_RISE '(' identifier ')' '{' VALUES '(' parameter_list ')' ';' '}' { $$ = new LNTimingTable("cell_rise", ((LNString*)$3)->value(), $8); }
-        | FALL_TRANSITION '(' identifier ')' '{' VALUES '(' parameter_list ')' ';' '}' { $$ = new LNTimingTable("fall_transition", ((LNString*)$3)->value(), $8); }
-        | RISE_TRANSITION '(' identifier ')' '{' VALUES '(' parameter_list ')' ';' '}' { $$ = new LNTimingTable("rise_transition", ((LNString*)$3)->value(), $8); }
-        | FALL_CONSTRAINT '(' identifier ')' '{' VALUES '(' parameter_list ')' ';' '}' { $$ = new LNTimingTable("fall_constraint", ((LNString*)$3)->value(), $8); }
-        | RISE_CONSTRAINT '(' identifier ')' '{' VALUES '(' parameter_list ')' ';' '}' { $$ = new LNTimingTable("rise_constraint", ((LNString*)$3)->value(), $8); }
+        | CELL_FALL '(' identifier ')' '{' VALUES '(' number_table ')' optional_semicolon '}' { $$ = new LNTimingTable("cell_fall", ((LNString*)$3)->value(), $8); delete $3; delete $8; }
+        | CELL_RISE '(' identifier ')' '{' VALUES '(' number_table ')' optional_semicolon '}' { $$ = new LNTimingTable("cell_rise", ((LNString*)$3)->value(), $8); delete $3; delete $8; }
+        | FALL_TRANSITION '(' identifier ')' '{' VALUES '(' number_table ')' optional_semicolon '}' { $$ = new LNTimingTable("fall_transition", ((LNString*)$3)->value(), $8); delete $3; delete $8; }
+        | RISE_TRANSITION '(' identifier ')' '{' VALUES '(' number_table ')' optional_semicolon '}' { $$ = new LNTimingTable("rise_transition", ((LNString*)$3)->value(), $8); delete $3; delete $8; }
+        | FALL_CONSTRAINT '(' identifier ')' '{' VALUES '(' number_table ')' optional_semicolon '}' { $$ = new LNTimingTable("fall_constraint", ((LNString*)$3)->value(), $8); delete $3; delete $8; }
+        | RISE_CONSTRAINT '(' identifier ')' '{' VALUES '(' number_table ')' optional_semicolon '}' { $$ = new LNTimingTable("rise_constraint", ((LNString*)$3)->value(), $8); delete $3; delete $8; }
         | WHEN ':' string ';'                   { $$ = new LNValue("when", *$3); delete $3; }
         | SDF_COND ':' string ';'               { $$ = new LNValue("sdf_cond", *$3); delete $3; }
         | statement
@@ -666,6 +670,27 @@ value
         : identifier                    { $$ = $1; }
         | INTEGER                       { $$ = new LNInteger(atoi($1->c_str())); delete $1; }
         | FLOAT                         { $$ = new LNDouble(atof($1->c_str())); delete $1; }
+        | NUMBER_LIST                   { LNTable *table = new LNTable; table->appendRow(*$1); delete $1; $$ = table; }
+        ;
+
+number_table
+        : NUMBER_LIST                   { $$ = new LNTable; $$->appendRow(*$1); delete $1; }
+        | number_table ',' NUMBER_LIST
+        {
+            if (!$1->appendRow(*$3))
+            {
+                error(@3, std::string("Bad Table"));
+                delete $1;
+                delete $3;
+                YYERROR;
+            }
+            delete $3;
+        }
+        ;
+
+optional_semicolon
+        : /* empty */
+        | ';'
         ;
 
 string
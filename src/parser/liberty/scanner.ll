@@ -3,7 +3,9 @@
 
 %{ /*** C/C++ Declarations ***/
 
+#include <cstdlib>
 #include <string>
+#include <vector>
 
 #include "scanner.h"
 
@@ -50,6 +52,7 @@ typedef Liberty::Parser::token_type token_type;
 %}
 
 %x IN_COMMENT
+%x IN_TABLE
 
 O   [0-7]
 D   [0-9]
@@ -66,6 +69,8 @@ CP  (u|U|L)
 SP  (u8|u|U|L)
 ES  (\\(['"\?\\\nabfnrtv]|[0-7]{1,3}|x[a-fA-F0-9]+))
 WS  [ \t\v\n\f]
+NUM ([+-]?({D}+"."?{D}*|"."{D}+){E}?)
+BL  [ \t]
 
 %% /*** Regular Expressions Part ***/
 
@@ -96,8 +101,8 @@ WS  [ \t\v\n\f]
 "lu_table_template"                 { return token::LU_TABLE_TEMPLATE; }
 "variable_1"                        { return token::VARIABLE_1; }
 "variable_2"                        { return token::VARIABLE_2; }
-"index_1"                           { return token::INDEX_1; }
-"index_2"                           { return token::INDEX_2; }
+"index_1"                           { yy_push_state(IN_TABLE); return token::INDEX_1; }
+"index_2"                           { yy_push_state(IN_TABLE); return token::INDEX_2; }
 "cell"                              { return token::CELL; }
 "area"                              { return token::AREA; }
 "cell_leakage_power"                { return token::CELL_LEAKAGE_POWER; }
@@ -124,7 +129,7 @@ WS  [ \t\v\n\f]
 "rise_capacitance"                  { return token::RISE_CAPACITANCE; }
 "fall_capacitance_range"            { return token::FALL_CAPACITANCE_RANGE; }
 "rise_capacitance_range"            { return token::RISE_CAPACITANCE_RANGE; }
-"values"                            { return token::VALUES; }
+"values"                            { yy_push_state(IN_TABLE); return token::VALUES; }
 
 {L}({L}|{D})*                       { YY_SAVE_TOKEN; return token::IDENTIFIER; }
 ({SP}?\"([^"\\\n]|{ES})*\"{WS}*)+   { YY_SAVE_TOKEN; return token::STRING; }
@@ -144,6 +149,34 @@ WS  [ \t\v\n\f]
 {D}+("."{D}+)+                      { YY_SAVE_TOKEN; return token::VERSION; }
 ({L}|{D})+                          { YY_SAVE_TOKEN; return token::IDENTIFIER; }
 
+ /* the quoted lists of values(...) and index_n(...) are converted here, so
+  * a table is never held as text */
+<IN_TABLE>{
+"("                     { return static_cast<token_type>(*yytext); }
+","                     { return static_cast<token_type>(*yytext); }
+")"                     { yy_pop_state(); return static_cast<token_type>(*yytext); }
+\"{BL}*{NUM}({BL}*","?{BL}*{NUM})*{BL}*","?{BL}*\" {
+    yylval->nlist = new std::vector<double>;
+    const char *p = yytext + 1;
+    for (;;)
+    {
+        while (*p == ' ' || *p == '\t' || *p == ',')
+            p++;
+        char *end;
+        double value = strtod(p, &end);
+        if (end == p)
+            break;
+        yylval->nlist->push_back(value);
+        p = end;
+    }
+    return token::NUMBER_LIST;
+}
+\"([^"\\\n]|{ES})*\"     { YY_SAVE_TOKEN; return token::STRING; }
+[ \t\r\\]+               yylloc->step();
+\n                      yylloc->lines(yyleng); yylloc->step();
+.                       { yyless(0); yy_pop_state(); /* not a table, e.g. "values : ..." */ }
+}
+
  /* gobble up white-spaces */
 [ \t\r\\]+ {
     yylloc->step();
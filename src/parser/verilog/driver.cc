@@ -2,44 +2,97 @@
 /** \file driver.cc Implementation of the Verilog::Driver class. */
 
 #include <fstream>
+#include <set>
 #include <sstream>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "driver.h"
 #include "scanner.h"
+#include "expression.h"
 
 namespace Verilog {
 
 Driver::Driver(class VerilogContext& verilog_)
     : trace_scanning(false),
       trace_parsing(false),
-      verilog(verilog_)
+      builder(0),
+      verilog(verilog_),
+      module(0)
 {
 }
 
+bool Driver::parse(Scanner& scanner)
+{
+    this->lexer = &scanner;
+
+    Parser parser(*this);
+    parser.set_debug_level(trace_parsing);
+    bool result = (parser.parse() == 0);
+
+    // left over by a syntax error or an aborted build
+    delete module;
+    module = 0;
+    return result;
+}
+
 bool Driver::parse_stream(std::istream& in, const std::string& sname)
 {
     streamname = sname;
 
     Scanner scanner(&in);
     scanner.set_debug(trace_scanning);
-    this->lexer = &scanner;
+    return parse(scanner);
+}
 
-    Parser parser(*this);
-    parser.set_debug_level(trace_parsing);
-    return (parser.parse() == 0);
+bool Driver::parse_buffer(const char* data, size_t size, const std::string& sname)
+{
+    streamname = sname;
+
+    MappedScanner scanner(data, data + size);
+    return parse(scanner);
 }
 
 bool Driver::parse_file(const std::string &filename)
 {
+#ifndef _WIN32
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+	error("Could not open file: " + filename);
+	return false;
+    }
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+	data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data != MAP_FAILED)
+    {
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+	bool result = parse_buffer((const char*) data, st.st_size, filename);
+	munmap(data, st.st_size);
+	return result;
+    }
+#endif
+    // Empty or unmappable files go through the stream scanner
     std::ifstream in(filename.c_str());
-    if (!in.good()) return false;
+    if (!in.good())
+    {
+	error("Could not open file: " + filename);
+	return false;
+    }
     return parse_stream(in, filename);
 }
 
 bool Driver::parse_string(const std::string &input, const std::string& sname)
 {
-    std::istringstream iss(input);
-    return parse_stream(iss, sname);
+    return parse_buffer(input.data(), input.size(), sname);
 }
 
 void Driver::error(const class location& l,
@@ -53,4 +106,78 @@ void Driver::error(const std::string& m)
     std::cerr << m << std::endl;
 }
 
+bool Driver::begin_module(VNModule* module_)
+{
+    delete module;
+    module = module_;
+    return !builder || builder->beginModule(*module);
+}
+
+bool Driver::add_module_item(VerilogNode* item)
+{
+    bool result = true;
+    if (!builder)
+    {
+	item->detach();
+	module->addItem(item);
+    }
+    else
+	result = builder->addItem(item);
+
+    // The item has been built or detached, so its tokens can go
+    lexer->recycle();
+    return result;
+}
+
+bool Driver::end_module()
+{
+    if (builder)
+    {
+	delete module;
+	module = 0;
+	return builder->endModule();
+    }
+    verilog.expressions.push_back(module);
+    module = 0;
+    return true;
+}
+
+/* A name can be written as it is if the scanner lexes it as exactly one
+ * plain identifier: [a-zA-Z_][a-zA-Z0-9_$]* that is not one of the
+ * keywords in scanner.ll. */
+bool is_identifier(const char *s, size_t len)
+{
+    static const char *words[] = {
+	"module", "endmodule", "task", "endtask", "function", "endfunction",
+	"assign", "specify", "endspecify", "parameter", "integer", "real",
+	"always", "initial", "if", "else", "begin", "end", "repeat",
+	"posedge", "negedge", "input", "output", "inout", "scalared",
+	"vectored", "reg",
+	"and", "nand", "or", "nor", "xor", "xnor", "buf", "bufif0", "bufif1",
+	"not", "notif0", "notif1", "pulldown", "pullup", "nmos", "rnmos",
+	"pmos", "rpmos", "cmos", "rcmos", "tran", "rtran", "tranif0",
+	"rtranif0", "tranif1", "rtranif1",
+	"strong0", "pull0", "weak0", "highz0", "strong1", "pull1", "weak1",
+	"highz1",
+	"wire", "tri", "tri1", "supply0", "wand", "triand", "tri0", "supply1",
+	"wor", "trior", "trireg"
+    };
+    static const size_t LongestWord = 11;
+    static const std::set<std::string> keywords(words, words + sizeof(words) / sizeof(words[0]));
+
+    if (len == 0)
+	return false;
+    char c = s[0];
+    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'))
+	return false;
+    for (size_t i = 1; i < len; i++)
+    {
+	c = s[i];
+	if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+		|| (c >= '0' && c <= '9') || c == '_' || c == '$'))
+	    return false;
+    }
+    return len > LongestWord || !keywords.count(std::string(s, len));
+}
+
 } // namespace Verilog
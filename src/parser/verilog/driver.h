@@ -4,11 +4,15 @@
 #ifndef VERILOG_DRIVER_H
 #define VERILOG_DRIVER_H
 
+#include <cstddef>
 #include <string>
 #include <vector>
 
 // forward declaration
 class VerilogContext;
+class VerilogBuilder;
+class VerilogNode;
+class VNModule;
 
 /** The Verilog namespace is used to encapsulate the three parser classes
  * Verilog::Parser, Verilog::Scanner and Verilog::Driver */
@@ -35,6 +39,10 @@ public:
     /// stream name (file or input stream) used for error messages.
     std::string streamname;
 
+    /** When set, modules are passed to the builder while they are parsed and
+     * their items are handed over to it; verilog stays empty. */
+    class VerilogBuilder* builder;
+
     /** Invoke the scanner and parser for a stream.
      * @param in	input stream
      * @param sname	stream name for error messages
@@ -51,8 +59,19 @@ public:
     bool parse_string(const std::string& input,
 		      const std::string& sname = "string stream");
 
-    /** Invoke the scanner and parser on a file. Use parse_stream with a
-     * std::ifstream if detection of file reading errors is required.
+    /** Invoke the parser on a buffer that stays valid and unchanged until
+     * the call returns. The buffer is lexed in place by a MappedScanner.
+     * @param data	first character of the input
+     * @param size	length of the input
+     * @param sname	stream name for error messages
+     * @return		true if successfully parsed
+     */
+    bool parse_buffer(const char* data, size_t size,
+		      const std::string& sname = "buffer input");
+
+    /** Invoke the scanner and parser on a file. The file is memory-mapped
+     * and parsed with parse_buffer where the platform allows it, otherwise
+     * it is read through parse_stream.
      * @param filename	input file name
      * @return		true if successfully parsed
      */
@@ -70,6 +89,12 @@ public:
      * e.g. to a dialog box. */
     void error(const std::string& m);
 
+    // Called by the grammar rules for each module and module item. They
+    // return false when the builder asks to stop parsing.
+    bool begin_module(VNModule* module);
+    bool add_module_item(VerilogNode* item);
+    bool end_module();
+
     /** Pointer to the current lexer instance, this is used to connect the
      * parser to the scanner. It is used in the yylex macro. */
     class Scanner* lexer;
@@ -77,8 +102,18 @@ public:
     /** Reference to the calculator context filled during parsing of the
      * expressions. */
     class VerilogContext& verilog;
+
+private:
+    bool parse(class Scanner& scanner);
+
+    /// module being parsed, owned by the driver until end_module()
+    VNModule* module;
 };
 
+/** True if the name can be written as a plain identifier, false if it is a
+ * keyword or needs the escaped form \name followed by white space. */
+bool is_identifier(const char *s, size_t len);
+
 } // namespace Verilog
 
 #endif // VERILOG_DRIVER_H
@@ -5,11 +5,13 @@
 #define EXPRESSION_H
 
 #include <map>
+#include <string>
 #include <vector>
 #include <iostream>
 #include <ostream>
 #include <stdexcept>
 #include <cmath>
+#include <cstring>
 
 class VNPort;
 class VNVariable;
@@ -20,6 +22,61 @@ class VNOutput;
 class VNGateInst;
 class VNModuleInst;
 class VNNet;
+class VNAssign;
+
+/** Characters of a token, pointing into the scanner's input or its token
+ * storage. The parse nodes keep slices, which stay valid while the item is
+ * handed to VerilogBuilder::addItem(), and are copied into a std::string
+ * only when they become a name in the netlist. */
+struct VerilogSlice
+{
+    const char *data;
+    size_t size;
+
+    std::string str() const { return std::string(data, size); }
+    bool empty() const { return size == 0; }
+
+    static VerilogSlice literal(const char *s)
+    {
+        VerilogSlice slice = { s, strlen(s) };
+        return slice;
+    }
+};
+
+inline bool operator== (const VerilogSlice &a, const char *b)
+{
+    return strncmp(a.data, b, a.size) == 0 && b[a.size] == '\0';
+}
+
+inline bool operator!= (const VerilogSlice &a, const char *b)
+{
+    return !(a == b);
+}
+
+inline std::ostream& operator<< (std::ostream &out, const VerilogSlice &slice)
+{
+    return out.write(slice.data, slice.size);
+}
+
+/** Copies the characters of the slices into text and points the slices at
+ * the copy, so a node kept after the parse owns its names. */
+inline void detachSlices(std::string &text, VerilogSlice *slices[], size_t n)
+{
+    if (!text.empty())
+        return;
+    size_t size = 0;
+    for (size_t i = 0; i < n; i++)
+        size += slices[i]->size;
+    text.reserve(size);
+    for (size_t i = 0; i < n; i++)
+        text.append(slices[i]->data, slices[i]->size);
+    const char *p = text.data();
+    for (size_t i = 0; i < n; i++)
+    {
+        slices[i]->data = p;
+        p += slices[i]->size;
+    }
+}
 
 class VerilogNode
 {
@@ -30,6 +87,7 @@ public:
         NetNode     = 3,
         GateInstNode = 4,
         ModuleInstNode = 5,
+        AssignNode  = 6,
         BaseNode = 11
     };
     virtual ~VerilogNode() {}
@@ -38,7 +96,11 @@ public:
     bool isNet() const          { return nodeType() == NetNode; }
     bool isGateInst() const     { return nodeType() == GateInstNode; }
     bool isModuleInst() const   { return nodeType() == ModuleInstNode; }
+    bool isAssign() const       { return nodeType() == AssignNode; }
     virtual NodeType nodeType() const { return BaseNode; }
+    /** Makes the node own the text of its slices, for an item kept after
+     * VerilogBuilder::addItem() returns */
+    virtual void detach() {}
 };
 
 class VerilogList
@@ -52,83 +114,99 @@ public:
                 delete nodes[i];
         nodes.clear();
     }
+    void detach()
+    {
+        for (size_t i = 0; i < nodes.size(); i++)
+            if (nodes[i] != NULL)
+                nodes[i]->detach();
+    }
     std::vector<VerilogNode*> nodes;
 };
 
 class VNModule : public VerilogNode
 {
 public:
-    VNModule(const std::string &name, VerilogList *ports, VerilogList *items)
-        : m_name(name), m_ports(ports), m_items(items)
+    VNModule(const std::string &name, VerilogList *ports)
+        : m_name(name), m_ports(ports ? ports : new VerilogList)
     {
         m_inputs = new VerilogList;
         m_outputs = new VerilogList;
         m_nets = new VerilogList;
         m_gateInsts = new VerilogList;
         m_moduleInsts = new VerilogList;
-
-        for (size_t i = 0; i < items->nodes.size(); i++)
-        {
-            VerilogNode *item = items->nodes[i];
-
-            switch (item->nodeType())
-            {
-                case VerilogNode::InputNode:
-                    m_inputs->nodes.push_back(item);
-                    break;
-                case VerilogNode::OutputNode:
-                    m_outputs->nodes.push_back(item);
-                    break;
-                case VerilogNode::NetNode:
-                    m_nets->nodes.push_back(item);
-                    break;
-                case VerilogNode::GateInstNode:
-                    m_gateInsts->nodes.push_back(item);
-                    break;
-                case VerilogNode::ModuleInstNode:
-                    m_moduleInsts->nodes.push_back(item);
-                    break;
-                default:
-                    ; // Do nothing
-            }
-        }
+        m_assigns = new VerilogList;
     }
     ~VNModule() {
+        delete m_ports;
         delete m_inputs;
         delete m_outputs;
         delete m_nets;
         delete m_gateInsts;
         delete m_moduleInsts;
+        delete m_assigns;
+    }
+
+    // Takes ownership of a module item
+    void addItem(VerilogNode *item)
+    {
+        switch (item->nodeType())
+        {
+            case VerilogNode::InputNode:
+                m_inputs->nodes.push_back(item);
+                break;
+            case VerilogNode::OutputNode:
+                m_outputs->nodes.push_back(item);
+                break;
+            case VerilogNode::NetNode:
+                m_nets->nodes.push_back(item);
+                break;
+            case VerilogNode::GateInstNode:
+                m_gateInsts->nodes.push_back(item);
+                break;
+            case VerilogNode::ModuleInstNode:
+                m_moduleInsts->nodes.push_back(item);
+                break;
+            case VerilogNode::AssignNode:
+                m_assigns->nodes.push_back(item);
+                break;
+            default:
+                delete item;
+                return;
+        }
+        m_items.push_back(item);
     }
 
     std::string name() const { return m_name; }
     size_t portSize() const             { return m_ports->nodes.size(); }
-    size_t itemSize() const             { return m_items->nodes.size(); }
+    size_t itemSize() const             { return m_items.size(); }
     VNPort* port(size_t i) const        { return ((VNPort*)m_ports->nodes[i]); }
-    VerilogNode* item(size_t i) const   { return m_items->nodes[i]; }
+    VerilogNode* item(size_t i) const   { return m_items[i]; }
 
     size_t inputSize() const            { return m_inputs->nodes.size(); }
     size_t outputSize() const           { return m_outputs->nodes.size(); }
     size_t netSize() const              { return m_nets->nodes.size(); }
     size_t gateInstSize() const         { return m_gateInsts->nodes.size(); }
     size_t moduleInstSize() const       { return m_moduleInsts->nodes.size(); }
+    size_t assignSize() const           { return m_assigns->nodes.size(); }
 
     VNInput* input(size_t i) const      { return (VNInput*)(m_inputs->nodes[i]); }
     VNOutput* output(size_t i) const    { return (VNOutput*)(m_outputs->nodes[i]); }
     VNNet* net(size_t i) const          { return (VNNet*)(m_nets->nodes[i]); }
     VNGateInst* gateInst(size_t i) const { return (VNGateInst*)(m_gateInsts->nodes[i]); }
     VNModuleInst* moduleInst(size_t i) const { return (VNModuleInst*)(m_moduleInsts->nodes[i]); }
+    VNAssign* assign(size_t i) const    { return (VNAssign*)(m_assigns->nodes[i]); }
 
 private:
     std::string m_name;
     VerilogList *m_ports;
-    VerilogList *m_items;
+    std::vector<VerilogNode*> m_items;  // in source order, owned by the lists below
 
     VerilogList *m_inputs;
     VerilogList *m_outputs;
     VerilogList *m_nets;
     VerilogList *m_moduleInsts;
     VerilogList *m_gateInsts;
+    VerilogList *m_assigns;
 };
 
 class VNRange : public VerilogNode
@@ -160,11 +238,13 @@ class VNInput : public VerilogNode
 public:
     VNInput(VerilogNode *range, VerilogList *vars)
         : m_range(range), m_vars(vars) {}
+    ~VNInput() { delete m_range; delete m_vars; }
 
     VNRange* range() const { return ((VNRange*)m_range); }
     size_t varSize() const { return m_vars->nodes.size(); }
     VNVariable* var(size_t i) const { return ((VNVariable*)(m_vars->nodes[i])); }
     VerilogNode::NodeType nodeType() const { return VerilogNode::InputNode; }
+    void detach() { m_vars->detach(); }
 
 private:
     VerilogNode *m_range;
@@ -176,11 +256,13 @@ class VNOutput : public VerilogNode
 public:
     VNOutput(VerilogNode *range, VerilogList *vars)
         : m_range(range), m_vars(vars) {}
+    ~VNOutput() { delete m_range; delete m_vars; }
 
     VNRange* range() const { return ((VNRange*)m_range); }
     size_t varSize() const { return m_vars->nodes.size(); }
     VNVariable* var(size_t i) const { return ((VNVariable*)(m_vars->nodes[i])); }
     VerilogNode::NodeType nodeType() const { return VerilogNode::OutputNode; }
+    void detach() { m_vars->detach(); }
 
 private:
     VerilogNode *m_range;
@@ -190,17 +272,25 @@ private:
 class VNNet : public VerilogNode
 {
 public:
-    VNNet(const std::string &type, VerilogNode *range, VerilogList *vars)
+    VNNet(const VerilogSlice &type, VerilogNode *range, VerilogList *vars)
         : m_type(type), m_range(range), m_vars(vars) {}
+    ~VNNet() { delete m_range; delete m_vars; }
 
-    std::string type() const { return m_type; }
+    VerilogSlice type() const { return m_type; }
     VNRange* range() const { return ((VNRange*)m_range); }
     size_t varSize() const { return m_vars->nodes.size(); }
     VNVariable* var(size_t i) const { return ((VNVariable*)(m_vars->nodes[i])); }
     VerilogNode::NodeType nodeType() const { return VerilogNode::NetNode; }
+    void detach()
+    {
+        VerilogSlice *slices[] = { &m_type };
+        detachSlices(m_text, slices, 1);
+        m_vars->detach();
+    }
 
 private:
-    std::string m_type;
+    VerilogSlice m_type;
+    std::string m_text;
     VerilogNode *m_range;
     VerilogList *m_vars;
 };
@@ -208,58 +298,89 @@ private:
 class VNVariable : public VerilogNode
 {
 public:
-    VNVariable(const std::string &name) : m_name(name) {}
+    VNVariable(const VerilogSlice &name) : m_name(name) {}
 
-    std::string name() const { return m_name; }
+    VerilogSlice name() const { return m_name; }
+    void detach()
+    {
+        VerilogSlice *slices[] = { &m_name };
+        detachSlices(m_text, slices, 1);
+    }
 
 private:
-    std::string m_name;
+    VerilogSlice m_name;
+    std::string m_text;
 };
 
 class VNGateInst : public VerilogNode
 {
 public:
-    VNGateInst(const std::string &type, VerilogList *insts)
+    VNGateInst(const VerilogSlice &type, VerilogList *insts)
         : m_type(type), m_insts(insts) {}
+    ~VNGateInst() { delete m_insts; }
 
-    std::string type() const { return m_type; }
+    VerilogSlice type() const { return m_type; }
     size_t instSize() const { return m_insts->nodes.size(); }
     VNInstance* inst(size_t i) const { return ((VNInstance*)(m_insts->nodes[i])); }
     VerilogNode::NodeType nodeType() const { return VerilogNode::GateInstNode; }
+    void detach()
+    {
+        VerilogSlice *slices[] = { &m_type };
+        detachSlices(m_text, slices, 1);
+        m_insts->detach();
+    }
 
 private:
-    std::string m_type;
+    VerilogSlice m_type;
+    std::string m_text;
     VerilogList *m_insts;
 };
 
 class VNModuleInst : public VerilogNode
 {
 public:
-    VNModuleInst(const std::string &name, VerilogList *insts)
+    VNModuleInst(const VerilogSlice &name, VerilogList *insts)
         : m_name(name), m_insts(insts) {}
+    ~VNModuleInst() { delete m_insts; }
 
-    std::string name() const { return m_name; }
+    VerilogSlice name() const { return m_name; }
     size_t instSize() const { return m_insts->nodes.size(); }
     VNInstance* inst(size_t i) const { return ((VNInstance*)(m_insts->nodes[i])); }
     VerilogNode::NodeType nodeType() const { return VerilogNode::ModuleInstNode; }
+    void detach()
+    {
+        VerilogSlice *slices[] = { &m_name };
+        detachSlices(m_text, slices, 1);
+        m_insts->detach();
+    }
 
 private:
-    std::string m_name;
+    VerilogSlice m_name;
+    std::string m_text;
     VerilogList *m_insts;
 };
 
 class VNInstance : public VerilogNode
 {
 public:
-    VNInstance(const std::string &name, VerilogList *conns)
+    VNInstance(const VerilogSlice &name, VerilogList *conns)
         : m_name(name), m_conns(conns) {}
+    ~VNInstance() { delete m_conns; }
 
-    std::string name() const { return m_name; }
-    size_t connSize() const { return m_conns->nodes.size(); }
+    VerilogSlice name() const { return m_name; }
+    size_t connSize() const { return m_conns ? m_conns->nodes.size() : 0; }
     VNConnection* conn(size_t i) const { return ((VNConnection*)(m_conns->nodes[i])); }
+    void detach()
+    {
+        VerilogSlice *slices[] = { &m_name };
+        detachSlices(m_text, slices, 1);
+        if (m_conns)
+            m_conns->detach();
+    }
 
 private:
-    std::string m_name;
+    VerilogSlice m_name;
+    std::string m_text;
     VerilogList *m_conns;
 };
 
@@ -277,14 +398,56 @@ private:
 class VNConnection : public VerilogNode
 {
 public:
-    VNConnection(const std::string &from, const std::string &to) : m_from(from), m_to(to) {}
+    VNConnection(const VerilogSlice &from, const VerilogSlice &to) : m_from(from), m_to(to) {}
 
-    std::string from() const { return m_from; }
-    std::string to() const { return m_to; }
+    VerilogSlice from() const { return m_from; }
+    VerilogSlice to() const { return m_to; }
+    void detach()
+    {
+        VerilogSlice *slices[] = { &m_from, &m_to };
+        detachSlices(m_text, slices, 2);
+    }
 
 private:
-    std::string m_from;
-    std::string m_to;
+    VerilogSlice m_from;
+    VerilogSlice m_to;
+    std::string m_text;
+};
+
+/** Continuous assignment of one net to another, assign lhs = rhs; */
+class VNAssign : public VerilogNode
+{
+public:
+    VNAssign(const VerilogSlice &lhs, const VerilogSlice &rhs) : m_lhs(lhs), m_rhs(rhs) {}
+
+    VerilogSlice lhs() const { return m_lhs; }
+    VerilogSlice rhs() const { return m_rhs; }
+    VerilogNode::NodeType nodeType() const { return VerilogNode::AssignNode; }
+    void detach()
+    {
+        VerilogSlice *slices[] = { &m_lhs, &m_rhs };
+        detachSlices(m_text, slices, 2);
+    }
+
+private:
+    VerilogSlice m_lhs;
+    VerilogSlice m_rhs;
+    std::string m_text;
+};
+
+/** Receives modules statement by statement while they are parsed, instead
+ * of collecting them in a VerilogContext. The module passed to beginModule()
+ * only holds its name and port list. addItem() takes ownership of the item,
+ * which is normally freed once it is elaborated, so no parse tree builds
+ * up. The slices of the item are only valid during addItem(), an item kept
+ * longer must be detached. Returning false aborts the parse. */
+class VerilogBuilder
+{
+public:
+    virtual ~VerilogBuilder() {}
+    virtual bool beginModule(const VNModule &module) = 0;
+    virtual bool addItem(VerilogNode *item) = 0;
+    virtual bool endModule() = 0;
 };
 
 class VerilogContext
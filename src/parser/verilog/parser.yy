@@ -25,8 +25,8 @@
 
 /*** yacc/bison Declarations ***/
 
-/* Require bison 2.3 or later */
-%require "2.3"
+/* Require bison 2.4 or later, for %code requires */
+%require "2.4"
 
 /* add debug output code to generated parser. disable this for release
  * versions. */
@@ -65,10 +65,16 @@
 
  /*** BEGIN EXAMPLE - Change the Verilog grammar's tokens below ***/
 
+/* parser.h needs VerilogSlice for the semantic type */
+%code requires {
+#include "expression.h"
+}
+
 %union {
     int                         ival;
     double                      fval;
     std::string*                sval;
+    VerilogSlice                slice;
     class VerilogNode*          vnode;
     class VerilogList*          vlist;
 }
@@ -93,18 +99,17 @@
 %token VECTORED
 %token NON_BLOCK_ASSIGN
 %token SPECIFY_ASSIGN
-%token<sval> GATETYPE
-%token<sval> UNSIGNED_NUMBER
-%token<sval> FLOAT_NUMBER
-%token<sval> IDENTIFIER
-%token<sval> STRING
-%token<sval> NETTYPE
+%token<slice> GATETYPE
+%token<slice> UNSIGNED_NUMBER
+%token<slice> FLOAT_NUMBER
+%token<slice> IDENTIFIER
+%token<slice> STRING
+%token<slice> NETTYPE
 %token<sval> REG
-%token<sval> SYSTEM_IDENTIFIER
-%token<sval> BASE
-%token<sval> STRENGTH0 STRENGTH1
+%token<slice> SYSTEM_IDENTIFIER
+%token<slice> BASE
+%token<slice> STRENGTH0 STRENGTH1
 
-%type<vlist> module_item_list
 %type<vlist> gate_instance_list
 %type<vlist> module_instance_list
 %type<vlist> terminal_list
@@ -113,37 +118,35 @@
 %type<vnode> net_declaration
 %type<vlist> list_of_ports
 %type<vlist> port_list
-%type<vnode> module
+%type<vnode> module_header
 %type<vnode> module_item
 %type<vnode> port
-%type<sval> identifier
+%type<slice> identifier
 %type<vnode> name_of_variable
-%type<sval> name_of_module
+%type<slice> name_of_module
 %type<vnode> input_declaration
 %type<vnode> output_declaration
 %type<vnode> port_reference
 %type<vnode> port_expression
 %type<vlist> list_of_variables
-%type<sval> DECIMAL_NUMBER
-%type<sval> name_of_gate_instance
+%type<slice> DECIMAL_NUMBER
+%type<slice> name_of_gate_instance
 %type<vnode> gate_instance
 %type<vnode> module_instance
 %type<vnode> terminal
-%type<sval> name_of_instance
-%type<sval> number
+%type<slice> name_of_instance
+%type<slice> number
 %type<vnode> range
-%type<sval> primary
+%type<slice> primary
 %type<vlist> expression_list
-%type<sval> expression
+%type<slice> expression
 %type<vnode> module_port_connection
 %type<vlist> module_port_connection_list
 %type<vnode> named_port_connection
 %type<vlist> named_port_connection_list
 %type<vlist> list_of_module_connections
 %type<vnode> module_instantiation
-
-%destructor { delete $$; } STRING IDENTIFIER
-%destructor { delete $$; } name_of_module
+%type<vnode> continuous_assign
 
  /*** END EXAMPLE - Change the Verilog grammar's tokens above ***/
 
@@ -173,7 +176,7 @@ source_text
         ;
 
 description
-        : module                        { driver.verilog.expressions.push_back($1);  }
+        : module                        { /* handed to the driver by end_module */ }
         ;
 
 description_list
@@ -182,14 +185,18 @@ description_list
         ;
 
 module
-        : MODULE name_of_module ';' ENDMODULE                   { $$ = new VNModule(*$2, 0, 0); delete($2); }
-        | MODULE name_of_module ';' module_item_list ENDMODULE  { $$ = new VNModule(*$2, 0, $4); delete($2); }
-        | MODULE name_of_module list_of_ports ';' module_item_list ENDMODULE { $$ = new VNModule(*$2, $3, $5); delete $2; }
+        : module_header ENDMODULE       { if (!driver.end_module()) YYABORT; }
+        | module_header module_item_list ENDMODULE { if (!driver.end_module()) YYABORT; }
+        ;
+
+module_header
+        : MODULE name_of_module ';'     { $$ = new VNModule($2.str(), 0); if (!driver.begin_module((VNModule*)$$)) YYABORT; }
+        | MODULE name_of_module list_of_ports ';' { $$ = new VNModule($2.str(), $3); if (!driver.begin_module((VNModule*)$$)) YYABORT; }
         ;
 
 port
         :                               { $$ = 0; }
-        | port_expression               { $$ = new VNPort(((VNVariable*)$1)->name()); delete $1; }
+        | port_expression               { $$ = new VNPort(((VNVariable*)$1)->name().str()); delete $1; }
         /*
         | '.' name_of_port '(' ')'      { $$ = NULL; }
         | '.' name_of_port '(' port_expression ')' { $$ = NULL; }
@@ -236,11 +243,12 @@ module_item
         | net_declaration               { $$ = $1; }
         | gate_declaration              { $$ = $1; }
         | module_instantiation          { $$ = $1; }
+        | continuous_assign             { $$ = $1; }
         ;
 
 module_item_list
-        : module_item                   { $$ = new VerilogList; $$->nodes.push_back($1); }
-        | module_item_list module_item  { $1->nodes.push_back($2); }
+        : module_item                   { if (!driver.add_module_item($1)) YYABORT; }
+        | module_item_list module_item  { if (!driver.add_module_item($2)) YYABORT; }
         ;
 
 //
@@ -265,8 +273,8 @@ inout_declaration
 */
 
 net_declaration
-        : NETTYPE list_of_variables ';' { $$ = new VNNet(*$1, 0, $2); delete $1; }
-        | NETTYPE range list_of_variables ';' { $$ = new VNNet(*$1, $2, $3); delete $1; }
+        : NETTYPE list_of_variables ';' { $$ = new VNNet($1, 0, $2); }
+        | NETTYPE range list_of_variables ';' { $$ = new VNNet($1, $2, $3); }
         ;
 
 list_of_variables
@@ -274,7 +282,7 @@ list_of_variables
         ;
 
 name_of_variable
-        : IDENTIFIER                    { $$ = new VNVariable(*$1); delete $1; }
+        : IDENTIFIER                    { $$ = new VNVariable($1); }
         ;
 
 name_of_variable_list
@@ -285,21 +293,24 @@ name_of_variable_list
 range
         : '[' expression ':' expression ']'
         {
-            $$ = new VNRange(atoi($2->c_str()), atoi($4->c_str()));
-            delete $2; delete $4;
+            $$ = new VNRange(atoi($2.str().c_str()), atoi($4.str().c_str()));
         }
         ;
 
+continuous_assign
+        : ASSIGN primary '=' expression ';' { $$ = new VNAssign($2, $4); }
+        ;
+
 //
 // 3. Primitive Instances
 //
 gate_declaration
-        : GATETYPE gate_instance_list ';' { $$ = new VNGateInst(*$1, $2); delete $1; }
+        : GATETYPE gate_instance_list ';' { $$ = new VNGateInst($1, $2); }
         ;
 
 gate_instance
-        : '(' terminal_list ')'         { $$ = new VNInstance("", $2); }
-        | name_of_gate_instance '(' terminal_list ')' { $$ = new VNInstance(*$1, $3); delete $1; }
+        : '(' terminal_list ')'         { $$ = new VNInstance(VerilogSlice::literal(""), $2); }
+        | name_of_gate_instance '(' terminal_list ')' { $$ = new VNInstance($1, $3); }
         ;
 
 gate_instance_list
@@ -309,11 +320,11 @@ gate_instance_list
 
 name_of_gate_instance
         : IDENTIFIER                    { $$ = $1; }
-        | IDENTIFIER range              { error(@$, std::string("Unsupported range with gate instance")); YYERROR; delete $1; delete $2; }
+        | IDENTIFIER range              { error(@$, std::string("Unsupported range with gate instance")); YYERROR; delete $2; }
         ;
 
 terminal
-        : expression                    { $$ = new VNConnection(*$1, ""); delete $1; }
+        : expression                    { $$ = new VNConnection($1, VerilogSlice::literal("")); }
         ;
 
 terminal_list
@@ -325,11 +336,10 @@ terminal_list
 // 4. Module Instantiations
 //
 module_instantiation
-        : name_of_module module_instance_list ';' { $$ = new VNModuleInst(*$1, $2); delete $1; }
+        : name_of_module module_instance_list ';' { $$ = new VNModuleInst($1, $2); }
         | name_of_module parameter_value_assignment module_instance_list ';'
         {
             error(@$, std::string("Unimplemented rule")); YYERROR;
-            delete $1;
         }
         ;
 
@@ -341,8 +351,8 @@ parameter_value_assignment
         : '#' '(' expression_list ')'   { /* no implementation */ }
 
 module_instance
-        : name_of_instance '(' ')'      { $$ = new VNInstance(*$1, 0); delete $1; }
-        | name_of_instance '(' list_of_module_connections ')' { $$ = new VNInstance(*$1, $3); delete $1; }
+        : name_of_instance '(' ')'      { $$ = new VNInstance($1, 0); }
+        | name_of_instance '(' list_of_module_connections ')' { $$ = new VNInstance($1, $3); }
         ;
 
 module_instance_list
@@ -352,7 +362,7 @@ module_instance_list
 
 name_of_instance
         : IDENTIFIER                    { $$ = $1; }
-        | IDENTIFIER range              { error(@$, std::string("Range in instance name is unsupported")); YYERROR; delete $1; delete $2; }
+        | IDENTIFIER range              { error(@$, std::string("Range in instance name is unsupported")); YYERROR; delete $2; }
         ;
 
 list_of_module_connections
@@ -361,13 +371,13 @@ list_of_module_connections
         ;
 
 module_port_connection
-        :                               { $$ = new VNConnection("", ""); }
-        | expression                    { $$ = new VNConnection(*$1, ""); delete $1; }
+        :                               { $$ = new VNConnection(VerilogSlice::literal(""), VerilogSlice::literal("")); }
+        | expression                    { $$ = new VNConnection($1, VerilogSlice::literal("")); }
         ;
 
 named_port_connection
-        : '.' IDENTIFIER '(' identifier ')' { $$ = new VNConnection(*$4, *$2); delete $2; delete $4; }
-        | '.' IDENTIFIER '(' expression ')' { $$ = new VNConnection(*$4, *$2); delete $2; delete $4; }
+        : '.' IDENTIFIER '(' identifier ')' { $$ = new VNConnection($4, $2); }
+        | '.' IDENTIFIER '(' expression ')' { $$ = new VNConnection($4, $2); }
         ;
 
 module_port_connection_list
@@ -399,14 +409,18 @@ expression
         ;
 
 expression_list
-        : expression                    { $$ = new VerilogList; $$->nodes.push_back(new VNVariable(*$1)); delete $1; }
-        | expression_list ',' expression { $1->nodes.push_back(new VNVariable(*$3)); delete $3; }
+        : expression                    { $$ = new VerilogList; $$->nodes.push_back(new VNVariable($1)); }
+        | expression_list ',' expression { $1->nodes.push_back(new VNVariable($3)); }
         ;
 
 primary
         : number                        { $$ = $1; }
         | identifier                    { $$ = $1; }
-        | identifier '[' expression ']' { $$ = $1; *$$ += "["+(*$3)+"]"; delete $3; }
+        | identifier '[' expression ']'
+        {
+            VerilogSlice parts[] = { $1, VerilogSlice::literal("["), $3, VerilogSlice::literal("]") };
+            $$ = driver.lexer->join(parts, 4);
+        }
         | identifier '[' expression ':' expression ']' { error(@$, std::string("Unimplemented rule")); YYERROR; }
         | concatenation                 { error(@$, std::string("Unimplemented rule")); YYERROR; }
         | multiple_concatenation        { error(@$, std::string("Unimplemented rule")); YYERROR; }
@@ -415,15 +429,15 @@ primary
 
 number
         : DECIMAL_NUMBER                { $$ = $1;  }
-        | BASE UNSIGNED_NUMBER          { $$ = $1; *$$ += *$2; }
-        | UNSIGNED_NUMBER BASE UNSIGNED_NUMBER { $$ = $1; *$$ += *$2 + *$3; }
+        | BASE UNSIGNED_NUMBER          { VerilogSlice parts[] = { $1, $2 }; $$ = driver.lexer->join(parts, 2); }
+        | UNSIGNED_NUMBER BASE UNSIGNED_NUMBER { VerilogSlice parts[] = { $1, $2, $3 }; $$ = driver.lexer->join(parts, 3); }
         | FLOAT_NUMBER                  { $$ = $1; }
         ;
 
 DECIMAL_NUMBER
         : UNSIGNED_NUMBER               { $$ = $1; }
         | '+' UNSIGNED_NUMBER           { $$ = $2; }
-        | '-' UNSIGNED_NUMBER           { $$ = $2; *$$ = "-" + *$2; }
+        | '-' UNSIGNED_NUMBER           { VerilogSlice parts[] = { VerilogSlice::literal("-"), $2 }; $$ = driver.lexer->join(parts, 2); }
         ;
 
 concatenation
@@ -440,7 +454,11 @@ multiple_concatenation
 
 identifier
         : IDENTIFIER                    { $$ = $1; }
-        | identifier '.' IDENTIFIER     { *$$ += "." + *$3; }
+        | identifier '.' IDENTIFIER
+        {
+            VerilogSlice parts[] = { $1, VerilogSlice::literal("."), $3 };
+            $$ = driver.lexer->join(parts, 3);
+        }
         ;
 
  /*** END EXAMPLE - Change the Verilog grammar rules above ***/
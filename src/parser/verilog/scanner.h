@@ -22,6 +22,10 @@
 #undef yyFlexLexer
 #endif
 
+#include <istream>
+#include <streambuf>
+#include <vector>
+
 #include "parser.h"
 
 namespace Verilog {
@@ -53,6 +57,69 @@ public:
 
     /** Enable debug output (via arg_yyout) if compiled into the scanner. */
     void set_debug(bool b);
+
+    /** Text made of several slices, such as "a[3]" or "1'b0". It is a slice
+     * of the mapped buffer when the input spells it without spaces, and is
+     * otherwise stored like a token. */
+    VerilogSlice join(const VerilogSlice *parts, size_t n);
+
+    /** Lets the storage of the slices returned so far be reused, except
+     * for the last token, which may be the parser's lookahead. Called
+     * once each module item has been built. */
+    void recycle();
+
+protected:
+    /** Text of the current token. It is copied out of the flex buffer,
+     * which is reused as the input moves on, into blocks that are kept
+     * until recycle(), unless the input is a mapped buffer. */
+    VerilogSlice save(const char *text, size_t len);
+
+    /** Start of an input that stays in memory for the whole parse, see
+     * MappedScanner, or 0 */
+    const char *mapped;
+
+private:
+    char* allocate(size_t len);
+
+    std::vector<char*> blocks;
+    /// recycled blocks of BlockSize
+    std::vector<char*> spare;
+    size_t blockUsed;
+    /// block of the last token saved
+    size_t tokenBlock;
+    /** Input matched so far and the offset of the current token, kept up
+     * to date by YY_USER_ACTION */
+    size_t consumed;
+    size_t tokenStart;
+};
+
+/** Presents a buffer in memory as a std::istream without copying it. */
+class MemoryInput
+{
+protected:
+    MemoryInput(const char *begin, const char *end);
+
+    class Buffer : public std::streambuf
+    {
+    public:
+	Buffer(const char *begin, const char *end)
+	{
+	    setg(const_cast<char*>(begin), const_cast<char*>(begin), const_cast<char*>(end));
+	}
+    };
+
+    Buffer buffer;
+    std::istream stream;
+};
+
+/** MappedScanner lexes a buffer that stays in memory for the whole parse,
+ * such as a memory-mapped file. It runs the same flex rules as Scanner,
+ * but the token slices point straight into the buffer, so nothing is
+ * copied or allocated per token. */
+class MappedScanner : private MemoryInput, public Scanner
+{
+public:
+    MappedScanner(const char *begin, const char *end);
 };
 
 } // namespace Verilog
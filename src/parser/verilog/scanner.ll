@@ -4,8 +4,10 @@
 %{ /*** C/C++ Declarations ***/
 
 #include <string>
+#include <cstring>
 
 #include "scanner.h"
+#include "driver.h"
 
 /* import the parser's token type into a local typedef */
 typedef Verilog::Parser::token token;
@@ -43,10 +45,12 @@ typedef Verilog::Parser::token_type token_type;
 %option stack
 
 /* The following paragraph suffices to track locations accurately. Each time
- * yylex is invoked, the begin position is moved onto the end position. */
+ * yylex is invoked, the begin position is moved onto the end position.
+ * Every input character is matched by some rule, so consumed is also the
+ * offset of the next token in a mapped buffer. */
 %{
-#define YY_USER_ACTION  yylloc->columns(yyleng);
-#define YY_SAVE_TOKEN   yylval->sval = new std::string(yytext, yyleng)
+#define YY_USER_ACTION  yylloc->columns(yyleng); tokenStart = consumed; consumed += yyleng;
+#define YY_SAVE_TOKEN   yylval->slice = save(yytext, yyleng)
 %}
 
 %x IN_COMMENT
@@ -140,7 +144,9 @@ typedef Verilog::Parser::token_type token_type;
 [+-]*[0-9]+\.[0-9]+     { YY_SAVE_TOKEN; return token::FLOAT_NUMBER; }
 [+-]*[0-9]+(\.[0-9]+)?[eE][+-]*[0-9]+ { YY_SAVE_TOKEN; return token::FLOAT_NUMBER; }
 [0-9]+                  { YY_SAVE_TOKEN; return token::UNSIGNED_NUMBER; }
-[a-zA-Z][a-zA-Z0-9_$]*  { YY_SAVE_TOKEN; return token::IDENTIFIER; }
+[a-zA-Z_][a-zA-Z0-9_$]* { YY_SAVE_TOKEN; return token::IDENTIFIER; }
+ /* escaped identifier, the name runs from the backslash to white space */
+\\[^ \t\r\n]+           { yylval->slice = save(yytext + 1, yyleng - 1); return token::IDENTIFIER; }
 "$"[a-zA-Z][a-zA-Z0-9_$]* { YY_SAVE_TOKEN; return token::SYSTEM_IDENTIFIER; }
 \"('\"'|[^"])*\"        { YY_SAVE_TOKEN; return token::STRING; }
 "<="                    { return token::NON_BLOCK_ASSIGN; }
@@ -180,12 +186,111 @@ namespace Verilog {
 
 Scanner::Scanner(std::istream* in,
 		 std::ostream* out)
-    : VerilogFlexLexer(in, out)
+    : VerilogFlexLexer(in, out),
+      mapped(0),
+      blockUsed(0),
+      tokenBlock(0),
+      consumed(0),
+      tokenStart(0)
 {
 }
 
+static const size_t BlockSize = 64 * 1024;
+
 Scanner::~Scanner()
 {
+    for (size_t i = 0; i < blocks.size(); i++)
+	delete [] blocks[i];
+    for (size_t i = 0; i < spare.size(); i++)
+	delete [] spare[i];
+}
+
+char* Scanner::allocate(size_t len)
+{
+    if (blocks.empty() || blockUsed + len > BlockSize)
+    {
+	if (len > BlockSize)
+	    blocks.push_back(new char[len]);
+	else if (!spare.empty())
+	{
+	    blocks.push_back(spare.back());
+	    spare.pop_back();
+	}
+	else
+	    blocks.push_back(new char[BlockSize]);
+	blockUsed = 0;
+    }
+    char *p = blocks.back() + blockUsed;
+    blockUsed += len;
+    return p;
+}
+
+VerilogSlice Scanner::save(const char *text, size_t len)
+{
+    // The token is in the mapped buffer at the offset it was matched at
+    if (mapped)
+    {
+	VerilogSlice slice = { mapped + tokenStart + (text - yytext), len };
+	return slice;
+    }
+
+    char *p = allocate(len);
+    memcpy(p, text, len);
+    tokenBlock = blocks.size() - 1;
+    VerilogSlice slice = { p, len };
+    return slice;
+}
+
+VerilogSlice Scanner::join(const VerilogSlice *parts, size_t n)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < n; i++)
+	len += parts[i].size;
+
+    // Tokens written next to each other, as "1'b0" usually is
+    const char *start = parts[0].data;
+    if (mapped && start >= mapped && start + len <= mapped + consumed)
+    {
+	const char *p = start;
+	size_t i = 0;
+	for (; i < n; i++)
+	{
+	    if (memcmp(p, parts[i].data, parts[i].size) != 0)
+		break;
+	    p += parts[i].size;
+	}
+	if (i == n)
+	{
+	    VerilogSlice slice = { start, len };
+	    return slice;
+	}
+    }
+
+    char *p = allocate(len);
+    VerilogSlice slice = { p, len };
+    for (size_t i = 0; i < n; i++)
+    {
+	memcpy(p, parts[i].data, parts[i].size);
+	p += parts[i].size;
+    }
+    return slice;
+}
+
+void Scanner::recycle()
+{
+    // Keeps the last token and the block join() allocates from
+    size_t keep = blocks.size();
+    if (keep > 0)
+	keep = (mapped ? keep - 1 : tokenBlock);
+    for (size_t i = 0; i < keep; i++)
+    {
+	if (spare.size() < 4)
+	    spare.push_back(blocks[i]);
+	else
+	    delete [] blocks[i];
+    }
+    blocks.erase(blocks.begin(), blocks.begin() + keep);
+    tokenBlock -= keep;
 }
 
 void Scanner::set_debug(bool b)
@@ -193,6 +298,21 @@ void Scanner::set_debug(bool b)
     yy_flex_debug = b;
 }
 
+MemoryInput::MemoryInput(const char *begin, const char *end)
+    : buffer(begin, end),
+      stream(&buffer)
+{
+}
+
+/* Flex reads the buffer through the stream in chunks, as it would read a
+ * file, but tokens are not copied out of it. */
+MappedScanner::MappedScanner(const char *begin, const char *end)
+    : MemoryInput(begin, end),
+      Scanner(&stream)
+{
+    mapped = begin;
+}
+
 }
 
 /* This implementation of VerilogFlexLexer::yylex() is required to fill the
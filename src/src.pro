@@ -7,6 +7,11 @@ CONFIG -= debug_and_release debug_and_release_target
 
 INCLUDEPATH += circuit celllibrary interpolate
 
+# Compressed netlists and libraries, e.g. qmake CONFIG+=zlib CONFIG+=zstd.
+# Programs linking the library add -lz / -lzstd.
+zlib: DEFINES += LIBCIRCUIT_ZLIB
+zstd: DEFINES += LIBCIRCUIT_ZSTD
+
 include(parser/verilog/verilog.pri)
 include(parser/liberty/liberty.pri)
 include(celllibrary/celllibrary.pri)
@@ -1,5 +1,12 @@
 #include <QtTest/QtTest>
 #include "circuit.h"
+#include "celllibrary.h"
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 class TestCircuit : public QObject
 {
@@ -7,6 +14,24 @@ class TestCircuit : public QObject
 private slots:
     void testCircuitProperties_data();
     void testCircuitProperties();
+    void testNetlistView();
+    void testRemoveNode();
+    void testBatchedEdit();
+    void testNodeRange();
+    void testSnapshot();
+    void testLoadAsync();
+    void testReload();
+    void testLibraryCache();
+    void testLibraryTables();
+    void testLibraryLazyCells();
+    void testWrite();
+    void testScanners();
+    void testCompressedInput();
+    void testHierarchy();
+    void testCompiledSimulator();
+    void testParallelSimulation();
+    void testFourValuedSimulation();
+    void testEventSimulation();
 };
 
 void TestCircuit::testCircuitProperties_data()
@@ -40,5 +65,775 @@ void TestCircuit::testCircuitProperties()
     QCOMPARE(circuit.gateCount(), gateCount);
 }
 
+void TestCircuit::testNetlistView()
+{
+    Circuit circuit("data/c17_syn.v");
+    NetlistView view(circuit);
+    QCOMPARE(view.size(), 30ul);
+    QCOMPARE(view.inputSize(), circuit.inputSize());
+    QCOMPARE(view.outputSize(), circuit.outputSize());
+
+    for (size_t i = 0; i < view.size(); i++)
+    {
+        for (size_t j = 0; j < view.faninSize(i); j++)
+        {
+            NetlistView::Id in = view.fanin(i, j);
+            QVERIFY(in != NetlistView::NullId);
+            QVERIFY(std::find(view.fanoutBegin(in), view.fanoutEnd(in), (NetlistView::Id) i) != view.fanoutEnd(in));
+        }
+    }
+
+    view.levelize();
+    QCOMPARE(view.maxLevel(), 5);
+    QCOMPARE(view.level(view.input(0)), 0);
+}
+
+void TestCircuit::testRemoveNode()
+{
+    Circuit circuit("data/c17_syn.v");
+    Module module = circuit.topModule();
+
+    Port n2 = module.port("N2");
+    QVERIFY(module.removeNode(n2));
+    QVERIFY(!module.hasPort("N2"));
+    QCOMPARE(module.PISize(), 4ul);
+    QCOMPARE(module.PI(0).name(), std::string("N1"));
+    QCOMPARE(module.PI(1).name(), std::string("N3"));
+    QCOMPARE(module.inputPort(1).name(), std::string("N3"));
+    // Ports keep their declaration order
+    QCOMPARE(module.port(0).name(), std::string("N1"));
+    QCOMPARE(module.port(1).name(), std::string("N3"));
+
+    // Ports removed in an edit leave holes until the commit
+    size_t portSize = module.portSize();
+    module.beginEdit();
+    Port n3 = module.port("N3");
+    Port n6 = module.port("N6");
+    QVERIFY(module.removeNode(n3));
+    QVERIFY(module.removeNode(n6));
+    QCOMPARE(module.portSize(), portSize);
+    QVERIFY(module.port(1).isNull());
+    module.commitEdit();
+    QCOMPARE(module.portSize(), portSize - 2);
+    QCOMPARE(module.PISize(), 2ul);
+    QCOMPARE(module.PI(1).name(), std::string("N7"));
+    QCOMPARE(module.port(1).name(), std::string("N7"));
+    QCOMPARE(module.inputSize(), 2ul);
+
+    // The last cell takes the place of a removed one
+    Cell u10 = module.cell("U10");
+    size_t u10Index = 0;
+    while (module.cell(u10Index).name() != "U10")
+        u10Index++;
+    std::string last = module.cell(module.cellSize() - 1).name();
+    QVERIFY(module.removeNode(u10));
+    QCOMPARE(module.cellSize(), 8ul);
+    QCOMPARE(module.cell(u10Index).name(), last);
+    for (size_t i = 0; i < module.cellSize(); i++)
+        QVERIFY(module.cell(i).name() != "U10");
+    QVERIFY(module.cell("U10").isNull());
+    QVERIFY(module.wire("n13").inputSize() == 0);
+}
+
+// Level of a cell as EDAUtils::levelize() assigns it
+static int referenceLevel(const Cell &cell)
+{
+    int level = 0;
+    for (size_t i = 0; i < cell.inputSize(); i++)
+    {
+        Node net = cell.input(i);
+        Node driver = net.inputSize() ? net.input(0) : Node();
+        if (driver.isCell())
+            level = std::max(level, referenceLevel(driver.toCell()));
+    }
+    return level + 1;
+}
+
+void TestCircuit::testBatchedEdit()
+{
+    Circuit circuit("data/c17_syn.v");
+    Module module = circuit.topModule();
+    for (size_t i = 0; i < module.cellSize(); i++)
+        module.cell(i).setLevel(referenceLevel(module.cell(i)));
+    Cell u9 = module.cell("U9");
+    int u9Level = u9.level();
+    int u13Level = module.cell("U13").level();
+
+    // Two inverters in front of U9, and a cell that is gone again
+    module.beginEdit();
+    Wire n6 = module.wire("n6");
+    Wire w1 = module.createWire("w1");
+    Wire w2 = module.createWire("w2");
+    Cell u20 = module.createCell("U20", module.cell("U8"));
+    Cell u21 = module.createCell("U21", module.cell("U8"));
+    Cell u22 = module.createCell("U22", module.cell("U8"));
+    u9.connect("A", w2);
+    u20.connect("A", n6);
+    u20.connect("ZN", w1);
+    u21.connect("A", w1);
+    u21.connect("ZN", w2);
+    u22.connect("A", w1);
+    QVERIFY(module.removeNode(u22));
+    module.commitEdit();
+
+    QVERIFY(module.hasCell("U20"));
+    QVERIFY(module.hasWire("w2"));
+    QVERIFY(u9.input(0) == w2);
+    QVERIFY(w2.input(0) == u21);
+    QVERIFY(w1.input(0) == u20);
+    QCOMPARE(w1.outputSize(), 1ul);
+    QVERIFY(u20.input(0) == n6);
+
+    QCOMPARE(u9.level(), u9Level + 2);
+    QCOMPARE(module.cell("U13").level(), u13Level);
+    for (size_t i = 0; i < module.cellSize(); i++)
+        QCOMPARE(module.cell(i).level(), referenceLevel(module.cell(i)));
+}
+
+void TestCircuit::testNodeRange()
+{
+    Circuit circuit("data/c17_syn.v");
+    Module module = circuit.topModule();
+
+    size_t count = 0;
+    for (NodeRef cell : circuit)
+    {
+        QVERIFY(cell.isCell());
+        QCOMPARE(cell.name(), module.cell(count).name());
+        count++;
+    }
+    QCOMPARE(count, module.cellSize());
+    QCOMPARE(module.ports().size(), module.portSize());
+    NodeRange inputs = circuit.inputPorts();
+    QCOMPARE(inputs.size(), module.inputSize());
+    for (size_t i = 0; i < inputs.size(); i++)
+        QVERIFY(inputs[i].toNode() == module.inputPort(i));
+    NodeRange POs = module.POs();
+    QCOMPARE(POs.size(), module.POSize());
+    QCOMPARE(POs[1].name(), module.PO(1).name());
+
+    Cell u10 = module.cell("U10");
+    NodeRange fanin = u10.fanin();
+    QCOMPARE(fanin.size(), u10.inputSize());
+    for (size_t i = 0; i < fanin.size(); i++)
+        QVERIFY(fanin[i].toNode() == u10.input(i));
+
+    CellRef ref = u10;
+    QCOMPARE(ref.type(), u10.type());
+    QVERIFY(fanin[0].toCell().isNull());
+    Cell moved = std::move(u10);
+    QVERIFY(u10.isNull());
+    QVERIFY(CellRef(moved) == ref);
+}
+
+void TestCircuit::testSnapshot()
+{
+    Circuit circuit("data/c17_syn.v");
+    Module module = circuit.topModule();
+    module.createPort("PPI:N1", Port::PPI);
+    QVERIFY(circuit.save("c17_syn.snap"));
+
+    Circuit restored;
+    restored.loadSnapshot("c17_syn.snap");
+    QVERIFY(!restored.isNull());
+    QCOMPARE(restored.name(), circuit.name());
+    QCOMPARE(restored.filePath(), circuit.filePath());
+    QCOMPARE(restored.inputSize(), circuit.inputSize());
+    QCOMPARE(restored.PPISize(), circuit.PPISize());
+    QCOMPARE(restored.PPI(0).name(), std::string("PPI:N1"));
+
+    Module copy = restored.topModule();
+    QCOMPARE(copy.cellSize(), module.cellSize());
+    for (size_t i = 0; i < module.cellSize(); i++)
+    {
+        Cell a = module.cell(i);
+        Cell b = copy.cell(a.name());
+        QCOMPARE(b.type(), a.type());
+        QCOMPARE(b.inputSize(), a.inputSize());
+        for (size_t j = 0; j < a.inputSize(); j++)
+            QCOMPARE(b.input(j).name(), a.input(j).name());
+        QCOMPARE(b.output(0).name(), a.output(0).name());
+    }
+
+    // A port removed in an open edit is left out
+    module.beginEdit();
+    Port n3 = module.port("N3");
+    QVERIFY(module.removeNode(n3));
+    const Circuit &view = circuit;
+    QVERIFY(view.save("c17_syn.snap"));
+    module.commitEdit();
+    restored.loadSnapshot("c17_syn.snap");
+    QVERIFY(!restored.isNull());
+    QVERIFY(!restored.topModule().hasPort("N3"));
+    QCOMPARE(restored.inputSize(), circuit.inputSize());
+
+    // Threads saving to one path write their own temporary files
+    std::vector<std::thread> writers;
+    std::vector<char> saved(4, 0);
+    for (size_t t = 0; t < saved.size(); t++)
+        writers.push_back(std::thread([&circuit, &saved, t]() {
+            saved[t] = circuit.save("c17_syn.snap");
+        }));
+    for (size_t t = 0; t < writers.size(); t++)
+        writers[t].join();
+    for (size_t t = 0; t < saved.size(); t++)
+        QVERIFY(saved[t]);
+    restored.loadSnapshot("c17_syn.snap");
+    QVERIFY(!restored.isNull());
+    QCOMPARE(restored.inputSize(), circuit.inputSize());
+    QFile::remove("c17_syn.snap");
+
+    // Instances refer to their module, which may be defined after them
+    Circuit adder("data/adder.v");
+    QVERIFY(adder.save("adder.snap"));
+    Circuit hierarchy;
+    hierarchy.loadSnapshot("adder.snap");
+    QVERIFY(!hierarchy.isNull());
+    QCOMPARE(hierarchy.moduleSize(), 3ul);
+    Module top = hierarchy.topModule();
+    QCOMPARE(top.name(), std::string("adder"));
+    QCOMPARE(top.instanceSize(), 2ul);
+    Cell fa0 = top.instance("FA0");
+    QCOMPARE(fa0.type(), std::string("FullAdder_1"));
+    QVERIFY(fa0.definition() == hierarchy.module("FullAdder_1"));
+    QCOMPARE(fa0.output(0).name(), std::string("Co1"));
+    QCOMPARE(top.instance("FA1").input(2).name(), std::string("Co1"));
+    QCOMPARE(top.flatGateCount(), 14ul);
+    QFile::remove("adder.snap");
+}
+
+void TestCircuit::testLoadAsync()
+{
+    Circuit circuit("data/c17_syn.v");
+
+    // Binding the cells waits for the library, so the load cannot finish
+    // before it is given, however fast the parsing is
+    std::promise<CellLibrary> library;
+    std::future<Circuit> loading = Circuit::loadAsync("data/c17_syn.v", library.get_future().share());
+    QVERIFY(loading.wait_for(std::chrono::seconds(0)) == std::future_status::timeout);
+    library.set_value(CellLibrary());
+    Circuit loaded = loading.get();
+    QVERIFY(!loaded.isNull());
+    QCOMPARE(loaded.name(), circuit.name());
+    QCOMPARE(loaded.inputSize(), circuit.inputSize());
+    QCOMPARE(loaded.outputSize(), circuit.outputSize());
+
+    Module module = circuit.topModule();
+    Module copy = loaded.topModule();
+    QCOMPARE(copy.cellSize(), module.cellSize());
+    for (size_t i = 0; i < module.cellSize(); i++)
+    {
+        Cell a = module.cell(i);
+        Cell b = copy.cell(i);
+        QCOMPARE(b.name(), a.name());
+        QCOMPARE(b.type(), a.type());
+        for (size_t j = 0; j < a.inputSize(); j++)
+            QCOMPARE(b.input(j).name(), a.input(j).name());
+    }
+}
+
+void TestCircuit::testReload()
+{
+    // Loading into one copy leaves the others with the circuit they share
+    Circuit circuit("data/c17_syn.v");
+    Circuit copy = circuit;
+    CellLibrary library;
+    copy.load("data/adder.v", library);
+    QCOMPARE(copy.name(), std::string("adder"));
+    QCOMPARE(circuit.name(), std::string("c17"));
+    QCOMPARE(circuit.inputSize(), 5ul);
+    QCOMPARE(circuit.topModule().cellSize(), 9ul);
+    QVERIFY(!circuit.topModule().cell("U8").isNull());
+
+    // The last handle frees the circuit it held before loading
+    circuit.load("data/gate.v", library);
+    QCOMPARE(circuit.name(), std::string("Gate"));
+    QCOMPARE(copy.name(), std::string("adder"));
+}
+
+static std::string fileText(const std::string &path)
+{
+    std::ifstream in(path.c_str(), std::ios::binary);
+    std::ostringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+void TestCircuit::testLibraryCache()
+{
+    // A copy, so that only this test writes the cache
+    std::string text = fileText("data/tables.lib");
+    QVERIFY(!text.empty());
+    const std::string path = "tables_cache.lib";
+    const std::string cachePath = path + ".lcc";
+    QFile::remove(cachePath.c_str());
+    std::ofstream(path.c_str(), std::ios::binary) << text;
+
+    CellLibrary compiled(path);
+    QVERIFY(!compiled.isCached());
+    QCOMPARE(compiled.cellCount(), 3ul);
+    QVERIFY(std::ifstream(cachePath.c_str()).good());
+
+    CellLibrary cached(path);
+    QVERIFY(cached.isCached());
+    QCOMPARE(cached.cellCount(), 3ul);
+    QCOMPARE(cached.cell("INV_X1").delay("A", "ZN", Signal::Rise, 0.1, 4.0), 1.22);
+
+    // The cache is stale once the source changes
+    text.replace(text.find("1.22"), 4, "9.22");
+    std::ofstream(path.c_str(), std::ios::binary | std::ios::trunc) << text;
+    CellLibrary rebuilt(path);
+    QVERIFY(!rebuilt.isCached());
+    QCOMPARE(rebuilt.cell("INV_X1").delay("A", "ZN", Signal::Rise, 0.1, 4.0), 9.22);
+    QCOMPARE(cached.cell("INV_X1").delay("A", "ZN", Signal::Rise, 0.1, 4.0), 1.22);
+    QVERIFY(CellLibrary(path).isCached());
+
+    QFile::remove(path.c_str());
+    QFile::remove(cachePath.c_str());
+}
+
+void TestCircuit::testLibraryTables()
+{
+    // Parsed, not taken from the cache of an earlier run
+    QFile::remove("data/tables.lib.lcc");
+    CellLibrary library("data/tables.lib");
+    QVERIFY(!library.isCached());
+    QCOMPARE(library.cellCount(), 3ul);
+
+    // Entry r, c of table t holds t.rc, rows follow the slew
+    const double slews[] = { 0.01, 0.1, 0.2 };
+    const double loads[] = { 1.0, 4.0, 16.0 };
+    Cell inv = library.cell("INV_X1");
+    Cell buf = library.cell("BUF_X1");
+    for (size_t r = 0; r < 3; r++)
+        for (size_t c = 0; c < 3; c++)
+        {
+            double entry = (r + 1) / 10.0 + (c + 1) / 100.0;
+            QCOMPARE(inv.delay("A", "ZN", Signal::Rise, slews[r], loads[c]), 1 + entry);
+            QCOMPARE(inv.delay("A", "ZN", Signal::Fall, slews[r], loads[c]), 2 + entry);
+            QCOMPARE(buf.delay("A", "Z", Signal::Fall, slews[r], loads[c]), 3 + entry);
+            QCOMPARE(buf.delay("A", "Z", Signal::Rise, slews[r], loads[c]), 4 + entry);
+        }
+
+    // Rows follow the load when the template says so
+    const double nandLoads[] = { 1.0, 2.0, 4.0 };
+    const double nandSlews[] = { 0.05, 0.5 };
+    Cell nand = library.cell("NAND2_X1");
+    for (size_t r = 0; r < 3; r++)
+        for (size_t c = 0; c < 2; c++)
+        {
+            double entry = (r + 1) / 10.0 + (c + 1) / 100.0;
+            QCOMPARE(nand.delay("A1", "ZN", Signal::Rise, nandSlews[c], nandLoads[r]), 5 + entry);
+            QCOMPARE(nand.delay("A1", "ZN", Signal::Fall, nandSlews[c], nandLoads[r]), 6 + entry);
+        }
+
+    // Between the indices the table is interpolated
+    QCOMPARE(inv.delay("A", "ZN", Signal::Rise, 0.15, 4.0), 1.27);
+    QCOMPARE(nand.delay("A1", "ZN", Signal::Rise, 0.05, 3.0), 5.26);
+    QFile::remove("data/tables.lib.lcc");
+}
+
+void TestCircuit::testLibraryLazyCells()
+{
+    CellLibrary library("data/tables.lib");
+    QCOMPARE(library.cellCount(), 3ul);
+    QCOMPARE(library.builtCellCount(), 0ul);
+    QVERIFY(library.hasCell("BUF_X1"));
+    QCOMPARE(library.builtCellCount(), 0ul);
+
+    // Every thread asks for the same cells while they are still unbuilt
+    const size_t threadCount = 8;
+    std::vector<size_t> wrong(threadCount, 0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threadCount; t++)
+        threads.push_back(std::thread([&library, &wrong, t]() {
+            for (size_t i = 0; i < 200; i++)
+            {
+                Cell cell = library.cell(i % 2 ? "NAND2_X1" : "INV_X1");
+                double delay = (i % 2 ? cell.delay("A1", "ZN", Signal::Rise, 0.05, 1.0)
+                                      : cell.delay("A", "ZN", Signal::Rise, 0.01, 1.0));
+                if (cell.isNull() || delay != (i % 2 ? 5.11 : 1.11))
+                    wrong[t]++;
+            }
+        }));
+    for (size_t t = 0; t < threadCount; t++)
+        threads[t].join();
+    for (size_t t = 0; t < threadCount; t++)
+        QCOMPARE(wrong[t], 0ul);
+
+    // Only the cells asked for were built, once each
+    QCOMPARE(library.builtCellCount(), 2ul);
+    QCOMPARE(library.cellCount(), 3ul);
+    QVERIFY(library.cell("NOR2_X1").isNull());
+    QCOMPARE(library.builtCellCount(), 2ul);
+    QCOMPARE(library.cell("BUF_X1").type(), std::string("BUF_X1"));
+    QCOMPARE(library.builtCellCount(), 3ul);
+
+    // The image is released with the last cell, the built ones stay
+    QVERIFY(library.hasCell("INV_X1"));
+    QVERIFY(!library.hasCell("NOR2_X1"));
+    QVERIFY(library.cell("INV_X1").delay("A", "ZN", Signal::Rise, 0.01, 1.0) > 0);
+    QCOMPARE(library.cellCount(), 3ul);
+    QFile::remove("data/tables.lib.lcc");
+}
+
+void TestCircuit::testWrite()
+{
+    Circuit circuit("data/c17_syn.v");
+    Module module = circuit.topModule();
+    module.createPort("PPI:N1", Port::PPI);
+    module.createPort("wire", Port::PPI);
+    module.createPort("_N2", Port::PPI);
+    QVERIFY(circuit.write("c17_syn_out.v"));
+
+    // Keywords are escaped, other identifiers are written as they are
+    std::string text = fileText("c17_syn_out.v");
+    QVERIFY(text.find("\\wire ") != std::string::npos);
+    QVERIFY(text.find("\\_N2") == std::string::npos);
+
+    Circuit written("c17_syn_out.v");
+    QVERIFY(!written.isNull());
+    QCOMPARE(written.name(), circuit.name());
+    QCOMPARE(written.inputSize(), circuit.inputSize());
+    QCOMPARE(written.outputSize(), circuit.outputSize());
+    QVERIFY(written.topModule().hasPort("PPI:N1"));
+    QVERIFY(written.topModule().hasPort("wire"));
+    QVERIFY(written.topModule().hasPort("_N2"));
+
+    Module copy = written.topModule();
+    QCOMPARE(copy.cellSize(), module.cellSize());
+    for (size_t i = 0; i < module.cellSize(); i++)
+    {
+        Cell a = module.cell(i);
+        Cell b = copy.cell(i);
+        QCOMPARE(b.name(), a.name());
+        QCOMPARE(b.type(), a.type());
+        for (size_t j = 0; j < a.inputSize(); j++)
+            QCOMPARE(b.input(j).name(), a.input(j).name());
+        QCOMPARE(b.output(0).name(), a.output(0).name());
+    }
+    QFile::remove("c17_syn_out.v");
+
+    // Writing takes the module as it is in an open edit, before the holes
+    // of a removed port are compacted
+    module.beginEdit();
+    Port n3 = module.port("N3");
+    QVERIFY(module.removeNode(n3));
+    module.createPort("PPO:N22", Port::PPO);
+    const Circuit &view = circuit;
+    QVERIFY(view.write("c17_syn_edit.v"));
+    module.commitEdit();
+    Circuit edited("c17_syn_edit.v");
+    QVERIFY(!edited.isNull());
+    QVERIFY(!edited.topModule().hasPort("N3"));
+    QVERIFY(edited.topModule().hasPort("PPO:N22"));
+    QCOMPARE(edited.inputSize(), circuit.inputSize());
+    QCOMPARE(edited.outputSize(), circuit.outputSize());
+    QFile::remove("c17_syn_edit.v");
+}
+
+void TestCircuit::testScanners()
+{
+    // Files are mapped and lexed in place, streams go through the flex
+    // buffer; both must read the same netlist. c7552.v spans several blocks
+    // of the stream scanner's token storage, which is reused as it goes
+    const char *files[] = { "data/adder.v", "data/c17_syn.v", "data/c7552.v", "data/gate.v" };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+    {
+        Circuit mapped(files[i]);
+        std::fstream in(files[i], std::ios::in);
+        Circuit streamed;
+        streamed.load(in, files[i]);
+        QVERIFY(!mapped.isNull());
+        QVERIFY(mapped.write("mapped_out.v"));
+        QVERIFY(streamed.write("streamed_out.v"));
+        QCOMPARE(fileText("streamed_out.v"), fileText("mapped_out.v"));
+    }
+    QFile::remove("mapped_out.v");
+    QFile::remove("streamed_out.v");
+}
+
+void TestCircuit::testCompressedInput()
+{
+    std::vector<std::string> suffixes;
+#ifdef LIBCIRCUIT_ZLIB
+    suffixes.push_back(".gz");
+#endif
+#ifdef LIBCIRCUIT_ZSTD
+    suffixes.push_back(".zst");
+#endif
+    if (suffixes.empty())
+        QSKIP("Built without CONFIG+=zlib or CONFIG+=zstd");
+
+    Circuit plain("data/c17_syn.v");
+    QVERIFY(plain.write("plain_out.v"));
+    CellLibrary plainLibrary("data/tables.lib");
+    const char *types[] = { "INV_X1", "BUF_X1", "NAND2_X1" };
+    const char *pins[][2] = { { "A", "ZN" }, { "A", "Z" }, { "A1", "ZN" } };
+
+    for (size_t k = 0; k < suffixes.size(); k++)
+    {
+        // The same netlist and library as the plain files
+        Circuit circuit("data/c17_syn.v" + suffixes[k]);
+        QVERIFY(!circuit.isNull());
+        QCOMPARE(circuit.name(), plain.name());
+        QCOMPARE(circuit.inputSize(), plain.inputSize());
+        QCOMPARE(circuit.outputSize(), plain.outputSize());
+        QVERIFY(circuit.write("compressed_out.v"));
+        QCOMPARE(fileText("compressed_out.v"), fileText("plain_out.v"));
+
+        std::string libraryPath = "data/tables.lib" + suffixes[k];
+        CellLibrary library(libraryPath);
+        QCOMPARE(library.cellCount(), plainLibrary.cellCount());
+        for (size_t i = 0; i < 3; i++)
+        {
+            Cell a = plainLibrary.cell(types[i]);
+            Cell b = library.cell(types[i]);
+            QCOMPARE(b.area(), a.area());
+            for (size_t t = 0; t < 2; t++)
+            {
+                Signal::Transition trans = (t ? Signal::Rise : Signal::Fall);
+                QCOMPARE(b.delay(pins[i][0], pins[i][1], trans, 0.1, 2.0),
+                         a.delay(pins[i][0], pins[i][1], trans, 0.1, 2.0));
+            }
+        }
+        QFile::remove((libraryPath + ".lcc").c_str());
+
+        // A stream that ends early is an error, and the worker that
+        // decompresses it stops
+        const char *sources[] = { "data/c17_syn.v", "data/tables.lib" };
+        std::string truncated[2];
+        for (size_t i = 0; i < 2; i++)
+        {
+            std::string data = fileText(sources[i] + suffixes[k]);
+            truncated[i] = std::string("truncated") + (i ? ".lib" : ".v") + suffixes[k];
+            std::ofstream(truncated[i].c_str(), std::ios::binary) << data.substr(0, data.size() / 2);
+        }
+        QVERIFY(Circuit(truncated[0]).isNull());
+        QCOMPARE(CellLibrary(truncated[1]).cellCount(), 0ul);
+        QFile::remove(truncated[0].c_str());
+        QFile::remove(truncated[1].c_str());
+        QFile::remove((truncated[1] + ".lcc").c_str());
+    }
+    QFile::remove("plain_out.v");
+    QFile::remove("compressed_out.v");
+    QFile::remove("data/tables.lib.lcc");
+}
+
+void TestCircuit::testHierarchy()
+{
+    Circuit circuit("data/adder.v");
+    QCOMPARE(circuit.moduleSize(), 3ul);
+    Module top = circuit.topModule();
+    QCOMPARE(top.name(), std::string("adder"));
+    QCOMPARE(top.cellSize(), 0ul);
+    QCOMPARE(top.instanceSize(), 2ul);
+    QCOMPARE(top.flatGateCount(), 14ul);
+
+    Cell fa1 = top.instance("FA1");
+    QCOMPARE(fa1.type(), std::string("FullAdder_0"));
+    QVERIFY(fa1.definition() == circuit.module("FullAdder_0"));
+    QCOMPARE(fa1.input(2).name(), std::string("Co1"));
+    QCOMPARE(fa1.output(0).name(), std::string("Co2"));
+    QCOMPARE(top.submodules().size(), 2ul);
+
+    Circuit flat = circuit.flatten();
+    Module module = flat.topModule();
+    QCOMPARE(flat.moduleSize(), 1ul);
+    QCOMPARE(module.instanceSize(), 0ul);
+    QCOMPARE(module.cellSize(), 14ul);
+    QCOMPARE(module.portSize(), top.portSize());
+    Cell carry = module.cell("FA1/U4");
+    QCOMPARE(carry.type(), std::string("OR2_X1"));
+    QCOMPARE(carry.output(0).name(), std::string("Co2"));
+    QCOMPARE(module.cell("FA1/U5").input(1).name(), std::string("Co1"));
+
+    // Instances are simulated through a flattened copy
+    CompiledSimulator hierarchical(circuit), flatSim(flat);
+    QCOMPARE(hierarchical.instructionSize(), flatSim.instructionSize());
+    for (int p = 0; p < 16; p++)
+    {
+        Pattern pattern;
+        for (int i = 3; i >= 0; i--)
+            pattern += (p >> i & 1) ? '1' : '0';
+        QVERIFY(hierarchical.input(pattern));
+        hierarchical.run();
+        QVERIFY(flatSim.input(pattern));
+        flatSim.run();
+        QCOMPARE(hierarchical.output(), flatSim.output());
+        QVERIFY(hierarchical.value(top.wire("Co1")) == flatSim.value(module.wire("Co1")));
+    }
+    QCOMPARE(hierarchical.output(), Pattern("110"));
+    QVERIFY(hierarchical.value(fa1) == Signal::X);
+
+    // A module whose ports change keeps instances in step, even if the
+    // count of inputs and outputs stays the same
+    Module probe = circuit.createModule("Probe");
+    probe.createPort("a", Port::Input);
+    Port y = probe.createPort("y", Port::Output);
+    Cell p0 = top.createInstance("P0", probe);
+    QVERIFY(probe.removeNode(y));
+    probe.createPort("z", Port::Output);
+    Cell p1 = top.createInstance("P1", probe);
+    QCOMPARE(p0.outputPinName(0), std::string("y"));
+    QCOMPARE(p1.outputPinName(0), std::string("z"));
+    Cell p2 = top.createInstance("P2", probe);
+    QCOMPARE(p2.inputPinName(0), std::string("a"));
+    QCOMPARE(p2.outputPinName(0), std::string("z"));
+}
+
+void TestCircuit::testCompiledSimulator()
+{
+    Circuit circuit("data/c17_syn.v");
+    CompiledSimulator sim(circuit);
+    QCOMPARE(sim.inputSize(), 5ul);
+    QCOMPARE(sim.outputSize(), 2ul);
+    QCOMPARE(sim.instructionSize(), 9ul);
+
+    for (int p = 0; p < 32; p++)
+    {
+        bool n1 = p & 16, n2 = p & 8, n3 = p & 4, n6 = p & 2, n7 = p & 1;
+        Pattern pattern;
+        pattern += n1 ? '1' : '0';
+        pattern += n2 ? '1' : '0';
+        pattern += n3 ? '1' : '0';
+        pattern += n6 ? '1' : '0';
+        pattern += n7 ? '1' : '0';
+        QVERIFY(sim.input(pattern));
+        sim.run();
+        bool n10 = !(n3 && n6);
+        Pattern expected;
+        expected += !(!(n1 && n3) && !(n2 && n10)) ? '1' : '0';
+        expected += (n10 && (n2 || n7)) ? '1' : '0';
+        QCOMPARE(sim.output(), expected);
+    }
+    QVERIFY(sim.value(circuit.topModule().wire("n10")) == Signal::F);
+
+    // A controlling 0 hides the unknown input, otherwise it goes through
+    QVERIFY(sim.input("x0000"));
+    sim.run();
+    QCOMPARE(sim.output(), Pattern("00"));
+    QVERIFY(sim.input("0x000"));
+    sim.run();
+    QCOMPARE(sim.output(), Pattern("33"));
+    QVERIFY(!sim.input("000"));
+}
+
+void TestCircuit::testParallelSimulation()
+{
+    Circuit circuit("data/c7552.v");
+    CompiledSimulator sim(circuit);
+    std::vector<Pattern> patterns(150, Pattern(sim.inputSize(), '0'));
+    for (size_t k = 0; k < patterns.size(); k++)
+        for (size_t i = 0; i < sim.inputSize(); i++)
+            patterns[k][i] = ((k * 7919 + i * 104729) >> 3) & 1 ? '1' : '0';
+
+    std::vector<Pattern> outputs = sim.simulate(patterns);
+    QCOMPARE(outputs.size(), patterns.size());
+    for (size_t k = 0; k < patterns.size(); k++)
+    {
+        QVERIFY(sim.input(patterns[k]));
+        sim.run();
+        QCOMPARE(outputs[k], sim.output());
+    }
+
+    QVERIFY(sim.input(patterns, 64));
+    sim.runWords();
+    for (size_t i = 0; i < sim.outputSize(); i++)
+        QCOMPARE((sim.outputWord(i) >> 5) & 1, (CompiledSimulator::Word) (outputs[69][i] == '1'));
+    QVERIFY(sim.simulate(std::vector<Pattern>(1, "0")).empty());
+
+    const size_t lanes[] = { 64, 256, 512 };
+    for (int k = CompiledSimulator::Scalar; k <= CompiledSimulator::AVX512; k++)
+    {
+        CompiledSimulator::Kernel kernel = (CompiledSimulator::Kernel) k;
+        if (!CompiledSimulator::hasKernel(kernel))
+            continue;
+        QVERIFY(sim.setKernel(kernel));
+        QCOMPARE(sim.lanes(), lanes[k]);
+        QVERIFY(sim.simulate(patterns) == outputs);
+    }
+}
+
+void TestCircuit::testFourValuedSimulation()
+{
+    const Signal f(Signal::F), t(Signal::T), z(Signal::Z), x(Signal::X);
+    QVERIFY((f & x) == Signal::F);
+    QVERIFY((t & z) == Signal::X);
+    QVERIFY((t | x) == Signal::T);
+    QVERIFY((f | z) == Signal::X);
+    QVERIFY((t ^ x) == Signal::X);
+    QVERIFY(~z == Signal::X);
+    QVERIFY(Signal::fromPlanes(false, true) == Signal::Z);
+
+    // Every pattern of 0, 1, x and z matches the scalar run()
+    Circuit circuit("data/c17_syn.v");
+    CompiledSimulator sim(circuit);
+    const char values[] = "01xz";
+    std::vector<Pattern> patterns;
+    for (int p = 0; p < 1024; p++)
+    {
+        Pattern pattern;
+        for (int i = 0; i < 5; i++)
+            pattern += values[(p >> (2 * i)) & 3];
+        patterns.push_back(pattern);
+    }
+    sim.setFourValued(true);
+    std::vector<Pattern> outputs = sim.simulate(patterns);
+    QCOMPARE(outputs.size(), patterns.size());
+    for (size_t k = 0; k < patterns.size(); k++)
+    {
+        QVERIFY(sim.input(patterns[k]));
+        sim.run();
+        QCOMPARE(outputs[k], sim.output());
+    }
+
+    for (size_t i = 0; i < sim.inputSize(); i++)
+        sim.setInputPlanes(i, 0, ~(CompiledSimulator::Word) 0);
+    sim.runWords();
+    QCOMPARE(sim.outputUnknownWord(0) & sim.outputUnknownWord(1), ~(CompiledSimulator::Word) 0);
+
+    // A net without a driver is X, not the 0 a node starts with
+    Module top = circuit.topModule();
+    Wire floating = top.createWire("floating");
+    Gate buffer = top.createGate("floating_buf", Gate::BUF);
+    buffer.connectInput(0, floating);
+    CompiledSimulator open(circuit);
+    QVERIFY(open.input(Pattern(5, '1')));
+    open.run();
+    QVERIFY(open.value(floating) == Signal::X);
+    QVERIFY(open.value(buffer) == Signal::X);
+}
+
+void TestCircuit::testEventSimulation()
+{
+    Circuit circuit("data/c7552.v");
+    CompiledSimulator events(circuit), full(circuit);
+    Pattern pattern(events.inputSize(), '0');
+    QVERIFY(events.input(pattern));
+    events.runEvents();
+    QCOMPARE(events.eventCount(), events.instructionSize());
+
+    // One input changes per pattern
+    for (size_t k = 0; k < 300; k++)
+    {
+        size_t i = (k * 7919) % pattern.size();
+        pattern[i] = (pattern[i] == '0' ? (k % 5 ? '1' : 'x') : '0');
+        QVERIFY(events.input(pattern));
+        events.runEvents();
+        QVERIFY(full.input(pattern));
+        full.run();
+        QCOMPARE(events.output(), full.output());
+    }
+    QCOMPARE(events.runCount(), 301ul);
+    QVERIFY(events.activity() < 0.5);
+    QCOMPARE(full.activity(), 1.0);
+
+    events.runEvents();
+    QCOMPARE(events.eventCount(), 0ul);
+    events.resetCounters();
+    QCOMPARE(events.runCount(), 0ul);
+}
+
 QTEST_MAIN(TestCircuit)
 #include "testcircuit.moc"
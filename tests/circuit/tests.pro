@@ -3,11 +3,20 @@ TEMPLATE = app
 TARGET = tests
 INCLUDEPATH += .
 HEADERS += circuit.h
-SOURCES += testcircuit.cpp ../../src/circuit/circuit.cpp
+SOURCES += testcircuit.cpp ../../src/circuit/circuit.cpp ../../src/circuit/signal.cpp ../../src/circuit/netlistview.cpp ../../src/circuit/symboltable.cpp ../../src/circuit/snapshot.cpp ../../src/circuit/compressedstream.cpp ../../src/circuit/verilogwriter.cpp ../../src/circuit/hierarchy.cpp ../../src/circuit/simulator.cpp
+SOURCES += ../../src/celllibrary/celllibrary.cpp ../../src/interpolate/interpolate.cpp
 CONFIG += console
 CONFIG -= debug_and_release debug_and_release_target
-INCLUDEPATH += ../../src/circuit
-LIBS += -L../../lib -lverilog
+INCLUDEPATH += ../../src/circuit ../../src/celllibrary ../../src/interpolate
+# The Verilog and Liberty parsers, built by the library's make below
+LIBS += -L../../lib -L../../src/parser/verilog -L../../src/parser/liberty -lverilog -lliberty
+
+# The same CONFIG+=zlib / CONFIG+=zstd as the library
+zlib: DEFINES += LIBCIRCUIT_ZLIB
+zlib: LIBS += -lz
+zstd: DEFINES += LIBCIRCUIT_ZSTD
+zstd: LIBS += -lzstd
+
 PRE_TARGETDEPS += ./lib/libcircuit.a
 QMAKE_EXTRA_TARGETS += verilog
 